@@ -41,6 +41,8 @@ extern struct f2fs_configuration c;
 struct f2fs_super_block raw_sb;
 struct f2fs_super_block *sb = &raw_sb;
 struct f2fs_checkpoint *cp;
+int meta_log_gens = 2;		/* -G */
+int meta_log_stripes = META_STRIPE_CNT;	/* -M */
 
 /* Return first segment number of each area */
 #define prev_zone(cur)		(c.cur_seg[cur] - c.segs_per_zone)
@@ -232,9 +234,6 @@ static int f2fs_prepare_super_block(void)
   uint32_t blkz_size_blks = c.devices[0].zone_blocks;
 	blkz_cap_blks = c.devices[0].zone_cap_blocks[0];
 	blkz_size_segs = blkz_size_blks / c.blks_per_seg;
-	//META_STRIPING
-	//CONFIGURE
-	int meta_stripe_cnt = META_STRIPE_CNT; // no meta striping
 	MSG(1, "Info: Blocks per zone: %u\n",
 					blkz_size_blks);
 #endif
@@ -562,10 +561,10 @@ static int f2fs_prepare_super_block(void)
 		get_sb(segment_count_nat) +
 		get_sb(segment_count_ssa); 
 #if GRID_STRIPE
-  total_meta_segments += 6 * blkz_size_segs;
+  total_meta_segments += 3 * meta_log_gens * blkz_size_segs * meta_log_stripes;
 #else
 //  total_meta_segments += 6 * c.segs_per_zone;
-  total_meta_segments += 6 * c.segs_per_zone * meta_stripe_cnt;
+  total_meta_segments += 3 * meta_log_gens * c.segs_per_zone * meta_log_stripes;
 #endif
 // adjust SSA segment count to align to blkzone
 	diff = total_meta_segments % blkz_size_segs;
@@ -598,29 +597,31 @@ static int f2fs_prepare_super_block(void)
 
   //log area
 #if GRID_STRIPE
-	set_sb(segment_count_sit_log, 2 * blkz_size_segs);
-//	set_sb(segment_count_sit_log, 2 * blkz_size_segs * meta_stripe_cnt);
+	set_sb(segment_count_sit_log, meta_log_gens * blkz_size_segs * meta_log_stripes);
+//	set_sb(segment_count_sit_log, 2 * blkz_size_segs * meta_log_stripes);
 #else
-	set_sb(segment_count_sit_log, 2 * c.segs_per_zone * meta_stripe_cnt);
+	set_sb(segment_count_sit_log, meta_log_gens * c.segs_per_zone * meta_log_stripes);
 #endif // GRID_STRIPE
 	//set_sb(sit_log_blkaddr, get_sb(ssa_blkaddr) + get_sb(segment_count_ssa) *
 	//		c.blks_per_seg);
 	set_sb(sit_log_blkaddr, get_sb(ssa_blkaddr) + 
 			2 * zone_needed * blkz_size_blks);
 #if GRID_STRIPE
-	set_sb(segment_count_nat_log, 2 * blkz_size_segs);
-//	set_sb(segment_count_nat_log, 2 * blkz_size_segs * meta_stripe_cnt);
+	set_sb(segment_count_nat_log, meta_log_gens * blkz_size_segs * meta_log_stripes);
+//	set_sb(segment_count_nat_log, 2 * blkz_size_segs * meta_log_stripes);
 #else
-	set_sb(segment_count_nat_log, 2 * c.segs_per_zone * meta_stripe_cnt);
+	set_sb(segment_count_nat_log, meta_log_gens * c.segs_per_zone * meta_log_stripes);
 #endif // GRID_STRIPE
 	set_sb(nat_log_blkaddr, get_sb(sit_log_blkaddr) + 
 			get_sb(segment_count_sit_log) * c.blks_per_seg);
 
 #if GRID_STRIPE
-	set_sb(segment_count_ssa_log, 2 * blkz_size_segs * meta_stripe_cnt);
+	set_sb(segment_count_ssa_log, meta_log_gens * blkz_size_segs * meta_log_stripes);
 #else
-	set_sb(segment_count_ssa_log, 2 * c.segs_per_zone * meta_stripe_cnt);
+	set_sb(segment_count_ssa_log, meta_log_gens * c.segs_per_zone * meta_log_stripes);
 #endif // GRID_STRIPE
+	/* every log writes its blocks to meta_log_stripes zones in turn */
+	set_sb(meta_log_stripes, meta_log_stripes);
 	set_sb(ssa_log_blkaddr, get_sb(nat_log_blkaddr) + 
 			get_sb(segment_count_nat_log) * c.blks_per_seg);
 
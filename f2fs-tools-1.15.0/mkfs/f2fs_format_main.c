@@ -58,10 +58,12 @@ static void mkfs_usage()
 	MSG(0, "  -E [hot file ext list] e.g. \"db\"\n");
 	MSG(0, "  -f force overwrite of the existing filesystem\n");
 	MSG(0, "  -g add default options\n");
+	MSG(0, "  -G # of zones per metadata log [default:2]\n");
 	MSG(0, "  -i extended node bitmap, node ratio is 20%% by default\n");
 	MSG(0, "  -l label\n");
 	MSG(0, "  -U uuid\n");
 	MSG(0, "  -m support zoned block device [default:0]\n");
+	MSG(0, "  -M # of zones each metadata log stripes over [default:2]\n");
 	MSG(0, "  -o overprovision percentage [default:auto]\n");
 	MSG(0, "  -O feature1[,feature2,...] e.g. \"encrypt\"\n");
 	MSG(0, "  -C [encoding[:flag1,...]] Support casefolding with optional flags\n");
@@ -176,7 +178,7 @@ static void add_default_options(void)
 
 static void f2fs_parse_options(int argc, char *argv[])
 {
-	static const char *option_string = "qa:c:C:d:e:E:g:hil:mo:O:rR:s:S:z:t:T:U:Vfw:";
+	static const char *option_string = "qa:c:C:d:e:E:g:G:hil:mM:o:O:rR:s:S:z:t:T:U:Vfw:";
 	static const struct option long_opts[] = {
 		{ .name = "help", .has_arg = 0, .flag = NULL, .val = 'h' },
 		{ .name = NULL, .has_arg = 0, .flag = NULL, .val = 0 }
@@ -219,6 +221,15 @@ static void f2fs_parse_options(int argc, char *argv[])
 			if (!strcmp(optarg, "android"))
 				c.defset = CONF_ANDROID;
 			break;
+		case 'G':
+			meta_log_gens = atoi(optarg);
+			if (meta_log_gens < 2 ||
+					meta_log_gens > MAX_META_LOG_GENS) {
+				MSG(0, "\tError: # of metadata log zones should be "
+					"2 to %d\n", MAX_META_LOG_GENS);
+				mkfs_usage();
+			}
+			break;
 		case 'h':
 			mkfs_usage();
 			break;
@@ -236,6 +247,15 @@ static void f2fs_parse_options(int argc, char *argv[])
 		case 'm':
 			c.zoned_mode = 1;
 			break;
+		case 'M':
+			meta_log_stripes = atoi(optarg);
+			if (meta_log_stripes < 1 ||
+					meta_log_stripes > MAX_META_LOG_STRIPES) {
+				MSG(0, "\tError: # of metadata log stripes should be "
+					"1 to %d\n", MAX_META_LOG_STRIPES);
+				mkfs_usage();
+			}
+			break;
 		case 'o':
 			c.overprovision = atof(optarg);
 			break;
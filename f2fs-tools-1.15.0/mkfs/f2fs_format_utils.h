@@ -12,6 +12,16 @@
 
 extern struct f2fs_configuration c;
 
+/* metadata log geometry, see MAX_META_LOG_* of the kernel */
+#ifndef MAX_META_LOG_GENS
+#define MAX_META_LOG_GENS	8
+#endif
+extern int meta_log_gens;
+#ifndef MAX_META_LOG_STRIPES
+#define MAX_META_LOG_STRIPES	4
+#endif
+extern int meta_log_stripes;
+
 int f2fs_trim_device(int, uint64_t);
 int f2fs_trim_devices(void);
 int f2fs_format_device(void);
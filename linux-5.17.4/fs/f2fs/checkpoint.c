@@ -14,6 +14,7 @@
 #include <linux/pagevec.h>
 #include <linux/swap.h>
 #include <linux/kthread.h>
+#include <linux/list_sort.h>
 
 #include "f2fs.h"
 #include "node.h"
@@ -45,6 +46,9 @@ unsigned long long zone_finTime, zone_finCnt;
 
 static struct kmem_cache *ino_entry_slab;
 struct kmem_cache *f2fs_inode_entry_slab;
+#if META_FOR_ZNS
+static struct kmem_cache *meta_merge_unit_slab;
+#endif
 
 void f2fs_stop_checkpoint(struct f2fs_sb_info *sbi, bool end_io)
 {
@@ -216,6 +220,9 @@ bool f2fs_is_valid_blkaddr(struct f2fs_sb_info *sbi,
 		}
 		break;
 	case META_GENERIC:
+#if META_FOR_ZNS
+	case META_LOG:
+#endif
 		if (unlikely(blkaddr < SEG0_BLKADDR(sbi) ||
 			blkaddr >= MAIN_BLKADDR(sbi)))
 			return false;
@@ -249,11 +256,6 @@ int f2fs_ra_meta_pages(struct f2fs_sb_info *sbi, block_t start, int nrpages,
 
 	if (unlikely(type == META_POR))
 		fio.op_flags &= ~REQ_META;
-#if META_FOR_ZNS
-  if (type == META_SSA) {
-    down_read(&SM_I(sbi)->ssa_ltree_slock);
-  }
-#endif
 	blk_start_plug(&plug);
 	for (; nrpages-- > 0; blkno++) {
 
@@ -285,6 +287,9 @@ int f2fs_ra_meta_pages(struct f2fs_sb_info *sbi, block_t start, int nrpages,
 #endif
 		case META_CP:
 		case META_POR:
+#if META_FOR_ZNS
+		case META_LOG:
+#endif
 			fio.new_blkaddr = blkno;
 			break;
 		default:
@@ -302,36 +307,11 @@ int f2fs_ra_meta_pages(struct f2fs_sb_info *sbi, block_t start, int nrpages,
 #if META_FOR_ZNS
 #if !NAIVE_MFZ
   if (type == META_SSA) {
-    //lookup log tree
-	  struct f2fs_summary_block *sum;
-    struct ssa_set *head;
-    struct radix_tree_root *root;
-    sum = (struct f2fs_summary_block *) page_address(page);
-//    down_read(&SM_I(sbi)->ssa_ltree_slock);
-	  root = &SM_I(sbi)->ssa_log_root[SM_I(sbi)->cur_log_tree_idx];
-    head = radix_tree_lookup(root, blkno);
-    
-    if (head) {
-      memcpy(sum->entries, head->entries, SUM_ENTRY_SIZE);
-      memcpy(&sum->footer, &head->footer, SUM_FOOTER_SIZE);
-//      up_read(&SM_I(sbi)->ssa_ltree_slock);
+    //lookup log tree, newest generation first
+    if (copy_ssa_log(sbi, blkno, page_address(page))) {
       f2fs_put_page(page, 1);
       continue;
     }
-
-    if (is_set_ckpt_flags(sbi, CP_SSA_MERGE_FLAG)) {
-	    root = &SM_I(sbi)->ssa_log_root[SM_I(sbi)->cur_log_tree_idx ^ 0x1];
-      head = radix_tree_lookup(root, blkno);
-
-      if (head) {
-        memcpy(sum->entries, head->entries, SUM_ENTRY_SIZE);
-        memcpy(&sum->footer, &head->footer, SUM_FOOTER_SIZE);
-//        up_read(&SM_I(sbi)->ssa_ltree_slock);
-        f2fs_put_page(page, 1);
-        continue;
-      }
-    }
-//    up_read(&SM_I(sbi)->ssa_ltree_slock);
   }
 #endif
 #endif
@@ -344,11 +324,6 @@ int f2fs_ra_meta_pages(struct f2fs_sb_info *sbi, block_t start, int nrpages,
 	}
 out:
 	blk_finish_plug(&plug);
-#if META_FOR_ZNS
-  if (type == META_SSA) {
-    up_read(&SM_I(sbi)->ssa_ltree_slock);
-  }
-#endif
 	return blkno - start;
 }
 
@@ -549,7 +524,9 @@ continue_unlock:
 	if(io_type == FS_META_IO || io_type == FS_CP_META_IO){
 #if DELAYED_MERGE
 		//printk("(%s:%d) flush_sum during sync_meta", __func__, __LINE__); 
-		__flush_sum_blks(sbi);
+		/* the checkpoint makes room in the ring before it gets here */
+		if (io_type == FS_CP_META_IO || !sum_log_blocked(sbi))
+			__flush_sum_blks(sbi);
 #else
 		if(has_curlog_space(sbi, dirty_sum_pages, SSA_LOG)){
 			__flush_sum_blks(sbi);
@@ -1409,6 +1386,15 @@ retry_flush_dents:
 		goto retry_flush_quotas;
 	}
 	
+#ifdef CONFIG_BLK_DEV_ZONED
+	/* appended data should reach its dnode before nodes are flushed */
+	if (atomic_read(&sbi->zone_appending)) {
+		f2fs_unlock_all(sbi);
+		f2fs_wait_zone_appends(sbi);
+		cond_resched();
+		goto retry_flush_quotas;
+	}
+#endif
 	/*
 	 * POR: we should ensure that there are no dirty node pages
 	 * until finishing nat/sit flush. inode->i_blocks can be updated.
@@ -1552,6 +1538,12 @@ static void update_ckpt_flags(struct f2fs_sb_info *sbi, struct cp_control *cpc)
 	else
 		__clear_ckpt_flags(ckpt, CP_RESIZEFS_FLAG);
 
+#if LIFE_LOG
+	__set_ckpt_flags(ckpt, CP_LIFE_LOG_FLAG);
+#else
+	__clear_ckpt_flags(ckpt, CP_LIFE_LOG_FLAG);
+#endif
+
 	if (is_sbi_flag_set(sbi, SBI_CP_DISABLED))
 		__set_ckpt_flags(ckpt, CP_DISABLED_FLAG);
 	else
@@ -1570,6 +1562,20 @@ static void update_ckpt_flags(struct f2fs_sb_info *sbi, struct cp_control *cpc)
 	if (is_sbi_flag_set(sbi, SBI_QUOTA_NEED_REPAIR))
 		__set_ckpt_flags(ckpt, CP_QUOTA_NEED_FSCK_FLAG);
 
+#if DELAYED_MERGE
+	if (is_sbi_flag_set(sbi, SBI_NEED_LOG_MERGE))
+		__set_ckpt_flags(ckpt, CP_LOG_MERGED_FLAG);
+	else
+		__clear_ckpt_flags(ckpt, CP_LOG_MERGED_FLAG);
+
+	/* keeps the next mount from taking CP_UMOUNT_FLAG as merged logs */
+	if ((cpc->reason & CP_UMOUNT) &&
+			!is_sbi_flag_set(sbi, SBI_NEED_LOG_MERGE))
+		__set_ckpt_flags(ckpt, CP_LOG_PENDING_FLAG);
+	else
+		__clear_ckpt_flags(ckpt, CP_LOG_PENDING_FLAG);
+#endif
+
 	/* set this flag to activate crc|cp_ver for recovery */
 	__set_ckpt_flags(ckpt, CP_CRC_RECOVERY_FLAG);
 	__clear_ckpt_flags(ckpt, CP_NOCRC_RECOVERY_FLAG);
@@ -1678,6 +1684,14 @@ static int do_checkpoint(struct f2fs_sb_info *sbi, struct cp_control *cpc)
 		ckpt->alloc_type[i + CURSEG_HOT_DATA] =
 				curseg_alloc_type(sbi, i + CURSEG_HOT_DATA);
 	}
+#if LIFE_LOG
+	for (i = CURSEG_LIFE1_DATA; i <= CURSEG_LIFE5_DATA; i++) {
+		ckpt->cur_data_segno[LIFE_LOG_CP_IDX(i)] =
+			cpu_to_le32(curseg_segno(sbi, i));
+		ckpt->cur_data_blkoff[LIFE_LOG_CP_IDX(i)] =
+			cpu_to_le16(curseg_blkoff(sbi, i));
+	}
+#endif
 	//TODO: 4k striping -> store all cursegs
 	/* 2 cp + n data seg summary + orphan inode blocks */
 	data_sum_blocks = f2fs_npages_for_summary_flush(sbi, false);
@@ -1795,7 +1809,7 @@ static int do_checkpoint(struct f2fs_sb_info *sbi, struct cp_control *cpc)
 #if NAIVE_MFZ
   f2fs_wait_on_all_pages(sbi, F2FS_MERGE_META);  
 #else
-  if (cpc->reason & CP_UMOUNT) {
+  if (log_fg_merge(sbi, cpc)) {
    f2fs_wait_on_all_pages(sbi, F2FS_MERGE_META);  
   }
 #endif
@@ -1892,6 +1906,14 @@ static int do_checkpoint(struct f2fs_sb_info *sbi, struct cp_control *cpc)
 		ckpt->alloc_type[i + CURSEG_HOT_DATA] =
 				curseg_alloc_type(sbi, i + CURSEG_HOT_DATA);
 	}
+#if LIFE_LOG
+	for (i = CURSEG_LIFE1_DATA; i <= CURSEG_LIFE5_DATA; i++) {
+		ckpt->cur_data_segno[LIFE_LOG_CP_IDX(i)] =
+			cpu_to_le32(curseg_segno(sbi, i));
+		ckpt->cur_data_blkoff[LIFE_LOG_CP_IDX(i)] =
+			cpu_to_le16(curseg_blkoff(sbi, i));
+	}
+#endif
 
 	/* 2 cp + n data seg summary + orphan inode blocks */
 	data_sum_blocks = f2fs_npages_for_summary_flush(sbi, false);
@@ -2031,6 +2053,71 @@ static int do_checkpoint(struct f2fs_sb_info *sbi, struct cp_control *cpc)
 	return unlikely(f2fs_cp_error(sbi)) ? -EIO : 0;
 }
 #endif
+#if DELAYED_MERGE
+static const unsigned int log_merge_flag[SSA_LOG + 1] = {
+	[SIT_LOG] = CP_SIT_MERGE_FLAG,
+	[NAT_LOG] = CP_NAT_MERGE_FLAG,
+	[SSA_LOG] = CP_SSA_MERGE_FLAG,
+};
+
+static const unsigned int log_in_merge_flag[SSA_LOG + 1] = {
+	[SIT_LOG] = CP_SIT_IN_MERGE_FLAG,
+	[NAT_LOG] = CP_NAT_IN_MERGE_FLAG,
+	[SSA_LOG] = CP_SSA_IN_MERGE_FLAG,
+};
+
+static const unsigned int log_merge_done_flag[SSA_LOG + 1] = {
+	[SIT_LOG] = CP_SIT_MERGE_DONE_FLAG,
+	[NAT_LOG] = CP_NAT_MERGE_DONE_FLAG,
+	[SSA_LOG] = CP_SSA_MERGE_DONE_FLAG,
+};
+
+#define LOG_MERGE_FLAGS(type)	(log_merge_flag[type] | \
+		log_in_merge_flag[type] | log_merge_done_flag[type])
+
+/*
+ * A log which may fill its zone in this checkpoint has to switch to the
+ * next one. If that one still waits for its merge, every tree is merged
+ * in the foreground instead.
+ */
+static bool meta_log_ring_exhausted(struct f2fs_sb_info *sbi)
+{
+	if (log_ring_full(sbi, SIT_LOG) &&
+		!has_curlog_space(sbi, SIT_I(sbi)->dirty_sentries, SIT_LOG))
+		return true;
+	if (log_ring_full(sbi, NAT_LOG) &&
+		!has_curlog_space(sbi, NM_I(sbi)->nat_cnt[DIRTY_NAT], NAT_LOG))
+		return true;
+	return sum_log_blocked(sbi);
+}
+
+/* the head tree is merged and checkpointed, reuse its zone */
+static void finish_log_merge(struct f2fs_sb_info *sbi, int type)
+{
+	unsigned int *head = log_tree_head(sbi, type);
+
+	if (!is_set_ckpt_flags(sbi, log_merge_done_flag[type]))
+		return;
+	reset_meta_zone_towrite(sbi, *head, type);
+	*head = next_log_gen(sbi, *head);
+	clear_ckpt_flags(sbi, log_merge_done_flag[type]);
+}
+
+/* hand the oldest switched out tree of each log to the merge thread */
+static void queue_log_merges(struct f2fs_sb_info *sbi)
+{
+	int type;
+
+	for (type = SIT_LOG; type <= SSA_LOG; type++) {
+		if (*log_tree_head(sbi, type) == *log_tree_idx(sbi, type))
+			continue;
+		if (is_set_ckpt_flags(sbi, LOG_MERGE_FLAGS(type)))
+			continue;
+		set_ckpt_flags(sbi, log_merge_flag[type]);
+	}
+}
+#endif
+
 int f2fs_write_checkpoint(struct f2fs_sb_info *sbi, struct cp_control *cpc)
 {
 	struct f2fs_checkpoint *ckpt = F2FS_CKPT(sbi);
@@ -2132,6 +2219,24 @@ int f2fs_write_checkpoint(struct f2fs_sb_info *sbi, struct cp_control *cpc)
 	 */
 	ckpt_ver = cur_cp_version(ckpt);
 	ckpt->checkpoint_ver = cpu_to_le64(++ckpt_ver);
+#if DELAYED_MERGE
+	/*
+	 * A full unmount leaves nothing in the logs, older trees included.
+	 * fast_umount only appends the dirty entries to the logs, replay at
+	 * the next mount finds them by their checkpoint version.
+	 */
+	if ((cpc->reason & CP_UMOUNT) && !test_opt(sbi, FAST_UMOUNT))
+		set_sbi_flag(sbi, SBI_NEED_LOG_MERGE);
+	if (meta_log_ring_exhausted(sbi))
+		set_sbi_flag(sbi, SBI_NEED_LOG_MERGE);
+	if (is_sbi_flag_set(sbi, SBI_NEED_LOG_MERGE)) {
+		err = f2fs_merge_log_trees(sbi, 0);
+		if (err) {
+			f2fs_err(sbi, "f2fs_merge_log_trees failed err:%d, stop checkpoint", err);
+			goto stop;
+		}
+	}
+#endif
 	/* write cached NAT/SIT entries to NAT/SIT area */
 	err = f2fs_flush_nat_entries(sbi, cpc);
 	if (err) {
@@ -2142,7 +2247,7 @@ int f2fs_write_checkpoint(struct f2fs_sb_info *sbi, struct cp_control *cpc)
 	f2fs_flush_sit_entries(sbi, cpc);
 #if META_FOR_ZNS
 #if !NAIVE_MFZ
-	if (cpc->reason & CP_UMOUNT) {
+	if (log_fg_merge(sbi, cpc)) {
 #else 
   {
 #endif
@@ -2153,6 +2258,18 @@ int f2fs_write_checkpoint(struct f2fs_sb_info *sbi, struct cp_control *cpc)
 			goto stop;
 		}
 	}
+#endif
+#if DELAYED_MERGE
+	if (is_sbi_flag_set(sbi, SBI_NEED_LOG_MERGE)) {
+		/* a log found no free zone during the flush, see switch_log_gen() */
+		err = f2fs_merge_log_trees(sbi, 0);
+		if (!err)
+			err = f2fs_merge_log_trees(sbi, 1);
+		if (err) {
+			f2fs_err(sbi, "f2fs_merge_log_trees failed err:%d, stop checkpoint", err);
+			goto stop;
+		}
+	}
 #endif
 	/* save inmem log status */
 	f2fs_save_inmem_curseg(sbi);
@@ -2171,28 +2288,26 @@ int f2fs_write_checkpoint(struct f2fs_sb_info *sbi, struct cp_control *cpc)
 	}
 
 #if DELAYED_MERGE
-	// invoke merge thread
-	if (is_set_ckpt_flags(sbi, CP_SIT_MERGE_DONE_FLAG)) {
-		reset_meta_zone_towrite(sbi, SM_I(sbi)->cur_sit_log ^ 0x1, SIT_LOG);
-		clear_ckpt_flags(sbi, CP_SIT_MERGE_DONE_FLAG);
-	}
-	if (is_set_ckpt_flags(sbi, CP_NAT_MERGE_DONE_FLAG)) {
-		reset_meta_zone_towrite(sbi, NM_I(sbi)->cur_nat_log ^ 0x1, NAT_LOG);
-		clear_ckpt_flags(sbi, CP_NAT_MERGE_DONE_FLAG);
+	/* CP_LOG_MERGED_FLAG is on disk, logs can start afresh */
+	if (!err && is_sbi_flag_set(sbi, SBI_NEED_LOG_MERGE) &&
+					!f2fs_reset_meta_logs(sbi)) {
+		clear_sbi_flag(sbi, SBI_NEED_LOG_MERGE);
+		/* the trees start afresh along with their zones */
+		cpc->merge = 0;
+		clear_ckpt_flags(sbi, CP_SSA_MERGE_PREPARE_FLAG);
 	}
-	if (is_set_ckpt_flags(sbi, CP_SSA_MERGE_DONE_FLAG)) {
-		//reset log zone
-		reset_meta_zone_towrite(sbi, SM_I(sbi)->cur_sum_log ^ 0x1, SSA_LOG);
-		clear_ckpt_flags(sbi, CP_SSA_MERGE_DONE_FLAG);
+	/* merged trees are in this checkpoint, their zones can be reused */
+	if (!err) {
+		finish_log_merge(sbi, SIT_LOG);
+		finish_log_merge(sbi, NAT_LOG);
+		finish_log_merge(sbi, SSA_LOG);
 	}
 
 	if (cpc->merge & 0x1) {
 		//printk("(%s : %d) invoke merge for sit", __func__, __LINE__);
 		cpc->merge = cpc->merge ;
-    memcpy(SIT_I(sbi)->sit_merge_bitmap, SIT_I(sbi)->sit_log_bitmap, f2fs_bitmap_size(MAIN_SEGS(sbi)));
-		set_ckpt_flags(sbi, CP_SIT_MERGE_FLAG);
 		down_write(&SM_I(sbi)->sit_ltree_slock);
-		SM_I(sbi)->sit_ltree_idx ^= 0x1;
+		SM_I(sbi)->sit_ltree_idx = next_log_gen(sbi, SM_I(sbi)->sit_ltree_idx);
 		up_write(&SM_I(sbi)->sit_ltree_slock);
 
 		//printk("(%s : %d) switch sit_ltree_idx to %d", 
@@ -2206,9 +2321,8 @@ int f2fs_write_checkpoint(struct f2fs_sb_info *sbi, struct cp_control *cpc)
 	if (cpc->merge & 0x2) {
 		//printk("(%s : %d) invoke merge for nat", __func__, __LINE__);
 		cpc->merge = 0;
-		set_ckpt_flags(sbi, CP_NAT_MERGE_FLAG);
 		down_write(&NM_I(sbi)->nat_ltree_slock);
-		NM_I(sbi)->nat_ltree_idx ^= 0x1;
+		NM_I(sbi)->nat_ltree_idx = next_log_gen(sbi, NM_I(sbi)->nat_ltree_idx);
 		up_write(&NM_I(sbi)->nat_ltree_slock);
 
 		//printk("(%s : %d) switch nat_ltree_idx to %d", 
@@ -2221,7 +2335,8 @@ int f2fs_write_checkpoint(struct f2fs_sb_info *sbi, struct cp_control *cpc)
 	if (is_set_ckpt_flags(sbi, CP_SSA_MERGE_PREPARE_FLAG)) {
 
 		down_write(&SM_I(sbi)->ssa_ltree_slock);
-		SM_I(sbi)->cur_log_tree_idx ^= 0x1;
+		SM_I(sbi)->cur_log_tree_idx =
+			next_log_gen(sbi, SM_I(sbi)->cur_log_tree_idx);
 		up_write(&SM_I(sbi)->ssa_ltree_slock);
 
 		//printk("(%s : %d) switch cur_log_tree_idx to %d", 
@@ -2230,9 +2345,10 @@ int f2fs_write_checkpoint(struct f2fs_sb_info *sbi, struct cp_control *cpc)
 			printk("(%s : %d) this is not empty tree", __func__, __LINE__);
 		}
 		clear_ckpt_flags(sbi, CP_SSA_MERGE_PREPARE_FLAG);
-		set_ckpt_flags(sbi, CP_SSA_MERGE_FLAG);
-// 		invoke merge thread
 	}
+	// invoke merge thread
+	queue_log_merges(sbi);
+	f2fs_wake_up_merge(sbi);
 
 #endif
 
@@ -2318,6 +2434,15 @@ int __init f2fs_create_checkpoint_caches(void)
 		kmem_cache_destroy(ino_entry_slab);
 		return -ENOMEM;
 	}
+#if META_FOR_ZNS
+	meta_merge_unit_slab = f2fs_kmem_cache_create("f2fs_meta_merge_unit",
+			sizeof(struct meta_merge_unit));
+	if (!meta_merge_unit_slab) {
+		kmem_cache_destroy(f2fs_inode_entry_slab);
+		kmem_cache_destroy(ino_entry_slab);
+		return -ENOMEM;
+	}
+#endif
 	return 0;
 }
 
@@ -2325,6 +2450,9 @@ void f2fs_destroy_checkpoint_caches(void)
 {
 	kmem_cache_destroy(ino_entry_slab);
 	kmem_cache_destroy(f2fs_inode_entry_slab);
+#if META_FOR_ZNS
+	kmem_cache_destroy(meta_merge_unit_slab);
+#endif
 }
 
 static int __write_checkpoint_sync(struct f2fs_sb_info *sbi)
@@ -2490,100 +2618,143 @@ void f2fs_stop_ckpt_thread(struct f2fs_sb_info *sbi)
 }
 
 #if DELAYED_MERGE
-int f2fs_merge(void *data)
+/* a busy device postpones the merge of a log with this much room left */
+#define MERGE_BACKOFF_MS	20
+#define MERGE_URGENT_RATIO	4	/* 1/4 of the current log */
+
+/* the pending merge whose current log has the least room left */
+static int pick_log_merge(struct f2fs_sb_info *sbi)
 {
-	struct f2fs_sb_info *sbi = data;
-	long time_ms = 100;
-	int ret = 0;
-	bool done = false;
+	unsigned int room, min_room = UINT_MAX;
+	int type, pick = -1;
 
-	while (!kthread_should_stop()) {
-		//do merge
-		//ssa
-		done = false;
-
-		if (is_set_ckpt_flags(sbi, CP_SSA_MERGE_FLAG)) {
-		  if (is_set_ckpt_flags(sbi, CP_SSA_IN_MERGE_FLAG)) {
-        msleep(time_ms);
-        continue;
-      }
+	for (type = SIT_LOG; type <= SSA_LOG; type++) {
+		if (!is_set_ckpt_flags(sbi, log_merge_flag[type]))
+			continue;
+		/* the foreground merge has it */
+		if (type == SSA_LOG && is_set_ckpt_flags(sbi, CP_SSA_IN_MERGE_FLAG))
+			continue;
+		room = curlog_size(sbi, type) - curlog_used_blocks(sbi, type);
+		if (room < min_room) {
+			min_room = room;
+			pick = type;
+		}
+	}
+	return pick;
+}
+
+static bool log_merge_urgent(struct f2fs_sb_info *sbi, int type)
+{
+	unsigned int used = curlog_used_blocks(sbi, type);
+	unsigned int size = curlog_size(sbi, type);
+
+	return (size - used) * MERGE_URGENT_RATIO <= size;
+}
+
+static int merge_log(struct f2fs_sb_info *sbi, int type)
+{
+	int ret;
+
+	mutex_lock(&sbi->merge_mutex);
+	/* a foreground merge emptied the ring meanwhile */
+	if (*log_tree_head(sbi, type) == *log_tree_idx(sbi, type)) {
+		clear_ckpt_flags(sbi, log_merge_flag[type]);
+		mutex_unlock(&sbi->merge_mutex);
+		return 0;
+	}
+
+	if (type == SSA_LOG) {
 //			f2fs_lock_op(sbi);
-			set_ckpt_flags(sbi, CP_SSA_IN_MERGE_FLAG); 
-			clear_ckpt_flags(sbi, CP_SSA_MERGE_FLAG);
-
-			// do ssa merge
-//			printk("(%s : %d) merge ssa", __func__, __LINE__);
-			down_write(&SM_I(sbi)->ssa_ltree_slock);
-			ret = merge_ssa(sbi, 0); 
-			up_write(&SM_I(sbi)->ssa_ltree_slock);
-			if (!ret) {
-				//printk("(%s : %d) merge ssa success"
-				//		, __func__, __LINE__);
-				set_ckpt_flags(sbi, CP_SSA_MERGE_DONE_FLAG);
-				clear_ckpt_flags(sbi, CP_SSA_IN_MERGE_FLAG);
-			} else {
-				set_ckpt_flags(sbi, CP_SSA_MERGE_DONE_FLAG);
-				clear_ckpt_flags(sbi, CP_SSA_IN_MERGE_FLAG);
-				printk("(%s : %d) merge ssa failed"
-						, __func__, __LINE__);
-			}
+		set_ckpt_flags(sbi, CP_SSA_IN_MERGE_FLAG); 
+		clear_ckpt_flags(sbi, CP_SSA_MERGE_FLAG);
+
+		// do ssa merge, it locks the zone switch itself
+		ret = merge_ssa(sbi, 0); 
+		set_ckpt_flags(sbi, CP_SSA_MERGE_DONE_FLAG);
+		clear_ckpt_flags(sbi, CP_SSA_IN_MERGE_FLAG);
 //			f2fs_unlock_op(sbi);
-			done = true;
+	} else if (type == NAT_LOG) {
+		set_ckpt_flags(sbi, CP_NAT_IN_MERGE_FLAG); 
+		clear_ckpt_flags(sbi, CP_NAT_MERGE_FLAG);
+
+		ret = merge_nat_bg(sbi);
+		if (!ret) {
+			set_ckpt_flags(sbi, CP_NAT_MERGE_DONE_FLAG);
+			clear_ckpt_flags(sbi, CP_NAT_IN_MERGE_FLAG);
 		}
-
-		//nat
-		if (is_set_ckpt_flags(sbi, CP_NAT_MERGE_FLAG)) {
-
-			set_ckpt_flags(sbi, CP_NAT_IN_MERGE_FLAG); 
-			clear_ckpt_flags(sbi, CP_NAT_MERGE_FLAG);
-
-//			printk("(%s : %d) merge nat", __func__, __LINE__);
-			down_read(&NM_I(sbi)->nat_ltree_slock);
-			ret = merge_nat(sbi, 0); 
-			up_read(&NM_I(sbi)->nat_ltree_slock);
-
-			if (!ret) {
-				printk("(%s : %d) merge nat success"
-						, __func__, __LINE__);
-				set_ckpt_flags(sbi, CP_NAT_MERGE_DONE_FLAG);
-				clear_ckpt_flags(sbi, CP_NAT_IN_MERGE_FLAG);
-			} else {
-				printk("(%s : %d) merge nat failed"
-						, __func__, __LINE__);
-			}
-			done = true;
+	} else {
+		set_ckpt_flags(sbi, CP_SIT_IN_MERGE_FLAG); 
+		clear_ckpt_flags(sbi, CP_SIT_MERGE_FLAG);
+
+		down_read(&SM_I(sbi)->sit_ltree_slock);
+		ret = merge_sit(sbi, 0); 
+		up_read(&SM_I(sbi)->sit_ltree_slock);
+		if (!ret) {
+			set_ckpt_flags(sbi, CP_SIT_MERGE_DONE_FLAG);
+			clear_ckpt_flags(sbi, CP_SIT_IN_MERGE_FLAG);
 		}
+	}
 
-		//sit
-		
-		if (is_set_ckpt_flags(sbi, CP_SIT_MERGE_FLAG)) {
-			set_ckpt_flags(sbi, CP_SIT_IN_MERGE_FLAG); 
-			clear_ckpt_flags(sbi, CP_SIT_MERGE_FLAG);
-
-//			printk("(%s : %d) merge sit", __func__, __LINE__);
-			down_read(&SM_I(sbi)->sit_ltree_slock);
-			ret = merge_sit(sbi, 0); 
-			up_read(&SM_I(sbi)->sit_ltree_slock);
-
-			if (!ret) {
-				printk("(%s : %d) merge sit success"
-						, __func__, __LINE__);
-				set_ckpt_flags(sbi, CP_SIT_MERGE_DONE_FLAG);
-				clear_ckpt_flags(sbi, CP_SIT_IN_MERGE_FLAG);
-			} else {
-				printk("(%s : %d) merge sit failed"
-						, __func__, __LINE__);
-			}
-			done = true;
+	f2fs_submit_merged_write(sbi, META);
+	f2fs_wait_on_all_pages(sbi, F2FS_MERGE_META);
+	mutex_unlock(&sbi->merge_mutex);
+	return ret;
+}
+
+int f2fs_merge(void *data)
+{
+	static const char * const log_name[SSA_LOG + 1] = {
+		[SIT_LOG] = "sit", [NAT_LOG] = "nat", [SSA_LOG] = "ssa",
+	};
+	struct f2fs_sb_info *sbi = data;
+	wait_queue_head_t *wq = &sbi->merge_wait_queue;
+
+	set_freezable();
+	while (!kthread_should_stop()) {
+		struct f2fs_merge_stat *ms;
+		unsigned long long blocks;
+		unsigned int us;
+		ktime_t start;
+		int type, ret;
+
+		wait_event_interruptible(*wq, kthread_should_stop() ||
+					pick_log_merge(sbi) >= 0);
+		if (try_to_freeze() || kthread_should_stop())
+			continue;
+
+		type = pick_log_merge(sbi);
+		if (type < 0)
+			continue;
+
+		/* let user I/O go first while the log has room */
+		if (!is_idle(sbi, REQ_TIME) && !log_merge_urgent(sbi, type)) {
+			wait_event_interruptible_timeout(*wq,
+				kthread_should_stop(),
+				msecs_to_jiffies(MERGE_BACKOFF_MS));
+			if (!log_merge_urgent(sbi, type) && !is_idle(sbi, REQ_TIME))
+				continue;
 		}
 
-		//sleep
-		if (done) {
-			f2fs_submit_merged_write(sbi, META);
-      f2fs_wait_on_all_pages(sbi, F2FS_MERGE_META);
-	//		printk("(%s : %d) merge wait done", __func__, __LINE__);
-    }
-		msleep(time_ms);
+		start = ktime_get();
+		blocks = atomic64_read(&sbi->merged_blocks[type]);
+		ret = merge_log(sbi, type);
+		us = ktime_us_delta(ktime_get(), start);
+		blocks = atomic64_read(&sbi->merged_blocks[type]) - blocks;
+
+		ms = &sbi->merge_stat[type];
+		ms->count++;
+		ms->bytes += blocks << F2FS_BLKSIZE_BITS;
+		ms->total_us += us;
+		ms->last_us = us;
+		ms->max_us = max(ms->max_us, us);
+
+		if (ret)
+			printk("(%s : %d) merge %s failed (%d)",
+					__func__, __LINE__, log_name[type], ret);
+		else
+			f2fs_debug(sbi, "merge %s: %u us, %llu KB",
+					log_name[type], us,
+					blocks << (F2FS_BLKSIZE_BITS - 10));
 	}
 	return 0;
 }
@@ -2634,56 +2805,39 @@ inline pgoff_t next_log_addr(struct f2fs_sb_info *sbi, int log_type){
 	pgoff_t log_addr;
 	int off_in_zone = 0;
 	int stripe_idx = 0;
-	int stripe_cnt = 1;
-#if META_LOG_STRIPE
-  stripe_cnt = META_STRIPE_CNT;
-#endif
+	int stripe_cnt = meta_log_stripes(sbi, log_type);
+	int *blks_in_log;
+	int gen = 0;
+
+	/* consecutive log blocks go to the stripe zones in turn */
 	if (log_type == SIT_LOG){
-#if 0//META_LOG_STRIPE
-		off_in_zone = SM_I(sbi)->sit_blks_in_log / stripe_cnt;
-		stripe_idx = SM_I(sbi)->sit_blks_in_log % stripe_cnt;
-#else 
-		off_in_zone = SM_I(sbi)->sit_blks_in_log;
-#endif
-		log_addr = SM_I(sbi)->sit_log_blkaddr + stripe_idx * sbi->blocks_per_blkz;
-		log_addr += off_in_zone;
-//		log_addr = SM_I(sbi)->sit_log_blkaddr + SM_I(sbi)->sit_blks_in_log;
-		SM_I(sbi)->sit_blks_in_log++;
+		log_addr = SM_I(sbi)->sit_log_blkaddr;
+		blks_in_log = &SM_I(sbi)->sit_blks_in_log;
 #if DELAYED_MERGE
-		log_addr = log_addr + SM_I(sbi)->cur_sit_log * sbi->blocks_per_blkz;
+		gen = SM_I(sbi)->cur_sit_log;
 #endif
 	} else if (log_type == NAT_LOG) {
-#if 0//META_LOG_STRIPE
-		off_in_zone = NM_I(sbi)->nat_blks_in_log / stripe_cnt;
-		stripe_idx = NM_I(sbi)->nat_blks_in_log % stripe_cnt;
-#else 
-		off_in_zone = NM_I(sbi)->nat_blks_in_log;
-#endif
-		log_addr = NM_I(sbi)->nat_log_blkaddr + stripe_idx * sbi->blocks_per_blkz;
-		log_addr += off_in_zone;
-//		log_addr = NM_I(sbi)->nat_log_blkaddr + NM_I(sbi)->nat_blks_in_log;
-		NM_I(sbi)->nat_blks_in_log++;
-		
-//		NM_I(sbi)->nat_stripe_idx++;
-//		if (NM_I(sbi)->nat_stripe_idx > 4);
-//			NM_I(sbi)->nat_stripe_idx = 0;
+		log_addr = NM_I(sbi)->nat_log_blkaddr;
+		blks_in_log = &NM_I(sbi)->nat_blks_in_log;
 #if DELAYED_MERGE
-		log_addr = log_addr + NM_I(sbi)->cur_nat_log * sbi->blocks_per_blkz;
-#endif		
+		gen = NM_I(sbi)->cur_nat_log;
+#endif
 	} else if (log_type == SSA_LOG) {
-		off_in_zone = SM_I(sbi)->sum_blks_in_log / stripe_cnt;
-		stripe_idx = SM_I(sbi)->sum_blks_in_log % stripe_cnt;
-
-		log_addr = SM_I(sbi)->sum_log_blkaddr + stripe_idx * sbi->blocks_per_blkz;
-		log_addr += off_in_zone;
-//		log_addr = SM_I(sbi)->sum_log_blkaddr + SM_I(sbi)->sum_blks_in_log;
-		SM_I(sbi)->sum_blks_in_log++;
+		log_addr = SM_I(sbi)->sum_log_blkaddr;
+		blks_in_log = &SM_I(sbi)->sum_blks_in_log;
 #if DELAYED_MERGE
-		log_addr = log_addr + SM_I(sbi)->cur_sum_log * stripe_cnt * sbi->blocks_per_blkz;
-#endif		
+		gen = SM_I(sbi)->cur_sum_log;
+#endif
 	} else {
 		f2fs_bug_on(sbi, 1);
+		return 0;
 	}
+	off_in_zone = *blks_in_log / stripe_cnt;
+	stripe_idx = *blks_in_log % stripe_cnt;
+	(*blks_in_log)++;
+
+	log_addr += (gen * stripe_cnt + stripe_idx) * sbi->blocks_per_blkz;
+	log_addr += off_in_zone;
 	return log_addr;
 }
 
@@ -2728,13 +2882,71 @@ struct page *get_next_log_page(struct f2fs_sb_info *sbi, int log_type){
 
 	return page;
 }
-static int __move_metadata_page(struct f2fs_sb_info *sbi, 
+static int meta_area_of(struct f2fs_sb_info *sbi, int type,
+		block_t *base, char **bitmap){
+	int ssa = 0;
+
+	if(type == NAT || type == NAT_LOG){
+		*base = NM_I(sbi)->nat_blkaddr;
+		*bitmap = NM_I(sbi)->nat_bitmap;
+	} else if (type == SIT || type == SIT_LOG){
+		*base = SIT_I(sbi)->sit_base_addr;
+		*bitmap = SIT_I(sbi)->sit_bitmap;
+	} else {
+		*base = SM_I(sbi)->ssa_blkaddr;
+		*bitmap = SM_I(sbi)->ssa_bitmap;
+		ssa = 1;
+	}
+	return ssa;
+}
+/*
+ * Queue a locked, clean page on the write bio of @unit. Pages of a zone
+ * are added in block order, so the bio grows up to BIO_MAX_VECS blocks.
+ */
+int f2fs_write_merged_meta_page(struct meta_merge_unit *unit,
+		struct page *page){
+	struct f2fs_sb_info *sbi = unit->sbi;
+	struct f2fs_io_info fio = {
+		.sbi = sbi,
+		.type = META,
+		.temp = HOT,
+		.op = REQ_OP_WRITE,
+		.op_flags = REQ_SYNC | REQ_META | REQ_PRIO,
+		.old_blkaddr = page->index,
+		.new_blkaddr = page->index,
+		.page = page,
+		.encrypted_page = NULL,
+		.in_list = false,
+		.bio = &unit->bio,
+		.last_block = &unit->last_block,
+	};
+	int err;
+
+	if (unlikely(f2fs_cp_error(sbi)))
+		return -EIO;
+
+	set_page_writeback(page);
+	ClearPageError(page);
+	err = f2fs_merge_page_bio(&fio);
+	if (err) {
+		end_page_writeback(page);
+		return err;
+	}
+	stat_inc_meta_count(sbi, page->index);
+	f2fs_update_iostat(sbi, FS_CP_META_IO, F2FS_BLKSIZE);
+	atomic64_inc(&sbi->merged_blocks[unit->type - SIT + SIT_LOG]);
+	dec_page_count(sbi, F2FS_DIRTY_META);
+	unlock_page(page);
+	return 0;
+}
+static int __move_metadata_page(struct meta_merge_unit *unit, 
 		pgoff_t src_off, pgoff_t dst_off){
 	
+	struct f2fs_sb_info *sbi = unit->sbi;
 	struct page *src_page, *dst_page;
 	int ret;
 	//read src and dst page
-	src_page = f2fs_get_meta_page(sbi, src_off); //read src page
+	src_page = f2fs_get_meta_page(sbi, src_off); //read ahead by f2fs_ra_meta_zone()
 	if(IS_ERR(src_page)){
 		printk("(%s : %d) error while reading src page(%lu off)"
 				, __func__, __LINE__, src_off);
@@ -2746,7 +2958,7 @@ static int __move_metadata_page(struct f2fs_sb_info *sbi,
 	//write page
 	inc_page_count(sbi, F2FS_DIRTY_META);
 	//printk("(%s : %d) dst_page(idx: %lu)"	, __func__, __LINE__, dst_page->index);
-	if((ret = f2fs_sync_single_meta_page(dst_page))){
+	if((ret = f2fs_write_merged_meta_page(unit, dst_page))){
 		printk("(%s : %d) write error while moving clean metadata in dirty zone(idx: %lu)"
 				, __func__, __LINE__, dst_page->index);
 		unlock_page(dst_page);
@@ -2776,89 +2988,458 @@ static bool check_end_of_meta(struct f2fs_sb_info *sbi,
 	return false;
 
 }
-int advance_meta_zone_wp(struct f2fs_sb_info *sbi,
-		block_t zoff, int cur_wp, int add, 
-		int type){
-	int i, ret, full = 0;
-	block_t meta_off, base;
-	struct f2fs_dev_info *zbd;
-	sector_t zone_sectors;
+/* # of blocks of the zone of @unit from @wp on, up to the end of meta */
+static int meta_zone_blocks_left(struct meta_merge_unit *unit, int wp)
+{
+	struct f2fs_sb_info *sbi = unit->sbi;
+	block_t meta_off = meta_zoff_to_boff(sbi, unit->zone) + wp;
+	int left = meta_blks_zone_cap(sbi) - wp;
+	block_t blk_cnt;
+
+	if (unit->type == SSA)
+		return left;
+	blk_cnt = unit->type == NAT ? NM_I(sbi)->nat_blocks :
+					SIT_I(sbi)->sit_blocks;
+	if (meta_off >= blk_cnt)
+		return 0;
+	return min_t(int, left, blk_cnt - meta_off);
+}
+/*
+ * Read ahead the blocks [wp, wp + cnt) of the zone of @unit without
+ * waiting. All blocks of a meta zone sit in the same half of the zone
+ * pair, so the source range is contiguous.
+ */
+void f2fs_ra_meta_zone(struct meta_merge_unit *unit, int wp, int cnt)
+{
+	struct f2fs_sb_info *sbi = unit->sbi;
+	block_t base;
 	char *bitmap;
-	int ssa = 0;
+	int ssa;
 
-	meta_off = meta_zoff_to_boff(sbi, zoff) + cur_wp;
-	for(i=0;i<add;i++){
-		if(check_end_of_meta(sbi, meta_off + i, type)){
-			full = 1;
-			break;
+	cnt = min(cnt, meta_zone_blocks_left(unit, wp));
+	if (cnt <= 0)
+		return;
+
+	ssa = meta_area_of(sbi, unit->type, &base, &bitmap);
+	f2fs_ra_meta_pages(sbi, get_cur_meta_blkaddr(sbi,
+			meta_zoff_to_boff(sbi, unit->zone) + wp,
+			base, bitmap, ssa), cnt, META_LOG, true);
+}
+/* wait for the blocks written to the zone rebuilt by @unit */
+static int wait_meta_zone_writeback(struct meta_merge_unit *unit)
+{
+	struct f2fs_sb_info *sbi = unit->sbi;
+	block_t base, start;
+	char *bitmap;
+	int ssa;
+
+	ssa = meta_area_of(sbi, unit->type, &base, &bitmap);
+	start = get_next_meta_blkaddr(sbi, meta_zoff_to_boff(sbi, unit->zone),
+						base, bitmap, ssa);
+	filemap_fdatawait_range_keep_errors(META_MAPPING(sbi),
+			(loff_t)start << PAGE_SHIFT,
+			((loff_t)(start + sbi->blocks_per_blkz) << PAGE_SHIFT) - 1);
+	/* a failed meta write stops checkpoint */
+	if (unlikely(f2fs_cp_error(sbi)))
+		return -EIO;
+	return 0;
+}
+/* allocate the copy buffer of @unit, kept until the unit is freed */
+static int meta_zone_copy_buf(struct meta_merge_unit *unit)
+{
+	while (unit->nr_copy_pages < META_ZONE_COPY_BLKS) {
+		struct page *page = alloc_page(GFP_NOFS);
+
+		if (!page)
+			return -ENOMEM;
+		unit->copy_pages[unit->nr_copy_pages++] = page;
+	}
+	return 0;
+}
+/* read or write @cnt blocks at @blkaddr through the copy buffer of @unit */
+static int meta_zone_copy_io(struct meta_merge_unit *unit, block_t blkaddr,
+		int cnt, int op)
+{
+	struct f2fs_sb_info *sbi = unit->sbi;
+	struct bio *bio;
+	int i, err;
+
+	bio = bio_alloc(GFP_NOIO, cnt);
+	bio_set_dev(bio, FDEV(0).bdev);
+	bio->bi_iter.bi_sector = SECTOR_FROM_BLOCK(blkaddr);
+	bio->bi_opf = op | REQ_SYNC | REQ_META | REQ_PRIO;
+	/* @cnt is at most META_ZONE_COPY_BLKS, the bio has room for all */
+	for (i = 0; i < cnt; i++)
+		__bio_add_page(bio, unit->copy_pages[i], PAGE_SIZE, 0);
+	err = submit_bio_wait(bio);
+	bio_put(bio);
+	return err;
+}
+/*
+ * Carry the clean blocks [wp, wp + cnt) over with one read and one write
+ * bio per META_ZONE_COPY_BLKS, bypassing the meta page cache. Cached
+ * pages are still honoured on both sides.
+ */
+static int copy_meta_zone_blocks(struct meta_merge_unit *unit, int wp, int cnt)
+{
+	struct f2fs_sb_info *sbi = unit->sbi;
+	struct address_space *mapping = META_MAPPING(sbi);
+	block_t base, meta_off;
+	pgoff_t src_off, dst_off;
+	char *bitmap;
+	int ssa, i, n, err;
+
+	if (unlikely(f2fs_cp_error(sbi)))
+		return -EIO;
+
+	ssa = meta_area_of(sbi, unit->type, &base, &bitmap);
+	meta_off = meta_zoff_to_boff(sbi, unit->zone) + wp;
+	src_off = get_cur_meta_blkaddr(sbi, meta_off, base, bitmap, ssa);
+	dst_off = get_next_meta_blkaddr(sbi, meta_off, base, bitmap, ssa);
+
+	//blocks queued before must reach the zone first
+	if (unit->bio) {
+		f2fs_submit_merged_ipu_write(sbi, &unit->bio, NULL);
+		err = wait_meta_zone_writeback(unit);
+		if (err)
+			return err;
+	}
+
+	for (; cnt > 0; cnt -= n, src_off += n, dst_off += n) {
+		n = min(cnt, META_ZONE_COPY_BLKS);
+		err = meta_zone_copy_io(unit, src_off, n, REQ_OP_READ);
+		if (err)
+			return err;
+		f2fs_update_iostat(sbi, FS_META_READ_IO, n * F2FS_BLKSIZE);
+
+		for (i = 0; i < n; i++) {
+			struct page *page;
+
+			//a cached source can still be under writeback
+			page = find_get_page(mapping, src_off + i);
+			if (page) {
+				if (PageUptodate(page))
+					f2fs_copy_page(page, unit->copy_pages[i]);
+				f2fs_put_page(page, 0);
+			}
+			//do not leave a stale copy of the destination behind
+			page = find_lock_page(mapping, dst_off + i);
+			if (page) {
+				f2fs_wait_on_page_writeback(page, META, true, true);
+				f2fs_copy_page(unit->copy_pages[i], page);
+				SetPageUptodate(page);
+				f2fs_put_page(page, 1);
+			}
+			stat_inc_meta_count(sbi, dst_off + i);
 		}
-		ret = move_metadata_page(sbi, meta_off + i, type);
-		if(ret){
+
+		err = meta_zone_copy_io(unit, dst_off, n, REQ_OP_WRITE);
+		if (err)
+			return err;
+		f2fs_update_iostat(sbi, FS_CP_META_IO, n * F2FS_BLKSIZE);
+		atomic64_add(n, &sbi->merged_blocks[unit->type - SIT + SIT_LOG]);
+	}
+	return 0;
+}
+/*
+ * Carry the clean blocks [cur_wp, cur_wp + add) over to the zone rebuilt
+ * by @unit. Returns the new write pointer, or -1 on error.
+ */
+int advance_meta_zone_wp(struct meta_merge_unit *unit, int cur_wp, int add){
+	struct f2fs_sb_info *sbi = unit->sbi;
+	int i, ret, cnt;
+	block_t meta_off;
+
+	cnt = min(add, meta_zone_blocks_left(unit, cur_wp));
+	if (cnt > 0 && !meta_zone_copy_buf(unit)) {
+		if (copy_meta_zone_blocks(unit, cur_wp, cnt))
 			return -1;
-		}
+		//meta zone full
+		if (cnt < add)
+			return sbi->blocks_per_blkz;
+		return cur_wp + add;
 	}
-	if(full){
-		//printk("(%s : %d) meta zone full",
-		//			__func__, __LINE__);
-		zbd = &FDEV(0);
-		zone_sectors = SECTOR_FROM_BLOCK(sbi->blocks_per_blkz);
-		
-		if(type == NAT || type == NAT_LOG){
-			base = NM_I(sbi)->nat_blkaddr;
-			bitmap = NM_I(sbi)->nat_bitmap;
-		} else if (type == SIT || type == SIT_LOG){
-			base = SIT_I(sbi)->sit_base_addr;
-			bitmap = SIT_I(sbi)->sit_bitmap;
-		} else if(type == SSA || type == SSA_LOG){
-			base = SM_I(sbi)->ssa_blkaddr;
-			bitmap = SM_I(sbi)->ssa_bitmap;
-			ssa = 1;
+
+	//no copy buffer, move page by page
+	meta_off = meta_zoff_to_boff(sbi, unit->zone) + cur_wp;
+	for(i=0;i<add;i++){
+		if(check_end_of_meta(sbi, meta_off + i, unit->type)){
+			//meta zone full
+			return sbi->blocks_per_blkz;
 		}
-		base = get_cur_meta_blkaddr(sbi, 
-				meta_zoff_to_boff(sbi, zoff), 
-				base, bitmap, ssa);
+		ret = move_metadata_page(unit, meta_off + i);
 		if(ret){
-			printk("(%s : %d) zone finish failed. error : %d, base addr : %u",
-					__func__, __LINE__, ret, base);
+			return -1;
 		}
-		return SECTOR_TO_BLOCK(zone_sectors);
 	}
 
 	return cur_wp+add;
 }
-int move_metadata_page(struct f2fs_sb_info *sbi, 
-		block_t meta_off, int type){
+int move_metadata_page(struct meta_merge_unit *unit, block_t meta_off){
 
-	int ret = -1;
-	pgoff_t base;
+	struct f2fs_sb_info *sbi = unit->sbi;
+	block_t base;
 	char *bitmap;
 	pgoff_t src_off, dst_off;
-	int ssa = 0;
-
-	if(type == NAT || type == NAT_LOG){
-		base = NM_I(sbi)->nat_blkaddr;
-		bitmap = NM_I(sbi)->nat_bitmap;
-	} else if (type == SIT || type == SIT_LOG){
-		base = SIT_I(sbi)->sit_base_addr;
-		bitmap = SIT_I(sbi)->sit_bitmap;
-	} else if(type == SSA || type == SSA_LOG){
-		base = SM_I(sbi)->ssa_blkaddr;
-		bitmap = SM_I(sbi)->ssa_bitmap;
-		ssa = 1;
-	}
+	int ssa;
 
+	ssa = meta_area_of(sbi, unit->type, &base, &bitmap);
 	src_off= get_cur_meta_blkaddr(sbi, meta_off, base, bitmap, ssa);
 	dst_off= get_next_meta_blkaddr(sbi, meta_off, base, bitmap, ssa);
 //  if (type == NAT || type == NAT_LOG) {
 //    printk("(%s : %d) move page(%lu) to page(%lu)"
 //        , __func__, __LINE__, src_off, dst_off);
 //  }
-	ret = __move_metadata_page(sbi, src_off, dst_off);
-	if(type != SSA_LOG && type != SSA)
-		f2fs_change_bit(meta_off, bitmap);
+	//bitmap is flipped once the whole zone is written
+	return __move_metadata_page(unit, src_off, dst_off);
+}
+/* switch the zone rebuilt by @unit to current, see f2fs_meta_merge_work() */
+static void flip_meta_zone(struct meta_merge_unit *unit)
+{
+	struct f2fs_sb_info *sbi = unit->sbi;
+	block_t base, meta_off;
+	char *bitmap;
+	int left;
 
-	return ret;
+	if (meta_area_of(sbi, unit->type, &base, &bitmap)) {
+		spin_lock(&sbi->meta_merge_lock);
+		f2fs_change_bit(unit->zone, bitmap);
+		spin_unlock(&sbi->meta_merge_lock);
+		return;
+	}
+
+	meta_off = meta_zoff_to_boff(sbi, unit->zone);
+	left = meta_zone_blocks_left(unit, 0);
+	spin_lock(&sbi->meta_merge_lock);
+	while (left--)
+		f2fs_change_bit(meta_off++, bitmap);
+	spin_unlock(&sbi->meta_merge_lock);
+}
+static void f2fs_meta_merge_work(struct work_struct *work)
+{
+	struct meta_merge_unit *unit = container_of(work,
+					struct meta_merge_unit, work);
+	struct f2fs_sb_info *sbi = unit->sbi;
+	int err;
+
+	unit->err = reset_meta_zone_towrite(sbi, unit->zone, unit->type);
+	if (unit->err)
+		return;
+	unit->err = unit->merge(unit);
+	if (unit->bio)
+		f2fs_submit_merged_ipu_write(sbi, &unit->bio, NULL);
+	err = wait_meta_zone_writeback(unit);
+	if (!unit->err)
+		unit->err = err;
+	/* on error the old copy of the zone stays current */
+	if (!unit->err && unit->type != SSA)
+		flip_meta_zone(unit);
+}
+/*
+ * SSA zones switch together with their log sets, so readers never see
+ * a set dropped before its zone is current. See merge_ssa().
+ */
+void f2fs_flip_meta_zones(struct list_head *units)
+{
+	struct meta_merge_unit *unit;
+
+	list_for_each_entry(unit, units, list)
+		if (!unit->err)
+			flip_meta_zone(unit);
+}
+struct meta_merge_unit *f2fs_add_meta_merge_unit(struct f2fs_sb_info *sbi,
+		struct list_head *units, int type, unsigned int zone,
+		int foreground, int (*merge)(struct meta_merge_unit *))
+{
+	struct meta_merge_unit *unit;
+
+	unit = f2fs_kmem_cache_alloc(meta_merge_unit_slab,
+					GFP_NOFS, true, NULL);
+	unit->sbi = sbi;
+	unit->type = type;
+	unit->zone = zone;
+	unit->foreground = foreground;
+	unit->merge = merge;
+	unit->bio = NULL;
+	unit->last_block = NULL_ADDR;
+	unit->err = 0;
+	unit->nr_copy_pages = 0;
+	unit->nr_sets = 0;
+	unit->nr_entries = 0;
+	INIT_LIST_HEAD(&unit->sets);
+	INIT_WORK(&unit->work, f2fs_meta_merge_work);
+	list_add_tail(&unit->list, units);
+	return unit;
+}
+static int meta_unit_denser(void *priv, const struct list_head *a,
+					const struct list_head *b)
+{
+	struct meta_merge_unit *ua = list_entry(a, struct meta_merge_unit, list);
+	struct meta_merge_unit *ub = list_entry(b, struct meta_merge_unit, list);
+
+	return ua->nr_sets < ub->nr_sets;
+}
+#if DELAYED_MERGE
+/*
+ * Move the sparsest units to @deferred while their log entries fit in
+ * @budget. Zones that sat out META_ZONE_MAX_DEFER merges are merged.
+ * @units is sorted densest first.
+ */
+static void defer_sparse_meta_zones(struct f2fs_sb_info *sbi, int type,
+		struct list_head *units, struct list_head *deferred,
+		unsigned int budget)
+{
+	struct meta_zone_stat *zs = sbi->meta_zone_stat[type];
+	unsigned int zone_cap = meta_blks_zone_cap(sbi);
+	struct meta_merge_unit *unit, *tmp;
+
+	if (!zs)
+		return;
+
+	spin_lock(&sbi->meta_merge_lock);
+	list_for_each_entry_safe_reverse(unit, tmp, units, list) {
+		if (unit->nr_sets * META_ZONE_SPARSE_RATIO >= zone_cap)
+			break;
+		if (unit->zone >= sbi->nr_meta_zones[type] ||
+				zs[unit->zone].age >= META_ZONE_MAX_DEFER ||
+				unit->nr_entries > budget)
+			continue;
+		budget -= unit->nr_entries;
+		list_move(&unit->list, deferred);
+	}
+	spin_unlock(&sbi->meta_merge_lock);
+}
+
+/* zones of log @type age by one merge, the merged ones of @units restart */
+static void note_meta_zone_merges(struct f2fs_sb_info *sbi, int type,
+					struct list_head *units)
+{
+	struct meta_merge_unit *unit;
+	struct meta_zone_stat *zs;
+	unsigned int i, nr;
+
+	zs = sbi->meta_zone_stat[type];
+	nr = sbi->nr_meta_zones[type];
+	if (!zs)
+		return;
+
+	spin_lock(&sbi->meta_merge_lock);
+	for (i = 0; i < nr; i++)
+		zs[i].age++;
+	list_for_each_entry(unit, units, list) {
+		if (unit->err || unit->zone >= nr)
+			continue;
+		zs[unit->zone].dirty = unit->nr_sets;
+		zs[unit->zone].merges++;
+		zs[unit->zone].age = 0;
+	}
+	spin_unlock(&sbi->meta_merge_lock);
+}
+#endif
+/*
+ * Rewrite every zone of @units on the merge workqueue and wait for them.
+ * Units only touch their own zone; state shared between them is updated
+ * under meta_merge_lock or by the caller afterwards. With @deferred, sparse
+ * zones whose log entries fit in @budget are moved there instead, for the
+ * caller to log their sets again.
+ */
+int f2fs_merge_meta_zones(struct f2fs_sb_info *sbi, struct list_head *units,
+		struct list_head *deferred, unsigned int budget)
+{
+	struct meta_merge_unit *unit;
+	struct list_head *pos;
+	int err = 0;
+#if DELAYED_MERGE
+	int type;
+
+	if (list_empty(units))
+		return 0;
+	type = list_first_entry(units, struct meta_merge_unit,
+					list)->type - SIT + SIT_LOG;
+#endif
+
+	list_for_each_entry(unit, units, list)
+		list_for_each(pos, &unit->sets)
+			unit->nr_sets++;
+	list_sort(NULL, units, meta_unit_denser);
+#if DELAYED_MERGE
+	if (deferred)
+		defer_sparse_meta_zones(sbi, type, units, deferred, budget);
+#endif
+
+	list_for_each_entry(unit, units, list)
+		queue_work(sbi->meta_merge_wq, &unit->work);
+
+	list_for_each_entry(unit, units, list) {
+		flush_work(&unit->work);
+		if (unit->err && !err)
+			err = unit->err;
+	}
+#if DELAYED_MERGE
+	note_meta_zone_merges(sbi, type, units);
+#endif
+	return err;
+}
+void f2fs_free_meta_merge_units(struct list_head *units)
+{
+	struct meta_merge_unit *unit, *tmp;
+
+	list_for_each_entry_safe(unit, tmp, units, list) {
+		list_del(&unit->list);
+		while (unit->nr_copy_pages)
+			__free_page(unit->copy_pages[--unit->nr_copy_pages]);
+		kmem_cache_free(meta_merge_unit_slab, unit);
+	}
+}
+int f2fs_init_meta_merge_wq(struct f2fs_sb_info *sbi)
+{
+	spin_lock_init(&sbi->meta_merge_lock);
+	mutex_init(&sbi->merge_mutex);
+	init_waitqueue_head(&sbi->merge_wait_queue);
+
+	/* checkpoint waits for it */
+	sbi->meta_merge_wq = alloc_workqueue("f2fs_merge_wq",
+				WQ_UNBOUND | WQ_MEM_RECLAIM,
+				META_MERGE_MAX_ACTIVE);
+	if (!sbi->meta_merge_wq)
+		return -ENOMEM;
+	return 0;
+}
+void f2fs_destroy_meta_merge_wq(struct f2fs_sb_info *sbi)
+{
+#if DELAYED_MERGE
+	int type;
+
+	for (type = SIT_LOG; type <= SSA_LOG; type++)
+		kvfree(sbi->meta_zone_stat[type]);
+#endif
+	if (sbi->meta_merge_wq)
+		destroy_workqueue(sbi->meta_merge_wq);
+}
+#if DELAYED_MERGE
+/* needs the sit and nat areas, freed by f2fs_destroy_meta_merge_wq() */
+int f2fs_build_meta_zone_stats(struct f2fs_sb_info *sbi)
+{
+	unsigned int blocks[SSA_LOG + 1] = {
+		[SIT_LOG] = SIT_I(sbi)->sit_blocks,
+		[NAT_LOG] = NM_I(sbi)->nat_blocks,
+		[SSA_LOG] = MAIN_SEGS(sbi),
+	};
+	int type;
+
+	for (type = SIT_LOG; type <= SSA_LOG; type++) {
+		sbi->nr_meta_zones[type] = DIV_ROUND_UP(blocks[type],
+						meta_blks_zone_cap(sbi));
+		sbi->meta_zone_stat[type] = f2fs_kvzalloc(sbi,
+				array_size(sbi->nr_meta_zones[type],
+					sizeof(struct meta_zone_stat)),
+				GFP_KERNEL);
+		if (!sbi->meta_zone_stat[type])
+			return -ENOMEM;
+	}
+	return 0;
 }
+#endif
 int reset_meta_zone_towrite(struct f2fs_sb_info *sbi,
 		block_t zone_off, int type)
 {
@@ -2867,7 +3448,7 @@ int reset_meta_zone_towrite(struct f2fs_sb_info *sbi,
 	block_t base;
 	char *bitmap;
 	unsigned int offset = 0;
-	int log = 0, ret, i;
+	int log = 0, ret = 0, i;
 	
 	bdev = FDEV(0).bdev;
 	
@@ -2907,19 +3488,9 @@ int reset_meta_zone_towrite(struct f2fs_sb_info *sbi,
 	if (log) {
 		blkstart = base;
 #if DELAYED_MERGE
-		if (type == SSA_LOG){
-#if META_LOG_STRIPE
-			blkstart = blkstart + (SM_I(sbi)->cur_sum_log ^ 0x1) * 
-        META_STRIPE_CNT * sbi->blocks_per_blkz;
-#else
-			blkstart = blkstart + (SM_I(sbi)->cur_sum_log ^ 0x1) * sbi->blocks_per_blkz;
-#endif
-    }
-		else if (type == NAT_LOG)
-			blkstart = blkstart + (NM_I(sbi)->cur_nat_log ^ 0x1) * sbi->blocks_per_blkz;
-		else if (type == SIT_LOG)
-			blkstart = blkstart + (SM_I(sbi)->cur_sit_log ^ 0x1) * sbi->blocks_per_blkz;
-				
+		/* zone_off is the log generation */
+		blkstart = blkstart + zone_off * meta_log_stripes(sbi, type) *
+						sbi->blocks_per_blkz;
 #endif
 	} else {
 		blkstart = base + 2 * zone_off * sbi->blocks_per_blkz;
@@ -2927,22 +3498,398 @@ int reset_meta_zone_towrite(struct f2fs_sb_info *sbi,
 			blkstart += sbi->blocks_per_blkz;
 	}
 	blklen = sbi->blocks_per_blkz; 
-#if META_LOG_STRIPE
-  if (type == SSA_LOG) {
-    for (i=0;i<META_STRIPE_CNT;i++){
-      ret = f2fs_issue_discard_zone(sbi, bdev, blkstart, blklen);
-      //printk("(%s:%d) issue discard zone start block %x", __func__, __LINE__, blkstart);
-      blkstart += blklen;
-      if (ret)
-        return ret;
-    }
-  } else {
-    ret = f2fs_issue_discard_zone(sbi, bdev, blkstart, blklen);
-    //printk("(%s:%d) issue discard zone start block %x", __func__, __LINE__, blkstart);
-  }
-#else
-  ret = f2fs_issue_discard_zone(sbi, bdev, blkstart, blklen);
-#endif
+	if (log) {
+		for (i = 0; i < meta_log_stripes(sbi, type); i++) {
+			ret = f2fs_issue_discard_zone(sbi, bdev, blkstart, blklen);
+			//printk("(%s:%d) issue discard zone start block %x", __func__, __LINE__, blkstart);
+			blkstart += blklen;
+			if (ret)
+				return ret;
+		}
+	} else {
+		ret = f2fs_issue_discard_zone(sbi, bdev, blkstart, blklen);
+	}
+  if (!ret)
+    ret = f2fs_wait_zone_resets(sbi);
+	return ret;
+}
+#if DELAYED_MERGE
+/* first block of @stripe in log generation @gen, see next_log_addr() */
+static block_t meta_log_blkaddr(struct f2fs_sb_info *sbi, int log_type,
+						int gen, int stripe)
+{
+	block_t base;
+
+	if (log_type == SIT_LOG)
+		base = SM_I(sbi)->sit_log_blkaddr;
+	else if (log_type == NAT_LOG)
+		base = NM_I(sbi)->nat_log_blkaddr;
+	else
+		base = SM_I(sbi)->sum_log_blkaddr;
+
+	return base + (gen * meta_log_stripes(sbi, log_type) + stripe) *
+						sbi->blocks_per_blkz;
+}
+
+static __u64 meta_log_cp_ver(int log_type, void *blk)
+{
+	if (log_type == SIT_LOG)
+		return le64_to_cpu(((struct f2fs_sit_log_block *)blk)->cp_ver);
+	if (log_type == NAT_LOG)
+		return le64_to_cpu(((struct f2fs_nat_log_block *)blk)->cp_ver);
+	return le64_to_cpu(((struct f2fs_sum_log_block *)blk)->cp_ver);
+}
+
+static int read_meta_log_ver(struct f2fs_sb_info *sbi, int log_type,
+					block_t blkaddr, __u64 *ver)
+{
+	struct page *page = f2fs_get_meta_page(sbi, blkaddr);
+
+	if (IS_ERR(page))
+		return PTR_ERR(page);
+	*ver = meta_log_cp_ver(log_type, page_address(page));
+	f2fs_put_page(page, 1);
+	return 0;
+}
+
+/* readahead or drop up to @nr written blocks from @off of each stripe */
+static void meta_log_pages(struct f2fs_sb_info *sbi, int log_type, int gen,
+			block_t *written, block_t off, block_t nr, bool drop)
+{
+	int s;
+
+	for (s = 0; s < meta_log_stripes(sbi, log_type); s++) {
+		block_t blkaddr = meta_log_blkaddr(sbi, log_type, gen, s) + off;
+		block_t len;
+
+		if (written[s] <= off)
+			continue;
+		len = min(nr, written[s] - off);
+		if (drop)
+			invalidate_mapping_pages(META_MAPPING(sbi),
+						blkaddr, blkaddr + len - 1);
+		else
+			f2fs_ra_meta_pages(sbi, blkaddr, len, META_LOG, true);
+	}
+}
+
+static int reset_meta_log(struct f2fs_sb_info *sbi, int log_type, int gen)
+{
+	int s, ret = 0;
+
+	for (s = 0; s < meta_log_stripes(sbi, log_type) && !ret; s++)
+		ret = f2fs_issue_discard_zone(sbi, FDEV(0).bdev,
+				meta_log_blkaddr(sbi, log_type, gen, s),
+				sbi->blocks_per_blkz);
+	if (!ret)
+		ret = f2fs_wait_zone_resets(sbi);
 	return ret;
 }
+
+static void set_meta_log_cursor(struct f2fs_sb_info *sbi, int log_type,
+					int gen, unsigned int blks)
+{
+	if (log_type == SIT_LOG) {
+		SM_I(sbi)->cur_sit_log = gen;
+		SM_I(sbi)->sit_blks_in_log = blks;
+	} else if (log_type == NAT_LOG) {
+		NM_I(sbi)->cur_nat_log = gen;
+		NM_I(sbi)->nat_blks_in_log = blks;
+	} else {
+		SM_I(sbi)->cur_sum_log = gen;
+		SM_I(sbi)->sum_blks_in_log = blks;
+	}
+}
+
+/* same as the switch at the end of a checkpoint which filled a log zone */
+static void switch_replayed_log_tree(struct f2fs_sb_info *sbi, int log_type)
+{
+	unsigned int *idx = log_tree_idx(sbi, log_type);
+
+	*idx = next_log_gen(sbi, *idx);
+}
+
+/* @a was filled before @b was started */
+static bool meta_log_older(__u64 *first, block_t *max_off, block_t zone_cap,
+						int a, int b)
+{
+	if (first[a] != first[b])
+		return first[a] < first[b];
+	return max_off[a] >= zone_cap && max_off[b] < zone_cap;
+}
+
+/*
+ * Rebuild the log trees of @log_type from its log zones at mount, calling
+ * @replay on every valid block, older generation first. Each generation goes
+ * to its own tree, the ones before the current tree are merged later on.
+ *
+ * A log block carries the version of the checkpoint which wrote it, so a
+ * generation is valid up to the first block which is unwritten, older than
+ * its predecessor or newer than the mounted checkpoint. Once a zone holds
+ * blocks of a checkpoint which never committed, or is not written up to
+ * its write pointer, it cannot be appended to anymore: the next checkpoint
+ * then merges everything in the foreground and resets the logs. The same
+ * goes for generations which are not in ring order.
+ */
+int f2fs_replay_meta_log(struct f2fs_sb_info *sbi, int log_type,
+		int (*replay)(struct f2fs_sb_info *, void *, void *), void *data)
+{
+	static const char * const names[] = { "SIT", "NAT", "SSA" };
+	__u64 cp_ver = cur_cp_version(F2FS_CKPT(sbi));
+	int stripes = meta_log_stripes(sbi, log_type);
+	int gens = sbi->meta_log_gens;
+	block_t zone_cap = min_t(block_t, log_size(sbi),
+					meta_blks_zone_cap(sbi));
+	block_t written[MAX_META_LOG_GENS][MAX_META_LOG_STRIPES];
+	block_t total[MAX_META_LOG_GENS] = { 0 };
+	block_t max_off[MAX_META_LOG_GENS] = { 0 };
+	unsigned int scanned[MAX_META_LOG_GENS] = { 0 };
+	unsigned int nr_scanned = 0;
+	__u64 first[MAX_META_LOG_GENS] = { 0 }, last = 0, ver;
+	int order[MAX_META_LOG_GENS];
+	bool orphan = false, appendable = true, in_ring = true;
+	int i, used = 0, gen, cur, s, err;
+
+	for (gen = 0; gen < gens; gen++) {
+		for (s = 0; s < stripes; s++) {
+			block_t blkaddr = meta_log_blkaddr(sbi, log_type, gen, s);
+
+			err = f2fs_meta_zone_written(sbi, blkaddr,
+							&written[gen][s]);
+			if (err)
+				return err;
+			written[gen][s] = min(written[gen][s], zone_cap);
+			total[gen] += written[gen][s];
+			max_off[gen] = max(max_off[gen], written[gen][s]);
+			if (!written[gen][s])
+				continue;
+
+			err = read_meta_log_ver(sbi, log_type,
+					blkaddr + written[gen][s] - 1, &ver);
+			if (err)
+				return err;
+			if (ver > cp_ver)
+				orphan = true;
+		}
+		if (!written[gen][0])
+			continue;
+		err = read_meta_log_ver(sbi, log_type,
+				meta_log_blkaddr(sbi, log_type, gen, 0),
+				&first[gen]);
+		if (err)
+			return err;
+
+		/* oldest generation first */
+		for (i = used++; i > 0 &&
+			meta_log_older(first, max_off, zone_cap, gen,
+							order[i - 1]); i--)
+			order[i] = order[i - 1];
+		order[i] = gen;
+	}
+
+	/* the newest generation is the one being appended to */
+	cur = used ? order[used - 1] : 0;
+	/* a checkpoint filled it and switched to the next one */
+	if (max_off[cur] >= zone_cap && !total[next_log_gen(sbi, cur)])
+		cur = next_log_gen(sbi, cur);
+
+	/*
+	 * A clean umount without CP_LOG_PENDING_FLAG wrote the main area
+	 * and left the log zones stale, e.g. one by a kernel without logs.
+	 */
+	if (is_set_ckpt_flags(sbi, CP_LOG_MERGED_FLAG) ||
+			(is_set_ckpt_flags(sbi, CP_UMOUNT_FLAG) &&
+			!is_set_ckpt_flags(sbi, CP_LOG_PENDING_FLAG))) {
+		/* the main area is up to date, drop what is left in the log */
+		if (f2fs_readonly(sbi->sb) || f2fs_hw_is_readonly(sbi)) {
+			set_sbi_flag(sbi, SBI_NEED_LOG_MERGE);
+			return 0;
+		}
+		for (gen = 0; gen < gens; gen++) {
+			if (!total[gen])
+				continue;
+			err = reset_meta_log(sbi, log_type, gen);
+			if (err)
+				return err;
+		}
+		set_meta_log_cursor(sbi, log_type, 0, 0);
+		*log_tree_idx(sbi, log_type) = 0;
+		*log_tree_head(sbi, log_type) = 0;
+		return 0;
+	}
+
+	*log_tree_idx(sbi, log_type) = used ? order[0] : cur;
+	*log_tree_head(sbi, log_type) = *log_tree_idx(sbi, log_type);
+
+	for (i = 0; i < used; i++) {
+		unsigned int n;
+
+		gen = order[i];
+		if (gen != (order[0] + i) % gens)
+			in_ring = false;
+		if (i)
+			switch_replayed_log_tree(sbi, log_type);
+
+		for (n = 0; ; n++) {
+			block_t off = n / stripes;
+			struct page *page;
+
+			s = n % stripes;
+			if (off >= written[gen][s])
+				break;
+
+			if (!s && !(off % BIO_MAX_VECS)) {
+				if (off)
+					meta_log_pages(sbi, log_type, gen,
+						written[gen], off - BIO_MAX_VECS,
+						BIO_MAX_VECS, true);
+				meta_log_pages(sbi, log_type, gen, written[gen],
+						off, BIO_MAX_VECS, false);
+			}
+
+			page = f2fs_get_meta_page(sbi,
+				meta_log_blkaddr(sbi, log_type, gen, s) + off);
+			if (IS_ERR(page)) {
+				err = PTR_ERR(page);
+				goto drop;
+			}
+			ver = meta_log_cp_ver(log_type, page_address(page));
+			if (!ver || ver < last || ver > cp_ver) {
+				f2fs_put_page(page, 1);
+				break;
+			}
+			last = ver;
+
+			err = replay(sbi, page_address(page), data);
+			f2fs_put_page(page, 1);
+			if (err)
+				goto drop;
+			scanned[gen]++;
+		}
+		meta_log_pages(sbi, log_type, gen, written[gen], 0,
+						zone_cap, true);
+		nr_scanned += scanned[gen];
+	}
+	/* appends go to a fresh zone */
+	if (used && cur != order[used - 1])
+		switch_replayed_log_tree(sbi, log_type);
+
+	/* appends go to the write pointer of every stripe zone */
+	for (s = 0; s < stripes; s++)
+		if (written[cur][s] != (scanned[cur] + stripes - 1 - s) / stripes)
+			appendable = false;
+
+	if (orphan || !appendable || !in_ring) {
+		f2fs_notice(sbi, "%s log is not appendable, merge it in next checkpoint",
+							names[log_type]);
+		set_sbi_flag(sbi, SBI_NEED_LOG_MERGE);
+		set_meta_log_cursor(sbi, log_type, cur, 0);
+	} else {
+		set_meta_log_cursor(sbi, log_type, cur, scanned[cur]);
+	}
+
+	/* every tree but the current one waits for a merge */
+	if (*log_tree_head(sbi, log_type) != *log_tree_idx(sbi, log_type))
+		sbi->replayed_merge |= log_merge_flag[log_type];
+
+	if (nr_scanned)
+		f2fs_info(sbi, "Replayed %u %s log blocks, version = %llx",
+			nr_scanned, names[log_type], last);
+	return 0;
+drop:
+	meta_log_pages(sbi, log_type, gen, written[gen], 0, zone_cap, true);
+	return err;
+}
+
+/* hand the trees switched out by log replay to the merge thread */
+void f2fs_start_replayed_merge(struct f2fs_sb_info *sbi)
+{
+	if (!sbi->replayed_merge)
+		return;
+
+	if (sbi->merge_thread && !is_sbi_flag_set(sbi, SBI_NEED_LOG_MERGE)) {
+		set_ckpt_flags(sbi, sbi->replayed_merge);
+		f2fs_wake_up_merge(sbi);
+	} else
+		set_sbi_flag(sbi, SBI_NEED_LOG_MERGE);
+	sbi->replayed_merge = 0;
+}
+
+static int merge_log_tree(struct f2fs_sb_info *sbi, int type, int fg)
+{
+	int err;
+
+	if (type == SSA_LOG) {
+		err = merge_ssa(sbi, fg);
+	} else if (type == NAT_LOG) {
+		err = merge_nat(sbi, fg);
+	} else {
+		err = merge_sit(sbi, fg);
+	}
+	return err;
+}
+
+/*
+ * Merge log trees in the checkpoint which sets CP_LOG_MERGED_FLAG. @fg picks
+ * the current trees, otherwise every tree from the head of the ring up to
+ * the current one, oldest first.
+ */
+int f2fs_merge_log_trees(struct f2fs_sb_info *sbi, int fg)
+{
+	static const int order[] = { SSA_LOG, NAT_LOG, SIT_LOG };
+	int i, type, err = 0;
+
+	if (fg) {
+		for (i = 0; i < ARRAY_SIZE(order) && !err; i++) {
+			type = order[i];
+			if (!log_tree_empty(sbi, type, *log_tree_idx(sbi, type)))
+				err = merge_log_tree(sbi, type, 1);
+		}
+		f2fs_submit_merged_write(sbi, META);
+		return err;
+	}
+
+	mutex_lock(&sbi->merge_mutex);
+	for (i = 0; i < ARRAY_SIZE(order) && !err; i++) {
+		unsigned int *head;
+
+		type = order[i];
+		head = log_tree_head(sbi, type);
+		while (*head != *log_tree_idx(sbi, type)) {
+			if (!log_tree_empty(sbi, type, *head)) {
+				err = merge_log_tree(sbi, type, 0);
+				if (err)
+					break;
+			}
+			*head = next_log_gen(sbi, *head);
+		}
+		if (!err)
+			clear_ckpt_flags(sbi, LOG_MERGE_FLAGS(type));
+	}
+	f2fs_submit_merged_write(sbi, META);
+	mutex_unlock(&sbi->merge_mutex);
+	return err;
+}
+
+/* start every log afresh, nothing in there is newer than the main area */
+int f2fs_reset_meta_logs(struct f2fs_sb_info *sbi)
+{
+	int type, gen, err = 0;
+
+	mutex_lock(&sbi->merge_mutex);
+	for (type = SIT_LOG; type <= SSA_LOG; type++) {
+		for (gen = 0; gen < sbi->meta_log_gens; gen++) {
+			err = reset_meta_log(sbi, type, gen);
+			if (err)
+				goto out;
+		}
+		set_meta_log_cursor(sbi, type, 0, 0);
+		*log_tree_idx(sbi, type) = 0;
+		*log_tree_head(sbi, type) = 0;
+	}
+out:
+	mutex_unlock(&sbi->merge_mutex);
+	return err;
+}
+#endif /* DELAYED_MERGE */
 #endif
@@ -44,10 +44,36 @@ static struct bio_set f2fs_bioset;
 
 #define	F2FS_BIO_POOL_SIZE	NR_CURSEG_TYPE
 
+#if ZF2FS_MONITOR
+/* front pad of f2fs bios: which log a write bio feeds, and when it left */
+struct f2fs_bio_stamp {
+	u64 submit_ns;
+	int log;
+	struct bio bio;
+};
+#define F2FS_BIO_FRONT_PAD	offsetof(struct f2fs_bio_stamp, bio)
+
+static inline struct f2fs_bio_stamp *f2fs_bio_stamp(struct bio *bio)
+{
+	return container_of(bio, struct f2fs_bio_stamp, bio);
+}
+
+static int f2fs_bio_log(struct f2fs_io_info *fio)
+{
+	if (fio->type == DATA)
+		return CURSEG_HOT_DATA + fio->temp;
+	if (fio->type == NODE)
+		return CURSEG_HOT_NODE + fio->temp;
+	return -1;
+}
+#else
+#define F2FS_BIO_FRONT_PAD	0
+#endif
+
 int __init f2fs_init_bioset(void)
 {
 	if (bioset_init(&f2fs_bioset, F2FS_BIO_POOL_SIZE,
-					0, BIOSET_NEED_BVECS))
+					F2FS_BIO_FRONT_PAD, BIOSET_NEED_BVECS))
 		return -ENOMEM;
 	return 0;
 }
@@ -332,6 +358,11 @@ static void f2fs_write_end_io(struct bio *bio)
 
 	iostat_update_and_unbind_ctx(bio, 1);
 	sbi = bio->bi_private;
+#if ZF2FS_MONITOR
+	if (f2fs_bio_stamp(bio)->log >= 0)
+		f2fs_stripe_stat_end(sbi, f2fs_bio_stamp(bio)->log,
+					f2fs_bio_stamp(bio)->submit_ns);
+#endif
 
 	if (time_to_inject(sbi, FAULT_WRITE_IO)) {
 		f2fs_show_injection_info(sbi, FAULT_WRITE_IO);
@@ -401,6 +432,133 @@ static void f2fs_write_end_io(struct bio *bio)
 	bio_put(bio);
 }
 
+#ifdef CONFIG_BLK_DEV_ZONED
+/*
+ * A Zone Append completes with the sector picked by the device. Zones of an
+ * appended log take nothing but appends of blocks allocated to them, and a
+ * section left in the middle of a segment is closed rather than written on
+ * past the hole, so the pages of a zone only swap addresses among
+ * themselves and the valid bits in SIT stay right: point each dnode and
+ * summary entry at where its page landed, then end writeback as usual.
+ */
+static void f2fs_append_end_io(struct bio *bio)
+{
+	struct f2fs_sb_info *sbi = F2FS_P_SB(bio_first_page_all(bio));
+	unsigned long flags;
+
+#if ZF2FS_MONITOR
+	/* the device is done, the fixup below is not part of its latency */
+	if (f2fs_bio_stamp(bio)->log >= 0) {
+		f2fs_stripe_stat_end(sbi, f2fs_bio_stamp(bio)->log,
+					f2fs_bio_stamp(bio)->submit_ns);
+		f2fs_bio_stamp(bio)->log = -1;
+	}
+#endif
+	spin_lock_irqsave(&sbi->zone_append_lock, flags);
+	bio_list_add(&sbi->zone_append_bios, bio);
+	spin_unlock_irqrestore(&sbi->zone_append_lock, flags);
+
+	queue_work(sbi->zone_append_wq, &sbi->zone_append_work);
+}
+
+static block_t f2fs_append_blkaddr(struct f2fs_sb_info *sbi, struct bio *bio)
+{
+	block_t blkaddr = SECTOR_TO_BLOCK(bio->bi_iter.bi_sector);
+	int i;
+
+	for (i = 0; i < sbi->s_ndevs; i++)
+		if (FDEV(i).bdev == bio->bi_bdev)
+			return blkaddr + FDEV(i).start_blk;
+	return blkaddr;
+}
+
+static void f2fs_fixup_append_page(struct f2fs_sb_info *sbi,
+				struct page *page, block_t blkaddr)
+{
+	struct dnode_of_data dn;
+	struct node_info ni;
+	struct f2fs_summary sum;
+
+	set_new_dnode(&dn, page->mapping->host, NULL, NULL, 0);
+	if (f2fs_get_dnode_of_data(&dn, page->index, LOOKUP_NODE))
+		goto fsck;
+
+	if (dn.data_blkaddr == blkaddr)
+		goto out;
+	if (dn.data_blkaddr >> sbi->log_blocks_per_blkz !=
+				blkaddr >> sbi->log_blocks_per_blkz ||
+			f2fs_get_node_info(sbi, dn.nid, &ni, false)) {
+		f2fs_put_dnode(&dn);
+		goto fsck;
+	}
+
+	set_summary(&sum, dn.nid, dn.ofs_in_node, ni.version);
+	f2fs_update_sum_entry(sbi, blkaddr, &sum);
+	f2fs_update_data_blkaddr(&dn, blkaddr);
+out:
+	f2fs_put_dnode(&dn);
+	return;
+fsck:
+	f2fs_warn(sbi, "%s: ino %lu page %lu appended at %u lost its address",
+			__func__, page->mapping->host->i_ino, page->index,
+			blkaddr);
+	set_sbi_flag(sbi, SBI_NEED_FSCK);
+}
+
+static void f2fs_zone_append_work(struct work_struct *work)
+{
+	struct f2fs_sb_info *sbi = container_of(work, struct f2fs_sb_info,
+							zone_append_work);
+	struct bio_list bios;
+	struct bio *bio;
+
+	spin_lock_irq(&sbi->zone_append_lock);
+	bios = sbi->zone_append_bios;
+	bio_list_init(&sbi->zone_append_bios);
+	spin_unlock_irq(&sbi->zone_append_lock);
+
+	while ((bio = bio_list_pop(&bios))) {
+		block_t blkaddr = f2fs_append_blkaddr(sbi, bio);
+		struct bio_vec *bvec;
+		struct bvec_iter_all iter_all;
+		int nr_pages = 0;
+
+		f2fs_lock_op(sbi);
+		bio_for_each_segment_all(bvec, bio, iter_all) {
+			if (!bio->bi_status)
+				f2fs_fixup_append_page(sbi, bvec->bv_page,
+							blkaddr + nr_pages);
+			nr_pages++;
+		}
+		f2fs_unlock_op(sbi);
+
+		f2fs_write_end_io(bio);
+
+		if (atomic_sub_and_test(nr_pages, &sbi->zone_appending))
+			wake_up_all(&sbi->zone_append_wait);
+	}
+}
+
+/* start the appended bio at its zone, and fix it up on completion */
+static void f2fs_init_append_bio(struct f2fs_sb_info *sbi, struct bio *bio)
+{
+	bio->bi_iter.bi_sector &= ~((sector_t)bdev_zone_sectors(bio->bi_bdev) - 1);
+	bio->bi_end_io = f2fs_append_end_io;
+}
+#endif
+
+#if ZF2FS_MONITOR
+/* write bios from __bio_alloc(), other bios have no stamp */
+static bool f2fs_bio_stamped(struct bio *bio)
+{
+#ifdef CONFIG_BLK_DEV_ZONED
+	if (bio->bi_end_io == f2fs_append_end_io)
+		return true;
+#endif
+	return bio->bi_end_io == f2fs_write_end_io;
+}
+#endif
+
 struct block_device *f2fs_target_device(struct f2fs_sb_info *sbi,
 				block_t blk_addr, struct bio *bio)
 {
@@ -454,6 +612,9 @@ static struct bio *__bio_alloc(struct f2fs_io_info *fio, int npages)
 		bio->bi_write_hint = f2fs_io_type_to_rw_hint(sbi,
 						fio->type, fio->temp);
 	}
+#if ZF2FS_MONITOR
+	f2fs_bio_stamp(bio)->log = is_read_io(fio->op) ? -1 : f2fs_bio_log(fio);
+#endif
 	iostat_alloc_and_bind_ctx(sbi, bio, NULL);
 
 	if (fio->io_wbc)
@@ -540,6 +701,12 @@ submit_io:
 	if(bio && bio->bi_private){
 		iostat_update_submit_ctx(bio, type);
 	}
+#if ZF2FS_MONITOR
+	if (f2fs_bio_stamped(bio) && f2fs_bio_stamp(bio)->log >= 0) {
+		f2fs_bio_stamp(bio)->submit_ns = ktime_get_ns();
+		f2fs_stripe_stat_submit(sbi, f2fs_bio_stamp(bio)->log);
+	}
+#endif
 	submit_bio(bio);
 }
 
@@ -577,24 +744,105 @@ static void __attach_io_flag(struct f2fs_io_info *fio)
 		fio->op_flags |= REQ_FUA;
 }
 
-static void __submit_merged_bio(struct f2fs_bio_info *io)
+static void __submit_io_bio(struct f2fs_sb_info *sbi, struct bio *bio,
+					struct f2fs_io_info *fio)
 {
-	struct f2fs_io_info *fio = &io->fio;
-
-	if (!io->bio)
-		return;
-
 	__attach_io_flag(fio);
-	bio_set_op_attrs(io->bio, fio->op, fio->op_flags);
+	bio_set_op_attrs(bio, fio->op, fio->op_flags);
 
 	if (is_read_io(fio->op))
-		trace_f2fs_prepare_read_bio(io->sbi->sb, fio->type, io->bio);
+		trace_f2fs_prepare_read_bio(sbi->sb, fio->type, bio);
 	else
-		trace_f2fs_prepare_write_bio(io->sbi->sb, fio->type, io->bio);
+		trace_f2fs_prepare_write_bio(sbi->sb, fio->type, bio);
+
+	__submit_bio(sbi, bio, fio->type);
+}
+
+static void __submit_merged_bio(struct f2fs_bio_info *io)
+{
+	if (!io->bio)
+		return;
 
-	__submit_bio(io->sbi, io->bio, fio->type);
+	__submit_io_bio(io->sbi, io->bio, &io->fio);
 	io->bio = NULL;
 }
+
+#if STRIPE
+/*
+ * A striped log rotates its cursor across many zones, so the next block
+ * rarely follows io->bio. Instead of submitting it, park the bio of the zone
+ * being left and pick up the one parked for the zone being entered. A zone
+ * owns at most one bio at a time, so its writes still go out in order.
+ */
+static unsigned int __zone_bio_key(struct f2fs_sb_info *sbi, block_t blkaddr)
+{
+#if META_LOG_STRIPE
+	/* striped metadata logs, see next_log_addr() */
+	if (blkaddr < MAIN_BLKADDR(sbi))
+		return (blkaddr - SEG0_BLKADDR(sbi)) / sbi->blocks_per_blkz;
+#endif
+	return (blkaddr - SEG0_BLKADDR(sbi)) /
+			(BLKS_PER_SEC(sbi) / stripe_unit_zones(sbi));
+}
+
+static void __drop_zone_bio(struct f2fs_bio_info *io, unsigned int i)
+{
+	io->nr_zbios--;
+	memmove(&io->zbios[i], &io->zbios[i + 1],
+			(io->nr_zbios - i) * sizeof(struct f2fs_zone_bio));
+}
+
+static void __submit_zone_bios(struct f2fs_bio_info *io)
+{
+	unsigned int i;
+
+	for (i = 0; i < io->nr_zbios; i++)
+		__submit_io_bio(io->sbi, io->zbios[i].bio, &io->zbios[i].fio);
+	io->nr_zbios = 0;
+}
+
+/* return true if io->bio was replaced by another one or parked */
+static bool __switch_zone_bio(struct f2fs_bio_info *io, block_t blkaddr)
+{
+	struct f2fs_sb_info *sbi = io->sbi;
+	unsigned int zone = __zone_bio_key(sbi, blkaddr);
+	struct f2fs_zone_bio *zb;
+	unsigned int i;
+	bool switched = false;
+
+	if (!io->zbios)
+		return false;
+
+	if (io->bio) {
+		if (__zone_bio_key(sbi, io->last_block_in_bio) == zone)
+			return false;
+
+		/* evict the zone parked longest ago */
+		if (io->nr_zbios == STRIPE_ZONE_BIOS) {
+			__submit_io_bio(sbi, io->zbios[0].bio, &io->zbios[0].fio);
+			__drop_zone_bio(io, 0);
+		}
+		zb = &io->zbios[io->nr_zbios++];
+		zb->bio = io->bio;
+		zb->last_block_in_bio = io->last_block_in_bio;
+		zb->fio = io->fio;
+		io->bio = NULL;
+		switched = true;
+	}
+
+	for (i = 0; i + switched < io->nr_zbios; i++) {
+		zb = &io->zbios[i];
+		if (__zone_bio_key(sbi, zb->last_block_in_bio) != zone)
+			continue;
+		io->bio = zb->bio;
+		io->last_block_in_bio = zb->last_block_in_bio;
+		io->fio = zb->fio;
+		__drop_zone_bio(io, i);
+		return true;
+	}
+	return switched;
+}
+#endif
 static bool __has_merged_page(struct bio *bio, struct inode *inode,
 						struct page *page, nid_t ino)
 {
@@ -632,6 +880,19 @@ static bool __has_merged_page(struct bio *bio, struct inode *inode,
 	return false;
 }
 
+#if STRIPE
+static bool __has_merged_zone_page(struct f2fs_bio_info *io,
+			struct inode *inode, struct page *page, nid_t ino)
+{
+	unsigned int i;
+
+	for (i = 0; i < io->nr_zbios; i++)
+		if (__has_merged_page(io->zbios[i].bio, inode, page, ino))
+			return true;
+	return false;
+}
+#endif
+
 static void __f2fs_submit_merged_write(struct f2fs_sb_info *sbi,
 				enum page_type type, enum temp_type temp)
 {
@@ -660,6 +921,9 @@ static void __f2fs_submit_merged_write(struct f2fs_sb_info *sbi,
 			io->fio.op_flags |= REQ_PREFLUSH | REQ_FUA;
 	}
 	__submit_merged_bio(io);
+#if STRIPE
+	__submit_zone_bios(io);
+#endif
 	up_write(&io->io_rwsem);
 }
 
@@ -677,6 +941,10 @@ static void __submit_merged_write_cond(struct f2fs_sb_info *sbi,
 
 			down_read(&io->io_rwsem);
 			ret = __has_merged_page(io->bio, inode, page, ino);
+#if STRIPE
+			if (!ret)
+				ret = __has_merged_zone_page(io, inode, page, ino);
+#endif
 			up_read(&io->io_rwsem);
 		}
 		if (ret)
@@ -784,6 +1052,20 @@ static bool io_is_mergeable(struct f2fs_sb_info *sbi, struct bio *bio,
 					block_t last_blkaddr,
 					block_t cur_blkaddr)
 {
+#ifdef CONFIG_BLK_DEV_ZONED
+	/* the device picks the sector, any block of the same zone will do */
+	if (fio->op == REQ_OP_ZONE_APPEND) {
+		if (F2FS_BYTES_TO_BLK(bio->bi_iter.bi_size) >=
+						sbi->zone_append_blocks)
+			return false;
+		if (last_blkaddr >> sbi->log_blocks_per_blkz !=
+				cur_blkaddr >> sbi->log_blocks_per_blkz)
+			return false;
+		if (bio->bi_bdev != f2fs_target_device(sbi, cur_blkaddr, NULL))
+			return false;
+		return io_type_is_mergeable(io, fio);
+	}
+#endif
 	if (F2FS_IO_ALIGNED(sbi) && (fio->type == DATA || fio->type == NODE)) {
 		unsigned int filled_blocks =
 				F2FS_BYTES_TO_BLK(bio->bi_iter.bi_size);
@@ -1017,14 +1299,25 @@ next:
 	inc_page_count(sbi, type);
 #else
 	inc_page_count(sbi, WB_DATA_TYPE(bio_page));
+#endif
+#if STRIPE
+merge:
 #endif
 	if (io->bio &&
 	    (!io_is_mergeable(sbi, io->bio, io, fio, io->last_block_in_bio,
 			      fio->new_blkaddr) ||
 	     !f2fs_crypt_mergeable_bio(io->bio, fio->page->mapping->host,
 				       bio_page->index, fio))){
+#if STRIPE
+		if (__switch_zone_bio(io, fio->new_blkaddr))
+			goto merge;
+#endif
 		__submit_merged_bio(io);
 	}
+#if STRIPE
+	if (!io->bio && __switch_zone_bio(io, fio->new_blkaddr))
+		goto merge;
+#endif
 alloc_new:
 	if (io->bio == NULL) {
 		if (F2FS_IO_ALIGNED(sbi) &&
@@ -1035,6 +1328,10 @@ alloc_new:
 			goto skip;
 		}
 		io->bio = __bio_alloc(fio, BIO_MAX_VECS);
+#ifdef CONFIG_BLK_DEV_ZONED
+		if (fio->op == REQ_OP_ZONE_APPEND)
+			f2fs_init_append_bio(sbi, io->bio);
+#endif
 		f2fs_set_bio_crypt_ctx(io->bio, fio->page->mapping->host,
 				       bio_page->index, fio, GFP_NOIO);
 		io->fio = *fio;
@@ -1044,6 +1341,10 @@ alloc_new:
 		__submit_merged_bio(io);
 		goto alloc_new;
 	}
+#ifdef CONFIG_BLK_DEV_ZONED
+	if (fio->op == REQ_OP_ZONE_APPEND)
+		atomic_inc(&sbi->zone_appending);
+#endif
 
 	if (fio->io_wbc)
 		wbc_account_cgroup_owner(fio->io_wbc, bio_page, PAGE_SIZE);
@@ -1056,8 +1357,12 @@ skip:
 		goto next;
 out:
 	if (is_sbi_flag_set(sbi, SBI_IS_SHUTDOWN) ||
-				!f2fs_is_checkpoint_ready(sbi))
+				!f2fs_is_checkpoint_ready(sbi)) {
 		__submit_merged_bio(io);
+#if STRIPE
+		__submit_zone_bios(io);
+#endif
+	}
 	up_write(&io->io_rwsem);
 }
 
@@ -4107,6 +4412,43 @@ void f2fs_destroy_post_read_wq(struct f2fs_sb_info *sbi)
 		destroy_workqueue(sbi->post_read_wq);
 }
 
+#ifdef CONFIG_BLK_DEV_ZONED
+int f2fs_init_zone_append(struct f2fs_sb_info *sbi)
+{
+	atomic_set(&sbi->zone_appending, 0);
+	init_waitqueue_head(&sbi->zone_append_wait);
+	spin_lock_init(&sbi->zone_append_lock);
+	bio_list_init(&sbi->zone_append_bios);
+	INIT_WORK(&sbi->zone_append_work, f2fs_zone_append_work);
+
+	if (!test_opt(sbi, ZONE_APPEND))
+		return 0;
+
+	/* writeback of data pages waits for it */
+	sbi->zone_append_wq = alloc_workqueue("f2fs_zone_append_wq",
+					WQ_UNBOUND | WQ_MEM_RECLAIM, 0);
+	if (!sbi->zone_append_wq)
+		return -ENOMEM;
+	return 0;
+}
+
+void f2fs_destroy_zone_append(struct f2fs_sb_info *sbi)
+{
+	if (sbi->zone_append_wq)
+		destroy_workqueue(sbi->zone_append_wq);
+}
+
+/* submit the pending appends and wait until their dnodes point at them */
+void f2fs_wait_zone_appends(struct f2fs_sb_info *sbi)
+{
+	if (!atomic_read(&sbi->zone_appending))
+		return;
+	f2fs_submit_merged_write(sbi, DATA);
+	wait_event(sbi->zone_append_wait,
+			!atomic_read(&sbi->zone_appending));
+}
+#endif
+
 int __init f2fs_init_bio_entry_cache(void)
 {
 	bio_entry_slab = f2fs_kmem_cache_create("f2fs_bio_entry_slab",
@@ -26,6 +26,69 @@ static DEFINE_RAW_SPINLOCK(f2fs_stat_lock);
 static struct dentry *f2fs_debugfs_root;
 #endif
 
+#if GC_VICTIM_INDEX
+/* fold the buckets of the GC victim index into valid ratio ranges */
+static void update_victim_index_info(struct f2fs_sb_info *sbi,
+					struct f2fs_stat_info *si)
+{
+	struct victim_index *vi = &DIRTY_I(sbi)->victim_index;
+	unsigned int i;
+
+	memset(si->victim_index_hist, 0, sizeof(si->victim_index_hist));
+	si->victim_index_secs = 0;
+	if (!vi->buckets)
+		return;
+	for (i = 0; i < vi->nr_buckets; i++) {
+		si->victim_index_hist[i * VICTIM_INDEX_HIST_BUCKETS /
+					vi->nr_buckets] += vi->bucket_cnt[i];
+		si->victim_index_secs += vi->bucket_cnt[i];
+	}
+}
+#endif
+#if ZF2FS_MONITOR
+static const char *stripe_log_name[NR_PERSISTENT_LOG] = {
+	"HOT    data", "WARM   data", "COLD   data",
+	"Dir   dnode", "File  dnode", "Indir nodes",
+};
+#endif
+#if DELAYED_MERGE
+static const char *merge_log_name[SSA_LOG + 1] = {
+	[SIT_LOG] = "SIT", [NAT_LOG] = "NAT", [SSA_LOG] = "SSA",
+};
+
+/* bucket the merged zones of each log by how dirty their last merge was */
+static void update_meta_zone_info(struct f2fs_sb_info *sbi,
+					struct f2fs_stat_info *si)
+{
+	unsigned int zone_cap = meta_blks_zone_cap(sbi);
+	int type;
+
+	memset(si->meta_zone_hist, 0, sizeof(si->meta_zone_hist));
+	for (type = SIT_LOG; type <= SSA_LOG; type++) {
+		struct meta_zone_stat *zs = sbi->meta_zone_stat[type];
+		unsigned long long total_age = 0;
+		unsigned int i, merged = 0, max_age = 0;
+
+		for (i = 0; zs && i < sbi->nr_meta_zones[type]; i++) {
+			unsigned int b;
+
+			if (!zs[i].merges)
+				continue;
+			b = zs[i].dirty * META_ZONE_HIST_BUCKETS / zone_cap;
+			si->meta_zone_hist[type][min_t(unsigned int, b,
+					META_ZONE_HIST_BUCKETS - 1)]++;
+			total_age += zs[i].age;
+			max_age = max(max_age, zs[i].age);
+			merged++;
+		}
+		si->meta_zones_merged[type] = merged;
+		si->meta_zone_avg_age[type] = merged ?
+					div_u64(total_age, merged) : 0;
+		si->meta_zone_max_age[type] = max_age;
+	}
+}
+#endif
+
 /*
  * This function calculates BDF of every segments
  */
@@ -185,6 +248,21 @@ static void update_general_status(struct f2fs_sb_info *sbi)
 		si->curzone[i] = GET_ZONE_FROM_SEC(sbi, si->cursec[i]);
 	}
 
+#if ZF2FS_MONITOR
+	for (i = 0; i < NR_PERSISTENT_LOG; i++) {
+		si->stripe_width[i] = CURSEG_I(sbi, i)->wanted_size;
+		si->stripe_lat_us[i] = sbi->stripe_stat[i].lat_us;
+		si->stripe_qd[i] = sbi->stripe_stat[i].qd;
+	}
+#endif
+#if DELAYED_MERGE
+	memcpy(si->merge_stat, sbi->merge_stat, sizeof(si->merge_stat));
+	update_meta_zone_info(sbi, si);
+#endif
+#if GC_VICTIM_INDEX
+	update_victim_index_info(sbi, si);
+#endif
+
 	for (i = META_CP; i < META_MAX; i++)
 		si->meta_count[i] = atomic_read(&sbi->meta_count[i]);
 
@@ -448,6 +526,47 @@ static int stat_show(struct seq_file *s, void *v)
 			   si->curseg[CURSEG_ALL_DATA_ATGC],
 			   si->cursec[CURSEG_ALL_DATA_ATGC],
 			   si->curzone[CURSEG_ALL_DATA_ATGC]);
+#if ZF2FS_MONITOR
+		seq_printf(s, "\nStripe (%s):\n",
+			   F2FS_OPTION(si->sbi).stripe.ctrl == STRIPE_CTRL_FEEDBACK ?
+			   "feedback" : "threshold");
+		seq_printf(s, "    TYPE         %8s %8s %8s\n",
+			   "width", "lat(us)", "qd");
+		for (j = 0; j < NR_PERSISTENT_LOG; j++)
+			seq_printf(s, "  - %-11s: %8u %8u %8u\n",
+				   stripe_log_name[j], si->stripe_width[j],
+				   si->stripe_lat_us[j], si->stripe_qd[j]);
+#endif
+#if DELAYED_MERGE
+		seq_puts(s, "\nLog merge:\n");
+		seq_printf(s, "    TYPE  %8s %10s %10s %10s %10s\n",
+			   "count", "KB", "avg(us)", "last(us)", "max(us)");
+		for (j = SIT_LOG; j <= SSA_LOG; j++) {
+			struct f2fs_merge_stat *ms = &si->merge_stat[j];
+
+			seq_printf(s, "  - %s: %8llu %10llu %10llu %10u %10u\n",
+				   merge_log_name[j], ms->count, ms->bytes >> 10,
+				   ms->count ? div64_u64(ms->total_us, ms->count) : 0,
+				   ms->last_us, ms->max_us);
+		}
+		seq_puts(s, "\nMeta zones by dirty blocks of their last merge:\n");
+		seq_printf(s, "    TYPE  %6s %7s %7s  ", "merged", "avg age",
+			   "max age");
+		for (j = 0; j < META_ZONE_HIST_BUCKETS; j++)
+			seq_printf(s, " %3d%%", (j + 1) * 100 / META_ZONE_HIST_BUCKETS);
+		seq_putc(s, '\n');
+		for (j = SIT_LOG; j <= SSA_LOG; j++) {
+			int k;
+
+			seq_printf(s, "  - %s: %6u %7u %7u  ", merge_log_name[j],
+				   si->meta_zones_merged[j],
+				   si->meta_zone_avg_age[j],
+				   si->meta_zone_max_age[j]);
+			for (k = 0; k < META_ZONE_HIST_BUCKETS; k++)
+				seq_printf(s, " %4u", si->meta_zone_hist[j][k]);
+			seq_putc(s, '\n');
+		}
+#endif
 		seq_printf(s, "\n  - Valid: %d\n  - Dirty: %d\n",
 			   si->main_area_segs - si->dirty_count -
 			   si->prefree_count - si->free_segs,
@@ -483,6 +602,19 @@ static int stat_show(struct seq_file *s, void *v)
 				si->sbi->gc_reclaimed_segs[GC_IDLE_AT],
 				si->sbi->gc_reclaimed_segs[GC_URGENT_HIGH],
 				si->sbi->gc_reclaimed_segs[GC_URGENT_LOW]);
+#if GC_VICTIM_INDEX
+		if (si->victim_index_secs) {
+			seq_printf(s, "GC victim index: %u sections, by valid blocks:\n  ",
+				   si->victim_index_secs);
+			for (j = 0; j < VICTIM_INDEX_HIST_BUCKETS; j++)
+				seq_printf(s, " %3d%%", (j + 1) * 100 /
+						VICTIM_INDEX_HIST_BUCKETS);
+			seq_puts(s, "\n  ");
+			for (j = 0; j < VICTIM_INDEX_HIST_BUCKETS; j++)
+				seq_printf(s, " %4u", si->victim_index_hist[j]);
+			seq_putc(s, '\n');
+		}
+#endif
 		seq_printf(s, "Try to move %d blocks (BG: %d)\n", si->tot_blks,
 				si->bg_data_blks + si->bg_node_blks);
 		seq_printf(s, "  - data blocks : %d (%d)\n", si->data_blks,
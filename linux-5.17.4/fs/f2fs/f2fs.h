@@ -109,6 +109,7 @@ extern const char *f2fs_fault_name[FAULT_MAX];
 #define F2FS_MOUNT_NOBARRIER		0x00000800
 #define F2FS_MOUNT_FASTBOOT		0x00001000
 #define F2FS_MOUNT_EXTENT_CACHE		0x00002000
+#define F2FS_MOUNT_ZONE_APPEND		0x00004000
 #define F2FS_MOUNT_DATA_FLUSH		0x00008000
 #define F2FS_MOUNT_FAULT_INJECTION	0x00010000
 #define F2FS_MOUNT_USRQUOTA		0x00080000
@@ -123,6 +124,7 @@ extern const char *f2fs_fault_name[FAULT_MAX];
 #define F2FS_MOUNT_MERGE_CHECKPOINT	0x10000000
 #define	F2FS_MOUNT_GC_MERGE		0x20000000
 #define F2FS_MOUNT_COMPRESS_CACHE	0x40000000
+#define F2FS_MOUNT_FAST_UMOUNT		0x80000000
 
 #define F2FS_OPTION(sbi)	((sbi)->mount_opt)
 #define clear_opt(sbi, option)	(F2FS_OPTION(sbi).opt &= ~F2FS_MOUNT_##option)
@@ -141,6 +143,43 @@ typedef u32 nid_t;
 
 #define COMPRESS_EXT_NUM		16
 
+#if STRIPE
+enum {
+	STRIPE_CTRL_THRESH,	/* one zone per period on page thresholds */
+	STRIPE_CTRL_FEEDBACK,	/* jump to demand, back off on latency */
+	STRIPE_CTRL_MAX,
+};
+
+/* striping policy, set by mount options and tunable via sysfs */
+struct f2fs_stripe_policy {
+	unsigned int stripe_cnt;	/* static: zones of a warm log */
+	unsigned int max_cnt;		/* max zones (sections) per log */
+	unsigned int min_cnt;		/* min zones of a data log */
+	unsigned int opt;		/* static: stripe count per log type */
+	unsigned int zone_speed;	/* write speed of a zone in MB/s */
+	unsigned int max_open;		/* max zones (sections) of all logs,
+					 * 0: derived from the device */
+	unsigned int inc_thresh;	/* % of speed to widen a stripe */
+	unsigned int dec_thresh;	/* % of speed to narrow a stripe */
+	unsigned int probe_mb;		/* MB written to measure zone_speed */
+	unsigned int ctrl;		/* STRIPE_CTRL_* of the monitor */
+};
+#endif
+
+#if ZF2FS_MONITOR
+/* per-log write feedback, fed from the write end_io path */
+struct f2fs_stripe_stat {
+	atomic_t inflight;		/* write bios in flight */
+	atomic_t nr_bios;		/* bios completed in this period */
+	atomic64_t lat_sum;		/* their completion latency in ns */
+	atomic64_t qd_sum;		/* bios in flight seen at each submit */
+	/* published by the monitor thread every period */
+	unsigned int lat_us;		/* average latency */
+	unsigned int lat_base_us;	/* uncongested latency, slowly decays */
+	unsigned int qd;		/* average queue depth */
+};
+#endif
+
 struct f2fs_mount_info {
 	unsigned int opt;
 	int write_io_size_bits;		/* Write IO size bits */
@@ -184,6 +223,9 @@ struct f2fs_mount_info {
 	int compress_mode;			/* compression mode */
 	unsigned char extensions[COMPRESS_EXT_NUM][F2FS_EXTENSION_LEN];	/* extensions */
 	unsigned char noextensions[COMPRESS_EXT_NUM][F2FS_EXTENSION_LEN]; /* extensions */
+#if STRIPE
+	struct f2fs_stripe_policy stripe;	/* For striping */
+#endif
 };
 
 #define F2FS_FEATURE_ENCRYPT		0x0001
@@ -268,6 +310,9 @@ enum {
 	META_SSA,
 	META_MAX,
 	META_POR,
+#if META_FOR_ZNS
+	META_LOG,		/* raw blocks of the metadata area */
+#endif
 	DATA_GENERIC,		/* check range only */
 	DATA_GENERIC_ENHANCE,	/* strong check on range and segment bitmap */
 	DATA_GENERIC_ENHANCE_READ,	/*
@@ -377,6 +422,15 @@ struct discard_cmd {
 	unsigned short bio_ref;		/* bio reference count */
 };
 
+#ifdef CONFIG_BLK_DEV_ZONED
+/* asynchronous FINISH/RESET of a range of zones */
+struct zone_mgmt_cmd {
+	struct f2fs_sb_info *sbi;
+	enum req_opf op;		/* REQ_OP_ZONE_FINISH or _RESET */
+	unsigned int segno;		/* section released on FINISH */
+};
+#endif
+
 enum {
 	DPOLICY_BG,
 	DPOLICY_FORCE,
@@ -833,6 +887,9 @@ struct f2fs_inode_info {
 	unsigned char i_compress_level;		/* compress level (lz4hc,zstd) */
 	unsigned short i_compress_flag;		/* compress flag */
 	unsigned int i_cluster_size;		/* cluster size */
+#if LIFE_LOG
+	unsigned int i_data_life;	/* avg. life of overwritten blocks (s) */
+#endif
 };
 
 static inline void get_extent_info(struct extent_info *ext,
@@ -942,8 +999,9 @@ struct f2fs_nm_info {
 	int nat_blks_in_log; /* number of nat entries in current log block */
 	int cur_nat_log;
 #if DELAYED_MERGE
-	struct radix_tree_root nat_log_root[2];	/* in-mem cached nat log blocks */
+	struct radix_tree_root nat_log_root[MAX_META_LOG_GENS];	/* in-mem cached nat log blocks */
 	unsigned int nat_ltree_idx;				/* current sit log tree index */
+	unsigned int nat_ltree_head;			/* oldest tree not merged yet */
 	struct rw_semaphore nat_ltree_slock; /* locking log tree switch */
 #else
 	struct radix_tree_root nat_log_root;
@@ -1031,10 +1089,21 @@ static inline void set_new_dnode(struct dnode_of_data *dn, struct inode *inode,
  */
 #define	NR_CURSEG_DATA_TYPE	(3)
 #define NR_CURSEG_NODE_TYPE	(3)
+#if GC_LOG
+#define NR_CURSEG_INMEM_TYPE	(3)
+#else
 #define NR_CURSEG_INMEM_TYPE	(2)
+#endif
+#if LIFE_LOG
+/* the data logs the on-disk layout covers beyond hot/warm/cold */
+#define NR_CURSEG_LIFE_TYPE	(MAX_ACTIVE_DATA_LOGS - NR_CURSEG_DATA_TYPE)
+#else
+#define NR_CURSEG_LIFE_TYPE	(0)
+#endif
 #define NR_CURSEG_RO_TYPE	(2)
 #define NR_CURSEG_PERSIST_TYPE	(NR_CURSEG_DATA_TYPE + NR_CURSEG_NODE_TYPE)
-#define NR_CURSEG_TYPE		(NR_CURSEG_INMEM_TYPE + NR_CURSEG_PERSIST_TYPE)
+#define NR_CURSEG_TYPE		(NR_CURSEG_INMEM_TYPE + NR_CURSEG_PERSIST_TYPE + \
+					NR_CURSEG_LIFE_TYPE)
 
 enum {
 	CURSEG_HOT_DATA	= 0,	/* directory entry blocks */
@@ -1047,6 +1116,20 @@ enum {
 	CURSEG_COLD_DATA_PINNED = NR_PERSISTENT_LOG,
 				/* pinned file that needs consecutive block address */
 	CURSEG_ALL_DATA_ATGC,	/* SSR alloctor in hot/warm/cold data area */
+#if GC_LOG
+	CURSEG_GC_DATA,		/* striped log of GCed data blocks */
+#endif
+#if LIFE_LOG
+	/*
+	 * data classes by lifetime, shortest first, between hot and warm;
+	 * kept in cur_data_segno[NR_CURSEG_DATA_TYPE..] of the checkpoint
+	 */
+	CURSEG_LIFE1_DATA,
+	CURSEG_LIFE2_DATA,
+	CURSEG_LIFE3_DATA,
+	CURSEG_LIFE4_DATA,
+	CURSEG_LIFE5_DATA,
+#endif
 	NO_CHECK_TYPE,		/* number of persistent & inmem log */
 };
 
@@ -1098,25 +1181,25 @@ struct f2fs_sm_info {
 	unsigned int sum_log_tree_entries;		/* the numbers of entries in log tree */
 
 #if DELAYED_MERGE
-	struct radix_tree_root sit_log_root[2];	/* in-mem cached sit log entries */
+	struct radix_tree_root sit_log_root[MAX_META_LOG_GENS];	/* in-mem cached sit log entries */
 	unsigned int sit_ltree_idx;				/* current sit log tree index */
+	unsigned int sit_ltree_head;			/* oldest tree not merged yet */
 	struct rw_semaphore sit_ltree_slock; /* locking log tree switch */
 
-	struct radix_tree_root ssa_log_root[2];	/* in-mem cached sum log blocks */
+	struct radix_tree_root ssa_log_root[MAX_META_LOG_GENS];	/* in-mem cached sum log blocks */
 	unsigned int cur_log_tree_idx;				/* current tree index */
-	struct rw_semaphore ssa_ltree_slock; /* locking log tree switch */
+	unsigned int ssa_ltree_head;			/* oldest tree not merged yet */
+	struct rw_semaphore ssa_ltree_slock; /* locking ssa zone and log tree switch */
 #else
 	struct radix_tree_root sit_log_root;	/* in-mem cached sit log entries */
 	struct radix_tree_root ssa_log_root;	/* in-mem cached sum log blocks */
 #endif
 #endif
 #if STRIPE
-	unsigned int stripe_cnt;	/* the number of zones to write for each log */
-  unsigned int stripe_max_cnt;
-  unsigned int stripe_min_cnt;
 #if GRID_STRIPE
   unsigned int grid_cnt;  /* the number of zones to grid stripe for a segment */
 #endif
+  unsigned int stripe_slots;  /* max sections open in a striped log */
 #endif
 
 	unsigned int segment_count;	/* total # of segments */
@@ -1295,6 +1378,15 @@ struct bio_entry {
 };
 
 #define is_read_io(rw) ((rw) == READ)
+#if STRIPE
+/* write bio parked while the cursor of a striped log is on another zone */
+struct f2fs_zone_bio {
+	struct bio *bio;
+	sector_t last_block_in_bio;
+	struct f2fs_io_info fio;
+};
+#endif
+
 struct f2fs_bio_info {
 	struct f2fs_sb_info *sbi;	/* f2fs superblock */
 	struct bio *bio;		/* bios to merge */
@@ -1305,6 +1397,10 @@ struct f2fs_bio_info {
 	struct list_head io_list;	/* track fios */
 	struct list_head bio_list;	/* bio entry list head */
 	struct rw_semaphore bio_list_lock;	/* lock to protect bio entry list */
+#if STRIPE
+	struct f2fs_zone_bio *zbios;	/* parked bios, oldest first */
+	unsigned int nr_zbios;		/* # of parked bios */
+#endif
 };
 
 #define FDEV(i)				(sbi->devs[i])
@@ -1367,6 +1463,7 @@ enum {
 	SBI_QUOTA_NEED_REPAIR,			/* quota file may be corrupted */
 	SBI_IS_RESIZEFS,			/* resizefs is in process */
 	SBI_IS_FREEZING,			/* freezefs is in process */
+	SBI_NEED_LOG_MERGE,			/* merge meta logs in next CP */
 };
 
 enum {
@@ -1667,6 +1764,54 @@ struct decompress_io_ctx {
 #define MAX_COMPRESS_LOG_SIZE		8
 #define MAX_COMPRESS_WINDOW_SIZE(log_size)	((PAGE_SIZE) << (log_size))
 
+#if META_FOR_ZNS
+/* background merges of one log, see f2fs_merge() */
+struct f2fs_merge_stat {
+	unsigned long long count;
+	unsigned long long bytes;
+	unsigned long long total_us;
+	unsigned int last_us;
+	unsigned int max_us;
+};
+
+/* merge history of one meta zone, see note_meta_zone_merges() */
+struct meta_zone_stat {
+	unsigned int dirty;		/* blocks merged by its last merge */
+	unsigned int merges;		/* # of merges of the zone */
+	unsigned int age;		/* merges of its log since its last one */
+};
+#define META_ZONE_HIST_BUCKETS	10	/* dirty ratio buckets in debugfs */
+/*
+ * A background merge lets a zone with under 1/META_ZONE_SPARSE_RATIO of
+ * its blocks dirty wait for a later generation, at most META_ZONE_MAX_DEFER
+ * merges in a row. Its entries are logged again, which may take up to
+ * 1/META_ZONE_DEFER_ROOM of the room left in the current log.
+ */
+#define META_ZONE_SPARSE_RATIO	16
+#define META_ZONE_MAX_DEFER	4
+#define META_ZONE_DEFER_ROOM	4
+
+/* one meta zone rewritten by a merge, see f2fs_merge_meta_zones() */
+struct meta_merge_unit {
+	struct f2fs_sb_info *sbi;
+	struct work_struct work;
+	struct list_head list;		/* units of one merge */
+	int type;			/* NAT, SIT or SSA */
+	unsigned int zone;		/* meta zone offset */
+	int foreground;
+	struct list_head sets;		/* log sets merged into the zone */
+	unsigned int nr_sets;		/* dirty blocks of the zone */
+	unsigned int nr_entries;	/* log entries merged into the zone */
+	int (*merge)(struct meta_merge_unit *unit);
+	struct bio *bio;		/* write bio of the zone */
+	block_t last_block;		/* last block in bio */
+	int err;
+	/* buffer of clean blocks carried over, see advance_meta_zone_wp() */
+	struct page *copy_pages[META_ZONE_COPY_BLKS];
+	int nr_copy_pages;
+};
+#endif
+
 struct f2fs_sb_info {
 	struct super_block *sb;			/* pointer to VFS super block */
 	struct proc_dir_entry *s_proc;		/* proc entry */
@@ -1679,6 +1824,26 @@ struct f2fs_sb_info {
 #ifdef CONFIG_BLK_DEV_ZONED
 	unsigned int blocks_per_blkz;		/* F2FS blocks per zone */
 	unsigned int log_blocks_per_blkz;	/* log2 F2FS blocks per zone */
+
+	/* for asynchronous zone management */
+	atomic_t zone_finishing;		/* FINISH commands in flight */
+	atomic_t zone_resetting;		/* RESET commands in flight */
+	int zone_reset_err;			/* first RESET error not waited */
+	wait_queue_head_t zone_mgmt_wait;
+
+	/* for Zone Append writes of data logs */
+	unsigned int zone_append_blocks;	/* max blocks in an append bio */
+	atomic_t zone_appending;		/* appended pages not fixed up */
+	wait_queue_head_t zone_append_wait;
+	spinlock_t zone_append_lock;		/* protects zone_append_bios */
+	struct bio_list zone_append_bios;	/* completed, to be fixed up */
+	struct work_struct zone_append_work;
+	struct workqueue_struct *zone_append_wq;
+#endif
+#if META_FOR_ZNS
+	/* for merging meta logs, one work per meta zone */
+	struct workqueue_struct *meta_merge_wq;
+	spinlock_t meta_merge_lock;		/* meta bitmaps, nat bits */
 #endif
 
 	/* for node-related operations */
@@ -1785,6 +1950,11 @@ struct f2fs_sb_info {
 	struct f2fs_gc_kthread	*gc_thread;	/* GC thread */
 	struct atgc_management am;		/* atgc management */
 	unsigned int cur_victim_sec;		/* current victim section num */
+#if PARALLEL_GC
+	struct workqueue_struct *gc_wq;		/* parallel FG_GC workers */
+	unsigned int gc_victim_secs[PARALLEL_GC_MAX];	/* taken by gc_wq */
+	spinlock_t gc_stat_lock;		/* GC counters updated by gc_wq */
+#endif
 	unsigned int gc_mode;			/* current GC state */
 	unsigned int next_victim_seg[2];	/* next segment in victim section */
 	spinlock_t gc_urgent_high_lock;
@@ -1913,12 +2083,36 @@ struct f2fs_sb_info {
 	struct iostat_lat_info *iostat_io_lat;
 #endif
 
+#if META_FOR_ZNS
+	unsigned int log_stripes[SSA_LOG + 1];	/* zones per log generation */
+#endif
 #if DELAYED_MERGE
 	struct task_struct *merge_thread;
+	wait_queue_head_t merge_wait_queue;	/* woken when a log is switched */
+	struct mutex merge_mutex;		/* one merge of a log tree at a time */
+	unsigned int meta_log_gens;		/* log zones of each metadata log */
+	unsigned int replayed_merge;		/* merge flags raised by log replay */
+	atomic64_t merged_blocks[SSA_LOG + 1];	/* written by merges per log */
+	struct f2fs_merge_stat merge_stat[SSA_LOG + 1];
+	struct meta_zone_stat *meta_zone_stat[SSA_LOG + 1];
+	unsigned int nr_meta_zones[SSA_LOG + 1];
 #endif
 #if ZF2FS_MONITOR
   struct task_struct *monitor_thread;
   int f2fs_open_zones;
+  /* blocks allocated per log, drained by monitor thread every period */
+  struct percpu_counter monitor_pages[NR_PERSISTENT_LOG];
+  /* victim sections collected, drained by monitor thread every period */
+  struct percpu_counter gc_monitor;
+#if GC_LOG
+  /* blocks migrated into CURSEG_GC_DATA, drained with the above */
+  struct percpu_counter gc_log_pages;
+#endif
+#if LIFE_LOG
+  /* blocks written per lifetime log, drained with the above */
+  struct percpu_counter life_log_pages[NR_CURSEG_LIFE_TYPE];
+#endif
+  struct f2fs_stripe_stat stripe_stat[NR_PERSISTENT_LOG];
 #endif
 };
 
@@ -2678,6 +2872,59 @@ static inline s64 valid_inode_count(struct f2fs_sb_info *sbi)
 	return percpu_counter_sum_positive(&sbi->total_valid_inode_count);
 }
 
+#if ZF2FS_MONITOR
+static inline void f2fs_monitor_inc_pages(struct f2fs_sb_info *sbi, int type)
+{
+	/* in-memory logs (pinned, ATGC) are not striped */
+	if (type < NR_PERSISTENT_LOG)
+		percpu_counter_inc(&sbi->monitor_pages[type]);
+#if GC_LOG
+	else if (type == CURSEG_GC_DATA)
+		percpu_counter_inc(&sbi->gc_log_pages);
+#endif
+#if LIFE_LOG
+	else if (type >= CURSEG_LIFE1_DATA)
+		percpu_counter_inc(
+			&sbi->life_log_pages[type - CURSEG_LIFE1_DATA]);
+#endif
+}
+
+static inline void f2fs_monitor_inc_gc(struct f2fs_sb_info *sbi)
+{
+	percpu_counter_inc(&sbi->gc_monitor);
+}
+
+/*
+ * Drain a monitor counter: return what was accumulated since the last call
+ * and subtract exactly that, so increments racing with the read are kept
+ * for the next period.
+ */
+static inline s64 f2fs_monitor_drain(struct percpu_counter *fbc)
+{
+	s64 val = percpu_counter_sum_positive(fbc);
+
+	percpu_counter_sub(fbc, val);
+	return val;
+}
+
+static inline void f2fs_stripe_stat_submit(struct f2fs_sb_info *sbi, int log)
+{
+	struct f2fs_stripe_stat *st = &sbi->stripe_stat[log];
+
+	atomic64_add(atomic_inc_return(&st->inflight), &st->qd_sum);
+}
+
+static inline void f2fs_stripe_stat_end(struct f2fs_sb_info *sbi, int log,
+							u64 submit_ns)
+{
+	struct f2fs_stripe_stat *st = &sbi->stripe_stat[log];
+
+	atomic_dec(&st->inflight);
+	atomic64_add(ktime_get_ns() - submit_ns, &st->lat_sum);
+	atomic_inc(&st->nr_bios);
+}
+#endif
+
 static inline struct page *f2fs_grab_cache_page(struct address_space *mapping,
 						pgoff_t index, bool for_write)
 {
@@ -3595,6 +3842,9 @@ int __init f2fs_create_node_manager_caches(void);
 void f2fs_destroy_node_manager_caches(void);
 #if META_FOR_ZNS
 int merge_nat(struct f2fs_sb_info *sbi, int foreground);
+#if DELAYED_MERGE
+int merge_nat_bg(struct f2fs_sb_info *sbi);
+#endif
 #endif
 /*
  * segment.c
@@ -3620,6 +3870,10 @@ bool f2fs_issue_discard_timeout(struct f2fs_sb_info *sbi);
 void f2fs_clear_prefree_segments(struct f2fs_sb_info *sbi,
 					struct cp_control *cpc);
 void f2fs_dirty_to_prefree(struct f2fs_sb_info *sbi);
+#if GC_VICTIM_INDEX
+void f2fs_update_victim_index(struct f2fs_sb_info *sbi, unsigned int secno);
+void f2fs_refresh_victim_index(struct f2fs_sb_info *sbi);
+#endif
 block_t f2fs_get_unusable_blocks(struct f2fs_sb_info *sbi);
 int f2fs_disable_cp_again(struct f2fs_sb_info *sbi, block_t unusable);
 void f2fs_release_discard_addrs(struct f2fs_sb_info *sbi);
@@ -3638,6 +3892,10 @@ int f2fs_trim_fs(struct f2fs_sb_info *sbi, struct fstrim_range *range);
 bool f2fs_exist_trim_candidates(struct f2fs_sb_info *sbi,
 					struct cp_control *cpc);
 struct page *f2fs_get_sum_page(struct f2fs_sb_info *sbi, unsigned int segno);
+#if META_FOR_ZNS
+void f2fs_ra_sum_pages(struct f2fs_sb_info *sbi, unsigned int start_segno,
+						unsigned int end_segno);
+#endif
 void f2fs_update_meta_page(struct f2fs_sb_info *sbi, void *src,
 					block_t blk_addr);
 void f2fs_do_write_meta_page(struct f2fs_sb_info *sbi, struct page *page,
@@ -3696,6 +3954,26 @@ int __flush_sum_blks(struct f2fs_sb_info *sbi);
 int flush_sum_blks(struct f2fs_sb_info *sbi, struct cp_control *cpc);
 int merge_sit(struct f2fs_sb_info *sbi, int foreground);
 #endif
+#ifdef CONFIG_BLK_DEV_ZONED
+void f2fs_issue_zone_mgmt(struct f2fs_sb_info *sbi, struct block_device *bdev,
+			enum req_opf op, sector_t sector, sector_t nr_sects,
+			unsigned int segno);
+int f2fs_wait_zone_resets(struct f2fs_sb_info *sbi);
+void f2fs_wait_zone_mgmt(struct f2fs_sb_info *sbi);
+int f2fs_meta_zone_written(struct f2fs_sb_info *sbi, block_t zone_blkaddr,
+					block_t *written);
+void f2fs_update_sum_entry(struct f2fs_sb_info *sbi, block_t blkaddr,
+					struct f2fs_summary *sum);
+#endif
+#if STRIPE
+int f2fs_check_stripe_policy(struct f2fs_sb_info *sbi,
+			struct f2fs_stripe_policy *sp, bool clamp);
+void f2fs_calibrate_stripe(struct f2fs_sb_info *sbi);
+void f2fs_default_stripe_policy(struct f2fs_stripe_policy *sp);
+#if GC_LOG
+void f2fs_close_striped_log(struct f2fs_sb_info *sbi, int type);
+#endif
+#endif
 
 #define DEF_FRAGMENT_SIZE	4
 #define MIN_FRAGMENT_SIZE	1
@@ -3759,11 +4037,32 @@ void f2fs_init_ckpt_req_control(struct f2fs_sb_info *sbi);
 int f2fs_sync_single_meta_page(struct page *page);
 struct page *get_next_log_page(struct f2fs_sb_info *sbi, 
 		int log_type);
-int move_metadata_page(struct f2fs_sb_info *sbi, block_t offset, int type);
-int advance_meta_zone_wp(struct f2fs_sb_info *sbi, block_t zoff,
-		int cur_wp, int add, int type);
+int move_metadata_page(struct meta_merge_unit *unit, block_t meta_off);
+int advance_meta_zone_wp(struct meta_merge_unit *unit, int cur_wp, int add);
+int f2fs_write_merged_meta_page(struct meta_merge_unit *unit,
+		struct page *page);
+void f2fs_ra_meta_zone(struct meta_merge_unit *unit, int wp, int cnt);
+struct meta_merge_unit *f2fs_add_meta_merge_unit(struct f2fs_sb_info *sbi,
+		struct list_head *units, int type, unsigned int zone,
+		int foreground, int (*merge)(struct meta_merge_unit *));
+int f2fs_merge_meta_zones(struct f2fs_sb_info *sbi, struct list_head *units,
+		struct list_head *deferred, unsigned int budget);
+void f2fs_flip_meta_zones(struct list_head *units);
+#if DELAYED_MERGE
+int f2fs_build_meta_zone_stats(struct f2fs_sb_info *sbi);
+#endif
+void f2fs_free_meta_merge_units(struct list_head *units);
+int f2fs_init_meta_merge_wq(struct f2fs_sb_info *sbi);
+void f2fs_destroy_meta_merge_wq(struct f2fs_sb_info *sbi);
 int reset_meta_zone_towrite(struct f2fs_sb_info *sbi,
 		block_t zone_off, int type);
+#if DELAYED_MERGE
+int f2fs_replay_meta_log(struct f2fs_sb_info *sbi, int log_type,
+		int (*replay)(struct f2fs_sb_info *, void *, void *), void *data);
+void f2fs_start_replayed_merge(struct f2fs_sb_info *sbi);
+int f2fs_merge_log_trees(struct f2fs_sb_info *sbi, int fg);
+int f2fs_reset_meta_logs(struct f2fs_sb_info *sbi);
+#endif
 #endif
 
 /*
@@ -3829,6 +4128,11 @@ int f2fs_init_post_read_processing(void);
 void f2fs_destroy_post_read_processing(void);
 int f2fs_init_post_read_wq(struct f2fs_sb_info *sbi);
 void f2fs_destroy_post_read_wq(struct f2fs_sb_info *sbi);
+#ifdef CONFIG_BLK_DEV_ZONED
+int f2fs_init_zone_append(struct f2fs_sb_info *sbi);
+void f2fs_destroy_zone_append(struct f2fs_sb_info *sbi);
+void f2fs_wait_zone_appends(struct f2fs_sb_info *sbi);
+#endif
 extern const struct iomap_ops f2fs_iomap_ops;
 
 /*
@@ -3840,6 +4144,10 @@ block_t f2fs_start_bidx_of_node(unsigned int node_ofs, struct inode *inode);
 int f2fs_gc(struct f2fs_sb_info *sbi, bool sync, bool background, bool force,
 			unsigned int segno);
 void f2fs_build_gc_manager(struct f2fs_sb_info *sbi);
+#if PARALLEL_GC
+int f2fs_init_gc_wq(struct f2fs_sb_info *sbi);
+void f2fs_destroy_gc_wq(struct f2fs_sb_info *sbi);
+#endif
 int f2fs_resize_fs(struct f2fs_sb_info *sbi, __u64 block_count);
 int __init f2fs_create_garbage_collection_cache(void);
 void f2fs_destroy_garbage_collection_cache(void);
@@ -3856,6 +4164,9 @@ void f2fs_destroy_recovery_cache(void);
  * debug.c
  */
 #ifdef CONFIG_F2FS_STAT_FS
+#if GC_VICTIM_INDEX
+#define VICTIM_INDEX_HIST_BUCKETS	10	/* valid ratio buckets in debugfs */
+#endif
 struct f2fs_stat_info {
 	struct list_head stat_list;
 	struct f2fs_sb_info *sbi;
@@ -3903,6 +4214,22 @@ struct f2fs_stat_info {
 	unsigned int dirty_seg[NR_CURSEG_TYPE];
 	unsigned int full_seg[NR_CURSEG_TYPE];
 	unsigned int valid_blks[NR_CURSEG_TYPE];
+#if ZF2FS_MONITOR
+	unsigned int stripe_width[NR_PERSISTENT_LOG];
+	unsigned int stripe_lat_us[NR_PERSISTENT_LOG];
+	unsigned int stripe_qd[NR_PERSISTENT_LOG];
+#endif
+#if DELAYED_MERGE
+	struct f2fs_merge_stat merge_stat[SSA_LOG + 1];
+	unsigned int meta_zones_merged[SSA_LOG + 1];
+	unsigned int meta_zone_hist[SSA_LOG + 1][META_ZONE_HIST_BUCKETS];
+	unsigned int meta_zone_avg_age[SSA_LOG + 1];
+	unsigned int meta_zone_max_age[SSA_LOG + 1];
+#endif
+#if GC_VICTIM_INDEX
+	unsigned int victim_index_secs;
+	unsigned int victim_index_hist[VICTIM_INDEX_HIST_BUCKETS];
+#endif
 
 	unsigned int meta_count[META_MAX];
 	unsigned int segment_count[2];
@@ -4627,47 +4954,85 @@ static inline int meta_boff_in_zone(struct f2fs_sb_info *sbi, u32 blk_offset){
 	boff_in_zone = blk_offset % meta_blks_zone_cap(sbi);
 	return boff_in_zone;
 }
+/* zones a log writes to in turn, see next_log_addr() */
+static inline unsigned int meta_log_stripes(struct f2fs_sb_info *sbi,
+							int type)
+{
+	return sbi->log_stripes[type];
+}
+
+static inline unsigned int curlog_size(struct f2fs_sb_info *sbi, int type)
+{
+	unsigned int log_size;
+
+	// consider all zone size is equal
+	log_size = log_size(sbi);
+	log_size = min(log_size, meta_blks_zone_cap(sbi));
+	return log_size * meta_log_stripes(sbi, type);
+}
+
+static inline unsigned int curlog_used_blocks(struct f2fs_sb_info *sbi,
+							int type)
+{
+	if (type == SIT_LOG)
+		return SM_I(sbi)->sit_blks_in_log;
+	if (type == NAT_LOG)
+		return NM_I(sbi)->nat_blks_in_log;
+	//return SM_I(sbi)->logged_sum_blks;
+	return SM_I(sbi)->sum_blks_in_log;
+}
+
 static inline bool has_curlog_space(struct f2fs_sb_info *sbi, 
 		int entries, int type){
 
 	unsigned int used_blocks;
 	unsigned int blocks_needed;
-	unsigned int log_size;
 
 	if(!entries)
 		return true;
 
 	if(type == SIT_LOG){
-		used_blocks = SM_I(sbi)->sit_blks_in_log;
 		blocks_needed = (entries / SIT_LOG_ENTRIES) + 1;
 	} else if(type == NAT_LOG){
-		used_blocks = NM_I(sbi)->nat_blks_in_log;
 		blocks_needed = (entries / NAT_LOG_ENTRIES) + 1;
 	} else if(type == SSA_LOG){
-		used_blocks = SM_I(sbi)->sum_blks_in_log;
-		//used_blocks = SM_I(sbi)->logged_sum_blks;
 		blocks_needed = entries;
 	} else {
 		f2fs_bug_on(sbi, 1);
 		return true;
 	}
-	// consider all zone size is equal
-	log_size = log_size(sbi);
-	log_size = min(log_size, meta_blks_zone_cap(sbi));
-#if META_LOG_STRIPE
-  if (type == SSA_LOG) {
-    log_size *= META_STRIPE_CNT;
-  }
-#endif
+	used_blocks = curlog_used_blocks(sbi, type);
 	
 	//printk("(%s : %d) used blocks : %d, need : %d",
 	//		__func__, __LINE__, used_blocks, blocks_needed);
 
-	if(log_size >= (used_blocks + blocks_needed))
+	if(curlog_size(sbi, type) >= (used_blocks + blocks_needed))
 		return true;
 	
 	return false;
 }
+/*
+ * Metadata goes straight to the main area, bypassing the logs, on umount
+ * and in the first checkpoint after a replay that found uncommitted log
+ * blocks.
+ */
+static inline bool log_fg_merge(struct f2fs_sb_info *sbi,
+				struct cp_control *cpc)
+{
+	/* fast_umount leaves the logs to the merge thread of the next mount */
+	if ((cpc->reason & CP_UMOUNT) && !test_opt(sbi, FAST_UMOUNT))
+		return true;
+	return is_sbi_flag_set(sbi, SBI_NEED_LOG_MERGE);
+}
+
+#if DELAYED_MERGE
+/* a log tree was switched out, f2fs_merge() picks it up */
+static inline void f2fs_wake_up_merge(struct f2fs_sb_info *sbi)
+{
+	if (sbi->merge_thread)
+		wake_up_interruptible_all(&sbi->merge_wait_queue);
+}
+#endif
 static inline block_t get_cur_meta_blkaddr(struct f2fs_sb_info *sbi, 
 		block_t offset, block_t base_addr, char *bitmap, int ssa){
 
@@ -4730,6 +5095,128 @@ static inline int get_cur_log(struct f2fs_sb_info *sbi, int log_type){
 	}
 	return -1;
 }
+
+/*
+ * Each log has a ring of meta_log_gens zones, each with its own log tree of
+ * the same index. Trees from the head up to the current one wait for a
+ * merge, after which the checkpoint resets the zone of the head.
+ */
+static inline unsigned int next_log_gen(struct f2fs_sb_info *sbi,
+						unsigned int gen)
+{
+	return (gen + 1) % sbi->meta_log_gens;
+}
+
+static inline unsigned int prev_log_gen(struct f2fs_sb_info *sbi,
+						unsigned int gen)
+{
+	return (gen + sbi->meta_log_gens - 1) % sbi->meta_log_gens;
+}
+
+static inline unsigned int *log_tree_idx(struct f2fs_sb_info *sbi, int type)
+{
+	if (type == SIT_LOG)
+		return &SM_I(sbi)->sit_ltree_idx;
+	if (type == NAT_LOG)
+		return &NM_I(sbi)->nat_ltree_idx;
+	return &SM_I(sbi)->cur_log_tree_idx;
+}
+
+static inline unsigned int *log_tree_head(struct f2fs_sb_info *sbi, int type)
+{
+	if (type == SIT_LOG)
+		return &SM_I(sbi)->sit_ltree_head;
+	if (type == NAT_LOG)
+		return &NM_I(sbi)->nat_ltree_head;
+	return &SM_I(sbi)->ssa_ltree_head;
+}
+
+static inline bool log_tree_empty(struct f2fs_sb_info *sbi, int type,
+						unsigned int gen)
+{
+	if (type == SIT_LOG)
+		return radix_tree_empty(&SM_I(sbi)->sit_log_root[gen]);
+	if (type == NAT_LOG)
+		return radix_tree_empty(&NM_I(sbi)->nat_log_root[gen]);
+	return radix_tree_empty(&SM_I(sbi)->ssa_log_root[gen]);
+}
+
+static inline unsigned int cur_log_gen(struct f2fs_sb_info *sbi, int type)
+{
+	if (type == SIT_LOG)
+		return SM_I(sbi)->cur_sit_log;
+	if (type == NAT_LOG)
+		return NM_I(sbi)->cur_nat_log;
+	return SM_I(sbi)->cur_sum_log;
+}
+
+/* the zone after the current one still waits for its merge */
+static inline bool log_ring_full(struct f2fs_sb_info *sbi, int type)
+{
+	return next_log_gen(sbi, cur_log_gen(sbi, type)) ==
+					*log_tree_head(sbi, type);
+}
+
+/* a full log cannot move on, merge every tree in the foreground instead */
+static inline void force_log_merge(struct f2fs_sb_info *sbi, int type)
+{
+	if (!is_sbi_flag_set(sbi, SBI_NEED_LOG_MERGE))
+		f2fs_warn(sbi, "metadata log %d has no free zone, merge all logs",
+			  type);
+	set_sbi_flag(sbi, SBI_NEED_LOG_MERGE);
+}
+
+/*
+ * Go on with the next zone of a full log. If that one still waits for its
+ * merge, returns false and the caller writes no more log blocks, what is
+ * left goes to the main area with the foreground merge.
+ */
+static inline bool switch_log_gen(struct f2fs_sb_info *sbi, int type)
+{
+	if (log_ring_full(sbi, type)) {
+		force_log_merge(sbi, type);
+		return false;
+	}
+	if (type == SIT_LOG) {
+		SM_I(sbi)->cur_sit_log = next_log_gen(sbi, SM_I(sbi)->cur_sit_log);
+		SM_I(sbi)->sit_blks_in_log = 0;
+	} else if (type == NAT_LOG) {
+		NM_I(sbi)->cur_nat_log = next_log_gen(sbi, NM_I(sbi)->cur_nat_log);
+		NM_I(sbi)->nat_blks_in_log = 0;
+	} else {
+		SM_I(sbi)->cur_sum_log = next_log_gen(sbi, SM_I(sbi)->cur_sum_log);
+		SM_I(sbi)->sum_blks_in_log = 0;
+	}
+	return true;
+}
+
+/*
+ * Switch the SIT or NAT log in the checkpoint @cpc. The log trees follow
+ * at its end, once, so a second switch in one checkpoint is refused too.
+ */
+static inline bool cp_switch_log_gen(struct f2fs_sb_info *sbi,
+				struct cp_control *cpc, int type)
+{
+	unsigned int bit = type == SIT_LOG ? 0x1 : 0x2;
+
+	if (cpc->merge & bit) {
+		force_log_merge(sbi, type);
+		return false;
+	}
+	if (!switch_log_gen(sbi, type))
+		return false;
+	cpc->merge |= bit;
+	return true;
+}
+
+/* the SSA log can neither take the dirty summaries nor move on for now */
+static inline bool sum_log_blocked(struct f2fs_sb_info *sbi)
+{
+	if (has_curlog_space(sbi, get_dirty_sum_pages(sbi), SSA_LOG))
+		return false;
+	return log_ring_full(sbi, SSA_LOG) ||
+		is_set_ckpt_flags(sbi, CP_SSA_MERGE_PREPARE_FLAG);
+}
 #endif /* DELAYED_MERGE */
 #endif /* META_FOR_ZNS */
 
@@ -31,6 +31,18 @@
 
 static struct kmem_cache *victim_entry_slab;
 
+#if PARALLEL_GC
+/* workers of parallel_gc() share the GC counters of sbi and its stats */
+#define gc_stat_update(sbi, update)				\
+	do {							\
+		spin_lock(&(sbi)->gc_stat_lock);		\
+		update;						\
+		spin_unlock(&(sbi)->gc_stat_lock);		\
+	} while (0)
+#else
+#define gc_stat_update(sbi, update)	do { update; } while (0)
+#endif
+
 static unsigned int count_bits(const unsigned long *addr,
 				unsigned int offset, unsigned int len);
 
@@ -662,6 +674,65 @@ static void release_victim_entry(struct f2fs_sb_info *sbi)
 static unsigned int avoid_secno = NULL_SEGNO;
 #endif
 
+#if GC_VICTIM_INDEX
+static bool victim_index_usable(struct f2fs_sb_info *sbi,
+				struct victim_sel_policy *p)
+{
+	return DIRTY_I(sbi)->victim_index.buckets && p->alloc_mode == LFS &&
+		(p->gc_mode == GC_GREEDY || p->gc_mode == GC_CB);
+}
+
+/*
+ * Walk the victim index from the emptiest bucket up. Greedy is done with
+ * the first bucket holding a candidate, cost-benefit goes on until
+ * p->max_search sections, each bucket in the order its sections entered
+ * it. Stale sections are re-bucketed first, so no section moves during
+ * the walk.
+ */
+static void get_victim_from_index(struct f2fs_sb_info *sbi,
+			struct victim_sel_policy *p, int gc_type)
+{
+	struct dirty_seglist_info *dirty_i = DIRTY_I(sbi);
+	struct victim_index *vi = &dirty_i->victim_index;
+	unsigned int bucket, nsearched = 0;
+
+	f2fs_refresh_victim_index(sbi);
+
+	for_each_set_bit(bucket, vi->nonempty, vi->nr_buckets) {
+		struct list_head *pos;
+
+		list_for_each(pos, &vi->buckets[bucket]) {
+			unsigned int secno = pos - vi->sec_node;
+			unsigned int segno = GET_SEG_FROM_SEC(sbi, secno);
+			unsigned long cost;
+
+#ifdef CONFIG_F2FS_CHECK_FS
+			if (test_bit(segno, SIT_I(sbi)->invalid_segmap))
+				continue;
+#endif
+			if (sec_usage_check(sbi, secno))
+				continue;
+			if (unlikely(is_sbi_flag_set(sbi, SBI_CP_DISABLED)) &&
+					get_ckpt_valid_blocks(sbi, segno, true))
+				continue;
+			if (gc_type == BG_GC &&
+					test_bit(secno, dirty_i->victim_secmap))
+				continue;
+
+			cost = get_gc_cost(sbi, segno, p);
+			if (p->min_cost > cost) {
+				p->min_segno = segno;
+				p->min_cost = cost;
+			}
+			if (++nsearched >= p->max_search)
+				return;
+		}
+		if (p->gc_mode == GC_GREEDY && p->min_segno != NULL_SEGNO)
+			return;
+	}
+}
+#endif
+
 /* STRIPE */
 /* TODO: check inuse of section not to select section in ZSet as a victim */
 static int get_victim_by_default(struct f2fs_sb_info *sbi,
@@ -736,6 +807,12 @@ retry:
 			goto got_it;
 	}
 
+#if GC_VICTIM_INDEX
+	if (victim_index_usable(sbi, &p)) {
+		get_victim_from_index(sbi, &p, gc_type);
+		goto searched;
+	}
+#endif
 	while (1) {
 		unsigned long cost, *dirty_bitmap;
 		unsigned int unit_no, segno;
@@ -826,6 +903,9 @@ next:
 			break;
 		}
 	}
+#if GC_VICTIM_INDEX
+searched:
+#endif
 
 	/* get victim for GC_AT/AT_SSR */
 	if (is_atgc) {
@@ -1015,7 +1095,7 @@ next_step:
 		err = f2fs_move_node_page(node_page, gc_type);
 		if (!err && gc_type == FG_GC)
 			submitted++;
-		stat_inc_node_blk_count(sbi, 1, gc_type);
+		gc_stat_update(sbi, stat_inc_node_blk_count(sbi, 1, gc_type));
 	}
 
 	if (++phase < 3)
@@ -1234,6 +1314,144 @@ put_page:
 	return err;
 }
 
+#if GC_BULK_READ
+static block_t gc_data_blkaddr(struct f2fs_sb_info *sbi, block_t start_addr,
+							int off)
+{
+#if GRID_STRIPE
+	unsigned int blks_per_subseg = BLKS_PER_SUBSEG(sbi);
+
+	if ((SM_I(sbi)->grid_cnt) >= 2)
+		return start_addr + (off / blks_per_subseg) *
+			sbi->blocks_per_blkz + off % blks_per_subseg;
+#endif
+	return start_addr + off;
+}
+
+/*
+ * A block can be read from disk ahead of move_data_block() only if no
+ * write of it is still in flight; later writes go out of place.
+ */
+static bool gc_bulk_readable(struct inode *inode, pgoff_t index)
+{
+	struct page *page;
+	bool busy;
+
+	if (!S_ISREG(inode->i_mode))
+		return false;
+
+	page = find_get_page(inode->i_mapping, index);
+	if (!page)
+		return true;
+	busy = PageWriteback(page);
+	f2fs_put_page(page, 0);
+	return !busy;
+}
+
+static void gc_bulk_read_end_io(struct bio *bio)
+{
+	struct bio_vec *bv;
+	struct bvec_iter_all iter_all;
+
+	bio_for_each_segment_all(bv, bio, iter_all) {
+		struct page *page = bv->bv_page;
+
+		if (bio->bi_status)
+			ClearPageUptodate(page);
+		else
+			SetPageUptodate(page);
+		unlock_page(page);
+	}
+	bio_put(bio);
+}
+
+/*
+ * Read the blocks marked in @bulk_map into META_MAPPING with one bio per
+ * run contiguous on disk. With GRID_STRIPE a segment spans grid_cnt zones,
+ * so this is one sequential read per zone for a dense segment.
+ * move_data_block() waits on the page lock and re-reads on error.
+ */
+static void gc_bulk_read(struct f2fs_sb_info *sbi, unsigned int segno,
+						unsigned long *bulk_map)
+{
+	struct address_space *mapping = META_MAPPING(sbi);
+	unsigned int usable_blks_in_seg = f2fs_usable_blks_in_seg(sbi, segno);
+	block_t start_addr = START_BLOCK(sbi, segno);
+	block_t blkaddr, next_blkaddr = NULL_ADDR;
+	struct bio *bio = NULL;
+	unsigned int nr_blks = 0;
+	int off;
+
+	for_each_set_bit(off, bulk_map, usable_blks_in_seg) {
+		struct page *page;
+
+		/* freed since phase 3, the page would outlive the block */
+		if (!check_valid_map(sbi, segno, off)) {
+			__clear_bit(off, bulk_map);
+			continue;
+		}
+
+		blkaddr = gc_data_blkaddr(sbi, start_addr, off);
+		page = f2fs_pagecache_get_page(mapping, blkaddr,
+				FGP_LOCK | FGP_CREAT | FGP_NOWAIT, GFP_NOFS);
+		if (!page)
+			continue;
+		if (PageUptodate(page)) {
+			f2fs_put_page(page, 1);
+			continue;
+		}
+
+		if (bio && (blkaddr != next_blkaddr ||
+			bio_add_page(bio, page, PAGE_SIZE, 0) < PAGE_SIZE)) {
+			submit_bio(bio);
+			bio = NULL;
+		}
+		if (!bio) {
+			bio = bio_alloc(GFP_NOIO, BIO_MAX_VECS);
+			f2fs_target_device(sbi, blkaddr, bio);
+			bio->bi_opf = REQ_OP_READ;
+			bio->bi_end_io = gc_bulk_read_end_io;
+			bio_add_page(bio, page, PAGE_SIZE, 0);
+		}
+		/* locked until the read completes */
+		f2fs_put_page(page, 0);
+		next_blkaddr = blkaddr + 1;
+		nr_blks++;
+	}
+	if (bio)
+		submit_bio(bio);
+
+	f2fs_update_iostat(sbi, FS_DATA_READ_IO, nr_blks * F2FS_BLKSIZE);
+	f2fs_update_iostat(sbi, FS_GDATA_READ_IO, nr_blks * F2FS_BLKSIZE);
+}
+
+/*
+ * Drop the pages gc_bulk_read() left for the blocks still marked in
+ * @bulk_map, i.e. not moved by move_data_block(). Such a block may be
+ * freed and its address reused, so its page must not be found uptodate.
+ */
+static void gc_bulk_drop(struct f2fs_sb_info *sbi, unsigned int segno,
+						unsigned long *bulk_map)
+{
+	struct address_space *mapping = META_MAPPING(sbi);
+	block_t start_addr = START_BLOCK(sbi, segno);
+	int off;
+
+	for_each_set_bit(off, bulk_map, f2fs_usable_blks_in_seg(sbi, segno)) {
+		block_t blkaddr = gc_data_blkaddr(sbi, start_addr, off);
+		struct page *page;
+
+		/* waits for a read still in flight */
+		page = find_lock_page(mapping, blkaddr);
+		if (!page)
+			continue;
+		ClearPageUptodate(page);
+		f2fs_put_page(page, 1);
+		invalidate_mapping_pages(mapping, blkaddr, blkaddr);
+	}
+}
+#endif
+
 /*
  * Move data block via META_MAPPING while keeping locked data page.
  * This can be used to move blocks, aka LBAs, directly on disk.
@@ -1259,9 +1477,15 @@ static int move_data_block(struct inode *inode, block_t bidx,
 	block_t newaddr;
 	int err = 0;
 	bool lfs_mode = f2fs_lfs_mode(fio.sbi);
+#if GC_LOG
+	int type = fio.sbi->am.atgc_enabled && (gc_type == BG_GC) &&
+				(fio.sbi->gc_mode != GC_URGENT_HIGH) ?
+				CURSEG_ALL_DATA_ATGC : CURSEG_GC_DATA;
+#else
 	int type = fio.sbi->am.atgc_enabled && (gc_type == BG_GC) &&
 				(fio.sbi->gc_mode != GC_URGENT_HIGH) ?
 				CURSEG_ALL_DATA_ATGC : CURSEG_COLD_DATA;
+#endif
 
 	/* do not read out */
 	page = f2fs_grab_cache_page(inode->i_mapping, bidx, false);
@@ -1275,7 +1499,8 @@ static int move_data_block(struct inode *inode, block_t bidx,
 
 	if (f2fs_is_atomic_file(inode)) {
 		F2FS_I(inode)->i_gc_failures[GC_FAILURE_ATOMIC]++;
-		F2FS_I_SB(inode)->skipped_atomic_files[gc_type]++;
+		gc_stat_update(F2FS_I_SB(inode),
+			F2FS_I_SB(inode)->skipped_atomic_files[gc_type]++);
 		err = -EAGAIN;
 		goto out;
 	}
@@ -1432,7 +1657,8 @@ static int move_data_page(struct inode *inode, block_t bidx, int gc_type,
 
 	if (f2fs_is_atomic_file(inode)) {
 		F2FS_I(inode)->i_gc_failures[GC_FAILURE_ATOMIC]++;
-		F2FS_I_SB(inode)->skipped_atomic_files[gc_type]++;
+		gc_stat_update(F2FS_I_SB(inode),
+			F2FS_I_SB(inode)->skipped_atomic_files[gc_type]++);
 		err = -EAGAIN;
 		goto out;
 	}
@@ -1519,9 +1745,15 @@ static int gc_data_segment(struct f2fs_sb_info *sbi, struct f2fs_summary *sum,
 	int phase = 0;
 	int submitted = 0;
 	unsigned int usable_blks_in_seg = f2fs_usable_blks_in_seg(sbi, segno);
+#if GC_BULK_READ
+	DECLARE_BITMAP(bulk_map, ENTRIES_IN_SUM);
+#endif
 
   int dbg = 1;
 	start_addr = START_BLOCK(sbi, segno);
+#if GC_BULK_READ
+	bitmap_zero(bulk_map, ENTRIES_IN_SUM);
+#endif
   
 //  struct timespec64 ts[5][2];
 //  unsigned long long phaseTime[5] = {0,};
@@ -1570,7 +1802,7 @@ next_step:
 		if ((gc_type == BG_GC && has_not_enough_free_secs(sbi, 0, 0)) ||
 			(!force_migrate && get_valid_blocks(sbi, segno, true) ==
 							BLKS_PER_SEC(sbi)))
-			return submitted;
+			goto stop;
 
 		if (check_valid_map(sbi, segno, off) == 0)
 			continue;
@@ -1663,7 +1895,7 @@ next_step:
 			if (!down_write_trylock(
 				&F2FS_I(inode)->i_gc_rwsem[WRITE])) {
 				iput(inode);
-				sbi->skipped_gc_rwsem++;
+				gc_stat_update(sbi, sbi->skipped_gc_rwsem++);
         printk("(%s:%d) try lock failed", __func__, __LINE__);
 				continue;
 			}
@@ -1683,6 +1915,17 @@ next_step:
 				continue;
 			}
 
+#if GC_BULK_READ
+			/* read in runs after this phase, moved on disk */
+			if (gc_type == FG_GC &&
+					gc_bulk_readable(inode, start_bidx)) {
+				up_write(&F2FS_I(inode)->i_gc_rwsem[WRITE]);
+				__set_bit(off, bulk_map);
+				add_gc_inode(gc_list, inode);
+				continue;
+			}
+#endif
+
 			data_page = f2fs_get_read_data_page(inode,
 						start_bidx, REQ_RAHEAD, true);
 			up_write(&F2FS_I(inode)->i_gc_rwsem[WRITE]);
@@ -1709,13 +1952,13 @@ next_step:
 
 			if (S_ISREG(inode->i_mode)) {
 				if (!down_write_trylock(&fi->i_gc_rwsem[READ])) {
-					sbi->skipped_gc_rwsem++;
+					gc_stat_update(sbi, sbi->skipped_gc_rwsem++);
           printk("(%s:%d) try lock failed read phase 4", __func__, __LINE__);
 					continue;
 				}
 				if (!down_write_trylock(
 						&fi->i_gc_rwsem[WRITE])) {
-					sbi->skipped_gc_rwsem++;
+					gc_stat_update(sbi, sbi->skipped_gc_rwsem++);
 					up_write(&fi->i_gc_rwsem[READ]);
           printk("(%s:%d) try lock failed write phase 4", __func__, __LINE__);
 					continue;
@@ -1728,7 +1971,12 @@ next_step:
 
 			start_bidx = f2fs_start_bidx_of_node(nofs, inode)
 								+ ofs_in_node;
+#if GC_BULK_READ
+			if (f2fs_post_read_required(inode) ||
+					test_bit(off, bulk_map))
+#else
 			if (f2fs_post_read_required(inode))
+#endif
 				err = move_data_block(inode, start_bidx,
 							gc_type, segno, off);
 			else
@@ -1738,20 +1986,35 @@ next_step:
 			if (!err && (gc_type == FG_GC ||
 					f2fs_post_read_required(inode)))
 				submitted++;
+#if GC_BULK_READ
+			/* moved, its page is gone with the old address */
+			if (!err)
+				__clear_bit(off, bulk_map);
+#endif
 
 			if (locked) {
 				up_write(&fi->i_gc_rwsem[WRITE]);
 				up_write(&fi->i_gc_rwsem[READ]);
 			}
 
-			stat_inc_data_blk_count(sbi, 1, gc_type);
+			gc_stat_update(sbi,
+				stat_inc_data_blk_count(sbi, 1, gc_type));
 		}
 //    ktime_get_raw_ts64(&ts[phase][1]);
 //    calclock(ts[phase], &phaseTime[phase], &phaseCnt[phase]);
 	}
 
+#if GC_BULK_READ
+	if (phase == 3)
+		gc_bulk_read(sbi, segno, bulk_map);
+#endif
 	if (++phase < 5)
 		goto next_step;
+stop:
+#if GC_BULK_READ
+	if (phase >= 4)
+		gc_bulk_drop(sbi, segno, bulk_map);
+#endif
 /*
 	printk("%llu %llu %llu %llu %llu %llu %llu %llu %llu %llu",
     phaseTime[0], phaseTime[1],phaseTime[2],phaseTime[3],phaseTime[4],
@@ -1779,10 +2042,6 @@ static int __get_victim(struct f2fs_sb_info *sbi, unsigned int *victim,
 	return ret;
 }
 
-#if ZF2FS_MONITOR
-extern unsigned int f2fs_gc_monitor;
-#endif
-
 static int do_garbage_collect(struct f2fs_sb_info *sbi,
 				unsigned int start_segno,
 				struct gc_inode_list *gc_list, int gc_type,
@@ -1803,10 +2062,6 @@ static int do_garbage_collect(struct f2fs_sb_info *sbi,
   unsigned long long dogcTime = 0, dogcCnt = 0;
   unsigned long long gcTotalTime = 0 , gcTotalCnt = 0;
 
-#if META_FOR_ZNS && !NAIVE_MFZ
-  struct ssa_set *head;
-  struct radix_tree_root *root;
-#endif 
   
   ktime_get_raw_ts64(&ts_total[0]);
 
@@ -1814,7 +2069,7 @@ static int do_garbage_collect(struct f2fs_sb_info *sbi,
   printk("(%s:%d) gc start", __func__, __LINE__);
 #endif
 #if ZF2FS_MONITOR
-  f2fs_gc_monitor++;
+  f2fs_monitor_inc_gc(sbi);
 #endif
 
 	if (__is_large_section(sbi))
@@ -1831,10 +2086,15 @@ static int do_garbage_collect(struct f2fs_sb_info *sbi,
 
 	sanity_check_seg_type(sbi, get_seg_entry(sbi, segno)->type);
 #if DELAYED_MERGE
+  // keeps the SSA zones of the victim from switching under us, a merge
+  // only waits for it to switch them, see merge_ssa()
   down_read(&SM_I(sbi)->ssa_ltree_slock); // B:this works 2 times with B`
 #endif
 	/* readahead multi ssa blocks those have contiguous address */
-#if !META_FOR_ZNS && !DELAYED_MERGE
+#if META_FOR_ZNS
+	if (__is_large_section(sbi))
+		f2fs_ra_sum_pages(sbi, segno, end_segno);
+#else
 	if (__is_large_section(sbi))
 		f2fs_ra_meta_pages(sbi, GET_SUM_BLOCK(sbi, segno),
 					end_segno - segno, META_SSA, true);
@@ -1887,22 +2147,7 @@ static int do_garbage_collect(struct f2fs_sb_info *sbi,
 #if META_FOR_ZNS && !NAIVE_MFZ
 #if DELAYED_MERGE
     //search log and merge tree
-//    down_read(&SM_I(sbi)->ssa_ltree_slock);
-    root = &SM_I(sbi)->ssa_log_root[SM_I(sbi)->cur_log_tree_idx];
-    head = radix_tree_lookup(root, segno); 
-
-    if (head) {
-      memcpy(sum->entries, head->entries, SUM_ENTRY_SIZE);
-      memcpy(&sum->footer, &head->footer, SUM_FOOTER_SIZE);
-    } else if (is_set_ckpt_flags(sbi, CP_SSA_MERGE_FLAG)) {
-      root = &SM_I(sbi)->ssa_log_root[SM_I(sbi)->cur_log_tree_idx ^ 0x1];
-      head = radix_tree_lookup(root, segno);
-      if (head) { 
-        memcpy(sum->entries, head->entries, SUM_ENTRY_SIZE);
-        memcpy(&sum->footer, &head->footer, SUM_FOOTER_SIZE);
-      }
-    }
-//    up_read(&SM_I(sbi)->ssa_ltree_slock);
+    copy_ssa_log(sbi, segno, sum);
 #else // DELAYED_MERGE
 Not implemented
 #endif // DELAYED_MERGE
@@ -1950,8 +2195,8 @@ Not implemented
     if (gc_type == FG_GC)
       printk("(%s:%d) vblock count: %u, submitted %d", __func__, __LINE__, get_valid_blocks(sbi, segno, false), submitted);
 #endif
-		stat_inc_seg_count(sbi, type, gc_type);
-		sbi->gc_reclaimed_segs[sbi->gc_mode]++;
+		gc_stat_update(sbi, stat_inc_seg_count(sbi, type, gc_type));
+		gc_stat_update(sbi, sbi->gc_reclaimed_segs[sbi->gc_mode]++);
 		migrated++;
 
 freed:
@@ -1975,7 +2220,7 @@ skip:
 
 	blk_finish_plug(&plug);
 
-	stat_inc_call_count(sbi->stat_info);
+	gc_stat_update(sbi, stat_inc_call_count(sbi->stat_info));
       
 #if DEBUG_GC
   printk("(%s:%d) gc end, seg_freed: %d", __func__, __LINE__, seg_freed);
@@ -1986,6 +2231,96 @@ skip:
 	return seg_freed;
 }
 
+#if PARALLEL_GC
+struct gc_work {
+	struct work_struct work;
+	struct f2fs_sb_info *sbi;
+	unsigned int segno;
+	bool force;
+	int seg_freed;
+	struct gc_inode_list gc_list;
+};
+
+static void f2fs_gc_work(struct work_struct *work)
+{
+	struct gc_work *gw = container_of(work, struct gc_work, work);
+
+	gw->seg_freed = do_garbage_collect(gw->sbi, gw->segno, &gw->gc_list,
+							FG_GC, gw->force);
+}
+
+/*
+ * One victim while free sections hold twice the reserve, up to
+ * PARALLEL_GC_MAX as they drain below it.
+ */
+static int nr_parallel_victims(struct f2fs_sb_info *sbi)
+{
+	unsigned int rsvd = max_t(unsigned int, reserved_sections(sbi), 1);
+
+	return clamp_t(int, DIV_ROUND_UP(rsvd * 2, free_sections(sbi) + 1),
+						1, PARALLEL_GC_MAX);
+}
+
+/*
+ * Take up to @nr FG_GC victims and migrate them together on gc_wq, each
+ * worker with its own gc_inode_list. Block allocation and the SIT/SSA
+ * updates stay serialized by curseg_mutex and sentry_lock, and in LFS
+ * mode the writes by io_order_lock. Taken sections are kept in
+ * gc_victim_secs so that neither GC nor SSR picks them meanwhile.
+ */
+static int parallel_gc(struct f2fs_sb_info *sbi, int nr, bool force,
+					int *sec_freed, int *total_freed)
+{
+	struct gc_work *works;
+	int i, j, cnt = 0;
+
+	works = f2fs_kzalloc(sbi, sizeof(struct gc_work) * nr, GFP_NOFS);
+	if (!works)
+		return -ENOMEM;
+
+	for (i = 0; i < nr; i++) {
+		unsigned int segno = NULL_SEGNO;
+		unsigned int secno;
+
+		if (__get_victim(sbi, &segno, FG_GC))
+			break;
+		secno = GET_SEC_FROM_SEG(sbi, segno);
+		/* next_victim_seg of BG_GC and FG_GC can name the same one */
+		for (j = 0; j < cnt; j++)
+			if (sbi->gc_victim_secs[j] == secno)
+				break;
+		if (j < cnt)
+			continue;
+
+		sbi->gc_victim_secs[cnt] = secno;
+		works[cnt].sbi = sbi;
+		works[cnt].segno = segno;
+		works[cnt].force = force;
+		INIT_LIST_HEAD(&works[cnt].gc_list.ilist);
+		INIT_RADIX_TREE(&works[cnt].gc_list.iroot, GFP_NOFS);
+		INIT_WORK(&works[cnt].work, f2fs_gc_work);
+		cnt++;
+	}
+
+	for (i = 0; i < cnt; i++)
+		queue_work(sbi->gc_wq, &works[i].work);
+
+	for (i = 0; i < cnt; i++) {
+		flush_work(&works[i].work);
+		/* iput() may evict, do it here as the serial path does */
+		put_gc_inode(&works[i].gc_list);
+
+		if (works[i].seg_freed ==
+				f2fs_usable_segs_in_sec(sbi, works[i].segno))
+			(*sec_freed)++;
+		*total_freed += works[i].seg_freed;
+		sbi->gc_victim_secs[i] = NULL_SECNO;
+	}
+	kfree(works);
+	return cnt ? 0 : -ENODATA;
+}
+#endif
+
 int f2fs_gc(struct f2fs_sb_info *sbi, bool sync,
 			bool background, bool force, unsigned int segno)
 {
@@ -2052,6 +2387,18 @@ gc_more:
 		ret = -EINVAL;
 		goto stop;
 	}
+#if PARALLEL_GC
+	if (gc_type == FG_GC && !sync && segno == NULL_SEGNO &&
+				nr_parallel_victims(sbi) > 1) {
+		ret = parallel_gc(sbi, nr_parallel_victims(sbi), force,
+						&sec_freed, &total_freed);
+		if (!ret)
+			goto collected;
+		/* out of memory, collect one victim the serial way */
+		if (ret != -ENOMEM)
+			goto stop;
+	}
+#endif
   ktime_get_raw_ts64(&ts_f2fs_gc[0][0]);
 	ret = __get_victim(sbi, &segno, gc_type);
   ktime_get_raw_ts64(&ts_f2fs_gc[0][1]);
@@ -2068,6 +2415,9 @@ gc_more:
 		seg_freed == f2fs_usable_segs_in_sec(sbi, segno))
 		sec_freed++;
 	total_freed += seg_freed;
+#if PARALLEL_GC
+collected:
+#endif
 
 	if (gc_type == FG_GC) {
 		if (sbi->skipped_atomic_files[FG_GC] > last_skipped ||
@@ -2180,6 +2530,30 @@ void f2fs_build_gc_manager(struct f2fs_sb_info *sbi)
 	init_atgc_management(sbi);
 }
 
+#if PARALLEL_GC
+int f2fs_init_gc_wq(struct f2fs_sb_info *sbi)
+{
+	int i;
+
+	for (i = 0; i < PARALLEL_GC_MAX; i++)
+		sbi->gc_victim_secs[i] = NULL_SECNO;
+	spin_lock_init(&sbi->gc_stat_lock);
+
+	/* f2fs_balance_fs waits for it */
+	sbi->gc_wq = alloc_workqueue("f2fs_gc_wq",
+				WQ_UNBOUND | WQ_MEM_RECLAIM, PARALLEL_GC_MAX);
+	if (!sbi->gc_wq)
+		return -ENOMEM;
+	return 0;
+}
+
+void f2fs_destroy_gc_wq(struct f2fs_sb_info *sbi)
+{
+	if (sbi->gc_wq)
+		destroy_workqueue(sbi->gc_wq);
+}
+#endif
+
 static int free_segment_range(struct f2fs_sb_info *sbi,
 				unsigned int secs, bool gc_only)
 {
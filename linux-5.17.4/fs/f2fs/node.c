@@ -25,6 +25,9 @@
 static struct kmem_cache *nat_entry_slab;
 static struct kmem_cache *free_nid_slab;
 static struct kmem_cache *nat_entry_set_slab;
+#if META_FOR_ZNS
+static struct kmem_cache *nat_log_slots_slab;
+#endif
 static struct kmem_cache *fsync_node_entry_slab;
 
 /*
@@ -134,7 +137,8 @@ static struct page *get_current_nat_page(struct f2fs_sb_info *sbi, nid_t nid)
 	return f2fs_get_meta_page_retry(sbi, current_nat_addr(sbi, nid));
 }
 
-static struct page *get_next_nat_page(struct f2fs_sb_info *sbi, nid_t nid)
+/* copy the nat block of @nid to its next location, bitmap unchanged */
+static struct page *__get_next_nat_page(struct f2fs_sb_info *sbi, nid_t nid)
 {
 	struct page *src_page;
 	struct page *dst_page;
@@ -161,11 +165,18 @@ static struct page *get_next_nat_page(struct f2fs_sb_info *sbi, nid_t nid)
 	set_page_dirty(dst_page);
 	f2fs_put_page(src_page, 1);
 
-	set_to_next_nat(nm_i, nid);
-
 	return dst_page;
 }
 
+static struct page *get_next_nat_page(struct f2fs_sb_info *sbi, nid_t nid)
+{
+	struct page *page = __get_next_nat_page(sbi, nid);
+
+	if (!IS_ERR(page))
+		set_to_next_nat(NM_I(sbi), nid);
+	return page;
+}
+
 static struct nat_entry *__alloc_nat_entry(struct f2fs_sb_info *sbi,
 						nid_t nid, bool no_fail)
 {
@@ -234,7 +245,6 @@ static void __del_from_nat_cache(struct f2fs_nm_info *nm_i, struct nat_entry *e)
 	nm_i->nat_cnt[RECLAIMABLE_NAT]--;
 	__free_nat_entry(e);
 }
-#if META_FOR_ZNS
 static struct nat_entry_set *____grab_nat_entry_set(struct nat_entry *ne, 
 		struct radix_tree_root *root){
 
@@ -250,6 +260,9 @@ static struct nat_entry_set *____grab_nat_entry_set(struct nat_entry *ne,
 		INIT_LIST_HEAD(&head->set_list);
 		head->set = set;
 		head->entry_cnt = 0;
+#if META_FOR_ZNS
+		head->slots = NULL;
+#endif
 		f2fs_radix_tree_insert(root, set, head);
 	}
 	return head;
@@ -259,9 +272,27 @@ static struct nat_entry_set *__grab_nat_entry_set(struct f2fs_nm_info *nm_i,
 {
 	return ____grab_nat_entry_set(ne, &nm_i->nat_set_root);
 }
-static void __insert_nat_log_set(struct f2fs_nm_info *nm_i,
+static void __free_nat_entry_set(struct nat_entry_set *set)
+{
+#if META_FOR_ZNS
+	if (set->slots)
+		kmem_cache_free(nat_log_slots_slab, set->slots);
+#endif
+	kmem_cache_free(nat_entry_set_slab, set);
+}
+#if META_FOR_ZNS
+/* a log set holds one entry per nid, the newest one */
+static struct nat_entry *__lookup_nat_log(struct nat_entry_set *head,
+							nid_t nid)
+{
+	if (!head || !head->slots)
+		return NULL;
+	return head->slots[nid - START_NID(nid)];
+}
+static void __insert_nat_log_set(struct f2fs_sb_info *sbi,
 						struct nat_entry *ne)
 {
+	struct f2fs_nm_info *nm_i = NM_I(sbi);
 	struct nat_entry_set *head;
 	//printk("(%s : %d) insert ne to of nid(%u) to log set ", __func__, __LINE__, nat_get_nid(ne));
 
@@ -271,6 +302,11 @@ static void __insert_nat_log_set(struct f2fs_nm_info *nm_i,
 #else
 	head = ____grab_nat_entry_set(ne, &nm_i->nat_log_root);
 #endif
+	if (!head->slots)
+		head->slots = f2fs_kmem_cache_alloc(nat_log_slots_slab,
+					GFP_NOFS | __GFP_ZERO, true, NULL);
+	f2fs_bug_on(sbi, __lookup_nat_log(head, nat_get_nid(ne)));
+	head->slots[nat_get_nid(ne) - START_NID(nat_get_nid(ne))] = ne;
 	head->entry_cnt++;
 
 	//printk("(%s : %d) insert ne to of nid(%u) to log set ", __func__, __LINE__, nat_get_nid(ne));
@@ -278,26 +314,6 @@ static void __insert_nat_log_set(struct f2fs_nm_info *nm_i,
 	list_add_tail(&ne->list, &head->entry_list);
 	//printk("(%s : %d) insert ne to of nid(%u) to log set ", __func__, __LINE__, nat_get_nid(ne));
 }
-#else
-static struct nat_entry_set *__grab_nat_entry_set(struct f2fs_nm_info *nm_i,
-							struct nat_entry *ne)
-{
-	nid_t set = NAT_BLOCK_OFFSET(ne->ni.nid);
-	struct nat_entry_set *head;
-
-	head = radix_tree_lookup(&nm_i->nat_set_root, set);
-	if (!head) {
-		head = f2fs_kmem_cache_alloc(nat_entry_set_slab,
-						GFP_NOFS, true, NULL);
-
-		INIT_LIST_HEAD(&head->entry_list);
-		INIT_LIST_HEAD(&head->set_list);
-		head->set = set;
-		head->entry_cnt = 0;
-		f2fs_radix_tree_insert(&nm_i->nat_set_root, set, head);
-	}
-	return head;
-}
 #endif
 static void __set_nat_cache_dirty(struct f2fs_nm_info *nm_i,
 						struct nat_entry *ne)
@@ -613,6 +629,9 @@ int f2fs_get_node_info(struct f2fs_sb_info *sbi, nid_t nid,
 	block_t blkaddr;
 #if META_FOR_ZNS
 	struct nat_entry_set *head;
+#if DELAYED_MERGE
+	unsigned int t;
+#endif
 #else 
 	struct curseg_info *curseg = CURSEG_I(sbi, CURSEG_HOT_DATA);
 	struct f2fs_journal *journal = curseg->journal;
@@ -641,50 +660,43 @@ retry:
 #else
 	head = radix_tree_lookup(&nm_i->nat_log_root, NAT_BLOCK_OFFSET(nid));
 #endif
-	if(head){
-//		list_for_each_entry(e, &head->entry_list, list){
-		// get the newest node info in the log tree
-		// log tree do not update its entries, just add to tail
-		list_for_each_entry_reverse(e, &head->entry_list, list){
-			if(nat_get_nid(e) == nid){
-				ni->ino = nat_get_ino(e);
-				ni->blk_addr = nat_get_blkaddr(e);
-				ni->version = nat_get_version(e);
-				//printk("debug : get ni::nid(%u),ino(%u),blk_addr(%u)",
-				//		nid, ni->ino, ni->blk_addr);
-				up_read(&nm_i->nat_tree_lock);
-				//unlock cache tree;
-				raw_nat_from_node_info(&ne, ni);
-				goto cache;
-				//return 0;
-			}
-		}
+	// log sets keep the newest entry of each nid
+	e = __lookup_nat_log(head, nid);
+	if(e){
+		ni->ino = nat_get_ino(e);
+		ni->blk_addr = nat_get_blkaddr(e);
+		ni->version = nat_get_version(e);
+		//printk("debug : get ni::nid(%u),ino(%u),blk_addr(%u)",
+		//		nid, ni->ino, ni->blk_addr);
+		up_read(&nm_i->nat_tree_lock);
+		//unlock cache tree;
+		raw_nat_from_node_info(&ne, ni);
+		goto cache;
+		//return 0;
 	}
 	//unlock cache tree;
 #if DELAYED_MERGE
-	//search merge tree
+	//search trees waiting for merge, newest first
 	down_read(&nm_i->nat_ltree_slock);
-	head = radix_tree_lookup(&nm_i->nat_log_root[nm_i->nat_ltree_idx^0x1],
-			NAT_BLOCK_OFFSET(nid));
-	if(head){
-//		list_for_each_entry(e, &head->entry_list, list){
-		// get the newest node info in the log tree
-		// log tree do not update its entries, just add to tail
-		list_for_each_entry_reverse(e, &head->entry_list, list){
-			if(nat_get_nid(e) == nid){
-				ni->ino = nat_get_ino(e);
-				ni->blk_addr = nat_get_blkaddr(e);
-				ni->version = nat_get_version(e);
-				//printk("debug : get ni::nid(%u),ino(%u),blk_addr(%u)",
-				//		nid, ni->ino, ni->blk_addr);
-				up_read(&nm_i->nat_tree_lock);
-	      up_read(&nm_i->nat_ltree_slock);
-				//unlock cache tree;
-				raw_nat_from_node_info(&ne, ni);
-				goto cache;
-				//return 0;
-			}
-		}
+	e = NULL;
+	for (t = nm_i->nat_ltree_idx; !e && t != nm_i->nat_ltree_head; ) {
+		t = prev_log_gen(sbi, t);
+		head = radix_tree_lookup(&nm_i->nat_log_root[t],
+				NAT_BLOCK_OFFSET(nid));
+		e = __lookup_nat_log(head, nid);
+	}
+	if(e){
+		ni->ino = nat_get_ino(e);
+		ni->blk_addr = nat_get_blkaddr(e);
+		ni->version = nat_get_version(e);
+		//printk("debug : get ni::nid(%u),ino(%u),blk_addr(%u)",
+		//		nid, ni->ino, ni->blk_addr);
+		up_read(&nm_i->nat_tree_lock);
+		up_read(&nm_i->nat_ltree_slock);
+		//unlock cache tree;
+		raw_nat_from_node_info(&ne, ni);
+		goto cache;
+		//return 0;
 	}
 	up_read(&nm_i->nat_ltree_slock);
 
@@ -3111,18 +3123,35 @@ static inline int nid_zone_offset(struct f2fs_sb_info *sbi, nid_t nid){
 	ret = nid / ne_zone;
 	return ret;
 }
+/* log @ni in the current log tree, replacing an older entry of the nid */
+static void __log_node_info(struct f2fs_sb_info *sbi, struct node_info *ni)
+{
+	struct f2fs_nm_info *nm_i = NM_I(sbi);
+	struct nat_entry_set *head;
+	struct nat_entry *e;
+
+#if DELAYED_MERGE
+	head = radix_tree_lookup(&nm_i->nat_log_root[nm_i->nat_ltree_idx],
+						NAT_BLOCK_OFFSET(ni->nid));
+#else
+	head = radix_tree_lookup(&nm_i->nat_log_root, NAT_BLOCK_OFFSET(ni->nid));
+#endif
+	e = __lookup_nat_log(head, ni->nid);
+	if (e) {
+		copy_node_info(&e->ni, ni);
+		return;
+	}
+
+	e = __alloc_nat_entry(sbi, ni->nid, true);
+	copy_node_info(&e->ni, ni);
+	__insert_nat_log_set(sbi, e);
+}
 // only called in cp
 static void insert_nat_log_tree(struct f2fs_sb_info *sbi,
 		struct nat_entry *ne){
 
-	struct nat_entry *new;
-	
 	//printk("(%s : %d) insert nat entry of nid :%u", __func__, __LINE__, nat_get_nid(ne));
-	new = __alloc_nat_entry(sbi, nat_get_nid(ne), true);
-	copy_node_info(&new->ni, &ne->ni);
-	
-	//no lookup log tree 
-	__insert_nat_log_set(NM_I(sbi), new);
+	__log_node_info(sbi, &ne->ni);
 	//printk("(%s : %d) insert nat entry of nid :%u", __func__, __LINE__, nat_get_nid(ne));
 }
 
@@ -3134,32 +3163,33 @@ static inline void clean_nat_log_set(struct f2fs_sb_info *sbi,
 	if (foreground)
 		idx = NM_I(sbi)->nat_ltree_idx;
 	else
-		idx = NM_I(sbi)->nat_ltree_idx ^ 0x1;
+		idx = NM_I(sbi)->nat_ltree_head;
 	radix_tree_delete(&NM_I(sbi)->nat_log_root[idx], set->set);
 #else
 	f2fs_bug_on(sbi, set->entry_cnt);
 	radix_tree_delete(&NM_I(sbi)->nat_log_root, set->set);
 #endif
-	kmem_cache_free(nat_entry_set_slab, set);
+	__free_nat_entry_set(set);
 }
 static void del_from_log_tree(struct f2fs_sb_info *sbi, 
 		struct nat_entry_set *set, struct nat_entry *ne){
 
 	f2fs_bug_on(sbi, (set->set != NAT_BLOCK_OFFSET(nat_get_nid(ne))));
 	set->entry_cnt--;	
+	set->slots[nat_get_nid(ne) - START_NID(nat_get_nid(ne))] = NULL;
 	list_del(&ne->list);
 	__free_nat_entry(ne);
 }
-static int merge_nat_set(struct f2fs_sb_info *sbi,
+static int merge_nat_set(struct meta_merge_unit *unit,
 		struct nat_entry_set *set){
 
-
+	struct f2fs_sb_info *sbi = unit->sbi;
 	nid_t start_nid = set->set * NAT_ENTRY_PER_BLOCK; //consider zone cap
 	struct page *page = NULL;
 	struct f2fs_nat_block *nat_blk;
-	struct nat_entry *ne, *cur;
+	struct nat_entry *ne;
 
-	page = get_next_nat_page(sbi, start_nid); //TODO:consider zone cap
+	page = __get_next_nat_page(sbi, start_nid); //TODO:consider zone cap
 //	printk("(%s:%d) merge nat get page : %lx", __func__, __LINE__, page->index);
 	if (IS_ERR(page))
 		return PTR_ERR(page);
@@ -3167,7 +3197,8 @@ static int merge_nat_set(struct f2fs_sb_info *sbi,
 	f2fs_bug_on(sbi, !nat_blk);
 	//printk("(%s:%d) merge nat set of start nid(%u), page index(%lu)", __func__, __LINE__, start_nid, page->index);
 
-	list_for_each_entry_safe(ne, cur, &set->entry_list, list) {
+	//entries are dropped by merge_nat() once the zone is current
+	list_for_each_entry(ne, &set->entry_list, list) {
 		struct f2fs_nat_entry *raw_ne;
 		nid_t nid = nat_get_nid(ne);
 
@@ -3176,42 +3207,95 @@ static int merge_nat_set(struct f2fs_sb_info *sbi,
 		raw_nat_from_node_info(raw_ne, &ne->ni);
 //		nat_reset_flag(ne);
 	//	printk("(%s:%d) merge nat entry nid : %u, %u", __func__, __LINE__, nid, nat_get_blkaddr(ne));
-		del_from_log_tree(sbi, set, ne);
 	}
-	//update_nat_bits(sbi, start_nid, page);
 	//sync nat page;
 	if(!clear_page_dirty_for_io(page)){
 		printk("(%s : %d) error during clear page dirty flag",
 				__func__, __LINE__);
 		return -1;
 	}
-	if (f2fs_sync_single_meta_page(page)) {
+	//nat bits share words with the blocks of other zones
+	spin_lock(&sbi->meta_merge_lock);
+	update_nat_bits(sbi, start_nid, page); 
+	spin_unlock(&sbi->meta_merge_lock);
+	if (f2fs_write_merged_meta_page(unit, page)) {
 		unlock_page(page);
+		f2fs_put_page(page, 0);
 		printk("(%s : %d) error during sync log meta page",
 				__func__, __LINE__);
 		return -1;
 	}
-	update_nat_bits(sbi, set->set * NAT_ENTRY_PER_BLOCK, page); 
 	f2fs_put_page(page, 0);
-	
-	if (set->entry_cnt) { 
-		printk("(%s:%d) error : current set of set no(%u) is not empty!",
-				__func__, __LINE__, set->set);
-	}
 	//printk("(%s:%d) merge nat set done", __func__, __LINE__);
 	return 0;
 }
-int merge_nat(struct f2fs_sb_info *sbi, int foreground){
+/* rebuild one nat zone, runs on the merge workqueue */
+static int merge_nat_zone(struct meta_merge_unit *unit){
+	struct f2fs_sb_info *sbi = unit->sbi;
+	struct nat_entry_set *set;
+	unsigned int boff_in_zone = 0;
+	int wp = 0;	// wp in unit of blk offset in zone
+	unsigned int zone_cap = meta_blks_zone_cap(sbi);
+	int ret = 0;
+	int ra_start = 0, ra_cnt = 0;
+
+	//read ahead the runs of merged blocks, they start from their current
+	//copy. Clean blocks are carried over without the page cache.
+	list_for_each_entry(set, &unit->sets, set_list){
+		boff_in_zone = meta_boff_in_zone(sbi, set->set);
+		if (ra_cnt && boff_in_zone == ra_start + ra_cnt) {
+			ra_cnt++;
+			continue;
+		}
+		f2fs_ra_meta_zone(unit, ra_start, ra_cnt);
+		ra_start = boff_in_zone;
+		ra_cnt = 1;
+	}
+	f2fs_ra_meta_zone(unit, ra_start, ra_cnt);
+
+	//advance once per nat block
+	list_for_each_entry(set, &unit->sets, set_list){
+		boff_in_zone = meta_boff_in_zone(sbi, set->set);
+		//printk("(%s:%d) boff in zone : %u", __func__, __LINE__, boff_in_zone);
+
+		//copy nat blks and move write pointer
+		if (wp < boff_in_zone){
+			wp = advance_meta_zone_wp(unit, wp, (boff_in_zone - wp));
+			if (wp < 0){
+				f2fs_bug_on(sbi, 1);
+				return -1;
+			}
+		}
+		//merge nat entry in log with nat block
+		if ((ret = merge_nat_set(unit, set))){
+			printk("(%s:%d) merge_nat_set error!", __func__, __LINE__);
+			return ret;
+		}
+		wp++;
+	}
+	//finish zone
+	if (wp < zone_cap){
+		wp = advance_meta_zone_wp(unit, wp, (zone_cap - wp));
+		if (wp < 0){
+			f2fs_bug_on(sbi, 1);
+			return -1;
+		}
+	}
+	return 0;
+}
+/* with @defer, sparse zones keep their sets, see merge_nat_bg() */
+static int __merge_nat(struct f2fs_sb_info *sbi, int foreground, bool defer){
 	struct f2fs_nm_info *nm_i = NM_I(sbi);
 	struct nat_entry_set *set, *next;
 	struct nat_entry_set *setvec[SETVEC_SIZE];
+	struct meta_merge_unit *unit = NULL;
 	unsigned int found;
 	nid_t set_idx = 0;
 	LIST_HEAD(sets);
-	unsigned int boff_in_zone = 0;
-	unsigned int cur_zone_offset = 0;
-	int wp = 0;	// wp in unit of blk offset in zone
-	unsigned int zone_cap = meta_blks_zone_cap(sbi);
+	LIST_HEAD(units);
+	LIST_HEAD(deferred);
+	unsigned int budget = 0;
+	bool deferring;
 	int ret = 0;
 	//int i, base, tmp;
 	
@@ -3222,7 +3306,7 @@ int merge_nat(struct f2fs_sb_info *sbi, int foreground){
 	if (foreground) 
 		merge_tree_idx = nm_i->nat_ltree_idx;
 	else
-		merge_tree_idx = nm_i->nat_ltree_idx ^ 0x1;
+		merge_tree_idx = nm_i->nat_ltree_head;
 
 	while ((found = ____gang_lookup_nat_set(set_idx, 
 					SETVEC_SIZE, setvec,
@@ -3238,62 +3322,56 @@ int merge_nat(struct f2fs_sb_info *sbi, int foreground){
 			__adjust_nat_entry_set(setvec[idx], &sets, 0);
 	}
 	
-	set = list_first_entry(&sets, struct nat_entry_set, set_list);
-	cur_zone_offset = meta_boff_to_zoff(sbi, set->set);
-	reset_meta_zone_towrite(sbi, cur_zone_offset, NAT);
-
-	//advance once per nat block
+	// dirty set list -> one unit per nat zone
 	list_for_each_entry_safe(set, next, &sets, set_list){
-		//printk("(%s:%d) nat block of set no : %u", __func__, __LINE__, set->set);
-		if (cur_zone_offset != meta_boff_to_zoff(sbi, set->set)){
-			if (wp < zone_cap){
-				wp = advance_meta_zone_wp(sbi, cur_zone_offset, 
-						wp, (zone_cap - wp), NAT_LOG);
-				if (wp < 0){
-					f2fs_bug_on(sbi, 1);
-					return -1;
-				}
-			}
-			cur_zone_offset = meta_boff_to_zoff(sbi, set->set);
-			// f2fs_bug_on(sbi, zone_offset > SSA_zone_offset);
-			wp = 0;
-			reset_meta_zone_towrite(sbi, cur_zone_offset, NAT);
-		}
-
-		boff_in_zone = meta_boff_in_zone(sbi, set->set);
-		//printk("(%s:%d) boff in zone : %u", __func__, __LINE__, boff_in_zone);
-
-		//copy nat blks and move write pointer
-		if (wp < boff_in_zone){
-			wp = advance_meta_zone_wp(sbi, cur_zone_offset,
-					wp, (boff_in_zone - wp), NAT_LOG);
-			if (wp < 0){
-				f2fs_bug_on(sbi, 1);
-				return -1;
-			}
-		}
-		//merge nat entry in log with nat block
-		if ((ret = merge_nat_set(sbi, set))){
-			printk("(%s:%d) merge_nat_set error!", __func__, __LINE__);
-			return ret;
-		}
-		clean_nat_log_set(sbi, set, foreground);
-		wp++;
+		if (!unit || unit->zone != meta_boff_to_zoff(sbi, set->set))
+			unit = f2fs_add_meta_merge_unit(sbi, &units, NAT,
+					meta_boff_to_zoff(sbi, set->set),
+					foreground, merge_nat_zone);
+		unit->nr_entries += set->entry_cnt;
+		list_move_tail(&set->set_list, &unit->sets);
 	}
-	//finish last zone updated
-	if (wp < zone_cap){
-		wp = advance_meta_zone_wp(sbi, cur_zone_offset, 
-				wp, (zone_cap - wp), NAT_LOG);
-		if (wp < 0){
-			f2fs_bug_on(sbi, 1);
-			return -1;
+
+#if DELAYED_MERGE
+	if (defer)
+		budget = (curlog_size(sbi, NAT_LOG) -
+				curlog_used_blocks(sbi, NAT_LOG)) /
+				META_ZONE_DEFER_ROOM * NAT_LOG_ENTRIES;
+#endif
+	ret = f2fs_merge_meta_zones(sbi, &units, defer ? &deferred : NULL,
+								budget);
+
+	//sets of a deferred zone stay in the log tree to be carried over
+	deferring = !list_empty(&deferred);
+	list_for_each_entry(unit, &deferred, list)
+		list_for_each_entry_safe(set, next, &unit->sets, set_list)
+			list_del(&set->set_list);
+	f2fs_free_meta_merge_units(&deferred);
+
+	list_for_each_entry(unit, &units, list) {
+		//sets of a failed zone stay in the log tree
+		if (!unit->err)
+			nm_i->nat_cnt[LOGGED_NAT] -= unit->nr_entries;
+		list_for_each_entry_safe(set, next, &unit->sets, set_list) {
+			struct nat_entry *ne, *cur;
+
+			list_del(&set->set_list);
+			if (unit->err)
+				continue;
+			list_for_each_entry_safe(ne, cur, &set->entry_list, list)
+				del_from_log_tree(sbi, set, ne);
+			clean_nat_log_set(sbi, set, foreground);
 		}
 	}
+	f2fs_free_meta_merge_units(&units);
+	if (ret)
+		return ret;
 	
 #if DELAYED_MERGE
-	f2fs_bug_on(sbi, !radix_tree_empty(&nm_i->nat_log_root[nm_i->nat_ltree_idx^0x1]));
+	f2fs_bug_on(sbi, !deferring &&
+		!radix_tree_empty(&nm_i->nat_log_root[merge_tree_idx]));
 #else
-	reset_meta_zone_towrite(sbi, cur_zone_offset, NAT_LOG);
+	reset_meta_zone_towrite(sbi, 0, NAT_LOG);
 	NM_I(sbi)->nat_blks_in_log = 0;
 	f2fs_bug_on(sbi, !radix_tree_empty(&nm_i->nat_log_root));
 #endif
@@ -3318,6 +3396,95 @@ int merge_nat(struct f2fs_sb_info *sbi, int foreground){
 #endif
 	return ret;
 }
+int merge_nat(struct f2fs_sb_info *sbi, int foreground){
+	return __merge_nat(sbi, foreground, false);
+}
+#if DELAYED_MERGE
+/* is @nid logged in a tree newer than the head one */
+static bool __newer_nat_log(struct f2fs_sb_info *sbi, nid_t nid)
+{
+	struct f2fs_nm_info *nm_i = NM_I(sbi);
+	struct nat_entry_set *head;
+	unsigned int t;
+
+	for (t = nm_i->nat_ltree_idx; t != nm_i->nat_ltree_head;
+					t = prev_log_gen(sbi, t)) {
+		head = radix_tree_lookup(&nm_i->nat_log_root[t],
+					NAT_BLOCK_OFFSET(nid));
+		if (__lookup_nat_log(head, nid))
+			return true;
+	}
+	return false;
+}
+/*
+ * Turn the entries of a head tree set into dirty nat cache entries, unless
+ * a newer one of the nid exists. The next checkpoint logs them into the
+ * current generation, before the head zone is reused.
+ */
+static void carry_nat_log_set(struct f2fs_sb_info *sbi,
+		struct nat_entry_set *set)
+{
+	struct f2fs_nm_info *nm_i = NM_I(sbi);
+	struct nat_entry *ne, *cur, *e;
+
+	list_for_each_entry_safe(ne, cur, &set->entry_list, list) {
+		nid_t nid = nat_get_nid(ne);
+
+		set->entry_cnt--;
+		set->slots[nid - START_NID(nid)] = NULL;
+		nm_i->nat_cnt[LOGGED_NAT]--;
+		list_del(&ne->list);
+
+		e = __lookup_nat_cache(nm_i, nid);
+		if (!e && !__newer_nat_log(sbi, nid)) {
+			e = __init_nat_entry(nm_i, ne, NULL, true);
+			ne = NULL;
+		}
+		if (e && !get_nat_flag(e, IS_DIRTY))
+			__set_nat_cache_dirty(nm_i, e);
+		if (ne)
+			__free_nat_entry(ne);
+	}
+	clean_nat_log_set(sbi, set, 0);
+}
+/*
+ * Merge the head nat tree in the background. Sparse zones are left for a
+ * later generation: their sets are carried over and logged again.
+ */
+int merge_nat_bg(struct f2fs_sb_info *sbi)
+{
+	struct f2fs_nm_info *nm_i = NM_I(sbi);
+	struct nat_entry_set *setvec[SETVEC_SIZE];
+	struct radix_tree_root *root;
+	unsigned int found;
+	nid_t set_idx = 0;
+	int ret;
+
+	down_read(&nm_i->nat_ltree_slock);
+	ret = __merge_nat(sbi, 0, true);
+	up_read(&nm_i->nat_ltree_slock);
+	if (ret)
+		return ret;
+
+	//nat_tree_lock is taken before nat_ltree_slock
+	down_write(&nm_i->nat_tree_lock);
+	down_read(&nm_i->nat_ltree_slock);
+	root = &nm_i->nat_log_root[nm_i->nat_ltree_head];
+	while ((found = ____gang_lookup_nat_set(set_idx,
+					SETVEC_SIZE, setvec, root))) {
+		unsigned int idx;
+
+		set_idx = setvec[found - 1]->set + 1;
+		for (idx = 0; idx < found; idx++)
+			carry_nat_log_set(sbi, setvec[idx]);
+	}
+	if (set_idx)
+		set_sbi_flag(sbi, SBI_IS_DIRTY);
+	up_read(&nm_i->nat_ltree_slock);
+	up_write(&nm_i->nat_tree_lock);
+	return 0;
+}
+#endif
 #if DELAYED_MERGE
 static int __flush_nat_entry_set(struct f2fs_sb_info *sbi,
 		struct nat_entry_set *set, struct cp_control *cpc)
@@ -3328,7 +3495,7 @@ static int __flush_nat_entry_set(struct f2fs_sb_info *sbi,
 	bool fg_merge = false;
 	unsigned int offset = 0;
 	
-	if ((cpc->reason & CP_UMOUNT))
+	if (log_fg_merge(sbi, cpc))
 		fg_merge = true;
 #if NAIVE_MFZ
   fg_merge = true;
@@ -3376,20 +3543,12 @@ static int __flush_nat_entry_set(struct f2fs_sb_info *sbi,
 				}
 				f2fs_put_page(page, 0);
 
-			if (!has_curlog_space(sbi, 1, NAT_LOG))	{
-				// prepare merge
-				printk("(%s:%d) set merge flag", __func__, __LINE__);
-				if (is_set_ckpt_flags(sbi, CP_NAT_MERGE_FLAG)){
-					f2fs_bug_on(sbi, 1);
-					printk("(%s:%d) NAT_MERGE_FLAG is already set",
-							__func__, __LINE__);
-				}
-				//set_ckpt_flags(sbi, CP_NAT_MERGE_FLAG);
-				// switch log tree;
-				cpc->merge = cpc->merge | 0x2;
-				NM_I(sbi)->cur_nat_log ^= 0x1;
-				NM_I(sbi)->nat_blks_in_log = 0;
-				printk("(%s:%d) nat merge done", __func__, __LINE__);
+			if (!has_curlog_space(sbi, 1, NAT_LOG) &&
+					!cp_switch_log_gen(sbi, cpc, NAT_LOG)) {
+				// the rest goes to the main area with the merge
+				fg_merge = true;
+				page = NULL;
+				goto logged;
 			}
 
 				// allocate new log page
@@ -3412,6 +3571,7 @@ static int __flush_nat_entry_set(struct f2fs_sb_info *sbi,
 
 			offset++;
 		}
+logged:
 		nat_reset_flag(ne);
 		__clear_nat_cache_dirty(NM_I(sbi), set, ne);
 
@@ -3443,28 +3603,16 @@ static int __flush_nat_entry_set(struct f2fs_sb_info *sbi,
 		f2fs_put_page(page, 0);
 		//printk("(%s : %d) n_sits cpu : %x, le : %x", 
 		//		__func__, __LINE__, offset, raw_nat_log->n_nats);
-		if (!has_curlog_space(sbi, 1, NAT_LOG))	{
-			// prepare merge
-			printk("(%s:%d) set merge flag", __func__, __LINE__);
-			if (is_set_ckpt_flags(sbi, CP_NAT_MERGE_FLAG)){
-				f2fs_bug_on(sbi, 1);
-				printk("(%s:%d) NAT_MERGE_FLAG is already set",
-						__func__, __LINE__);
-			}
-			//set_ckpt_flags(sbi, CP_NAT_MERGE_FLAG);
-			cpc->merge = cpc->merge | 0x2;
-			// switch log tree;
-			NM_I(sbi)->cur_nat_log ^= 0x1;
-			NM_I(sbi)->nat_blks_in_log = 0;
-			printk("(%s:%d) set nat merge flag", __func__, __LINE__);
-		}
+		/* on failure the next sets go to the main area */
+		if (!has_curlog_space(sbi, 1, NAT_LOG))
+			cp_switch_log_gen(sbi, cpc, NAT_LOG);
 	} 
 
 
 	/* Allow dirty nats by node block allocation in write_begin */
 	if (!set->entry_cnt) {
 		radix_tree_delete(&NM_I(sbi)->nat_set_root, set->set);
-		kmem_cache_free(nat_entry_set_slab, set);
+		__free_nat_entry_set(set);
 	}
 	return 0;
 }
@@ -3486,16 +3634,12 @@ int f2fs_flush_nat_entries(struct f2fs_sb_info *sbi, struct cp_control *cpc)
 	if (!nm_i->nat_cnt[DIRTY_NAT])
 		return 0;
 #if !NAIVE_MFZ	
-	if((cpc->reason & CP_UMOUNT)) {
+	if (log_fg_merge(sbi, cpc)) {
 		merge = true;
 		fg_merge = true;
 	} else if (!has_curlog_space(sbi, 1, NAT_LOG)){
-		//set_ckpt_flags(sbi, CP_NAT_MERGE_FLAG);
-		printk("(%s:%d) set SSA Merge flag here", __func__, __LINE__);
-		//switch_cur_log(sbi, SSA_LOG);
-		cpc->merge = cpc->merge | 0x2;
-		NM_I(sbi)->cur_nat_log ^= 0x1;
-		NM_I(sbi)->nat_blks_in_log = 0;
+		if (!cp_switch_log_gen(sbi, cpc, NAT_LOG))
+			fg_merge = true;
 		merge = true;
 	}
 #else
@@ -3639,7 +3783,7 @@ static int __flush_nat_entry_set(struct f2fs_sb_info *sbi,
 	/* Allow dirty nats by node block allocation in write_begin */
 	if (!set->entry_cnt) {
 		radix_tree_delete(&NM_I(sbi)->nat_set_root, set->set);
-		kmem_cache_free(nat_entry_set_slab, set);
+		__free_nat_entry_set(set);
 	}
 	return 0;
 }
@@ -3763,7 +3907,7 @@ static int __flush_nat_entry_set(struct f2fs_sb_info *sbi,
 	/* Allow dirty nats by node block allocation in write_begin */
 	if (!set->entry_cnt) {
 		radix_tree_delete(&NM_I(sbi)->nat_set_root, set->set);
-		kmem_cache_free(nat_entry_set_slab, set);
+		__free_nat_entry_set(set);
 	}
 	return 0;
 }
@@ -3915,7 +4059,7 @@ static int init_node_manager(struct f2fs_sb_info *sbi)
 	struct f2fs_nm_info *nm_i = NM_I(sbi);
 	unsigned char *version_bitmap;
 	unsigned int nat_segs;
-	int err;
+	int i, err;
 
 	nm_i->nat_blkaddr = le32_to_cpu(sb_raw->nat_blkaddr);
 #if META_FOR_ZNS
@@ -3942,8 +4086,8 @@ static int init_node_manager(struct f2fs_sb_info *sbi)
 	INIT_RADIX_TREE(&nm_i->nat_set_root, GFP_NOIO);
 #if META_FOR_ZNS
 #if DELAYED_MERGE
-	INIT_RADIX_TREE(&nm_i->nat_log_root[0], GFP_NOIO);
-	INIT_RADIX_TREE(&nm_i->nat_log_root[1], GFP_NOIO);
+	for (i = 0; i < MAX_META_LOG_GENS; i++)
+		INIT_RADIX_TREE(&nm_i->nat_log_root[i], GFP_NOIO);
 #else
 	INIT_RADIX_TREE(&nm_i->nat_log_root, GFP_NOIO);
 #endif
@@ -4026,6 +4170,99 @@ static int init_free_nid_cache(struct f2fs_sb_info *sbi)
 	return 0;
 }
 
+#if DELAYED_MERGE
+static int replay_nat_log_block(struct f2fs_sb_info *sbi, void *blk,
+							void *data)
+{
+	struct f2fs_nat_log_block *raw_nat_log = blk;
+	unsigned int n_nats = le16_to_cpu(raw_nat_log->n_nats);
+	struct node_info ni;
+	unsigned int i;
+	nid_t nid;
+
+	if (n_nats > NAT_LOG_ENTRIES) {
+		f2fs_err(sbi, "Wrong NAT log block with %u entries", n_nats);
+		return -EFSCORRUPTED;
+	}
+
+	for (i = 0; i < n_nats; i++) {
+		nid = le32_to_cpu(nid_in_log(raw_nat_log, i));
+		if (f2fs_check_nid_range(sbi, nid))
+			return -EFSCORRUPTED;
+
+		node_info_from_raw_nat(&ni, &nat_in_log(raw_nat_log, i));
+		ni.nid = nid;
+		__log_node_info(sbi, &ni);
+	}
+	return 0;
+}
+
+/*
+ * Free nids are scanned from the NAT area, apply the replayed log entries
+ * on top of it, from the oldest tree waiting for merge to the current one.
+ */
+static int update_free_nids_from_log(struct f2fs_sb_info *sbi)
+{
+	struct f2fs_nm_info *nm_i = NM_I(sbi);
+	struct nat_entry_set *setvec[SETVEC_SIZE];
+	struct nat_entry *ne;
+	unsigned int found, idx;
+	nid_t set_idx;
+	int t, err = 0;
+
+	down_read(&nm_i->nat_tree_lock);
+	for (t = nm_i->nat_ltree_head; !err; t = next_log_gen(sbi, t)) {
+		struct radix_tree_root *root = &nm_i->nat_log_root[t];
+
+		set_idx = 0;
+		while (!err && (found = ____gang_lookup_nat_set(set_idx,
+					SETVEC_SIZE, setvec, root))) {
+			set_idx = setvec[found - 1]->set + 1;
+			for (idx = 0; idx < found; idx++) {
+				nid_t start_nid = setvec[idx]->set *
+							NAT_ENTRY_PER_BLOCK;
+
+				if (!test_bit_le(setvec[idx]->set,
+						nm_i->nat_block_bitmap)) {
+					struct page *page;
+
+					page = get_current_nat_page(sbi, start_nid);
+					if (IS_ERR(page)) {
+						err = PTR_ERR(page);
+						break;
+					}
+					err = scan_nat_page(sbi, page, start_nid);
+					f2fs_put_page(page, 1);
+					if (err)
+						break;
+				}
+
+				list_for_each_entry(ne, &setvec[idx]->entry_list,
+									list) {
+					nid_t nid = nat_get_nid(ne);
+
+					if (nat_get_blkaddr(ne) == NULL_ADDR) {
+						add_free_nid(sbi, nid, true, true);
+						continue;
+					}
+					remove_free_nid(sbi, nid);
+					spin_lock(&nm_i->nid_list_lock);
+					update_free_nid_bitmap(sbi, nid, false, false);
+					spin_unlock(&nm_i->nid_list_lock);
+				}
+			}
+		}
+		if (t == nm_i->nat_ltree_idx)
+			break;
+	}
+	up_read(&nm_i->nat_tree_lock);
+
+	if (err)
+		f2fs_err(sbi, "NAT is corrupt, run fsck to fix it");
+	return err;
+}
+#endif
+
 int f2fs_build_node_manager(struct f2fs_sb_info *sbi)
 {
 	int err;
@@ -4046,6 +4283,15 @@ int f2fs_build_node_manager(struct f2fs_sb_info *sbi)
 	/* load free nid status from nat_bits table */
 	load_free_nid_bitmap(sbi);
 
+#if DELAYED_MERGE
+	err = f2fs_replay_meta_log(sbi, NAT_LOG, replay_nat_log_block, NULL);
+	if (err)
+		return err;
+	err = update_free_nids_from_log(sbi);
+	if (err)
+		return err;
+#endif
+
 	return f2fs_build_free_nids(sbi, true, true);
 }
 
@@ -4057,6 +4303,9 @@ void f2fs_destroy_node_manager(struct f2fs_sb_info *sbi)
 	struct nat_entry_set *setvec[SETVEC_SIZE];
 	nid_t nid = 0;
 	unsigned int found;
+#if DELAYED_MERGE
+	int t;
+#endif
 
 	if (!nm_i)
 		return;
@@ -4102,9 +4351,33 @@ void f2fs_destroy_node_manager(struct f2fs_sb_info *sbi)
 			/* entry_cnt is not zero, when cp_error was occurred */
 			f2fs_bug_on(sbi, !list_empty(&setvec[idx]->entry_list));
 			radix_tree_delete(&nm_i->nat_set_root, setvec[idx]->set);
-			kmem_cache_free(nat_entry_set_slab, setvec[idx]);
+			__free_nat_entry_set(setvec[idx]);
+		}
+	}
+#if DELAYED_MERGE
+	/* log trees are only left by read-only or failed mounts */
+	for (t = 0; t < MAX_META_LOG_GENS; t++) {
+		nid = 0;
+		while ((found = ____gang_lookup_nat_set(nid, SETVEC_SIZE,
+					setvec, &nm_i->nat_log_root[t]))) {
+			unsigned idx;
+
+			nid = setvec[found - 1]->set + 1;
+			for (idx = 0; idx < found; idx++) {
+				struct nat_entry *ne, *tmp;
+
+				list_for_each_entry_safe(ne, tmp,
+						&setvec[idx]->entry_list, list) {
+					list_del(&ne->list);
+					__free_nat_entry(ne);
+				}
+				radix_tree_delete(&nm_i->nat_log_root[t],
+							setvec[idx]->set);
+				__free_nat_entry_set(setvec[idx]);
+			}
 		}
 	}
+#endif
 	up_write(&nm_i->nat_tree_lock);
 
 	kvfree(nm_i->nat_block_bitmap);
@@ -4147,8 +4420,18 @@ int __init f2fs_create_node_manager_caches(void)
 			sizeof(struct fsync_node_entry));
 	if (!fsync_node_entry_slab)
 		goto destroy_nat_entry_set;
+#if META_FOR_ZNS
+	nat_log_slots_slab = f2fs_kmem_cache_create("f2fs_nat_log_slots",
+			sizeof(struct nat_entry *) * NAT_ENTRY_PER_BLOCK);
+	if (!nat_log_slots_slab)
+		goto destroy_fsync_node_entry;
+#endif
 	return 0;
 
+#if META_FOR_ZNS
+destroy_fsync_node_entry:
+	kmem_cache_destroy(fsync_node_entry_slab);
+#endif
 destroy_nat_entry_set:
 	kmem_cache_destroy(nat_entry_set_slab);
 destroy_free_nid:
@@ -4161,6 +4444,9 @@ fail:
 
 void f2fs_destroy_node_manager_caches(void)
 {
+#if META_FOR_ZNS
+	kmem_cache_destroy(nat_log_slots_slab);
+#endif
 	kmem_cache_destroy(fsync_node_entry_slab);
 	kmem_cache_destroy(nat_entry_set_slab);
 	kmem_cache_destroy(free_nid_slab);
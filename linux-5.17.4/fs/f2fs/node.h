@@ -155,6 +155,9 @@ struct nat_entry_set {
 	struct list_head entry_list;	/* link with dirty nat entries */
 	nid_t set;			/* set number*/
 	unsigned int entry_cnt;		/* the # of nat entries in set */
+#if META_FOR_ZNS
+	struct nat_entry **slots;	/* log sets: entry of each nid in block */
+#endif
 };
 
 struct free_nid {
@@ -37,6 +37,9 @@ static struct kmem_cache *discard_cmd_slab;
 static struct kmem_cache *sit_entry_set_slab;
 static struct kmem_cache *ssa_set_slab;
 static struct kmem_cache *inmem_entry_slab;
+#ifdef CONFIG_BLK_DEV_ZONED
+static struct kmem_cache *zone_mgmt_cmd_slab;
+#endif
 
 static unsigned long __reverse_ulong(unsigned char *str)
 {
@@ -863,6 +866,9 @@ static void __locate_dirty_segment(struct f2fs_sb_info *sbi, unsigned int segno,
 
 			if (!IS_CURSEC(sbi, secno))
 				set_bit(secno, dirty_i->dirty_secmap);
+#if GC_VICTIM_INDEX
+			f2fs_update_victim_index(sbi, secno);
+#endif
 		}
 	}
 }
@@ -897,15 +903,87 @@ static void __remove_dirty_segment(struct f2fs_sb_info *sbi, unsigned int segno,
 			if (!valid_blocks ||
 					valid_blocks == BLKS_PER_SEC(sbi)) {
 				clear_bit(secno, dirty_i->dirty_secmap);
+#if GC_VICTIM_INDEX
+				f2fs_update_victim_index(sbi, secno);
+#endif
 				return;
 			}
 
 			if (!IS_CURSEC(sbi, secno))
 				set_bit(secno, dirty_i->dirty_secmap);
+#if GC_VICTIM_INDEX
+			f2fs_update_victim_index(sbi, secno);
+#endif
 		}
 	}
 }
 
+#if GC_VICTIM_INDEX
+/*
+ * Move @secno to the bucket of its valid blocks, or out of the index once
+ * it left dirty_secmap. Callers hold seglist_lock; locate_dirty_segment()
+ * follows every update_sit_entry(), which keeps the buckets current.
+ */
+void f2fs_update_victim_index(struct f2fs_sb_info *sbi, unsigned int secno)
+{
+	struct dirty_seglist_info *dirty_i = DIRTY_I(sbi);
+	struct victim_index *vi = &dirty_i->victim_index;
+	unsigned int old, new = NULL_VICTIM_BUCKET;
+
+	if (!vi->buckets)
+		return;
+
+	if (test_bit(secno, dirty_i->dirty_secmap))
+		new = min(get_valid_blocks(sbi, GET_SEG_FROM_SEC(sbi, secno),
+				true) >> sbi->log_blocks_per_seg,
+				vi->nr_buckets - 1);
+	old = vi->sec_bucket[secno];
+	if (old == new)
+		return;
+
+	if (old != NULL_VICTIM_BUCKET) {
+		list_del(&vi->sec_node[secno]);
+		if (!--vi->bucket_cnt[old])
+			clear_bit(old, vi->nonempty);
+	}
+	vi->sec_bucket[secno] = new;
+	if (new != NULL_VICTIM_BUCKET) {
+		list_add_tail(&vi->sec_node[secno], &vi->buckets[new]);
+		if (!vi->bucket_cnt[new]++)
+			set_bit(new, vi->nonempty);
+	}
+}
+
+/* valid blocks of a section in use bypass the index, see below */
+static void mark_victim_index_stale(struct f2fs_sb_info *sbi,
+						unsigned int secno)
+{
+	struct victim_index *vi = &DIRTY_I(sbi)->victim_index;
+
+	if (vi->stale)
+		set_bit(secno, vi->stale);
+}
+
+/*
+ * Re-bucket the sections whose valid blocks changed while they were in
+ * use, so that a walk of the index sees every section in its bucket.
+ * Callers hold seglist_lock.
+ */
+void f2fs_refresh_victim_index(struct f2fs_sb_info *sbi)
+{
+	struct victim_index *vi = &DIRTY_I(sbi)->victim_index;
+	unsigned int secno;
+
+	if (!vi->buckets)
+		return;
+
+	for_each_set_bit(secno, vi->stale, MAIN_SECS(sbi)) {
+		clear_bit(secno, vi->stale);
+		f2fs_update_victim_index(sbi, secno);
+	}
+}
+#endif
+
 /*
  * Should not occur error such as -ENOMEM.
  * Adding dirty entry into seglist is not critical operation.
@@ -917,13 +995,18 @@ static void locate_dirty_segment(struct f2fs_sb_info *sbi, unsigned int segno)
 	unsigned short valid_blocks, ckpt_valid_blocks;
 	unsigned int usable_blocks;
 
-#if STRIPE
-	if (segno == NULL_SEGNO || IS_CURSEG(sbi, segno) || is_inuse_seg(sbi, segno))
+	if (segno == NULL_SEGNO)
 		return;
+#if STRIPE
+	if (IS_CURSEG(sbi, segno) || is_inuse_seg(sbi, segno)) {
 #else
-	if (segno == NULL_SEGNO || IS_CURSEG(sbi, segno))
-		return;
+	if (IS_CURSEG(sbi, segno)) {
 #endif
+#if GC_VICTIM_INDEX
+		mark_victim_index_stale(sbi, GET_SEC_FROM_SEG(sbi, segno));
+#endif
+		return;
+	}
 	//printk("(%s : %d) locate dirty seg: %u, %u", 
 	//		__func__, __LINE__, segno, is_inuse_seg(sbi,segno));
 
@@ -1868,6 +1951,87 @@ static int issue_discard_thread(void *data)
 }
 
 #ifdef CONFIG_BLK_DEV_ZONED
+static atomic_t *zone_mgmt_inflight(struct f2fs_sb_info *sbi,
+						enum req_opf op)
+{
+	if (op == REQ_OP_ZONE_FINISH)
+		return &sbi->zone_finishing;
+	return &sbi->zone_resetting;
+}
+
+static void f2fs_zone_mgmt_end_io(struct bio *bio)
+{
+	struct zone_mgmt_cmd *zc = bio->bi_private;
+	struct f2fs_sb_info *sbi = zc->sbi;
+	int err = blk_status_to_errno(bio->bi_status);
+
+	if (err) {
+		f2fs_warn(sbi, "zone %s failed at sector %llu (%d)",
+			  zc->op == REQ_OP_ZONE_FINISH ? "finish" : "reset",
+			  (unsigned long long)bio->bi_iter.bi_sector, err);
+		if (zc->op == REQ_OP_ZONE_RESET)
+			cmpxchg(&sbi->zone_reset_err, 0, err);
+	}
+	if (zc->op == REQ_OP_ZONE_FINISH && zc->segno != NULL_SEGNO)
+		get_sec_entry(sbi, zc->segno)->inuse = 0;
+
+	if (atomic_dec_and_test(zone_mgmt_inflight(sbi, zc->op)))
+		wake_up_all(&sbi->zone_mgmt_wait);
+	kmem_cache_free(zone_mgmt_cmd_slab, zc);
+	bio_put(bio);
+}
+
+/*
+ * Issue FINISH or RESET for the zones in [sector, sector + nr_sects)
+ * without waiting. Each zone gets a bio chained to the next one, so the
+ * last bio completes the command; callers plug to batch several ranges.
+ * A FINISH with @segno releases that section once the zones are full.
+ * Zones being reset must not be reused before f2fs_wait_zone_resets().
+ */
+void f2fs_issue_zone_mgmt(struct f2fs_sb_info *sbi, struct block_device *bdev,
+			enum req_opf op, sector_t sector, sector_t nr_sects,
+			unsigned int segno)
+{
+	sector_t zone_sects = bdev_zone_sectors(bdev);
+	sector_t end = sector + nr_sects;
+	struct zone_mgmt_cmd *zc;
+	struct bio *bio = NULL;
+
+	if (!nr_sects || !zone_sects)
+		return;
+
+	zc = f2fs_kmem_cache_alloc(zone_mgmt_cmd_slab, GFP_NOFS, true, NULL);
+	zc->sbi = sbi;
+	zc->op = op;
+	zc->segno = segno;
+	atomic_inc(zone_mgmt_inflight(sbi, op));
+
+	for (; sector < end; sector += zone_sects) {
+		bio = blk_next_bio(bio, 0, GFP_NOFS);
+		bio_set_dev(bio, bdev);
+		bio->bi_opf = op | REQ_SYNC;
+		bio->bi_iter.bi_sector = sector;
+	}
+	bio->bi_private = zc;
+	bio->bi_end_io = f2fs_zone_mgmt_end_io;
+	submit_bio(bio);
+}
+
+/* wait for issued zone resets, return the first error among them */
+int f2fs_wait_zone_resets(struct f2fs_sb_info *sbi)
+{
+	wait_event(sbi->zone_mgmt_wait, !atomic_read(&sbi->zone_resetting));
+	return xchg(&sbi->zone_reset_err, 0);
+}
+
+void f2fs_wait_zone_mgmt(struct f2fs_sb_info *sbi)
+{
+	wait_event(sbi->zone_mgmt_wait,
+			!atomic_read(&sbi->zone_finishing) &&
+			!atomic_read(&sbi->zone_resetting));
+}
+
+/* queues the reset of a sequential zone, see f2fs_wait_zone_resets() */
 static int __f2fs_issue_discard_zone(struct f2fs_sb_info *sbi,
 		struct block_device *bdev, block_t blkstart, block_t blklen)
 {
@@ -1898,8 +2062,9 @@ static int __f2fs_issue_discard_zone(struct f2fs_sb_info *sbi,
 			return -EIO;
 		}
 		trace_f2fs_issue_reset_zone(bdev, blkstart);
-		return blkdev_zone_mgmt(bdev, REQ_OP_ZONE_RESET,
-					sector, nr_sects, GFP_NOFS);
+		f2fs_issue_zone_mgmt(sbi, bdev, REQ_OP_ZONE_RESET,
+					sector, nr_sects, NULL_SEGNO);
+		return 0;
 	}
 
 	/* For conventional zones, use regular discard if supported */
@@ -2134,6 +2299,12 @@ next:
 	}
 	mutex_unlock(&dirty_i->seglist_lock);
 
+#ifdef CONFIG_BLK_DEV_ZONED
+	/* freed sections are reusable only once their zones are reset */
+	if (f2fs_sb_has_blkzoned(sbi))
+		f2fs_wait_zone_resets(sbi);
+#endif
+
 	if (!f2fs_block_unit_discard(sbi))
 		goto wakeup;
 
@@ -2515,6 +2686,62 @@ struct page *f2fs_get_sum_page(struct f2fs_sb_info *sbi, unsigned int segno)
 	return f2fs_get_meta_page_retry(sbi, GET_SUM_BLOCK(sbi, segno));
 }
 
+#if META_FOR_ZNS
+/*
+ * Readahead the summary blocks of [@start_segno, @end_segno). One in the
+ * log trees is copied in place, the others are read from their current SSA
+ * zone under one plug, so blocks contiguous on disk merge into one request.
+ * Racing a merge can only fill the zone half it just switched away from.
+ */
+void f2fs_ra_sum_pages(struct f2fs_sb_info *sbi, unsigned int start_segno,
+						unsigned int end_segno)
+{
+	struct f2fs_io_info fio = {
+		.sbi = sbi,
+		.type = META,
+		.op = REQ_OP_READ,
+		.op_flags = REQ_META | REQ_PRIO,
+		.encrypted_page = NULL,
+		.in_list = false,
+	};
+	struct blk_plug plug;
+	unsigned int segno;
+
+	blk_start_plug(&plug);
+	for (segno = start_segno; segno < end_segno; segno++) {
+		block_t blkaddr = GET_SUM_BLOCK(sbi, segno);
+		struct page *page;
+
+		page = f2fs_grab_cache_page(META_MAPPING(sbi), blkaddr, false);
+		if (!page)
+			continue;
+		if (PageUptodate(page)) {
+			f2fs_put_page(page, 1);
+			continue;
+		}
+#if DELAYED_MERGE && !NAIVE_MFZ
+		/* newer than the SSA zone, as do_garbage_collect() reads it */
+		memset(page_address(page), 0, PAGE_SIZE);
+		if (copy_ssa_log(sbi, segno, page_address(page))) {
+			SetPageUptodate(page);
+			f2fs_put_page(page, 1);
+			continue;
+		}
+#endif
+		fio.page = page;
+		fio.old_blkaddr = blkaddr;
+		fio.new_blkaddr = blkaddr;
+		if (f2fs_submit_page_bio(&fio)) {
+			f2fs_put_page(page, 1);
+			continue;
+		}
+		f2fs_put_page(page, 0);
+		f2fs_update_iostat(sbi, FS_META_READ_IO, F2FS_BLKSIZE);
+	}
+	blk_finish_plug(&plug);
+}
+#endif
+
 
 void f2fs_update_meta_page(struct f2fs_sb_info *sbi,
 					void *src, block_t blk_addr)
@@ -2527,11 +2754,45 @@ void f2fs_update_meta_page(struct f2fs_sb_info *sbi,
 }
 
 #if META_FOR_ZNS
-static void insert_ssa_log(struct f2fs_sb_info *sbi, unsigned int segno,
-		struct f2fs_summary_block *sum_blk){
+/* everything in @set is in the log now */
+static inline void ssa_set_logged(struct ssa_set *set)
+{
+	bitmap_zero(set->delta_map, ENTRIES_IN_SUM);
+	set->nr_deltas = 0;
+	set->footer_delta = false;
+	set->log_full = false;
+}
+
+/* mark the entries of @set that @entries is about to change */
+static void ssa_set_track_delta(struct ssa_set *set,
+		struct f2fs_summary *entries, struct summary_footer *footer)
+{
+	int i;
+
+	if (set->log_full)
+		return;
+	for (i = 0; i < ENTRIES_IN_SUM; i++) {
+		if (test_bit(i, set->delta_map) ||
+			!memcmp(&set->entries[i], &entries[i], SUMMARY_SIZE))
+			continue;
+		__set_bit(i, set->delta_map);
+		if (++set->nr_deltas > SUM_LOG_DELTA_MAX) {
+			/* cheaper to log the whole block */
+			set->log_full = true;
+			return;
+		}
+	}
+	if (memcmp(&set->footer, footer, SUM_FOOTER_SIZE))
+		set->footer_delta = true;
+}
+
+static struct ssa_set *__insert_ssa_log(struct f2fs_sb_info *sbi,
+		unsigned int segno,
+		struct f2fs_summary *entries, struct summary_footer *footer,
+		unsigned long long ckpt_ver){
 	struct ssa_set *head;
-	unsigned long long ckpt_ver;
 	struct radix_tree_root *root;
+	struct ssa_set *base = NULL;
 #if DELAYED_MERGE
 	root = &SM_I(sbi)->ssa_log_root[SM_I(sbi)->cur_log_tree_idx];
 #else
@@ -2540,29 +2801,59 @@ static void insert_ssa_log(struct f2fs_sb_info *sbi, unsigned int segno,
 	
 	if (!root) {
 		f2fs_bug_on(sbi, 1);
-		return;
+		return NULL;
 	}
 	head = radix_tree_lookup(root, segno);
 	if(!head){
 		head = f2fs_kmem_cache_alloc(ssa_set_slab,
 				GFP_NOFS, true, NULL);
 		INIT_LIST_HEAD(&head->set_list);
+		INIT_LIST_HEAD(&head->delta_list);
+		seqlock_init(&head->seqlock);
 		head->segno = segno;
+		ssa_set_logged(head);
+#if DELAYED_MERGE
+		/*
+		 * an older log still has this segment, diff against it.
+		 * The merge may drop it meanwhile, see clean_ssa_set().
+		 */
+		rcu_read_lock();
+		if (SM_I(sbi)->cur_log_tree_idx != SM_I(sbi)->ssa_ltree_head)
+			base = __lookup_ssa_log(sbi, segno,
+				prev_log_gen(sbi, SM_I(sbi)->cur_log_tree_idx));
+#endif
+		if (base) {
+			memcpy(head->entries, base->entries, SUM_ENTRY_SIZE);
+			memcpy(&head->footer, &base->footer, SUM_FOOTER_SIZE);
+		} else {
+			head->log_full = true;
+		}
+#if DELAYED_MERGE
+		rcu_read_unlock();
+#endif
 		f2fs_radix_tree_insert(root, segno, head);
 //		printk("(%s : %d) tree insert", __func__, __LINE__);
 	}
 
-	memcpy(head->entries, sum_blk->entries, SUM_ENTRY_SIZE);
-	memcpy(&head->footer, &sum_blk->footer, SUM_FOOTER_SIZE);
+	ssa_set_track_delta(head, entries, footer);
+	write_seqlock(&head->seqlock);
+	memcpy(head->entries, entries, SUM_ENTRY_SIZE);
+	memcpy(&head->footer, footer, SUM_FOOTER_SIZE);
+	write_sequnlock(&head->seqlock);
 	
 	// for versioning log
-	ckpt_ver = cur_cp_version(F2FS_CKPT(sbi));
 	head->cp_ver = ckpt_ver;
 
 	SM_I(sbi)->logged_sum_blks++;
 	SM_I(sbi)->sum_log_tree_entries++;
 	//printk("(%s : %d) insert ssa set of segno(%u)", 
 	//		__func__, __LINE__, segno);
+	return head;
+}
+static void insert_ssa_log(struct f2fs_sb_info *sbi, unsigned int segno,
+		struct f2fs_summary_block *sum_blk){
+	__insert_ssa_log(sbi, segno, sum_blk->entries, &sum_blk->footer,
+			cur_cp_version(F2FS_CKPT(sbi)));
 }
 static inline void sum_blk_to_sum_log(struct f2fs_summary_block *sum_blk,
 			struct f2fs_sum_log_block *raw_sum_log){
@@ -2571,13 +2862,32 @@ static inline void sum_blk_to_sum_log(struct f2fs_summary_block *sum_blk,
 	memcpy(&raw_sum_log->footer, &sum_blk->footer, 
 			SUM_FOOTER_SIZE);
 }
+static int sync_sum_log_page(struct page *page)
+{
+	int ret;
+
+	//sync meta log
+	if (!clear_page_dirty_for_io(page)){
+		printk("(%s : %d) error during clear page dirty flag",
+				__func__, __LINE__);
+		return -1;
+	}
+
+	if ((ret = f2fs_sync_single_meta_page(page))) {
+		unlock_page(page);
+		printk("(%s : %d) error during sync log meta page",
+				__func__, __LINE__);
+	} 
+	f2fs_put_page(page, 0);
+	 
+	return ret;
+}
 static int write_sum_log_page(struct f2fs_sb_info *sbi,
 			unsigned int segno,
 			struct f2fs_summary_block *sum_blk)
 {
 	struct page *page;
 	struct f2fs_sum_log_block *raw_sum_log;
-	int ret = 0;
 	if(segno >= SM_I(sbi)->main_segments) {
 //		printk("(%s : %d) error : invalid segno", __func__, __LINE__);
 		f2fs_bug_on(sbi, 1);
@@ -2596,21 +2906,7 @@ static int write_sum_log_page(struct f2fs_sb_info *sbi,
 
 	sum_blk_to_sum_log(sum_blk, raw_sum_log);
 
-	//sync meta log
-	if (!clear_page_dirty_for_io(page)){
-		printk("(%s : %d) error during clear page dirty flag",
-				__func__, __LINE__);
-		return -1;
-	}
-
-	if ((ret = f2fs_sync_single_meta_page(page))) {
-		unlock_page(page);
-		printk("(%s : %d) error during sync log meta page",
-				__func__, __LINE__);
-	} 
-	f2fs_put_page(page, 0);
-	 
-	return ret;
+	return sync_sum_log_page(page);
 }
 #endif //META_FOR_ZNS
 static void write_sum_page(struct f2fs_sb_info *sbi,
@@ -2619,6 +2915,76 @@ static void write_sum_page(struct f2fs_sb_info *sbi,
 	f2fs_update_meta_page(sbi, (void *)sum_blk, blk_addr);
 }
 
+#ifdef CONFIG_BLK_DEV_ZONED
+/*
+ * Rewrite the summary entry of a block whose owner is only known after the
+ * write, i.e. a Zone Append that landed elsewhere than it was allocated.
+ * Caller should hold f2fs_lock_op().
+ */
+void f2fs_update_sum_entry(struct f2fs_sb_info *sbi, block_t blkaddr,
+					struct f2fs_summary *sum)
+{
+	unsigned int segno = GET_SEGNO(sbi, blkaddr);
+	unsigned int blkoff = GET_BLKOFF_FROM_SEG0(sbi, blkaddr);
+	struct curseg_info *curseg =
+			CURSEG_I(sbi, get_seg_entry(sbi, segno)->type);
+	struct f2fs_summary_block *sum_blk;
+	struct page *page;
+
+	mutex_lock(&curseg->curseg_mutex);
+	if (curseg->segno == segno) {
+		curseg->sum_blk->entries[blkoff] = *sum;
+		goto out;
+	}
+
+	/* the segment was closed already, log its summary block again */
+	page = f2fs_get_sum_page(sbi, segno);
+	if (IS_ERR(page))
+		goto out;
+	sum_blk = (struct f2fs_summary_block *)page_address(page);
+	sum_blk->entries[blkoff] = *sum;
+#if META_FOR_ZNS
+	insert_ssa_log(sbi, segno, sum_blk);
+#endif
+	set_page_dirty(page);
+	f2fs_put_page(page, 1);
+out:
+	mutex_unlock(&curseg->curseg_mutex);
+}
+
+/*
+ * A zone takes either appends or positional writes, so the choice is made
+ * per log: a log is appended only if all of its blocks come from page cache
+ * fios. Without a log of its own, GC moves blocks into the cold data log
+ * with positional writes. A block allocated without a fio turns its zone
+ * to positional writes until the section is freed.
+ */
+static bool __log_use_zone_append(struct f2fs_sb_info *sbi, int type)
+{
+	if (!test_opt(sbi, ZONE_APPEND))
+		return false;
+#if GC_LOG
+	return type <= CURSEG_COLD_DATA;
+#else
+	return type < CURSEG_COLD_DATA;
+#endif
+}
+
+static bool __use_zone_append(struct f2fs_sb_info *sbi,
+			struct f2fs_io_info *fio, int type, block_t blkaddr)
+{
+	if (!__log_use_zone_append(sbi, type))
+		return false;
+	/* compression is refused with zone_append */
+	f2fs_bug_on(sbi, fio->type != DATA || fio->compressed_page);
+	if (test_bit(GET_SEC_FROM_SEG(sbi, GET_SEGNO(sbi, blkaddr)),
+					FREE_I(sbi)->positional_secmap))
+		return false;
+	return f2fs_blkz_is_seq(sbi,
+			f2fs_target_device_index(sbi, blkaddr), blkaddr);
+}
+#endif
+
 static void write_current_sum_page(struct f2fs_sb_info *sbi,
 						int type, block_t blk_addr)
 {
@@ -2858,8 +3224,6 @@ static void new_curseg_striped(struct f2fs_sb_info *sbi,
 	unsigned int old_segno;
 	int dir = ALLOC_LEFT;
   bool new_sec = false;
-  unsigned int old_start;
-  unsigned int max_size = 128;
 
 
 	if (curseg->inited){
@@ -2878,14 +3242,18 @@ static void new_curseg_striped(struct f2fs_sb_info *sbi,
 
   spin_lock(&curseg->active_lock); 
 
-  if ((curseg->active_end - curseg->active_start) % max_size < curseg->wanted_size) {
-    curseg->active_end = (curseg->active_end + 1) % max_size;
-    if (!curseg->active_end)
-      curseg->active_end = max_size;
-  }
+  // grow the stripe by a slot per allocation up to the wanted size
+  if (curseg->active_end < curseg->wanted_size &&
+      curseg->active_end < SM_I(sbi)->stripe_slots)
+    curseg->active_end++;
 
+  // left before it is full, going on in the section would leave a hole
+  if (curseg->inited &&
+      curseg->next_blkoff < f2fs_usable_blks_in_seg(sbi, segno) &&
+      stripe_zone_close(curseg, curseg->active_zones[curseg->cursor])) {
+    curseg->active_zones[curseg->cursor] = NULL_SEGNO;
   //current section is exhausted
-  if (((segno + 1) % sbi->segs_per_sec >= 
+  } else if (((segno + 1) % sbi->segs_per_sec >= 
     f2fs_usable_zone_segs_in_sec(sbi, segno))) { // for zone cap < zone size
 	  get_sec_entry(sbi, segno)->inuse = 0;
 
@@ -2896,25 +3264,15 @@ static void new_curseg_striped(struct f2fs_sb_info *sbi,
   
   // adjust cursor
   if (curseg->cursor >= curseg->active_end) {
-    spin_lock(&curseg->inactive_lock);
-
   // stripe size decrease by monitor thread
-    curseg->inactive_zones[curseg->inactive_end] = 
-      curseg->active_zones[curseg->cursor];
-    curseg->inactive_end++;
-    curseg->active_zones[curseg->cursor] = NULL_SEGNO;
-
-    spin_unlock(&curseg->inactive_lock);
-    curseg->cursor = curseg->active_start;
-  } else {
-  //ring buf next
-    curseg->cursor = curseg->cursor + 1;
-    if (curseg->cursor >= curseg->active_end) {
-      curseg->cursor = curseg->active_start;
-    } 
-    else {
-      curseg->cursor = curseg->cursor % max_size;
+    if (stripe_zone_deactivate(curseg,
+          curseg->active_zones[curseg->cursor])) {
+      curseg->active_zones[curseg->cursor] = NULL_SEGNO;
+      curseg->cursor = 0;
     }
+    // else no room to park it, keep filling it until there is
+  } else if (++curseg->cursor >= curseg->active_end) {
+    curseg->cursor = 0;
   }
 
   segno = curseg->active_zones[curseg->cursor];
@@ -2922,47 +3280,14 @@ static void new_curseg_striped(struct f2fs_sb_info *sbi,
 
   // A case need to allocate new section
   if (segno == NULL_SEGNO){
-    if (curseg->reclaimable_start != curseg->reclaimable_end) {
-      printk("%s:%d move reclaim to active", __func__, __LINE__);
-      spin_lock(&curseg->reclaimable_lock); 
-      if (curseg->reclaimable_start != curseg->reclaimable_end) {
-        
-        old_start = curseg->reclaimable_start++;
-        if (curseg->reclaimable_start > 127) {
-          curseg->reclaimable_start = 0;
-        }
-        curseg->active_zones[curseg->cursor] = curseg->reclaimable_zones[old_start];
-      }
-      spin_unlock(&curseg->reclaimable_lock); 
-      segno = curseg->active_zones[curseg->cursor];
-    }
-  // if inactive is not empty, change a zone into active
-    else if (curseg->inactive_start != curseg->inactive_end) {
-      printk("%s:%d move inactive to active", __func__, __LINE__);
-      spin_lock(&curseg->inactive_lock); 
-      if (curseg->inactive_start != curseg->inactive_end) {
-        old_start = curseg->inactive_start++;
-        if (curseg->inactive_start > 127) {
-          curseg->inactive_start = 0;
-        }
-        curseg->active_zones[curseg->cursor] = curseg->inactive_zones[old_start];
-      }
-      spin_unlock(&curseg->inactive_lock); 
-      segno = curseg->active_zones[curseg->cursor];
-    } else { 
+    // reopen a section dropped from the stripe before its zone is finished
+    if (!stripe_zone_reactivate(curseg, &segno)) {
       // after initialization
-      printk("%s:%d allocate new section", __func__, __LINE__);
       segno = 0;
       new_sec = true;
 #if ZF2FS_MONITOR
-#if GRID_STRIPE
-//      sbi->f2fs_open_zones += 8;
-      sbi->f2fs_open_zones += SM_I(sbi)->grid_cnt;
-#else
-      sbi->f2fs_open_zones += 1;
+      sbi->f2fs_open_zones += stripe_unit_zones(sbi);
 #endif
-#endif
-//      printk("f2fs_open zones %d", sbi->f2fs_open_zones);
     }
   }
 
@@ -2998,7 +3323,8 @@ static void new_curseg_striped(struct f2fs_sb_info *sbi,
 	unsigned int segno = curseg->segno;
 	unsigned int old_segno;
 	int dir = ALLOC_LEFT;
-	int stripe_cnt = SM_I(sbi)->stripe_min_cnt;
+	struct f2fs_stripe_policy *sp = &F2FS_OPTION(sbi).stripe;
+	int stripe_cnt;
   bool new_sec = false;
   unsigned int cursor;
 
@@ -3011,42 +3337,32 @@ static void new_curseg_striped(struct f2fs_sb_info *sbi,
 				GET_SUM_BLOCK(sbi, segno));
 	}
 
-#if OPT == 1 // statically allocate stripe count // for fileserver
-
-//opt1
-
-  if (seg_type == CURSEG_WARM_NODE) {
-    stripe_cnt = SM_I(sbi)->stripe_max_cnt;
-  }
-  else if (seg_type == CURSEG_WARM_DATA) {//) || seg_type == CURSEG_COLD_DATA) {
-   stripe_cnt = SM_I(sbi)->stripe_cnt;
-  }
-  else {
-    stripe_cnt = SM_I(sbi)->stripe_min_cnt;
-  }
-
-#elif OPT == 2
-//opt 2
-
-  if (seg_type == CURSEG_WARM_DATA) {
-    stripe_cnt = SM_I(sbi)->stripe_max_cnt;
-//    stripe_cnt = 12;
-  }
-  else if (seg_type == CURSEG_WARM_NODE) {//) || seg_type == CURSEG_COLD_DATA) {
-   stripe_cnt = SM_I(sbi)->stripe_cnt;
-  }
-  else {
-    stripe_cnt = SM_I(sbi)->stripe_min_cnt;
-  }
-#elif OPT == 3
-  if (seg_type == CURSEG_WARM_DATA) {
-    stripe_cnt = SM_I(sbi)->stripe_max_cnt;
-  } else {
-    stripe_cnt = SM_I(sbi)->stripe_cnt;
+  switch (sp->opt) {
+  case 1: // statically allocate stripe count // for fileserver
+    if (seg_type == CURSEG_WARM_NODE)
+      stripe_cnt = sp->max_cnt;
+    else if (seg_type == CURSEG_WARM_DATA)
+      stripe_cnt = sp->stripe_cnt;
+    else
+      stripe_cnt = sp->min_cnt;
+    break;
+  case 2:
+    if (seg_type == CURSEG_WARM_DATA)
+      stripe_cnt = sp->max_cnt;
+    else if (seg_type == CURSEG_WARM_NODE)
+      stripe_cnt = sp->stripe_cnt;
+    else
+      stripe_cnt = sp->min_cnt;
+    break;
+  case 3:
+    if (seg_type == CURSEG_WARM_DATA)
+      stripe_cnt = sp->max_cnt;
+    else
+      stripe_cnt = sp->stripe_cnt;
+    break;
+  default:
+    stripe_cnt = sp->stripe_cnt;
   }
-#else //OPT
-  stripe_cnt = SM_I(sbi)->stripe_cnt;
-#endif //OPT
 	if (seg_type == CURSEG_WARM_DATA || seg_type == CURSEG_COLD_DATA) {
 		dir = ALLOC_RIGHT;
   }
@@ -3057,6 +3373,12 @@ static void new_curseg_striped(struct f2fs_sb_info *sbi,
 	
 	if (!stripe_cnt)
 		stripe_cnt = 1;
+	/* left before it is full, the section is not written any more */
+	if (curseg->inited &&
+		curseg->next_blkoff < f2fs_usable_blks_in_seg(sbi, segno)) {
+		get_sec_entry(sbi, segno)->inuse = 0;
+		curseg->allocated_segs[curseg->stripe_idx] = NULL_SEGNO;
+	}
 	curseg->stripe_idx = (curseg->stripe_idx + 1) % stripe_cnt;
 	segno = curseg->allocated_segs[curseg->stripe_idx];
 	old_segno = segno;
@@ -3089,32 +3411,114 @@ static void new_curseg_striped(struct f2fs_sb_info *sbi,
 				prandom_u32() % sbi->max_fragment_chunk + 1;
 }
 #endif //DYNAMIC_STRIPE
-#endif //STRIPE
-
-static int __next_free_blkoff(struct f2fs_sb_info *sbi,
-					int segno, block_t start)
+#if GC_LOG
+/*
+ * The GC and lifetime logs are opened by their first write, with one slot
+ * the way new_curseg_striped() fills an empty one. Caller holds
+ * curseg_mutex and sentry_lock.
+ */
+static void open_striped_log(struct f2fs_sb_info *sbi, int type)
 {
-	struct seg_entry *se = get_seg_entry(sbi, segno);
-	int entries = SIT_VBLOCK_MAP_SIZE / sizeof(unsigned long);
-	unsigned long *target_map = SIT_I(sbi)->tmp_map;
-	unsigned long *ckpt_map = (unsigned long *)se->ckpt_valid_map;
-	unsigned long *cur_map = (unsigned long *)se->cur_valid_map;
-	int i;
+	struct curseg_info *curseg = CURSEG_I(sbi, type);
+	unsigned int segno = 0;
 
-	for (i = 0; i < entries; i++)
-		target_map[i] = ckpt_map[i] | cur_map[i];
+	get_new_segment(sbi, &segno, true, ALLOC_RIGHT);
+	curseg->next_segno = segno;
+	reset_curseg(sbi, type, 1);
+	curseg->alloc_type = LFS;
 
-	return __find_rev_next_zero_bit(target_map, sbi->blocks_per_seg, start);
+	spin_lock(&curseg->active_lock);
+	curseg->active_zones[0] = segno;
+	curseg->active_end = 1;
+	curseg->cursor = 0;
+	spin_unlock(&curseg->active_lock);
+
+	get_sec_entry(sbi, segno)->inuse = curseg->seg_type + 1;
+#if ZF2FS_MONITOR
+	sbi->f2fs_open_zones += stripe_unit_zones(sbi);
+#endif
+	stat_inc_seg_type(sbi, curseg);
 }
+
 /*
- * If a segment is written by LFS manner, next block offset is just obtained
- * by increasing the current block offset. However, if a segment is written by
- * SSR manner, next block offset obtained by calling __next_free_blkoff
+ * Close a lazily opened log that took no blocks for a monitor period, so
+ * that it holds no zone until its next write reopens it. The other slots
+ * are parked by f2fs_stripe_trim() already; the current section stops in
+ * the middle of a segment, so it is closed and finished in the next period,
+ * once the writes queued to it are done.
  */
-static void __refresh_next_blkoff(struct f2fs_sb_info *sbi,
-				struct curseg_info *seg)
+void f2fs_close_striped_log(struct f2fs_sb_info *sbi, int type)
 {
-	if (seg->alloc_type == SSR) {
+	struct curseg_info *curseg = CURSEG_I(sbi, type);
+	unsigned int i;
+
+	down_read(&SM_I(sbi)->curseg_lock);
+	mutex_lock(&curseg->curseg_mutex);
+	down_write(&SIT_I(sbi)->sentry_lock);
+
+	if (!curseg->inited)
+		goto out;
+
+	spin_lock(&curseg->active_lock);
+	/* a full inactive fifo left some slots active, try again later */
+	for (i = 0; i < curseg->active_end; i++) {
+		if (i != curseg->cursor &&
+				curseg->active_zones[i] != NULL_SEGNO) {
+			spin_unlock(&curseg->active_lock);
+			goto out;
+		}
+	}
+	if (!stripe_zone_close(curseg, curseg->active_zones[curseg->cursor])) {
+		spin_unlock(&curseg->active_lock);
+		goto out;
+	}
+	curseg->active_zones[curseg->cursor] = NULL_SEGNO;
+	curseg->active_end = 0;
+	curseg->cursor = 0;
+	spin_unlock(&curseg->active_lock);
+
+#if META_FOR_ZNS
+	insert_ssa_log(sbi, curseg->segno, curseg->sum_blk);
+#endif
+	write_sum_page(sbi, curseg->sum_blk, GET_SUM_BLOCK(sbi, curseg->segno));
+
+	curseg->segno = NULL_SEGNO;
+	curseg->inited = false;
+out:
+	up_write(&SIT_I(sbi)->sentry_lock);
+	mutex_unlock(&curseg->curseg_mutex);
+	up_read(&SM_I(sbi)->curseg_lock);
+
+	/* the blocks allocated so far go out before the zone is finished */
+	f2fs_submit_merged_write(sbi, DATA);
+}
+#endif
+#endif //STRIPE
+
+static int __next_free_blkoff(struct f2fs_sb_info *sbi,
+					int segno, block_t start)
+{
+	struct seg_entry *se = get_seg_entry(sbi, segno);
+	int entries = SIT_VBLOCK_MAP_SIZE / sizeof(unsigned long);
+	unsigned long *target_map = SIT_I(sbi)->tmp_map;
+	unsigned long *ckpt_map = (unsigned long *)se->ckpt_valid_map;
+	unsigned long *cur_map = (unsigned long *)se->cur_valid_map;
+	int i;
+
+	for (i = 0; i < entries; i++)
+		target_map[i] = ckpt_map[i] | cur_map[i];
+
+	return __find_rev_next_zero_bit(target_map, sbi->blocks_per_seg, start);
+}
+/*
+ * If a segment is written by LFS manner, next block offset is just obtained
+ * by increasing the current block offset. However, if a segment is written by
+ * SSR manner, next block offset obtained by calling __next_free_blkoff
+ */
+static void __refresh_next_blkoff(struct f2fs_sb_info *sbi,
+				struct curseg_info *seg)
+{
+	if (seg->alloc_type == SSR) {
 		seg->next_blkoff =
 			__next_free_blkoff(sbi, seg->segno,
 						seg->next_blkoff + 1);
@@ -3232,6 +3636,9 @@ static void __f2fs_save_inmem_curseg(struct f2fs_sb_info *sbi, int type)
 		goto out;
 
 	if (get_valid_blocks(sbi, curseg->segno, false)) {
+#if META_FOR_ZNS
+		insert_ssa_log(sbi, curseg->segno, curseg->sum_blk);
+#endif
 		write_sum_page(sbi, curseg->sum_blk,
 				GET_SUM_BLOCK(sbi, curseg->segno));
 	} else {
@@ -3245,10 +3652,21 @@ out:
 
 void f2fs_save_inmem_curseg(struct f2fs_sb_info *sbi)
 {
+#if LIFE_LOG
+	int i;
+
+#endif
 	__f2fs_save_inmem_curseg(sbi, CURSEG_COLD_DATA_PINNED);
 
 	if (sbi->am.atgc_enabled)
 		__f2fs_save_inmem_curseg(sbi, CURSEG_ALL_DATA_ATGC);
+#if GC_LOG
+	__f2fs_save_inmem_curseg(sbi, CURSEG_GC_DATA);
+#endif
+#if LIFE_LOG
+	for (i = CURSEG_LIFE1_DATA; i <= CURSEG_LIFE5_DATA; i++)
+		__f2fs_save_inmem_curseg(sbi, i);
+#endif
 }
 
 static void __f2fs_restore_inmem_curseg(struct f2fs_sb_info *sbi, int type)
@@ -3270,10 +3688,21 @@ out:
 
 void f2fs_restore_inmem_curseg(struct f2fs_sb_info *sbi)
 {
+#if LIFE_LOG
+	int i;
+
+#endif
 	__f2fs_restore_inmem_curseg(sbi, CURSEG_COLD_DATA_PINNED);
 
 	if (sbi->am.atgc_enabled)
 		__f2fs_restore_inmem_curseg(sbi, CURSEG_ALL_DATA_ATGC);
+#if GC_LOG
+	__f2fs_restore_inmem_curseg(sbi, CURSEG_GC_DATA);
+#endif
+#if LIFE_LOG
+	for (i = CURSEG_LIFE1_DATA; i <= CURSEG_LIFE5_DATA; i++)
+		__f2fs_restore_inmem_curseg(sbi, i);
+#endif
 }
 
 static int get_ssr_segment(struct f2fs_sb_info *sbi, int type,
@@ -3775,6 +4204,56 @@ static int __get_segment_type_4(struct f2fs_io_info *fio)
 	}
 }
 
+#if LIFE_LOG
+/*
+ * Pick the lifetime log of a data block that no extension or fadvise has
+ * placed. A write hint wins; otherwise each overwrite folds the age of the
+ * block it replaces, from the mtime of its segment, into the inode's
+ * average. CURSEG_LIFE1_DATA takes averages below 2^LIFE_LOG_BASE_SHIFT
+ * seconds and each next class 4x longer ones; data never overwritten, or
+ * outliving them all, stays warm.
+ */
+static int __get_life_log_type(struct f2fs_io_info *fio, struct inode *inode)
+{
+	struct f2fs_inode_info *fi = F2FS_I(inode);
+	unsigned int life = READ_ONCE(fi->i_data_life);
+	unsigned int class;
+
+	switch (inode->i_write_hint) {
+	case WRITE_LIFE_SHORT:
+		return CURSEG_HOT_DATA;
+	case WRITE_LIFE_MEDIUM:
+		return CURSEG_LIFE3_DATA;
+	case WRITE_LIFE_LONG:
+		return CURSEG_LIFE5_DATA;
+	case WRITE_LIFE_EXTREME:
+		return CURSEG_COLD_DATA;
+	default:
+		break;
+	}
+
+	if (__is_valid_data_blkaddr(fio->old_blkaddr)) {
+		unsigned long long now = get_mtime(fio->sbi, false);
+		unsigned long long born = get_segment_mtime(fio->sbi,
+							fio->old_blkaddr);
+		u64 age = now > born ? min_t(u64, now - born, UINT_MAX) : 1;
+
+		/* segments written before mtime was kept tell nothing */
+		if (born) {
+			life = life ? div_u64((u64)life * 3 + age, 4) : age;
+			WRITE_ONCE(fi->i_data_life, life);
+		}
+	}
+
+	if (!life)
+		return CURSEG_WARM_DATA;
+	class = (fls(life >> LIFE_LOG_BASE_SHIFT) + 1) / 2;
+	if (class >= NR_CURSEG_LIFE_TYPE)
+		return CURSEG_WARM_DATA;
+	return CURSEG_LIFE1_DATA + class;
+}
+#endif
+
 static int __get_segment_type_6(struct f2fs_io_info *fio)
 {
 	if (fio->type == DATA) {
@@ -3789,7 +4268,11 @@ static int __get_segment_type_6(struct f2fs_io_info *fio)
 				(fio->sbi->gc_mode != GC_URGENT_HIGH))
 				return CURSEG_ALL_DATA_ATGC;
 			else
+#if GC_LOG
+				return CURSEG_GC_DATA;
+#else
 				return CURSEG_COLD_DATA;
+#endif
 		}
 		if (file_is_cold(inode) || f2fs_need_compress_data(inode))
 			return CURSEG_COLD_DATA;
@@ -3798,7 +4281,11 @@ static int __get_segment_type_6(struct f2fs_io_info *fio)
 				f2fs_is_atomic_file(inode) ||
 				f2fs_is_volatile_file(inode))
 			return CURSEG_HOT_DATA;
+#if LIFE_LOG
+		return __get_life_log_type(fio, inode);
+#else
 		return f2fs_rw_hint_to_seg_type(inode->i_write_hint);
+#endif
 	} else {
 		if (IS_DNODE(fio->page))
 			return is_cold_node(fio->page) ? CURSEG_WARM_NODE :
@@ -3826,15 +4313,12 @@ static int __get_segment_type(struct f2fs_io_info *fio)
 
 	if (IS_HOT(type))
 		fio->temp = HOT;
-	else if (IS_WARM(type))
+	else if (IS_WARM(type) || IS_LIFE_LOG(type))
 		fio->temp = WARM;
 	else
 		fio->temp = COLD;
 	return type;
 }
-#if ZF2FS_MONITOR
-extern block_t f2fs_monitor_pages[6];
-#endif
 
 void f2fs_allocate_data_block(struct f2fs_sb_info *sbi, struct page *page,
 		block_t old_blkaddr, block_t *new_blkaddr,
@@ -3848,14 +4332,18 @@ void f2fs_allocate_data_block(struct f2fs_sb_info *sbi, struct page *page,
 	struct seg_entry *se = NULL;
 
 #if ZF2FS_MONITOR
-  f2fs_monitor_pages[type]++;
+	f2fs_monitor_inc_pages(sbi, type);
 #endif
 
 	down_read(&SM_I(sbi)->curseg_lock);
 
 	mutex_lock(&curseg->curseg_mutex);
 	down_write(&sit_i->sentry_lock);
-	
+
+#if GC_LOG
+	if (type >= CURSEG_GC_DATA && !curseg->inited)
+		open_striped_log(sbi, type);
+#endif
 #if 0
 	if (fio->io_type == FS_CP_NODE_IO) {
 		printk("(%s:%d) alloc_data_block of CP_NODE",
@@ -3871,6 +4359,12 @@ void f2fs_allocate_data_block(struct f2fs_sb_info *sbi, struct page *page,
 	*new_blkaddr = NEXT_FREE_BLKADDR(sbi, curseg);
 
 	f2fs_bug_on(sbi, curseg->next_blkoff >= sbi->blocks_per_seg);
+#ifdef CONFIG_BLK_DEV_ZONED
+	/* written without a fio, the zone cannot take appends any more */
+	if (!fio && __log_use_zone_append(sbi, type))
+		set_bit(GET_SEC_FROM_SEG(sbi, GET_SEGNO(sbi, *new_blkaddr)),
+					FREE_I(sbi)->positional_secmap);
+#endif
 
 	f2fs_wait_discard_bio(sbi, *new_blkaddr);
 
@@ -3933,10 +4427,22 @@ void f2fs_allocate_data_block(struct f2fs_sb_info *sbi, struct page *page,
 
 		INIT_LIST_HEAD(&fio->list);
 		fio->in_list = true;
-		io = sbi->write_io[fio->type] + fio->temp;
-		spin_lock(&io->io_lock);
-		list_add_tail(&fio->list, &io->io_list);
-		spin_unlock(&io->io_lock);
+#ifdef CONFIG_BLK_DEV_ZONED
+		/* appends may reach the zone in any order, don't queue them */
+		if (__use_zone_append(sbi, fio, type, *new_blkaddr)) {
+			fio->op = REQ_OP_ZONE_APPEND;
+			fio->in_list = false;
+		} else if (fio->op == REQ_OP_ZONE_APPEND) {
+			/* a reused fio, e.g. committing atomic pages */
+			fio->op = REQ_OP_WRITE;
+		}
+#endif
+		if (fio->in_list) {
+			io = sbi->write_io[fio->type] + fio->temp;
+			spin_lock(&io->io_lock);
+			list_add_tail(&fio->list, &io->io_list);
+			spin_unlock(&io->io_lock);
+		}
 	}
 
 	mutex_unlock(&curseg->curseg_mutex);
@@ -4176,7 +4682,8 @@ void f2fs_do_replace_block(struct f2fs_sb_info *sbi, struct f2fs_summary *sum,
 		}
 	}
 
-	f2fs_bug_on(sbi, !IS_DATASEG(type));
+	/* a lifetime log reopened at mount may take recovered blocks */
+	f2fs_bug_on(sbi, !IS_DATASEG(type) && !IS_LIFE_LOG(type));
 	curseg = CURSEG_I(sbi, type);
 
 	mutex_lock(&curseg->curseg_mutex);
@@ -4622,25 +5129,43 @@ static struct page *get_current_sit_page(struct f2fs_sb_info *sbi,
 }
 
 
-static struct page *get_next_sit_page(struct f2fs_sb_info *sbi,
+#if META_FOR_ZNS
+/* build the sit block of @start at its next location, bitmap unchanged */
+static struct page *__get_next_sit_page(struct f2fs_sb_info *sbi,
 					unsigned int start)
 {
 	struct sit_info *sit_i = SIT_I(sbi);
 	struct page *page;
 	pgoff_t dst_off;
-#if META_FOR_ZNS
+
 	dst_off = get_next_meta_blkaddr(sbi, SIT_BLOCK_OFFSET(start),
 			sit_i->sit_base_addr, sit_i->sit_bitmap, 0);
+	page = f2fs_grab_meta_page(sbi, dst_off);
+	seg_info_to_sit_page(sbi, page, start);
+
+	set_page_dirty(page);
+
+	return page;
+}
+#endif //META_FOR_ZNS
+
+static struct page *get_next_sit_page(struct f2fs_sb_info *sbi,
+					unsigned int start)
+{
+	struct sit_info *sit_i = SIT_I(sbi);
+	struct page *page;
+#if META_FOR_ZNS
+	page = __get_next_sit_page(sbi, start);
 #else
-	pgoff_t src_off;
+	pgoff_t src_off, dst_off;
 
 	src_off = current_sit_addr(sbi, start);
 	dst_off = next_sit_addr(sbi, src_off);
-#endif //META_FOR_ZNS
 	page = f2fs_grab_meta_page(sbi, dst_off);
 	seg_info_to_sit_page(sbi, page, start);
 
 	set_page_dirty(page);
+#endif //META_FOR_ZNS
 	set_to_next_sit(sit_i, start);
 
 	return page;
@@ -4711,6 +5236,120 @@ static void add_sits_in_set(struct f2fs_sb_info *sbi)
 
 #if META_FOR_ZNS
 #if DELAYED_MERGE
+/* called after each SSA log block, move to the other log once full */
+static void sum_log_written(struct f2fs_sb_info *sbi)
+{
+	if (has_curlog_space(sbi, 1, SSA_LOG))
+		return;
+	//prepare merge
+	//printk("(%s:%d) set merge flag", __func__, __LINE__);
+	/* older trees may still wait in the ring, a second switch may not */
+	if (is_set_ckpt_flags(sbi, CP_SSA_MERGE_PREPARE_FLAG)) {
+		force_log_merge(sbi, SSA_LOG);
+		return;
+	}
+/*
+	if (0) {
+	  blkdev_zone_mgmt(FDEV(0).bdev, REQ_OP_ZONE_FINISH, 
+	      SECTOR_FROM_BLOCK(sm_i->sum_log_blkaddr + sm_i->cur_sum_log * sbi->blocks_per_blkz), 
+	      SECTOR_FROM_BLOCK(sbi->blocks_per_blkz), GFP_NOFS);
+	}
+*/
+//	switch log tree;
+	if (switch_log_gen(sbi, SSA_LOG))
+		set_ckpt_flags(sbi, CP_SSA_MERGE_PREPARE_FLAG);
+//	printk("(%s:%d) set merge flag done", __func__, __LINE__);
+}
+
+/* append one delta to the open delta block, writing it out once full */
+static int add_sum_delta(struct f2fs_sb_info *sbi, struct page **page,
+		unsigned int segno, unsigned int ofs, void *src, size_t size,
+		long *nwritten)
+{
+	struct f2fs_sum_delta_log_block *raw;
+	struct f2fs_sum_delta *delta;
+	unsigned int n;
+	int err;
+
+	/* the log is full, the merge takes the set from its tree */
+	if (!*page && is_sbi_flag_set(sbi, SBI_NEED_LOG_MERGE))
+		return 0;
+	if (!*page) {
+		*page = get_next_log_page(sbi, SSA_LOG);
+		if (!*page) {
+			printk("(%s : %d) error : failed to get next log page",
+					__func__, __LINE__);
+			return -EIO;
+		}
+		raw = page_address(*page);
+		memset(raw, 0, PAGE_SIZE);
+		raw->segno = cpu_to_le32(SUM_LOG_DELTA_SEGNO);
+		raw->cp_ver = cpu_to_le64(cur_cp_version(F2FS_CKPT(sbi)));
+	}
+
+	raw = page_address(*page);
+	n = le16_to_cpu(raw->n_deltas);
+	delta = &raw->deltas[n];
+	delta->segno = cpu_to_le32(segno);
+	delta->ofs_in_seg = cpu_to_le16(ofs);
+	memcpy(&delta->sum, src, size);
+	raw->n_deltas = cpu_to_le16(++n);
+	if (n < SUM_DELTA_ENTRIES)
+		return 0;
+
+	err = sync_sum_log_page(*page);
+	*page = NULL;
+	if (err)
+		return -EIO;
+	(*nwritten)++;
+	sum_log_written(sbi);
+	return 0;
+}
+
+/*
+ * Log only the changed entries of @sets, packing many segments in each
+ * block. The full summary is folded back together at replay.
+ */
+static int write_sum_delta_log_pages(struct f2fs_sb_info *sbi,
+				struct list_head *sets, long *nwritten)
+{
+	struct ssa_set *set, *tmp;
+	struct page *page = NULL;
+	unsigned int ofs;
+	int err = 0;
+
+	list_for_each_entry_safe(set, tmp, sets, delta_list) {
+		list_del_init(&set->delta_list);
+		if (err)
+			continue;
+		for_each_set_bit(ofs, set->delta_map, ENTRIES_IN_SUM) {
+			err = add_sum_delta(sbi, &page, set->segno, ofs,
+				&set->entries[ofs], SUMMARY_SIZE, nwritten);
+			if (err)
+				break;
+		}
+		if (!err && set->footer_delta)
+			err = add_sum_delta(sbi, &page, set->segno,
+				SUM_DELTA_FOOTER, &set->footer, SUM_FOOTER_SIZE,
+				nwritten);
+		if (!err)
+			ssa_set_logged(set);
+	}
+
+	if (page) {
+		if (err) {
+			/* leave the partial block unwritten, nothing points at it */
+			f2fs_put_page(page, 1);
+		} else if (sync_sum_log_page(page)) {
+			err = -EIO;
+		} else {
+			(*nwritten)++;
+			sum_log_written(sbi);
+		}
+	}
+	return err;
+}
+
 int __flush_sum_blks(struct f2fs_sb_info *sbi){
 	struct f2fs_sm_info *sm_i = SM_I(sbi);
 	struct address_space *mapping = META_MAPPING(sbi);
@@ -4720,6 +5359,7 @@ int __flush_sum_blks(struct f2fs_sb_info *sbi){
 	pgoff_t index, end;
 	struct blk_plug plug;
 	int nr_pages;
+	LIST_HEAD(delta_sets);
 /*
 	if(sm_i->logged_sum_blks == sm_i->sum_blks_in_log){
 		printk("(%s : %d) there is no sum blks to log",
@@ -4759,38 +5399,33 @@ continue_unlock:
 			}
 
 #if !NAIVE_MFZ
-			if(write_sum_log_page(sbi, GET_SEGNO_FROM_SUM_ADDR(sbi, page->index),
-						page_address(page)))
-			{
-				unlock_page(page);
-				printk("(%s : %d) error while writing sum log page", __func__, __LINE__);
-				//f2fs_bug_on(sbi, 1);
-				ret = -EIO;
-				break;
-			}
-			nwritten++;
-			if (!has_curlog_space(sbi, 1, SSA_LOG)) {
-				//prepare merge
-				//printk("(%s:%d) set merge flag", __func__, __LINE__);
-				if (is_set_ckpt_flags(sbi, CP_SSA_MERGE_FLAG) ||
-						is_set_ckpt_flags(sbi, CP_SSA_MERGE_PREPARE_FLAG)){
-					f2fs_bug_on(sbi, 1);
-					printk("(%s:%d) SSA_MERGE_FLAG is already set",
-							__func__, __LINE__);
+			/* left to the tree until the next checkpoint merges it */
+			/* also set once the log finds no free zone */
+			if (!is_sbi_flag_set(sbi, SBI_NEED_LOG_MERGE)) {
+				unsigned int segno = GET_SEGNO_FROM_SUM_ADDR(sbi, page->index);
+				struct ssa_set *set = radix_tree_lookup(
+					&sm_i->ssa_log_root[sm_i->cur_log_tree_idx], segno);
+
+				if (set && !set->log_full) {
+					/* deltas go after all full blocks, see below */
+					if (set->nr_deltas || set->footer_delta)
+						list_add_tail(&set->delta_list, &delta_sets);
+					goto logged;
 				}
-/*
-        if (0) {
-          blkdev_zone_mgmt(FDEV(0).bdev, REQ_OP_ZONE_FINISH, 
-              SECTOR_FROM_BLOCK(sm_i->sum_log_blkaddr + sm_i->cur_sum_log * sbi->blocks_per_blkz), 
-              SECTOR_FROM_BLOCK(sbi->blocks_per_blkz), GFP_NOFS);
-        }
-*/
-				set_ckpt_flags(sbi, CP_SSA_MERGE_PREPARE_FLAG);
-//				switch log tree;
-				sm_i->cur_sum_log ^= 0x1;
-				sm_i->sum_blks_in_log = 0;
-//				printk("(%s:%d) set merge flag done", __func__, __LINE__);
+				if(write_sum_log_page(sbi, segno, page_address(page)))
+				{
+					unlock_page(page);
+					printk("(%s : %d) error while writing sum log page", __func__, __LINE__);
+					//f2fs_bug_on(sbi, 1);
+					ret = -EIO;
+					break;
+				}
+				if (set)
+					ssa_set_logged(set);
+				nwritten++;
+				sum_log_written(sbi);
 			}
+logged:
 #endif
 
 			f2fs_clear_page_cache_dirty_tag(page);
@@ -4800,6 +5435,17 @@ continue_unlock:
 		}
 		blk_finish_plug(&plug);
 	}
+
+	/* deltas follow the full blocks, the log zone is written in order */
+	if (!list_empty(&delta_sets)) {
+		int err = write_sum_delta_log_pages(sbi, &delta_sets, &nwritten);
+
+		if (err && !ret) {
+			printk("(%s : %d) error while writing sum delta log page",
+					__func__, __LINE__);
+			ret = err;
+		}
+	}
 	if (nwritten)
 		f2fs_submit_merged_write(sbi, META);
 
@@ -4812,14 +5458,12 @@ int flush_sum_blks(struct f2fs_sb_info *sbi, struct cp_control *cpc){
 #if NAIVE_MFZ
   fg_merge = true;
 #else
-	if (cpc->reason & CP_UMOUNT) {
+	if (log_fg_merge(sbi, cpc)) {
 		fg_merge = true;
 	} else if (!has_curlog_space(sbi, 1, SSA_LOG)) {
-		set_ckpt_flags(sbi, CP_SSA_MERGE_PREPARE_FLAG);
-		printk("(%s:%d) set SSA Merge flag here", __func__, __LINE__);
 		//switch_cur_log(sbi, SSA_LOG);
-		SM_I(sbi)->cur_sum_log ^= 0x1;
-		SM_I(sbi)->sum_blks_in_log = 0;
+		if (switch_log_gen(sbi, SSA_LOG))
+			set_ckpt_flags(sbi, CP_SSA_MERGE_PREPARE_FLAG);
 	}
 #endif // NAIVE_MFZ
   if((err = __flush_sum_blks(sbi))){
@@ -4941,6 +5585,11 @@ int flush_sum_blks(struct f2fs_sb_info *sbi, struct cp_control *cpc){
 	return err;
 } 
 #endif /* DELAYED_MERGE */
+static void free_ssa_set_rcu(struct rcu_head *head)
+{
+	kmem_cache_free(ssa_set_slab, container_of(head, struct ssa_set, rcu));
+}
+/* lookups take no lock, so free @set once they are done with it */
 static void clean_ssa_set(struct f2fs_sb_info *sbi,
 		struct ssa_set *set, int foreground){
 
@@ -4950,7 +5599,7 @@ static void clean_ssa_set(struct f2fs_sb_info *sbi,
   if (foreground)
 	  merge_idx = SM_I(sbi)->cur_log_tree_idx;
   else
-	  merge_idx = SM_I(sbi)->cur_log_tree_idx ^ 0x1;
+	  merge_idx = SM_I(sbi)->ssa_ltree_head;
 	root = &SM_I(sbi)->ssa_log_root[merge_idx];
 #else
 	root = &SM_I(sbi)->ssa_log_root;
@@ -4958,14 +5607,14 @@ static void clean_ssa_set(struct f2fs_sb_info *sbi,
 	if(!radix_tree_delete_item(root, set->segno, set))
 		f2fs_bug_on(sbi, 1);
 
-	kmem_cache_free(ssa_set_slab, set);
+	call_rcu(&set->rcu, free_ssa_set_rcu);
 }
 /* merge(flush) one sum block */
-static void merge_ssa_set(struct f2fs_sb_info *sbi, struct ssa_set *set, int foreground){
+static int merge_ssa_set(struct meta_merge_unit *unit, struct ssa_set *set){
 
+	struct f2fs_sb_info *sbi = unit->sbi;
 	struct page *page = NULL;
 	struct f2fs_summary_block *raw_sum = NULL;
-	struct f2fs_sm_info *sm_i = SM_I(sbi);
 
 	
 	page = get_next_sum_page(sbi, set->segno);
@@ -4974,36 +5623,67 @@ static void merge_ssa_set(struct f2fs_sb_info *sbi, struct ssa_set *set, int for
 	memcpy(raw_sum->entries, set->entries, SUM_ENTRY_SIZE);
 	memcpy(&raw_sum->footer, &set->footer, SUM_FOOTER_SIZE);
 	
-	sm_i->logged_sum_blks--;
-	clean_ssa_set(sbi, set, foreground);
-
 	if(!clear_page_dirty_for_io(page)){
 		printk("(%s : %d) error during clear page dirty flag",
 				__func__, __LINE__);
 	}
-	if (f2fs_sync_single_meta_page(page)) {
+	if (f2fs_write_merged_meta_page(unit, page)) {
 		unlock_page(page);
+		f2fs_put_page(page, 0);
 		printk("(%s : %d) error during sync ssa page(idx :%lu)",
 				__func__, __LINE__, page->index);
+		return -1;
 	}
 	f2fs_put_page(page, 0);
 
 //	printk("(%s : %d) merge ssa set of segno(%u) done",
 //			__func__, __LINE__, set->segno);
+	return 0;
+}
+/* rebuild one ssa zone, runs on the merge workqueue */
+static int merge_ssa_zone(struct meta_merge_unit *unit){
+	struct f2fs_sb_info *sbi = unit->sbi;
+	struct ssa_set *set;
+	unsigned boff_in_zone = 0;
+	int wp = 0;
+	unsigned int zone_cap = meta_blks_zone_cap(sbi);
+
+	//clean blocks are carried over without the page cache
+	list_for_each_entry(set, &unit->sets, set_list){
+		//printk("(%s : %d) merge ssa segno(%u)", __func__, __LINE__, set->segno);
+		boff_in_zone = meta_boff_in_zone(sbi, set->segno);
+
+		if(wp < boff_in_zone){
+		//	printk("(%s : %d) ", __func__, __LINE__);
+			wp = advance_meta_zone_wp(unit, wp, (boff_in_zone - wp));
+			f2fs_bug_on(sbi, wp < 0);
+			if (wp < 0)
+				return -1;
+		}
+		if (merge_ssa_set(unit, set))
+			return -1;
+		wp++;
+
+	}
+	if(wp < zone_cap){
+//		printk("(%s : %d) ", __func__, __LINE__);
+		wp = advance_meta_zone_wp(unit, wp, (zone_cap - wp));
+		if (wp < 0)
+			return -1;
+	}
+	return 0;
 }
 int merge_ssa(struct f2fs_sb_info *sbi, int foreground){
 	struct f2fs_sm_info *sm_i = SM_I(sbi);
 	struct ssa_set *set, *next;
 	struct ssa_set *setvec[SETVEC_SIZE];
+	struct meta_merge_unit *unit = NULL;
 	LIST_HEAD(sets);
+	LIST_HEAD(units);
 
 	unsigned int found;
 	unsigned int set_idx = 0;
-	unsigned int cur_zone_offset = 0;
-	unsigned boff_in_zone = 0;
-	int wp = 0;
-//	int last_updated_zone = -1;
-	unsigned int zone_cap = meta_blks_zone_cap(sbi);
+	int ret;
 	struct radix_tree_root *root;
 #if DELAYED_MERGE
 	int merge_tree_idx;
@@ -5011,7 +5691,7 @@ int merge_ssa(struct f2fs_sb_info *sbi, int foreground){
     merge_tree_idx = SM_I(sbi)->cur_log_tree_idx;
   }
   else {
-    merge_tree_idx = SM_I(sbi)->cur_log_tree_idx ^ 0x1;
+    merge_tree_idx = SM_I(sbi)->ssa_ltree_head;
   }
 
 	//printk("(%s : %d) merge_tree_idx %d", __func__, __LINE__, merge_tree_idx);
@@ -5040,44 +5720,42 @@ int merge_ssa(struct f2fs_sb_info *sbi, int foreground){
 			list_add_tail(&setvec[idx]->set_list, &sets);	
 		}
 	}
-	set = list_first_entry(&sets, struct ssa_set, set_list);
-	cur_zone_offset = meta_boff_to_zoff(sbi, set->segno); 
-	reset_meta_zone_towrite(sbi, cur_zone_offset, SSA);
-	
+
+	// dirty set list -> one unit per ssa zone
 	list_for_each_entry_safe(set, next, &sets, set_list){
-		//printk("(%s : %d) merge ssa segno(%u)", __func__, __LINE__, set->segno);
-		if(cur_zone_offset != meta_boff_to_zoff(sbi, 
-					set->segno)){
-			if(wp < zone_cap) {
-				wp = advance_meta_zone_wp(sbi, cur_zone_offset,
-						wp, (zone_cap - wp), SSA);
-				f2fs_bug_on(sbi, wp < 0);
-			}
-			f2fs_change_bit(cur_zone_offset, sm_i->ssa_bitmap);
-			//printk("(%s : %d) f2fs change bit", __func__, __LINE__);
-			cur_zone_offset = meta_boff_to_zoff(sbi, set->segno);
-			wp = 0;
-			reset_meta_zone_towrite(sbi, cur_zone_offset, SSA);
-		}
-		boff_in_zone = meta_boff_in_zone(sbi, set->segno);
+		if (!unit || unit->zone != meta_boff_to_zoff(sbi, set->segno))
+			unit = f2fs_add_meta_merge_unit(sbi, &units, SSA,
+					meta_boff_to_zoff(sbi, set->segno),
+					foreground, merge_ssa_zone);
+		list_move_tail(&set->set_list, &unit->sets);
+	}
 
-		if(wp < boff_in_zone){
-		//	printk("(%s : %d) ", __func__, __LINE__);
-			wp = advance_meta_zone_wp(sbi, cur_zone_offset, wp,
-					(boff_in_zone - wp), SSA);
-			f2fs_bug_on(sbi, wp < 0);
-		}
-		merge_ssa_set(sbi, set, foreground);
-		wp++;
+	ret = f2fs_merge_meta_zones(sbi, &units, NULL, 0);
 
+	/*
+	 * Zones are rebuilt without ssa_ltree_slock, only switching them
+	 * and dropping their sets is fenced from GC.
+	 */
+#if DELAYED_MERGE
+	down_write(&sm_i->ssa_ltree_slock);
+#endif
+	f2fs_flip_meta_zones(&units);
+	list_for_each_entry(unit, &units, list) {
+		list_for_each_entry_safe(set, next, &unit->sets, set_list) {
+			list_del(&set->set_list);
+			//sets of a failed zone stay in the log tree
+			if (unit->err)
+				continue;
+			sm_i->logged_sum_blks--;
+			clean_ssa_set(sbi, set, foreground);
+		}
 	}
-	if(wp < zone_cap){
-//		printk("(%s : %d) ", __func__, __LINE__);
-		wp = advance_meta_zone_wp(sbi, cur_zone_offset, wp,
-				(zone_cap - wp), SSA);
-		//f2fs_bug_on(sbi, wp < 0);
-	}
-	f2fs_change_bit(cur_zone_offset, sm_i->ssa_bitmap);
+#if DELAYED_MERGE
+	up_write(&sm_i->ssa_ltree_slock);
+#endif
+	f2fs_free_meta_merge_units(&units);
+	if (ret)
+		return ret;
 
 #if !DELAYED_MERGE
 	reset_meta_zone_towrite(sbi, 0, SSA_LOG);
@@ -5101,8 +5779,13 @@ int merge_ssa(struct f2fs_sb_info *sbi, int foreground){
 }
 static bool __mark_sit_log_dirty(struct f2fs_sb_info *sbi, unsigned int segno){
 	struct sit_info *sit_i = SIT_I(sbi);
+#if DELAYED_MERGE
+	unsigned long *bitmap = sit_i->sit_log_bitmap[SM_I(sbi)->sit_ltree_idx];
+#else
+	unsigned long *bitmap = sit_i->sit_log_bitmap;
+#endif
 
-	if(!__test_and_set_bit(segno, sit_i->sit_log_bitmap)){
+	if(!__test_and_set_bit(segno, bitmap)){
 		//sit_i->logged_sentries++;
 		return false;
 	}
@@ -5158,7 +5841,7 @@ static void clean_sit_log_set(struct f2fs_sb_info *sbi,
 	if (foreground)
 		idx = SM_I(sbi)->sit_ltree_idx;
 	else
-		idx = SM_I(sbi)->sit_ltree_idx ^ 0x1;
+		idx = SM_I(sbi)->sit_ltree_head;
 	radix_tree_delete(&SM_I(sbi)->sit_log_root[idx], set->start_segno);
 #else
 	radix_tree_delete(&SM_I(sbi)->sit_log_root, set->start_segno);
@@ -5179,7 +5862,7 @@ static void __flush_sit_log(struct f2fs_sb_info *sbi, struct cp_control *cpc){
 	unsigned int offset = 0;
 	bool fg_merge = false;
 
-	if (cpc->reason & CP_UMOUNT)
+	if (log_fg_merge(sbi, cpc))
 		fg_merge = true;
 #if NAIVE_MFZ
   fg_merge = true;
@@ -5237,23 +5920,14 @@ static void __flush_sit_log(struct f2fs_sb_info *sbi, struct cp_control *cpc){
 						printk("(%s : %d) error during sync log meta page",
 							__func__, __LINE__);
 					} 
-					if (!has_curlog_space(sbi, 1, SIT_LOG))	{
-						// prepare merge
-						printk("(%s:%d) set merge flag", __func__, __LINE__);
-						if (is_set_ckpt_flags(sbi, CP_SIT_MERGE_FLAG)){
-							f2fs_bug_on(sbi, 1);
-							printk("(%s:%d) SIT_MERGE_FLAG is already set",
-									__func__, __LINE__);
-						}
-						//set_ckpt_flags(sbi, CP_NAT_MERGE_FLAG);
-						// switch log tree;
-						cpc->merge = cpc->merge | 0x1;
-						SM_I(sbi)->cur_sit_log ^= 0x1;
-						SM_I(sbi)->sit_blks_in_log = 0;
-						printk("(%s:%d) switch sit log", __func__, __LINE__);
-					}
-
 					f2fs_put_page(page, 0);
+					if (!has_curlog_space(sbi, 1, SIT_LOG) &&
+						!cp_switch_log_gen(sbi, cpc, SIT_LOG)) {
+						// the rest goes to the main area with the merge
+						fg_merge = true;
+						page = NULL;
+						goto logged;
+					}
 					page = get_next_log_page(sbi, SIT_LOG);
 					if(page) {
 						raw_sit_log = page_address(page);
@@ -5276,7 +5950,7 @@ static void __flush_sit_log(struct f2fs_sb_info *sbi, struct cp_control *cpc){
 						&sit_in_log(raw_sit_log, offset));
 				offset++;
 			}
-
+logged:
 			insert_sit_log_set(sbi, segno);
 
 			__clear_bit(segno, bitmap);
@@ -5303,21 +5977,8 @@ static void __flush_sit_log(struct f2fs_sb_info *sbi, struct cp_control *cpc){
 					__func__, __LINE__);
 		}
 		f2fs_put_page(page, 0);
-		if (!has_curlog_space(sbi, 1, SIT_LOG))	{
-			// prepare merge
-			printk("(%s:%d) set merge flag", __func__, __LINE__);
-			if (is_set_ckpt_flags(sbi, CP_SIT_MERGE_FLAG)){
-				f2fs_bug_on(sbi, 1);
-				printk("(%s:%d) SIT_MERGE_FLAG is already set",
-						__func__, __LINE__);
-			}
-			//set_ckpt_flags(sbi, CP_NAT_MERGE_FLAG);
-			// switch log tree;
-			cpc->merge = cpc->merge | 0x1;
-			SM_I(sbi)->cur_sit_log ^= 0x1;
-			SM_I(sbi)->sit_blks_in_log = 0;
-			printk("(%s:%d) switch sit log", __func__, __LINE__);
-		}
+		if (!has_curlog_space(sbi, 1, SIT_LOG))
+			cp_switch_log_gen(sbi, cpc, SIT_LOG);
 	}
 	f2fs_bug_on(sbi, !list_empty(head));
 	f2fs_bug_on(sbi, sit_i->dirty_sentries);
@@ -5467,9 +6128,36 @@ out:
 	}
 }
 #endif /* DELAYED_MERGE */
-static int merge_sit_set(struct f2fs_sb_info *sbi, struct sit_entry_set *set, int foreground){
-
-	struct page *page = NULL;
+/* dirty sentries in the log tree merged by a (foreground) merge */
+static unsigned long *merge_sentry_bitmap(struct f2fs_sb_info *sbi,
+		int foreground)
+{
+#if DELAYED_MERGE
+	if (!foreground)
+		return SIT_I(sbi)->sit_log_bitmap[SM_I(sbi)->sit_ltree_head];
+	return SIT_I(sbi)->sit_log_bitmap[SM_I(sbi)->sit_ltree_idx];
+#else
+	return SIT_I(sbi)->sit_log_bitmap;
+#endif
+}
+/* drop the logged sentries of @set, its zone is current */
+static void drop_sit_set_entries(struct f2fs_sb_info *sbi,
+		struct sit_entry_set *set, int foreground)
+{
+	unsigned long *bitmap = merge_sentry_bitmap(sbi, foreground);
+	unsigned int end = min(set->start_segno + SIT_ENTRY_PER_BLOCK,
+			(unsigned long)MAIN_SEGS(sbi));
+	unsigned int segno = set->start_segno;
+
+	for_each_set_bit_from(segno, bitmap, end) {
+		clear_bit(segno, bitmap);
+		set->entry_cnt--;
+	}
+}
+static int merge_sit_set(struct meta_merge_unit *unit, struct sit_entry_set *set){
+
+	struct f2fs_sb_info *sbi = unit->sbi;
+	struct page *page = NULL;
 	struct f2fs_sit_block *raw_sit = NULL;
 	struct sit_info *sit_i = SIT_I(sbi);
 	struct seg_entry *se;
@@ -5478,18 +6166,9 @@ static int merge_sit_set(struct f2fs_sb_info *sbi, struct sit_entry_set *set, in
 	unsigned int end = min(start_segno + SIT_ENTRY_PER_BLOCK,
 			(unsigned long)MAIN_SEGS(sbi));
 	unsigned int segno = start_segno;
+	unsigned long *bitmap = merge_sentry_bitmap(sbi, unit->foreground);
 
-#if DELAYED_MERGE
-	unsigned long *bitmap;
-  if (foreground)
-    bitmap = sit_i->sit_log_bitmap; //dirty sentries in log
-  else
-    bitmap = sit_i->sit_merge_bitmap; //dirty sentries in log
-#else
-	unsigned long *bitmap = sit_i->sit_log_bitmap; //dirty sentries in log
-#endif
-
-	page = get_next_sit_page(sbi, start_segno);
+	page = __get_next_sit_page(sbi, start_segno);
 	raw_sit = page_address(page);
 
 	for_each_set_bit_from(segno, bitmap, end){
@@ -5499,23 +6178,17 @@ static int merge_sit_set(struct f2fs_sb_info *sbi, struct sit_entry_set *set, in
 		sit_offset = SIT_ENTRY_OFFSET(sit_i, segno);
 		seg_info_to_raw_sit(se, &raw_sit->entries[sit_offset]);
 		check_block_count(sbi, segno, &raw_sit->entries[sit_offset]);
-
-		__clear_bit(segno, bitmap);	
-		//sit_i->logged_sentries--;
-		set->entry_cnt--;
+		//bits are cleared by merge_sit() once the zone is current
 	}
-  if (set->entry_cnt) {	
-    printk("(%s : %d) segno(%u), cnt(%u)",
-	    __func__, __LINE__, start_segno, set->entry_cnt);
-  }
 
 	if(!clear_page_dirty_for_io(page)){
 		printk("(%s : %d) error during clear page dirty flag",
 				__func__, __LINE__);
 		return -1;
 	}
-	if (f2fs_sync_single_meta_page(page)) {
+	if (f2fs_write_merged_meta_page(unit, page)) {
 		unlock_page(page);
+		f2fs_put_page(page, 0);
 		printk("(%s : %d) error during sync sit page(idx : %lu)",
 				__func__, __LINE__, page->index);
 		return -1;
@@ -5526,26 +6199,71 @@ static int merge_sit_set(struct f2fs_sb_info *sbi, struct sit_entry_set *set, in
 //			__func__, __LINE__, start_segno, page->index);
 	return 0;
 }
+/* rebuild one sit zone, runs on the merge workqueue */
+static int merge_sit_zone(struct meta_merge_unit *unit){
+	struct f2fs_sb_info *sbi = unit->sbi;
+	struct sit_entry_set *set;
+	unsigned int boff_in_zone = 0;
+	int wp = 0;	// wp in unit of blk offset in zone
+	unsigned int zone_cap = meta_blks_zone_cap(sbi);
+	int ra_start = 0, ra_cnt = 0;
 
+	//read ahead the runs of merged blocks, they start from their current
+	//copy. Clean blocks are carried over without the page cache.
+	list_for_each_entry(set, &unit->sets, set_list){
+		boff_in_zone = meta_boff_in_zone(sbi, 
+				SIT_BLOCK_OFFSET(set->start_segno));
+		if (ra_cnt && boff_in_zone == ra_start + ra_cnt) {
+			ra_cnt++;
+			continue;
+		}
+		f2fs_ra_meta_zone(unit, ra_start, ra_cnt);
+		ra_start = boff_in_zone;
+		ra_cnt = 1;
+	}
+	f2fs_ra_meta_zone(unit, ra_start, ra_cnt);
+
+	list_for_each_entry(set, &unit->sets, set_list){
+		boff_in_zone = meta_boff_in_zone(sbi, 
+				SIT_BLOCK_OFFSET(set->start_segno));
+
+		if(wp < boff_in_zone){
+			wp = advance_meta_zone_wp(unit, wp, (boff_in_zone - wp));
+			f2fs_bug_on(sbi, wp < 0);
+			if (wp < 0)
+				return -1;
+		}
+		if (merge_sit_set(unit, set))
+			return -1;
+		wp++;
+	}
+
+	if (wp < zone_cap){
+		wp = advance_meta_zone_wp(unit, wp, (zone_cap - wp));
+		f2fs_bug_on(sbi, wp < 0);
+		if (wp < 0)
+			return -1;
+	}
+	return 0;
+}
 int merge_sit(struct f2fs_sb_info *sbi, int foreground){
 	struct f2fs_sm_info *sm_i = SM_I(sbi);
 	struct sit_entry_set *set, *next;
 	struct sit_entry_set *setvec[SETVEC_SIZE];
+	struct meta_merge_unit *unit = NULL;
 	LIST_HEAD(sets);
+	LIST_HEAD(units);
 
 	unsigned int found;	
-	unsigned int boff_in_zone = 0;
-	unsigned int cur_zone_offset = 0;
-	int wp = 0;	// wp in unit of blk offset in zone
-	unsigned int zone_cap = meta_blks_zone_cap(sbi);
 	unsigned int set_idx = 0;
+	int ret;
 	//printk("(%s : %d) adjust setvec", __func__, __LINE__);
 #if DELAYED_MERGE
 	int merge_tree_idx;
 	if (foreground)
 		merge_tree_idx = sm_i->sit_ltree_idx;
 	else
-		merge_tree_idx = sm_i->sit_ltree_idx ^ 0x1;
+		merge_tree_idx = sm_i->sit_ltree_head;
 
 	while ((found = radix_tree_gang_lookup(&sm_i->sit_log_root[merge_tree_idx],
 					(void **)setvec, set_idx, SETVEC_SIZE))){
@@ -5560,46 +6278,35 @@ int merge_sit(struct f2fs_sb_info *sbi, int foreground){
 		}
 	}
 
-	set = list_first_entry(&sets, struct sit_entry_set, set_list);
-	cur_zone_offset = meta_boff_to_zoff(sbi, SIT_BLOCK_OFFSET(set->start_segno));
-	reset_meta_zone_towrite(sbi, cur_zone_offset, SIT);
-
+	// dirty set list -> one unit per sit zone
 	list_for_each_entry_safe(set, next, &sets, set_list){
-
-		if(cur_zone_offset != meta_boff_to_zoff(sbi, 
-					SIT_BLOCK_OFFSET(set->start_segno))){
-			if(wp < zone_cap) {
-				wp = advance_meta_zone_wp(sbi, cur_zone_offset,
-						wp, (zone_cap - wp), SIT_LOG);
-				f2fs_bug_on(sbi, wp < 0);
-			}
-			cur_zone_offset = meta_boff_to_zoff(sbi, 
-					SIT_BLOCK_OFFSET(set->start_segno));
-			wp = 0;
-			reset_meta_zone_towrite(sbi, cur_zone_offset, SIT);
-		}
-		boff_in_zone = meta_boff_in_zone(sbi, 
+		unsigned int zone = meta_boff_to_zoff(sbi,
 				SIT_BLOCK_OFFSET(set->start_segno));
 
-		if(wp < boff_in_zone){
-			wp = advance_meta_zone_wp(sbi, cur_zone_offset, wp,
-					(boff_in_zone - wp), SIT_LOG);
-			f2fs_bug_on(sbi, wp < 0);
-		}
-		if (merge_sit_set(sbi, set, foreground)) {
-			return -1;
-    }
-		clean_sit_log_set(sbi, set, foreground);
-		wp++;
+		if (!unit || unit->zone != zone)
+			unit = f2fs_add_meta_merge_unit(sbi, &units, SIT,
+					zone, foreground, merge_sit_zone);
+		list_move_tail(&set->set_list, &unit->sets);
 	}
 
-	if (wp < zone_cap){
-		wp = advance_meta_zone_wp(sbi, cur_zone_offset, wp,
-				(zone_cap - wp), SIT_LOG);
-		f2fs_bug_on(sbi, wp < 0);
+	ret = f2fs_merge_meta_zones(sbi, &units, NULL, 0);
+
+	list_for_each_entry(unit, &units, list) {
+		list_for_each_entry_safe(set, next, &unit->sets, set_list) {
+			list_del(&set->set_list);
+			//sets of a failed zone stay in the log tree
+			if (unit->err)
+				continue;
+			drop_sit_set_entries(sbi, set, foreground);
+			clean_sit_log_set(sbi, set, foreground);
+		}
 	}
+	f2fs_free_meta_merge_units(&units);
+	if (ret)
+		return ret;
+
 #if DELAYED_MERGE
-	f2fs_bug_on(sbi, !radix_tree_empty(&sm_i->sit_log_root[sm_i->sit_ltree_idx ^ 0x1]));
+	f2fs_bug_on(sbi, !radix_tree_empty(&sm_i->sit_log_root[merge_tree_idx]));
 #else
 	reset_meta_zone_towrite(sbi, 0, SIT_LOG);
 	SM_I(sbi)->sit_blks_in_log = 0;
@@ -5625,7 +6332,7 @@ void f2fs_flush_sit_entries(struct f2fs_sb_info *sbi, struct cp_control *cpc)
 	 * merge log with SIT and use alternative log
 	 */
 #if DELAYED_MERGE
-	if (cpc->reason & CP_UMOUNT) {
+	if (log_fg_merge(sbi, cpc)) {
 		fg_merge = true;
 		merge = true;
 	}
@@ -5819,6 +6526,9 @@ static int build_sit_info(struct f2fs_sb_info *sbi)
 	char *src_bitmap, *bitmap;
 	unsigned int bitmap_size, main_bitmap_size, sit_bitmap_size;
 	unsigned int discard_map = f2fs_block_unit_discard(sbi) ? 1 : 0;
+#if DELAYED_MERGE
+	int i;
+#endif
 
 	/* allocate memory for SIT information */
 	sit_i = f2fs_kzalloc(sbi, sizeof(struct sit_info), GFP_KERNEL);
@@ -5840,21 +6550,20 @@ static int build_sit_info(struct f2fs_sb_info *sbi)
 	if (!sit_i->dirty_sentries_bitmap)
 		return -ENOMEM;
 #if META_FOR_ZNS
+#if DELAYED_MERGE
+	for (i = 0; i < sbi->meta_log_gens; i++) {
+		sit_i->sit_log_bitmap[i] = f2fs_kvzalloc(sbi, main_bitmap_size,
+								GFP_KERNEL);
+		if (!sit_i->sit_log_bitmap[i])
+			return -ENOMEM;
+	}
+#else
 	sit_i->sit_log_bitmap = f2fs_kvzalloc(sbi, main_bitmap_size,
 								GFP_KERNEL);
 	if (!sit_i->sit_log_bitmap)
 		return -ENOMEM;
-#if DELAYED_MERGE
-//TODO two sit log bitmap is needed
-	sit_i->sit_merge_bitmap = f2fs_kvzalloc(sbi, main_bitmap_size,
-								GFP_KERNEL);
-	if (!sit_i->sit_merge_bitmap)
-		return -ENOMEM;
 #endif
-	//TODO: something to make sit_log_bitmap by loading sit log
-	// if close (crash case) -> load log and make bitmap
-	// if empty (mkfs case) -> make empty bitmap
-	// when umount make log empty
+	// filled by replaying the sit log in build_sit_entries()
 #endif
 #ifdef CONFIG_F2FS_CHECK_FS
 	bitmap_size = MAIN_SEGS(sbi) * SIT_VBLOCK_MAP_SIZE * (3 + discard_map);
@@ -5976,6 +6685,13 @@ static int build_free_segmap(struct f2fs_sb_info *sbi)
 	if (!free_i->free_secmap)
 		return -ENOMEM;
 
+#ifdef CONFIG_BLK_DEV_ZONED
+	free_i->positional_secmap = f2fs_kvzalloc(sbi, sec_bitmap_size,
+								GFP_KERNEL);
+	if (!free_i->positional_secmap)
+		return -ENOMEM;
+#endif
+
 	/* set all segments as dirty temporarily */
 	memset(free_i->free_segmap, 0xff, bitmap_size);
 	memset(free_i->free_secmap, 0xff, sec_bitmap_size);
@@ -5988,6 +6704,70 @@ static int build_free_segmap(struct f2fs_sb_info *sbi)
 	return 0;
 }
 
+#if LIFE_LOG
+/*
+ * Reopen the lifetime logs the last checkpoint left, from their summary in
+ * the SSA. Slots that do not hold a sane, unclaimed segment are dropped:
+ * their sections are only dirty ones then.
+ */
+static int restore_life_logs(struct f2fs_sb_info *sbi)
+{
+	struct f2fs_checkpoint *ckpt = F2FS_CKPT(sbi);
+	int type;
+
+	if (!is_set_ckpt_flags(sbi, CP_LIFE_LOG_FLAG))
+		return 0;
+
+	for (type = CURSEG_LIFE1_DATA; type <= CURSEG_LIFE5_DATA; type++) {
+		struct curseg_info *curseg = CURSEG_I(sbi, type);
+		int i = LIFE_LOG_CP_IDX(type);
+		unsigned int segno = le32_to_cpu(ckpt->cur_data_segno[i]);
+		unsigned short blk_off = le16_to_cpu(ckpt->cur_data_blkoff[i]);
+		struct page *page;
+
+		if (segno == NULL_SEGNO)
+			continue;
+		if (segno >= MAIN_SEGS(sbi) || blk_off >= sbi->blocks_per_seg ||
+				IS_CURSEG(sbi, segno)) {
+			f2fs_warn(sbi, "Drop lifetime log %d: segno %u blkoff %u",
+				  type, segno, blk_off);
+			continue;
+		}
+
+		mutex_lock(&curseg->curseg_mutex);
+#if META_FOR_ZNS && DELAYED_MERGE
+		if (copy_ssa_log(sbi, segno, curseg->sum_blk))
+			goto found;
+#endif
+		page = f2fs_get_sum_page(sbi, segno);
+		if (IS_ERR(page)) {
+			mutex_unlock(&curseg->curseg_mutex);
+			return PTR_ERR(page);
+		}
+		memcpy(curseg->sum_blk->entries, page_address(page),
+							SUM_ENTRY_SIZE);
+		f2fs_put_page(page, 1);
+#if META_FOR_ZNS && DELAYED_MERGE
+found:
+#endif
+		curseg->next_segno = segno;
+		reset_curseg(sbi, type, 0);
+		curseg->alloc_type = LFS;
+		curseg->next_blkoff = blk_off;
+
+		curseg->active_zones[0] = segno;
+		curseg->active_end = 1;
+		curseg->cursor = 0;
+		get_sec_entry(sbi, segno)->inuse = curseg->seg_type + 1;
+#if ZF2FS_MONITOR
+		sbi->f2fs_open_zones += stripe_unit_zones(sbi);
+#endif
+		mutex_unlock(&curseg->curseg_mutex);
+	}
+	return 0;
+}
+#endif
+
 static int build_curseg(struct f2fs_sb_info *sbi)
 {
 	struct curseg_info *array;
@@ -6019,18 +6799,46 @@ static int build_curseg(struct f2fs_sb_info *sbi)
 			array[i].seg_type = CURSEG_COLD_DATA;
 		else if (i == CURSEG_ALL_DATA_ATGC)
 			array[i].seg_type = CURSEG_COLD_DATA;
+#if GC_LOG
+		else if (i == CURSEG_GC_DATA)
+			array[i].seg_type = CURSEG_COLD_DATA;
+#endif
+#if LIFE_LOG
+		else if (IS_LIFE_LOG(i))
+			array[i].seg_type = CURSEG_WARM_DATA;
+#endif
 		array[i].segno = NULL_SEGNO;
 		array[i].next_blkoff = 0;
 		array[i].inited = false;
 #if STRIPE
 #if !NODE_STRIPE
 		if (IS_DATASEG(i)) 
+#elif GC_LOG
+		if (i < NR_PERSISTENT_LOG || i >= CURSEG_GC_DATA)
 #else 
 		if (i < NR_PERSISTENT_LOG)
 #endif
 		{
       array[i].allocated_segs = f2fs_kzalloc(sbi, 
-          SM_I(sbi)->stripe_max_cnt * sizeof(unsigned int), GFP_KERNEL);
+          SM_I(sbi)->stripe_slots * sizeof(unsigned int), GFP_KERNEL);
+      if (!array[i].allocated_segs)
+        return -ENOMEM;
+#if DYNAMIC_STRIPE
+      array[i].active_zones = f2fs_kzalloc(sbi,
+          SM_I(sbi)->stripe_slots * sizeof(unsigned int), GFP_KERNEL);
+      if (!array[i].active_zones)
+        return -ENOMEM;
+      if (kfifo_alloc(&array[i].inactive_zones, SM_I(sbi)->stripe_slots,
+            GFP_KERNEL))
+        return -ENOMEM;
+      if (kfifo_alloc(&array[i].reclaimable_zones, SM_I(sbi)->stripe_slots,
+            GFP_KERNEL))
+        return -ENOMEM;
+      if (kfifo_alloc(&array[i].closed_zones, SM_I(sbi)->stripe_slots,
+            GFP_KERNEL))
+        return -ENOMEM;
+      array[i].closed_aged = 0;
+#endif
 		}
 #endif
 	}
@@ -6040,53 +6848,115 @@ static int build_curseg(struct f2fs_sb_info *sbi)
 	for(i = 0;i < NR_PERSISTENT_LOG; i++) {
 		array[i].allocated_segs[0] = array[i].segno;
 		get_sec_entry(sbi, array[i].segno)->inuse = i+1;
-    for(c = 1; c < SM_I(sbi)->stripe_max_cnt; c++) {
+    for(c = 1; c < SM_I(sbi)->stripe_slots; c++) {
       array[i].allocated_segs[c] = NULL_SEGNO;
     }
 #if DYNAMIC_STRIPE
-#if GRID_STRIPE
-    if (i < CURSEG_HOT_NODE) {
-      array[i].wanted_size = 4;
-    }
-    else {
-      array[i].wanted_size = 1;
-    }
-#else
-    if (i < CURSEG_HOT_NODE) {
-      array[i].wanted_size = 32;
-    }
-    else {
-      array[i].wanted_size = 8; //1 
-    }
-#endif 
+    array[i].wanted_size = stripe_min_wanted(sbi, i);
 
-    for(c = 0; c < 128; c++) {
+    for(c = 0; c < SM_I(sbi)->stripe_slots; c++) {
       array[i].active_zones[c] = NULL_SEGNO;
     }
-    array[i].active_start = 0;
     array[i].active_end = array[i].wanted_size;
-    array[i].cursor = array[i].active_start;
-
-    array[i].active_zones[array[i].active_start] = array[i].segno;
+    array[i].cursor = 0;
+    array[i].active_zones[0] = array[i].segno;
 
-    array[i].inactive_start = 0;
-    array[i].inactive_end = 0;
-    array[i].reclaimable_start = 0;
-    array[i].reclaimable_end = 0;
-    
 	  spin_lock_init(&array[i].active_lock);
-	  spin_lock_init(&array[i].inactive_lock);
-	  spin_lock_init(&array[i].reclaimable_lock);
+	  spin_lock_init(&array[i].zone_fifo_lock);
 
 #endif
 //		printk("(%s : %d) allocated %d segno(zoneno) : %u(%u)", 
 //			__func__, __LINE__, i, array[i].allocated_segs[0],
 //			array[i].allocated_segs[0]/sbi->segs_per_sec);
 	}
+#if GC_LOG
+	// opened by their first write, see open_striped_log()
+	for (i = CURSEG_GC_DATA; i < NO_CHECK_TYPE; i++) {
+		for (c = 0; c < SM_I(sbi)->stripe_slots; c++) {
+			array[i].allocated_segs[c] = NULL_SEGNO;
+			array[i].active_zones[c] = NULL_SEGNO;
+		}
+		array[i].wanted_size = 1;
+		spin_lock_init(&array[i].active_lock);
+		spin_lock_init(&array[i].zone_fifo_lock);
+	}
+#endif
+#if LIFE_LOG
+	if (!ret)
+		ret = restore_life_logs(sbi);
+#endif
 #endif
 	return ret;
 }
 
+/* overwrite a sentry loaded from the SIT area with a newer raw entry */
+static int update_sit_entry_from_raw(struct f2fs_sb_info *sbi,
+		unsigned int segno, struct f2fs_sit_entry *sit,
+		block_t *total_node_blocks)
+{
+	struct seg_entry *se = &SIT_I(sbi)->sentries[segno];
+	unsigned int old_valid_blocks = se->valid_blocks;
+	int err;
+
+	if (IS_NODESEG(se->type))
+		*total_node_blocks -= old_valid_blocks;
+
+	err = check_block_count(sbi, segno, sit);
+	if (err)
+		return err;
+	seg_info_from_raw_sit(se, sit);
+	if (IS_NODESEG(se->type))
+		*total_node_blocks += se->valid_blocks;
+
+	if (f2fs_block_unit_discard(sbi)) {
+		if (is_set_ckpt_flags(sbi, CP_TRIMMED_FLAG)) {
+			memset(se->discard_map, 0xff, SIT_VBLOCK_MAP_SIZE);
+		} else {
+			memcpy(se->discard_map, se->cur_valid_map,
+						SIT_VBLOCK_MAP_SIZE);
+			sbi->discard_blks += old_valid_blocks;
+			sbi->discard_blks -= se->valid_blocks;
+		}
+	}
+
+	if (__is_large_section(sbi)) {
+		get_sec_entry(sbi, segno)->valid_blocks += se->valid_blocks;
+		get_sec_entry(sbi, segno)->valid_blocks -= old_valid_blocks;
+	}
+	return 0;
+}
+
+#if DELAYED_MERGE
+static int replay_sit_log_block(struct f2fs_sb_info *sbi, void *blk,
+							void *total_node_blocks)
+{
+	struct f2fs_sit_log_block *raw_sit_log = blk;
+	unsigned int n_sits = le16_to_cpu(raw_sit_log->n_sits);
+	unsigned int i, segno;
+	int err;
+
+	if (n_sits > SIT_LOG_ENTRIES) {
+		f2fs_err(sbi, "Wrong SIT log block with %u entries", n_sits);
+		return -EFSCORRUPTED;
+	}
+
+	for (i = 0; i < n_sits; i++) {
+		segno = le32_to_cpu(segno_in_log(raw_sit_log, i));
+		if (segno >= MAIN_SEGS(sbi)) {
+			f2fs_err(sbi, "Wrong SIT log entry on segno %u", segno);
+			return -EFSCORRUPTED;
+		}
+
+		err = update_sit_entry_from_raw(sbi, segno,
+				&sit_in_log(raw_sit_log, i), total_node_blocks);
+		if (err)
+			return err;
+		insert_sit_log_set(sbi, segno);
+	}
+	return 0;
+}
+#endif
+
 static int build_sit_entries(struct f2fs_sb_info *sbi)
 {
 	struct sit_info *sit_i = SIT_I(sbi);
@@ -6150,8 +7020,6 @@ static int build_sit_entries(struct f2fs_sb_info *sbi)
 
 	down_read(&curseg->journal_rwsem);
 	for (i = 0; i < sits_in_cursum(journal); i++) {
-		unsigned int old_valid_blocks;
-
 		start = le32_to_cpu(segno_in_journal(journal, i));
 		if (start >= MAIN_SEGS(sbi)) {
 			f2fs_err(sbi, "Wrong journal entry on segno %u",
@@ -6160,40 +7028,19 @@ static int build_sit_entries(struct f2fs_sb_info *sbi)
 			break;
 		}
 
-		se = &sit_i->sentries[start];
-		sit = sit_in_journal(journal, i);
-
-		old_valid_blocks = se->valid_blocks;
-		if (IS_NODESEG(se->type))
-			total_node_blocks -= old_valid_blocks;
-
-		err = check_block_count(sbi, start, &sit);
+		err = update_sit_entry_from_raw(sbi, start,
+				&sit_in_journal(journal, i), &total_node_blocks);
 		if (err)
 			break;
-		seg_info_from_raw_sit(se, &sit);
-		if (IS_NODESEG(se->type))
-			total_node_blocks += se->valid_blocks;
-
-		if (f2fs_block_unit_discard(sbi)) {
-			if (is_set_ckpt_flags(sbi, CP_TRIMMED_FLAG)) {
-				memset(se->discard_map, 0xff, SIT_VBLOCK_MAP_SIZE);
-			} else {
-				memcpy(se->discard_map, se->cur_valid_map,
-							SIT_VBLOCK_MAP_SIZE);
-				sbi->discard_blks += old_valid_blocks;
-				sbi->discard_blks -= se->valid_blocks;
-			}
-		}
-
-		if (__is_large_section(sbi)) {
-			get_sec_entry(sbi, start)->valid_blocks +=
-							se->valid_blocks;
-			get_sec_entry(sbi, start)->valid_blocks -=
-							old_valid_blocks;
-		}
 	}
 	up_read(&curseg->journal_rwsem);
 
+#if DELAYED_MERGE
+	if (!err)
+		err = f2fs_replay_meta_log(sbi, SIT_LOG, replay_sit_log_block,
+							&total_node_blocks);
+#endif
+
 	if (!err && total_node_blocks != valid_node_count(sbi)) {
 		f2fs_err(sbi, "SIT is corrupted node# %u vs %u",
 			 total_node_blocks, valid_node_count(sbi));
@@ -6226,6 +7073,11 @@ static void init_free_segmap(struct f2fs_sb_info *sbi)
 
 		__set_test_and_inuse(sbi, curseg_t->segno);
 	}
+#if LIFE_LOG
+	for (type = CURSEG_LIFE1_DATA; type <= CURSEG_LIFE5_DATA; type++)
+		if (CURSEG_I(sbi, type)->inited)
+			__set_test_and_inuse(sbi, CURSEG_I(sbi, type)->segno);
+#endif
 }
 
 static void init_dirty_segmap(struct f2fs_sb_info *sbi)
@@ -6268,10 +7120,58 @@ static void init_dirty_segmap(struct f2fs_sb_info *sbi)
 		if (IS_CURSEC(sbi, secno))
 			continue;
 		set_bit(secno, dirty_i->dirty_secmap);
+#if GC_VICTIM_INDEX
+		f2fs_update_victim_index(sbi, secno);
+#endif
 	}
 	mutex_unlock(&dirty_i->seglist_lock);
 }
 
+#if GC_VICTIM_INDEX
+static int init_victim_index(struct f2fs_sb_info *sbi)
+{
+	struct victim_index *vi = &DIRTY_I(sbi)->victim_index;
+	unsigned int i;
+
+	vi->nr_buckets = sbi->segs_per_sec;
+	vi->buckets = f2fs_kvmalloc(sbi, array_size(vi->nr_buckets,
+				sizeof(struct list_head)), GFP_KERNEL);
+	vi->bucket_cnt = f2fs_kvzalloc(sbi, array_size(vi->nr_buckets,
+				sizeof(unsigned int)), GFP_KERNEL);
+	vi->nonempty = f2fs_kvzalloc(sbi,
+				f2fs_bitmap_size(vi->nr_buckets), GFP_KERNEL);
+	vi->sec_node = f2fs_kvmalloc(sbi, array_size(MAIN_SECS(sbi),
+				sizeof(struct list_head)), GFP_KERNEL);
+	vi->sec_bucket = f2fs_kvmalloc(sbi, array_size(MAIN_SECS(sbi),
+				sizeof(unsigned int)), GFP_KERNEL);
+	vi->stale = f2fs_kvzalloc(sbi,
+				f2fs_bitmap_size(MAIN_SECS(sbi)), GFP_KERNEL);
+	if (!vi->buckets || !vi->bucket_cnt || !vi->nonempty ||
+			!vi->sec_node || !vi->sec_bucket || !vi->stale)
+		return -ENOMEM;
+
+	for (i = 0; i < vi->nr_buckets; i++)
+		INIT_LIST_HEAD(&vi->buckets[i]);
+	for (i = 0; i < MAIN_SECS(sbi); i++)
+		vi->sec_bucket[i] = NULL_VICTIM_BUCKET;
+	return 0;
+}
+
+static void destroy_victim_index(struct f2fs_sb_info *sbi)
+{
+	struct victim_index *vi = &DIRTY_I(sbi)->victim_index;
+
+	kvfree(vi->buckets);
+	kvfree(vi->bucket_cnt);
+	kvfree(vi->nonempty);
+	kvfree(vi->sec_node);
+	kvfree(vi->sec_bucket);
+	kvfree(vi->stale);
+	vi->buckets = NULL;
+	vi->stale = NULL;
+}
+#endif
+
 static int init_victim_secmap(struct f2fs_sb_info *sbi)
 {
 	struct dirty_seglist_info *dirty_i = DIRTY_I(sbi);
@@ -6312,6 +7212,10 @@ static int build_dirty_segmap(struct f2fs_sb_info *sbi)
 						bitmap_size, GFP_KERNEL);
 		if (!dirty_i->dirty_secmap)
 			return -ENOMEM;
+#if GC_VICTIM_INDEX
+		if (init_victim_index(sbi))
+			return -ENOMEM;
+#endif
 	}
 
 	init_dirty_segmap(sbi);
@@ -6442,6 +7346,8 @@ static int check_zone_write_pointer(struct f2fs_sb_info *sbi,
 			    wp_segno, wp_blkoff);
 		ret = __f2fs_issue_discard_zone(sbi, fdev->bdev, zone_block,
 					zone->len >> log_sectors_per_block);
+		if (!ret)
+			ret = f2fs_wait_zone_resets(sbi);
 		if (ret) {
 			f2fs_err(sbi, "Discard zone failed: %s (errno=%d)",
 				 fdev->path, ret);
@@ -6475,6 +7381,40 @@ static int report_one_zone_cb(struct blk_zone *zone, unsigned int idx,
 	return 0;
 }
 
+/*
+ * Return in @written how far the zone at @zone_blkaddr was written, i.e.
+ * its write pointer. Zones without one report their whole length.
+ */
+int f2fs_meta_zone_written(struct f2fs_sb_info *sbi, block_t zone_blkaddr,
+					block_t *written)
+{
+	struct f2fs_dev_info *zbd;
+	struct blk_zone zone;
+	unsigned int log_sectors_per_block = sbi->log_blocksize - SECTOR_SHIFT;
+	sector_t zone_sector;
+	int err;
+
+	*written = sbi->blocks_per_blkz;
+
+	zbd = get_target_zoned_dev(sbi, zone_blkaddr);
+	if (!zbd)
+		return 0;
+
+	zone_sector = (sector_t)(zone_blkaddr - zbd->start_blk)
+		<< log_sectors_per_block;
+	err = blkdev_report_zones(zbd->bdev, zone_sector, 1,
+				  report_one_zone_cb, &zone);
+	if (err != 1) {
+		f2fs_err(sbi, "Report zone failed: %s errno=(%d)",
+			 zbd->path, err);
+		return err < 0 ? err : -EIO;
+	}
+
+	if (zone.type == BLK_ZONE_TYPE_SEQWRITE_REQ)
+		*written = (zone.wp - zone.start) >> log_sectors_per_block;
+	return 0;
+}
+
 static int fix_curseg_write_pointer(struct f2fs_sb_info *sbi, int type)
 {
 	struct curseg_info *cs = CURSEG_I(sbi, type);
@@ -6557,6 +7497,8 @@ static int fix_curseg_write_pointer(struct f2fs_sb_info *sbi, int type)
 		err = __f2fs_issue_discard_zone(sbi, zbd->bdev,
 				zone_sector >> log_sectors_per_block,
 				zone.len >> log_sectors_per_block);
+		if (!err)
+			err = f2fs_wait_zone_resets(sbi);
 		if (err) {
 			f2fs_err(sbi, "Discard zone failed: %s (errno=%d)",
 				 zbd->path, err);
@@ -6576,6 +7518,15 @@ int f2fs_fix_curseg_write_pointer(struct f2fs_sb_info *sbi)
 		if (ret)
 			return ret;
 	}
+#if LIFE_LOG
+	for (i = CURSEG_LIFE1_DATA; i <= CURSEG_LIFE5_DATA; i++) {
+		if (!CURSEG_I(sbi, i)->inited)
+			continue;
+		ret = fix_curseg_write_pointer(sbi, i);
+		if (ret)
+			return ret;
+	}
+#endif
 
 	return 0;
 }
@@ -6785,6 +7736,404 @@ static void init_min_max_mtime(struct f2fs_sb_info *sbi)
 	up_write(&sit_i->sentry_lock);
 }
 
+#if STRIPE
+static inline struct block_device *stripe_zone_bdev(struct f2fs_sb_info *sbi)
+{
+	return sbi->devs ? FDEV(0).bdev : sbi->sb->s_bdev;
+}
+
+static unsigned int stripe_zone_limit(struct f2fs_sb_info *sbi)
+{
+#ifdef CONFIG_BLK_DEV_ZONED
+	struct block_device *bdev = stripe_zone_bdev(sbi);
+	unsigned int limit = bdev_max_active_zones(bdev);
+
+	if (!limit)
+		limit = bdev_max_open_zones(bdev);
+	return limit;
+#else
+	return 0;
+#endif
+}
+
+/* every log keeps its minimum width open, the lazy ones a section */
+static unsigned int stripe_min_open(unsigned int min_cnt)
+{
+	return NR_CURSEG_DATA_TYPE * min_cnt +
+		NR_CURSEG_NODE_TYPE * STRIPE_NODE_MIN_CNT(min_cnt) +
+		STRIPE_LAZY_LOGS;
+}
+
+/*
+ * Validate a striping policy against itself and against the open/active
+ * zone limit of the device. With @clamp, a budget exceeding the device
+ * limit is lowered instead of rejected, and the widths are narrowed to fit
+ * it, so that defaults can still mount.
+ */
+int f2fs_check_stripe_policy(struct f2fs_sb_info *sbi,
+			struct f2fs_stripe_policy *sp, bool clamp)
+{
+	unsigned int unit = stripe_unit_zones(sbi);
+	unsigned int limit = stripe_zone_limit(sbi);
+	unsigned int min_open;
+
+	/* 0 means the whole device budget except what meta logs keep open */
+	if (!sp->max_open) {
+		if (limit > STRIPE_META_ZONES)
+			sp->max_open = (limit - STRIPE_META_ZONES) / unit;
+		else if (limit)
+			sp->max_open = limit / unit;
+		else
+			sp->max_open = STRIPE_MAX_OPEN;
+	}
+
+	if (limit && sp->max_open * unit > limit) {
+		if (!clamp) {
+			f2fs_err(sbi, "stripe_max_open %u needs %u zones, device allows %u",
+				 sp->max_open, sp->max_open * unit, limit);
+			return -EINVAL;
+		}
+		f2fs_warn(sbi, "stripe_max_open %u lowered to %u by device zone limit %u",
+			  sp->max_open, limit / unit, limit);
+		sp->max_open = limit / unit;
+		sp->max_cnt = min(sp->max_cnt, sp->max_open);
+
+		min_open = sp->min_cnt;
+		if (sp->min_cnt > sp->max_cnt)
+			sp->min_cnt = sp->max_cnt;
+		while (sp->min_cnt > 1 &&
+				stripe_min_open(sp->min_cnt) > sp->max_open)
+			sp->min_cnt--;
+		if (sp->min_cnt != min_open)
+			f2fs_warn(sbi, "stripe_min %u lowered to %u by stripe_max_open %u",
+				  min_open, sp->min_cnt, sp->max_open);
+		sp->stripe_cnt = min(sp->stripe_cnt, sp->max_cnt);
+	}
+
+	if (!sp->min_cnt || sp->min_cnt > sp->max_cnt ||
+				sp->max_cnt > SM_I(sbi)->stripe_slots) {
+		f2fs_err(sbi, "stripe_min %u and stripe_max %u should be in [1, %u]",
+			 sp->min_cnt, sp->max_cnt, SM_I(sbi)->stripe_slots);
+		return -EINVAL;
+	}
+
+	min_open = stripe_min_open(sp->min_cnt);
+	if (sp->max_open < min_open || sp->max_open < sp->max_cnt) {
+		f2fs_err(sbi, "stripe_max_open %u should be at least %u",
+			 sp->max_open, max(min_open, sp->max_cnt));
+		return -EINVAL;
+	}
+
+	if (!sp->stripe_cnt || sp->stripe_cnt > sp->max_cnt || sp->opt > 3 ||
+					sp->ctrl >= STRIPE_CTRL_MAX) {
+		f2fs_err(sbi, "invalid stripe_cnt %u, stripe_opt %u or stripe_ctrl %u",
+			 sp->stripe_cnt, sp->opt, sp->ctrl);
+		return -EINVAL;
+	}
+
+	if (!sp->zone_speed || sp->inc_thresh > 100 ||
+				sp->dec_thresh >= sp->inc_thresh) {
+		f2fs_err(sbi, "invalid stripe_zone_speed %u or thresholds %u/%u",
+			 sp->zone_speed, sp->inc_thresh, sp->dec_thresh);
+		return -EINVAL;
+	}
+	return 0;
+}
+
+#ifdef CONFIG_BLK_DEV_ZONED
+static int stripe_probe_write(struct block_device *bdev, sector_t sector,
+						unsigned int nr_pages)
+{
+	struct bio *bio;
+	unsigned int i, nr;
+	int err = 0;
+
+	while (nr_pages && !err) {
+		nr = min_t(unsigned int, nr_pages, BIO_MAX_VECS);
+		bio = bio_alloc(GFP_NOFS, nr);
+		bio_set_dev(bio, bdev);
+		bio->bi_iter.bi_sector = sector;
+		bio->bi_opf = REQ_OP_WRITE | REQ_SYNC;
+		for (i = 0; i < nr; i++)
+			__bio_add_page(bio, ZERO_PAGE(0), PAGE_SIZE, 0);
+		err = submit_bio_wait(bio);
+		bio_put(bio);
+
+		sector += SECTOR_FROM_BLOCK(nr);
+		nr_pages -= nr;
+	}
+	return err;
+}
+
+/*
+ * Measure the sequential write speed of one zone of device @devi by writing
+ * up to stripe_probe MB into the first zone of its last free section, then
+ * reset it. Returns the speed in MB/s, or 0 if nothing could be measured.
+ */
+static unsigned int stripe_probe_dev(struct f2fs_sb_info *sbi, int devi)
+{
+	struct f2fs_stripe_policy *sp = &F2FS_OPTION(sbi).stripe;
+	struct free_segmap_info *free_i = FREE_I(sbi);
+	struct block_device *bdev = FDEV(devi).bdev;
+	unsigned int nr_pages, secno, zone_idx, speed;
+	block_t blkaddr, cap;
+	sector_t sector, zone_sects;
+	ktime_t start;
+	u64 ns;
+	int err;
+
+	if (!bdev_is_zoned(bdev))
+		return 0;
+
+	spin_lock(&free_i->segmap_lock);
+	for (secno = MAIN_SECS(sbi); secno > 0; secno--) {
+		blkaddr = START_BLOCK(sbi, GET_SEG_FROM_SEC(sbi, secno - 1));
+		if (blkaddr > FDEV(devi).end_blk)
+			continue;
+		if (blkaddr < FDEV(devi).start_blk) {
+			secno = 0;
+			break;
+		}
+		if (!test_bit(secno - 1, free_i->free_secmap))
+			break;
+	}
+	spin_unlock(&free_i->segmap_lock);
+	if (!secno) {
+		f2fs_warn(sbi, "stripe probe: no free section on device %d", devi);
+		return 0;
+	}
+	secno--;
+
+	zone_idx = get_zone_idx(sbi, secno, devi);
+	if (is_conv_zone(sbi, zone_idx, devi)) {
+		f2fs_warn(sbi, "stripe probe: section %u is not sequential", secno);
+		return 0;
+	}
+
+	/* only the zone capacity can be written before the zone is full */
+	cap = FDEV(devi).zone_capacity_blocks ?
+		FDEV(devi).zone_capacity_blocks[zone_idx] : sbi->blocks_per_blkz;
+	nr_pages = min_t(unsigned int, sp->probe_mb << (20 - PAGE_SHIFT), cap);
+	sector = SECTOR_FROM_BLOCK((block_t)zone_idx << sbi->log_blocks_per_blkz);
+	zone_sects = bdev_zone_sectors(bdev);
+
+	err = blkdev_zone_mgmt(bdev, REQ_OP_ZONE_RESET, sector, zone_sects,
+								GFP_NOFS);
+	if (err)
+		goto out;
+
+	start = ktime_get();
+	err = stripe_probe_write(bdev, sector, nr_pages);
+	ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+
+	blkdev_zone_mgmt(bdev, REQ_OP_ZONE_RESET, sector, zone_sects, GFP_NOFS);
+	if (err || !ns)
+		goto out;
+
+	speed = div64_u64(((u64)nr_pages << PAGE_SHIFT) * NSEC_PER_SEC,
+							ns) >> 20;
+	return max(speed, 1U);
+out:
+	f2fs_warn(sbi, "stripe probe failed on device %d (%d)", devi, err);
+	return 0;
+}
+#else
+static unsigned int stripe_probe_dev(struct f2fs_sb_info *sbi, int devi)
+{
+	return 0;
+}
+#endif
+
+/*
+ * Measure every zoned device and keep the slowest zone as stripe_zone_speed,
+ * which scales the monitor thresholds. Runs after recovery and before the
+ * GC thread starts, so nothing else allocates the probed sections. Failures
+ * only leave the configured speed in place.
+ */
+void f2fs_calibrate_stripe(struct f2fs_sb_info *sbi)
+{
+	struct f2fs_stripe_policy *sp = &F2FS_OPTION(sbi).stripe;
+	unsigned int speed, min_speed = 0;
+	int i;
+
+	if (!sp->probe_mb || f2fs_readonly(sbi->sb) ||
+				!f2fs_sb_has_blkzoned(sbi))
+		return;
+
+	for (i = 0; i < sbi->s_ndevs; i++) {
+		speed = stripe_probe_dev(sbi, i);
+		if (speed && (!min_speed || speed < min_speed))
+			min_speed = speed;
+	}
+
+	if (!min_speed) {
+		f2fs_warn(sbi, "stripe probe: keep %u MB/s per zone",
+			  sp->zone_speed);
+		return;
+	}
+	WRITE_ONCE(sp->zone_speed, min_speed);
+	f2fs_info(sbi, "stripe probe: %u MB/s per zone, max open %u x %u zones",
+		  min_speed, sp->max_open, stripe_unit_zones(sbi));
+}
+
+/* the striping policy a mount starts from, see default_options() */
+void f2fs_default_stripe_policy(struct f2fs_stripe_policy *sp)
+{
+	sp->stripe_cnt = STRIPE_CNT;
+	sp->max_cnt = STRIPE_MAX_CNT;
+	sp->min_cnt = STRIPE_MIN_CNT;
+	sp->opt = OPT;
+	sp->zone_speed = STRIPE_ZONE_SPEED;
+	sp->max_open = 0;
+	sp->probe_mb = 0;
+	sp->ctrl = STRIPE_CTRL_THRESH;
+	sp->inc_thresh = STRIPE_INC_THRESHOLD;
+	sp->dec_thresh = STRIPE_DEC_THRESHOLD;
+}
+#endif
+
+#if DELAYED_MERGE
+/* the SSA area is older, keep the replayed summary cached instead */
+static void replay_sum_page(struct f2fs_sb_info *sbi, unsigned int segno,
+		struct f2fs_summary *entries, struct summary_footer *footer,
+		unsigned long long ckpt_ver)
+{
+	struct f2fs_summary_block *sum;
+	struct ssa_set *set;
+	struct page *page;
+
+	set = __insert_ssa_log(sbi, segno, entries, footer, ckpt_ver);
+	if (set)
+		ssa_set_logged(set);
+
+	page = f2fs_grab_meta_page(sbi, GET_SUM_BLOCK(sbi, segno));
+	sum = (struct f2fs_summary_block *)page_address(page);
+	memset(sum, 0, PAGE_SIZE);
+	memcpy(sum->entries, entries, SUM_ENTRY_SIZE);
+	memcpy(&sum->footer, footer, SUM_FOOTER_SIZE);
+	f2fs_put_page(page, 1);
+}
+
+/* fold a run of deltas of one segment into its latest summary */
+static int replay_sum_deltas(struct f2fs_sb_info *sbi,
+		struct f2fs_sum_delta *deltas, int cnt, unsigned long long ckpt_ver,
+		struct f2fs_summary_block *sum)
+{
+	unsigned int segno = le32_to_cpu(deltas[0].segno);
+	struct ssa_set *base;
+	int i;
+
+	base = lookup_ssa_log(sbi, segno);
+	if (base) {
+		memcpy(sum->entries, base->entries, SUM_ENTRY_SIZE);
+		memcpy(&sum->footer, &base->footer, SUM_FOOTER_SIZE);
+	} else {
+		/* not logged since the last merge, the SSA area has the rest */
+		struct page *page = f2fs_get_sum_page(sbi, segno);
+
+		if (IS_ERR(page))
+			return PTR_ERR(page);
+		memcpy(sum, page_address(page), PAGE_SIZE);
+		f2fs_put_page(page, 1);
+	}
+
+	for (i = 0; i < cnt; i++) {
+		unsigned int ofs = le16_to_cpu(deltas[i].ofs_in_seg);
+
+		if (ofs == SUM_DELTA_FOOTER)
+			memcpy(&sum->footer, &deltas[i].footer, SUM_FOOTER_SIZE);
+		else
+			memcpy(&sum->entries[ofs], &deltas[i].sum, SUMMARY_SIZE);
+	}
+
+	replay_sum_page(sbi, segno, sum->entries, &sum->footer, ckpt_ver);
+	return 0;
+}
+
+static int replay_sum_delta_log_block(struct f2fs_sb_info *sbi,
+			struct f2fs_sum_delta_log_block *raw)
+{
+	unsigned int n = le16_to_cpu(raw->n_deltas);
+	unsigned long long ckpt_ver = le64_to_cpu(raw->cp_ver);
+	struct f2fs_summary_block *sum;
+	unsigned int i, start;
+	int err = 0;
+
+	if (n > SUM_DELTA_ENTRIES)
+		goto corrupted;
+	for (i = 0; i < n; i++) {
+		unsigned int ofs = le16_to_cpu(raw->deltas[i].ofs_in_seg);
+
+		if (le32_to_cpu(raw->deltas[i].segno) >= MAIN_SEGS(sbi) ||
+			(ofs >= ENTRIES_IN_SUM && ofs != SUM_DELTA_FOOTER))
+			goto corrupted;
+	}
+
+	sum = f2fs_kmalloc(sbi, PAGE_SIZE, GFP_KERNEL);
+	if (!sum)
+		return -ENOMEM;
+
+	/* deltas of a segment are packed next to each other */
+	for (start = 0; start < n && !err; start = i) {
+		for (i = start + 1; i < n; i++)
+			if (raw->deltas[i].segno != raw->deltas[start].segno)
+				break;
+		err = replay_sum_deltas(sbi, &raw->deltas[start], i - start,
+							ckpt_ver, sum);
+	}
+	kfree(sum);
+	return err;
+corrupted:
+	f2fs_err(sbi, "Wrong SSA delta log block with %u deltas", n);
+	return -EFSCORRUPTED;
+}
+
+static int replay_sum_log_block(struct f2fs_sb_info *sbi, void *blk,
+							void *data)
+{
+	struct f2fs_sum_log_block *raw_sum_log = blk;
+	unsigned int segno = le32_to_cpu(raw_sum_log->segno);
+
+	if (segno == SUM_LOG_DELTA_SEGNO)
+		return replay_sum_delta_log_block(sbi, blk);
+
+	if (segno >= MAIN_SEGS(sbi)) {
+		f2fs_err(sbi, "Wrong SSA log block on segno %u", segno);
+		return -EFSCORRUPTED;
+	}
+
+	replay_sum_page(sbi, segno, raw_sum_log->entries,
+			&raw_sum_log->footer, le64_to_cpu(raw_sum_log->cp_ver));
+	return 0;
+}
+#endif
+
+#if META_FOR_ZNS
+/* mkfs -M stripes every log, older images stripe the SSA log only */
+static int init_meta_log_stripes(struct f2fs_sb_info *sbi)
+{
+	unsigned int stripes = le32_to_cpu(F2FS_RAW_SUPER(sbi)->meta_log_stripes);
+	int type;
+
+#if META_LOG_STRIPE
+	if (stripes > MAX_META_LOG_STRIPES) {
+#else
+	if (stripes > 1) {
+#endif
+		f2fs_err(sbi, "Wrong number of metadata log stripes: %u",
+								stripes);
+		return -EFSCORRUPTED;
+	}
+	for (type = SIT_LOG; type <= SSA_LOG; type++)
+		sbi->log_stripes[type] = stripes ? stripes : 1;
+#if META_LOG_STRIPE
+	if (!stripes)
+		sbi->log_stripes[SSA_LOG] = META_STRIPE_CNT;
+#endif
+	return 0;
+}
+#endif
+
 int f2fs_build_segment_manager(struct f2fs_sb_info *sbi)
 {
 	struct f2fs_super_block *raw_super = F2FS_RAW_SUPER(sbi);
@@ -6795,6 +8144,9 @@ int f2fs_build_segment_manager(struct f2fs_sb_info *sbi)
 	char *src_bitmap;
 	unsigned int ssa_bitmap_size;
 #endif
+#if DELAYED_MERGE
+	int i;
+#endif
 
 	sm_info = f2fs_kzalloc(sbi, sizeof(struct f2fs_sm_info), GFP_KERNEL);
 	if (!sm_info)
@@ -6824,12 +8176,24 @@ int f2fs_build_segment_manager(struct f2fs_sb_info *sbi)
 	// sm_info->ssa_bitmap = f2fs_kvzalloc(sbi, ssa_bitmap_size, GFP_KERNEL);
 	if(!sm_info->ssa_bitmap)
 		return -ENOMEM;
+	err = init_meta_log_stripes(sbi);
+	if (err)
+		return err;
 #if DELAYED_MERGE
-	INIT_RADIX_TREE(&sm_info->sit_log_root[0], GFP_NOIO);
-	INIT_RADIX_TREE(&sm_info->sit_log_root[1], GFP_NOIO);
-	
-	INIT_RADIX_TREE(&sm_info->ssa_log_root[0], GFP_NOIO);
-	INIT_RADIX_TREE(&sm_info->ssa_log_root[1], GFP_NOIO);
+	/* mkfs -G sets how many zones each log rotates through */
+	sbi->meta_log_gens = (le32_to_cpu(raw_super->segment_count_ssa_log) <<
+				sbi->log_blocks_per_seg) / sbi->blocks_per_blkz;
+	sbi->meta_log_gens /= meta_log_stripes(sbi, SSA_LOG);
+	if (sbi->meta_log_gens < 2 || sbi->meta_log_gens > MAX_META_LOG_GENS) {
+		f2fs_err(sbi, "Wrong number of metadata log zones: %u",
+						sbi->meta_log_gens);
+		return -EFSCORRUPTED;
+	}
+
+	for (i = 0; i < MAX_META_LOG_GENS; i++) {
+		INIT_RADIX_TREE(&sm_info->sit_log_root[i], GFP_NOIO);
+		INIT_RADIX_TREE(&sm_info->ssa_log_root[i], GFP_NOIO);
+	}
 #else
 	INIT_RADIX_TREE(&sm_info->sit_log_root, GFP_NOIO);
 	INIT_RADIX_TREE(&sm_info->ssa_log_root, GFP_NOIO);
@@ -6840,13 +8204,25 @@ int f2fs_build_segment_manager(struct f2fs_sb_info *sbi)
 #endif
 #endif //META_FOR_ZNS
 #if STRIPE
-	//for now, statically define
-	sm_info->stripe_cnt = STRIPE_CNT;
-  sm_info->stripe_max_cnt = STRIPE_MAX_CNT;
-  sm_info->stripe_min_cnt = STRIPE_MIN_CNT;
 #if GRID_STRIPE
-  sm_info->grid_cnt = GRID_CNT;
+  /* mkfs builds a section from grid_cnt zones */
+  if (sbi->blocks_per_blkz)
+    sm_info->grid_cnt = BLKS_PER_SEC(sbi) / sbi->blocks_per_blkz;
+  else
+    sm_info->grid_cnt = GRID_CNT;
 #endif
+  sm_info->stripe_slots = stripe_zone_limit(sbi) / stripe_unit_zones(sbi);
+  if (!sm_info->stripe_slots)
+    sm_info->stripe_slots = STRIPE_LIMIT;
+	if (f2fs_check_stripe_policy(sbi, &F2FS_OPTION(sbi).stripe, true)) {
+		/* a bad policy costs throughput only, mount with the defaults */
+		f2fs_warn(sbi, "invalid striping policy, use the defaults");
+		f2fs_default_stripe_policy(&F2FS_OPTION(sbi).stripe);
+		err = f2fs_check_stripe_policy(sbi, &F2FS_OPTION(sbi).stripe,
+									true);
+		if (err)
+			return err;
+	}
 #endif //STRIPE
 	sm_info->rec_prefree_segments = sm_info->main_segments *
 					DEF_RECLAIM_PREFREE_SEGMENTS / 100;
@@ -6881,6 +8257,12 @@ int f2fs_build_segment_manager(struct f2fs_sb_info *sbi)
 	err = build_free_segmap(sbi);
 	if (err)
 		return err;
+#if DELAYED_MERGE
+	/* before any summary block is read */
+	err = f2fs_replay_meta_log(sbi, SSA_LOG, replay_sum_log_block, NULL);
+	if (err)
+		return err;
+#endif
 	err = build_curseg(sbi);
 	if (err)
 		return err;
@@ -6936,6 +8318,9 @@ static void destroy_dirty_segmap(struct f2fs_sb_info *sbi)
 	if (__is_large_section(sbi)) {
 		mutex_lock(&dirty_i->seglist_lock);
 		kvfree(dirty_i->dirty_secmap);
+#if GC_VICTIM_INDEX
+		destroy_victim_index(sbi);
+#endif
 		mutex_unlock(&dirty_i->seglist_lock);
 	}
 
@@ -6960,6 +8345,12 @@ static void destroy_curseg(struct f2fs_sb_info *sbi)
 		if (IS_DATASEG(i))
 #endif
 			kfree(array[i].allocated_segs);
+#if DYNAMIC_STRIPE
+		kfree(array[i].active_zones);
+		kfifo_free(&array[i].inactive_zones);
+		kfifo_free(&array[i].reclaimable_zones);
+		kfifo_free(&array[i].closed_zones);
+#endif
 #endif
 	}
 	kfree(array);
@@ -6974,12 +8365,18 @@ static void destroy_free_segmap(struct f2fs_sb_info *sbi)
 	SM_I(sbi)->free_info = NULL;
 	kvfree(free_i->free_segmap);
 	kvfree(free_i->free_secmap);
+#ifdef CONFIG_BLK_DEV_ZONED
+	kvfree(free_i->positional_secmap);
+#endif
 	kfree(free_i);
 }
 
 static void destroy_sit_info(struct f2fs_sb_info *sbi)
 {
 	struct sit_info *sit_i = SIT_I(sbi);
+#if DELAYED_MERGE
+	int i;
+#endif
 
 	if (!sit_i)
 		return;
@@ -6992,9 +8389,11 @@ static void destroy_sit_info(struct f2fs_sb_info *sbi)
 	kvfree(sit_i->sec_entries);
 	kvfree(sit_i->dirty_sentries_bitmap);
 #if META_FOR_ZNS
-	kvfree(sit_i->sit_log_bitmap);
 #if DELAYED_MERGE
-	kvfree(sit_i->sit_merge_bitmap);
+	for (i = 0; i < MAX_META_LOG_GENS; i++)
+		kvfree(sit_i->sit_log_bitmap[i]);
+#else
+	kvfree(sit_i->sit_log_bitmap);
 #endif
 #endif //META_FOR_ZNS
 	SM_I(sbi)->sit_info = NULL;
@@ -7006,6 +8405,37 @@ static void destroy_sit_info(struct f2fs_sb_info *sbi)
 	kfree(sit_i);
 }
 
+#if DELAYED_MERGE
+/* log trees are only left by read-only or failed mounts */
+static void destroy_log_trees(struct f2fs_sb_info *sbi)
+{
+	struct f2fs_sm_info *sm_info = SM_I(sbi);
+	struct sit_entry_set *sitvec[SETVEC_SIZE];
+	struct ssa_set *ssavec[SETVEC_SIZE];
+	unsigned int found, idx;
+	int t;
+
+	for (t = 0; t < MAX_META_LOG_GENS; t++) {
+		while ((found = radix_tree_gang_lookup(&sm_info->sit_log_root[t],
+					(void **)sitvec, 0, SETVEC_SIZE))) {
+			for (idx = 0; idx < found; idx++) {
+				radix_tree_delete(&sm_info->sit_log_root[t],
+						sitvec[idx]->start_segno);
+				kmem_cache_free(sit_entry_set_slab, sitvec[idx]);
+			}
+		}
+		while ((found = radix_tree_gang_lookup(&sm_info->ssa_log_root[t],
+					(void **)ssavec, 0, SETVEC_SIZE))) {
+			for (idx = 0; idx < found; idx++) {
+				radix_tree_delete(&sm_info->ssa_log_root[t],
+						ssavec[idx]->segno);
+				kmem_cache_free(ssa_set_slab, ssavec[idx]);
+			}
+		}
+	}
+}
+#endif
+
 void f2fs_destroy_segment_manager(struct f2fs_sb_info *sbi)
 {
 	struct f2fs_sm_info *sm_info = SM_I(sbi);
@@ -7017,6 +8447,9 @@ void f2fs_destroy_segment_manager(struct f2fs_sb_info *sbi)
 	destroy_dirty_segmap(sbi);
 	destroy_curseg(sbi);
 	destroy_free_segmap(sbi);
+#if DELAYED_MERGE
+	destroy_log_trees(sbi);
+#endif
 	destroy_sit_info(sbi);
 	sbi->sm_info = NULL;
 	kfree(sm_info);
@@ -7043,6 +8476,12 @@ int __init f2fs_create_segment_manager_caches(void)
 			sizeof(struct inmem_pages));
 	if (!inmem_entry_slab)
 		goto destroy_sit_entry_set;
+#ifdef CONFIG_BLK_DEV_ZONED
+	zone_mgmt_cmd_slab = f2fs_kmem_cache_create("f2fs_zone_mgmt_cmd",
+			sizeof(struct zone_mgmt_cmd));
+	if (!zone_mgmt_cmd_slab)
+		goto destroy_inmem_entry;
+#endif
 #if META_FOR_ZNS
 	ssa_set_slab = f2fs_kmem_cache_create("f2fs_ssa_set",
 			sizeof(struct ssa_set));
@@ -7054,6 +8493,11 @@ int __init f2fs_create_segment_manager_caches(void)
 destroy_ssa_set:
 	kmem_cache_destroy(ssa_set_slab);
 #endif
+#ifdef CONFIG_BLK_DEV_ZONED
+	kmem_cache_destroy(zone_mgmt_cmd_slab);
+destroy_inmem_entry:
+#endif
+	kmem_cache_destroy(inmem_entry_slab);
 destroy_sit_entry_set:
 	kmem_cache_destroy(sit_entry_set_slab);
 destroy_discard_cmd:
@@ -7067,8 +8511,13 @@ fail:
 void f2fs_destroy_segment_manager_caches(void)
 {
 	kmem_cache_destroy(sit_entry_set_slab);
+	/* ssa sets freed by call_rcu() */
+	rcu_barrier();
 	kmem_cache_destroy(ssa_set_slab);
 	kmem_cache_destroy(discard_cmd_slab);
 	kmem_cache_destroy(discard_entry_slab);
 	kmem_cache_destroy(inmem_entry_slab);
+#ifdef CONFIG_BLK_DEV_ZONED
+	kmem_cache_destroy(zone_mgmt_cmd_slab);
+#endif
 }
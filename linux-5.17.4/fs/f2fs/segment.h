@@ -7,6 +7,7 @@
  */
 #include <linux/blkdev.h>
 #include <linux/backing-dev.h>
+#include <linux/kfifo.h>
 
 /* constant macro */
 #define NULL_SEGNO			((unsigned int)(~0))
@@ -35,6 +36,43 @@ static inline void sanity_check_seg_type(struct f2fs_sb_info *sbi,
 #define IS_WARM(t)	((t) == CURSEG_WARM_NODE || (t) == CURSEG_WARM_DATA)
 #define IS_COLD(t)	((t) == CURSEG_COLD_NODE || (t) == CURSEG_COLD_DATA)
 
+#if GC_LOG
+#define IS_GC_LOG_SEG(sbi, seg)						\
+	((seg) == CURSEG_I(sbi, CURSEG_GC_DATA)->segno)
+#define IS_GC_LOG_SEC(sbi, secno)					\
+	((secno) == CURSEG_I(sbi, CURSEG_GC_DATA)->segno / (sbi)->segs_per_sec)
+#else
+#define IS_GC_LOG_SEG(sbi, seg)		false
+#define IS_GC_LOG_SEC(sbi, secno)	false
+#endif
+
+#if LIFE_LOG
+#define IS_LIFE_LOG(t)	((t) >= CURSEG_LIFE1_DATA && (t) <= CURSEG_LIFE5_DATA)
+/* slot of a lifetime log in cur_data_segno[] of the checkpoint */
+#define LIFE_LOG_CP_IDX(t)	((t) - CURSEG_LIFE1_DATA + NR_CURSEG_DATA_TYPE)
+#define IS_LIFE_LOG_SEG(sbi, seg)					\
+	(((seg) == CURSEG_I(sbi, CURSEG_LIFE1_DATA)->segno) ||		\
+	 ((seg) == CURSEG_I(sbi, CURSEG_LIFE2_DATA)->segno) ||		\
+	 ((seg) == CURSEG_I(sbi, CURSEG_LIFE3_DATA)->segno) ||		\
+	 ((seg) == CURSEG_I(sbi, CURSEG_LIFE4_DATA)->segno) ||		\
+	 ((seg) == CURSEG_I(sbi, CURSEG_LIFE5_DATA)->segno))
+#define IS_LIFE_LOG_SEC(sbi, secno)					\
+	(((secno) == CURSEG_I(sbi, CURSEG_LIFE1_DATA)->segno /		\
+	  (sbi)->segs_per_sec) ||	\
+	 ((secno) == CURSEG_I(sbi, CURSEG_LIFE2_DATA)->segno /		\
+	  (sbi)->segs_per_sec) ||	\
+	 ((secno) == CURSEG_I(sbi, CURSEG_LIFE3_DATA)->segno /		\
+	  (sbi)->segs_per_sec) ||	\
+	 ((secno) == CURSEG_I(sbi, CURSEG_LIFE4_DATA)->segno /		\
+	  (sbi)->segs_per_sec) ||	\
+	 ((secno) == CURSEG_I(sbi, CURSEG_LIFE5_DATA)->segno /		\
+	  (sbi)->segs_per_sec))
+#else
+#define IS_LIFE_LOG(t)			false
+#define IS_LIFE_LOG_SEG(sbi, seg)	false
+#define IS_LIFE_LOG_SEC(sbi, secno)	false
+#endif
+
 #define IS_CURSEG(sbi, seg)						\
 	(((seg) == CURSEG_I(sbi, CURSEG_HOT_DATA)->segno) ||	\
 	 ((seg) == CURSEG_I(sbi, CURSEG_WARM_DATA)->segno) ||	\
@@ -43,7 +81,8 @@ static inline void sanity_check_seg_type(struct f2fs_sb_info *sbi,
 	 ((seg) == CURSEG_I(sbi, CURSEG_WARM_NODE)->segno) ||	\
 	 ((seg) == CURSEG_I(sbi, CURSEG_COLD_NODE)->segno) ||	\
 	 ((seg) == CURSEG_I(sbi, CURSEG_COLD_DATA_PINNED)->segno) ||	\
-	 ((seg) == CURSEG_I(sbi, CURSEG_ALL_DATA_ATGC)->segno))
+	 ((seg) == CURSEG_I(sbi, CURSEG_ALL_DATA_ATGC)->segno) ||	\
+	 IS_GC_LOG_SEG(sbi, seg) || IS_LIFE_LOG_SEG(sbi, seg))
 
 #define IS_CURSEC(sbi, secno)						\
 	(((secno) == CURSEG_I(sbi, CURSEG_HOT_DATA)->segno /		\
@@ -61,7 +100,8 @@ static inline void sanity_check_seg_type(struct f2fs_sb_info *sbi,
 	 ((secno) == CURSEG_I(sbi, CURSEG_COLD_DATA_PINNED)->segno /	\
 	  (sbi)->segs_per_sec) ||	\
 	 ((secno) == CURSEG_I(sbi, CURSEG_ALL_DATA_ATGC)->segno /	\
-	  (sbi)->segs_per_sec))
+	  (sbi)->segs_per_sec) ||	\
+	 IS_GC_LOG_SEC(sbi, secno) || IS_LIFE_LOG_SEC(sbi, secno))
 
 #define MAIN_BLKADDR(sbi)						\
 	(SM_I(sbi) ? SM_I(sbi)->main_blkaddr : 				\
@@ -256,11 +296,13 @@ struct sit_info {
 	char *bitmap;			/* all bitmaps pointer */
 	char *sit_bitmap;		/* SIT bitmap pointer */
 #if META_FOR_ZNS
-	unsigned long *sit_log_bitmap;
-	unsigned int logged_sentries;
 #if DELAYED_MERGE
-	unsigned long *sit_merge_bitmap;
+	/* sentries logged in each sit log tree */
+	unsigned long *sit_log_bitmap[MAX_META_LOG_GENS];
+#else
+	unsigned long *sit_log_bitmap;
 #endif
+	unsigned int logged_sentries;
 #endif
 #ifdef CONFIG_F2FS_CHECK_FS
 	char *sit_bitmap_mir;		/* SIT bitmap mirror */
@@ -296,6 +338,10 @@ struct free_segmap_info {
 	spinlock_t segmap_lock;		/* free segmap lock */
 	unsigned long *free_segmap;	/* free segment bitmap */
 	unsigned long *free_secmap;	/* free section bitmap */
+#ifdef CONFIG_BLK_DEV_ZONED
+	unsigned long *positional_secmap; /* sections of a zone append log
+					   * that took a positional write */
+#endif
 };
 
 /* Notice: The order of dirty type is same with CURSEG_XXX in f2fs.h */
@@ -311,6 +357,27 @@ enum dirty_type {
 	NR_DIRTY_TYPE
 };
 
+#if GC_VICTIM_INDEX
+#define NULL_VICTIM_BUCKET	UINT_MAX
+
+/*
+ * Sections of dirty_secmap bucketed by valid blocks, one segment worth of
+ * blocks per bucket. A section is appended when it enters a bucket, so
+ * each bucket lists its sections in the order they entered it. Sections
+ * in use are marked stale instead and re-bucketed before a victim search.
+ * See f2fs_update_victim_index().
+ */
+struct victim_index {
+	struct list_head *buckets;		/* sections of each bucket */
+	unsigned int *bucket_cnt;		/* # of sections in each bucket */
+	unsigned long *nonempty;		/* buckets holding a section */
+	unsigned int nr_buckets;
+	struct list_head *sec_node;		/* one per section */
+	unsigned int *sec_bucket;		/* bucket of each section */
+	unsigned long *stale;			/* sections changed while in use */
+};
+#endif
+
 struct dirty_seglist_info {
 	const struct victim_selection *v_ops;	/* victim selction operation */
 	unsigned long *dirty_segmap[NR_DIRTY_TYPE];
@@ -318,6 +385,9 @@ struct dirty_seglist_info {
 	struct mutex seglist_lock;		/* lock for segment bitmaps */
 	int nr_dirty[NR_DIRTY_TYPE];		/* # of dirty segments */
 	unsigned long *victim_secmap;		/* background GC victims */
+#if GC_VICTIM_INDEX
+	struct victim_index victim_index;	/* dirty_secmap by valid blocks */
+#endif
 };
 
 /* victim selection function for cleaning and SSR */
@@ -347,23 +417,26 @@ struct curseg_info {
 	unsigned int *allocated_segs;
 	unsigned int stripe_idx;
 #if DYNAMIC_STRIPE
-//MAX striping 128   
-  unsigned int cursor;
-  unsigned int wanted_size;
-
-  // active list is never empty
-  unsigned int active_zones[128];
-  unsigned int active_start, active_end;
+  unsigned int cursor;		/* active slot being written */
+  unsigned int wanted_size;	/* stripe width set by the monitor */
+
+  /*
+   * Active slots are written round robin and may hold NULL_SEGNO until
+   * refilled. Sections dropped from the stripe wait in inactive for one
+   * monitor period, then in reclaimable, and get finished unless the
+   * allocator reopens them first. Sections left in the middle of a segment
+   * wait in closed, are never reopened, and get finished one period later.
+   * Sized by sm_info->stripe_slots.
+   */
+  unsigned int *active_zones;
+  unsigned int active_end;	/* slots in use */
   spinlock_t active_lock;
-  
-  // inactive, reclaimable list is never full
-  unsigned int inactive_zones[128];
-  unsigned int inactive_start, inactive_end;
-  spinlock_t inactive_lock;
-
-  unsigned int reclaimable_zones[128];
-  unsigned int reclaimable_start, reclaimable_end;
-  spinlock_t reclaimable_lock;
+
+  DECLARE_KFIFO_PTR(inactive_zones, unsigned int);
+  DECLARE_KFIFO_PTR(reclaimable_zones, unsigned int);
+  DECLARE_KFIFO_PTR(closed_zones, unsigned int);
+  unsigned int closed_aged;	/* closed ones seen by the last period */
+  spinlock_t zone_fifo_lock;	/* the fifos, held for O(1) only */
 #endif
 #endif
 };
@@ -380,7 +453,64 @@ struct ssa_set {
 	unsigned long long cp_ver; 
 	struct f2fs_summary entries[ENTRIES_IN_SUM];
 	struct summary_footer footer;
+	/* changes not in the log yet, see __flush_sum_blks() */
+	unsigned long delta_map[BITS_TO_LONGS(ENTRIES_IN_SUM)];
+	unsigned int nr_deltas;		/* # of bits in delta_map */
+	bool footer_delta;
+	bool log_full;			/* no base to log deltas against */
+	struct list_head delta_list;	/* sets to log as deltas */
+	seqlock_t seqlock;		/* entries and footer, for lookups */
+	struct rcu_head rcu;		/* freed after lockless lookups */
 };
+
+#if DELAYED_MERGE
+/* newest copy of @segno in the SSA log trees from @idx back to the head */
+static inline struct ssa_set *__lookup_ssa_log(struct f2fs_sb_info *sbi,
+					unsigned int segno, unsigned int idx)
+{
+	struct f2fs_sm_info *sm_i = SM_I(sbi);
+	struct ssa_set *set;
+	unsigned int i;
+
+	for (i = 0; i < sbi->meta_log_gens; i++) {
+		set = radix_tree_lookup(&sm_i->ssa_log_root[idx], segno);
+		if (set || idx == sm_i->ssa_ltree_head)
+			return set;
+		idx = prev_log_gen(sbi, idx);
+	}
+	return NULL;
+}
+
+static inline struct ssa_set *lookup_ssa_log(struct f2fs_sb_info *sbi,
+							unsigned int segno)
+{
+	return __lookup_ssa_log(sbi, segno, SM_I(sbi)->cur_log_tree_idx);
+}
+
+/*
+ * Copy the newest logged summary of @segno to @sum. A set dropped by a
+ * merge meanwhile is freed after an RCU grace period, one updated in place
+ * is copied again.
+ */
+static inline bool copy_ssa_log(struct f2fs_sb_info *sbi, unsigned int segno,
+				struct f2fs_summary_block *sum)
+{
+	struct ssa_set *set;
+	unsigned int seq;
+
+	rcu_read_lock();
+	set = lookup_ssa_log(sbi, segno);
+	if (set) {
+		do {
+			seq = read_seqbegin(&set->seqlock);
+			memcpy(sum->entries, set->entries, SUM_ENTRY_SIZE);
+			memcpy(&sum->footer, &set->footer, SUM_FOOTER_SIZE);
+		} while (read_seqretry(&set->seqlock, seq));
+	}
+	rcu_read_unlock();
+	return set;
+}
+#endif
 #endif
 /*
  * inline functions
@@ -415,6 +545,90 @@ static inline struct sec_entry *get_sec_entry(struct f2fs_sb_info *sbi,
 static inline unsigned int is_inuse_seg(struct f2fs_sb_info *sbi, unsigned int segno) {
 	return get_sec_entry(sbi, segno)->inuse;
 }
+
+/* node logs are kept at a quarter of the data log minimum width */
+#define STRIPE_NODE_MIN_CNT(min_cnt)	max_t(unsigned int, (min_cnt) / 4, 1)
+
+/* the GC and lifetime logs keep one section each open once written */
+#if GC_LOG
+#define STRIPE_LAZY_LOGS	(NR_CURSEG_LIFE_TYPE + 1)
+#else
+#define STRIPE_LAZY_LOGS	NR_CURSEG_LIFE_TYPE
+#endif
+
+/* # of zones opened by one stripe unit (a section) */
+static inline unsigned int stripe_unit_zones(struct f2fs_sb_info *sbi)
+{
+#if GRID_STRIPE
+	return max_t(unsigned int, SM_I(sbi)->grid_cnt, 1);
+#else
+	return 1;
+#endif
+}
+
+static inline unsigned int stripe_min_wanted(struct f2fs_sb_info *sbi,
+						int type)
+{
+	unsigned int min_cnt = READ_ONCE(F2FS_OPTION(sbi).stripe.min_cnt);
+
+	if (IS_DATASEG(type))
+		return min_cnt;
+	return STRIPE_NODE_MIN_CNT(min_cnt);
+}
+
+#if DYNAMIC_STRIPE
+static inline unsigned int stripe_zones_queued(struct curseg_info *curseg)
+{
+	return kfifo_len(&curseg->inactive_zones) +
+		kfifo_len(&curseg->reclaimable_zones) +
+		kfifo_len(&curseg->closed_zones);
+}
+
+/* returns false if the inactive fifo is full and @segno must stay active */
+static inline bool stripe_zone_deactivate(struct curseg_info *curseg,
+						unsigned int segno)
+{
+	bool ret;
+
+	if (segno == NULL_SEGNO)
+		return true;
+	spin_lock(&curseg->zone_fifo_lock);
+	ret = kfifo_put(&curseg->inactive_zones, segno);
+	spin_unlock(&curseg->zone_fifo_lock);
+	return ret;
+}
+
+/*
+ * A section whose current segment is left before it is full would have a
+ * hole below the next write, so it is closed instead of dropped. Returns
+ * false if the closed fifo is full and @segno must stay active.
+ */
+static inline bool stripe_zone_close(struct curseg_info *curseg,
+						unsigned int segno)
+{
+	bool ret;
+
+	if (segno == NULL_SEGNO)
+		return true;
+	spin_lock(&curseg->zone_fifo_lock);
+	ret = kfifo_put(&curseg->closed_zones, segno);
+	spin_unlock(&curseg->zone_fifo_lock);
+	return ret;
+}
+
+/* take back the oldest dropped section, reclaimable ones first */
+static inline bool stripe_zone_reactivate(struct curseg_info *curseg,
+						unsigned int *segno)
+{
+	bool ret;
+
+	spin_lock(&curseg->zone_fifo_lock);
+	ret = kfifo_get(&curseg->reclaimable_zones, segno) ||
+		kfifo_get(&curseg->inactive_zones, segno);
+	spin_unlock(&curseg->zone_fifo_lock);
+	return ret;
+}
+#endif
 #endif
 static inline unsigned int get_valid_blocks(struct f2fs_sb_info *sbi,
 				unsigned int segno, bool use_section)
@@ -526,6 +740,9 @@ static inline void __set_free(struct f2fs_sb_info *sbi, unsigned int segno)
 	if (next >= start_segno + usable_segs) {
 		clear_bit(secno, free_i->free_secmap);
 		free_i->free_sections++;
+#ifdef CONFIG_BLK_DEV_ZONED
+		clear_bit(secno, free_i->positional_secmap);
+#endif
 	}
 	spin_unlock(&free_i->segmap_lock);
 }
@@ -562,6 +779,9 @@ static inline void __set_test_and_free(struct f2fs_sb_info *sbi,
 		if (next >= start_segno + usable_segs) {
 			if (test_and_clear_bit(secno, free_i->free_secmap))
 				free_i->free_sections++;
+#ifdef CONFIG_BLK_DEV_ZONED
+			clear_bit(secno, free_i->positional_secmap);
+#endif
 		}
 	}
 skip_free:
@@ -957,6 +1177,13 @@ static inline block_t sum_blk_addr(struct f2fs_sb_info *sbi, int base, int type)
 
 static inline bool sec_usage_check(struct f2fs_sb_info *sbi, unsigned int secno)
 {
+#if PARALLEL_GC
+	int i;
+
+	for (i = 0; i < PARALLEL_GC_MAX; i++)
+		if (sbi->gc_victim_secs[i] == secno)
+			return true;
+#endif
 	if (IS_CURSEC(sbi, secno) || (sbi->cur_victim_sec == secno))
 		return true;
 	return false;
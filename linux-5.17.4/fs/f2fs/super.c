@@ -170,6 +170,23 @@ enum {
 	Opt_gc_merge,
 	Opt_nogc_merge,
 	Opt_discard_unit,
+	Opt_zone_append,
+#if STRIPE
+	Opt_stripe_cnt,
+	Opt_stripe_max,
+	Opt_stripe_min,
+	Opt_stripe_opt,
+	Opt_stripe_zone_speed,
+	Opt_stripe_max_open,
+	Opt_stripe_inc_thresh,
+	Opt_stripe_dec_thresh,
+	Opt_stripe_probe,
+	Opt_stripe_ctrl,
+#endif
+#if DELAYED_MERGE
+	Opt_fast_umount,
+	Opt_nofast_umount,
+#endif
 	Opt_err,
 };
 
@@ -247,13 +264,205 @@ static match_table_t f2fs_tokens = {
 	{Opt_gc_merge, "gc_merge"},
 	{Opt_nogc_merge, "nogc_merge"},
 	{Opt_discard_unit, "discard_unit=%s"},
+	{Opt_zone_append, "zone_append"},
+#if STRIPE
+	{Opt_stripe_cnt, "stripe_cnt=%u"},
+	{Opt_stripe_max, "stripe_max=%u"},
+	{Opt_stripe_min, "stripe_min=%u"},
+	{Opt_stripe_opt, "stripe_opt=%u"},
+	{Opt_stripe_zone_speed, "stripe_zone_speed=%u"},
+	{Opt_stripe_max_open, "stripe_max_open=%u"},
+	{Opt_stripe_inc_thresh, "stripe_inc_thresh=%u"},
+	{Opt_stripe_dec_thresh, "stripe_dec_thresh=%u"},
+	{Opt_stripe_probe, "stripe_probe=%u"},
+	{Opt_stripe_ctrl, "stripe_ctrl=%u"},
+#endif
+#if DELAYED_MERGE
+	{Opt_fast_umount, "fast_umount"},
+	{Opt_nofast_umount, "nofast_umount"},
+#endif
 	{Opt_err, NULL},
 };
 
 
 #if ZF2FS_MONITOR
-block_t f2fs_monitor_pages[6] = {0,};
-unsigned int f2fs_gc_monitor = 0;
+/*
+ * Drain the per-cpu allocation counters of this superblock once per period,
+ * so each mount sizes its stripes from its own write rate only.
+ */
+static void f2fs_monitor_collect(struct f2fs_sb_info *sbi,
+		block_t *pages, unsigned int *gc_victims)
+{
+  int i;
+
+  for (i = 0; i < NR_PERSISTENT_LOG; i++)
+    pages[i] = f2fs_monitor_drain(&sbi->monitor_pages[i]);
+  *gc_victims = f2fs_monitor_drain(&sbi->gc_monitor);
+
+  // publish average write latency and queue depth of the period
+  for (i = 0; i < NR_PERSISTENT_LOG; i++) {
+    struct f2fs_stripe_stat *st = &sbi->stripe_stat[i];
+    unsigned int nr = atomic_xchg(&st->nr_bios, 0);
+    u64 lat = atomic64_xchg(&st->lat_sum, 0);
+    u64 qd = atomic64_xchg(&st->qd_sum, 0);
+
+    if (!nr) {
+      st->lat_us = 0;
+      st->qd = 0;
+      continue;
+    }
+    st->lat_us = div_u64(div_u64(lat, nr), NSEC_PER_USEC);
+    st->qd = div_u64(qd, nr);
+    if (!st->lat_base_us || st->lat_us < st->lat_base_us)
+      st->lat_base_us = st->lat_us;
+    else
+      st->lat_base_us += (st->lat_us - st->lat_base_us) / 16;
+  }
+}
+
+/*
+ * finish the zones of sections left reclaimable for a whole period, and of
+ * those closed before the last period, whose writes are done by now
+ */
+static void f2fs_stripe_reclaim(struct f2fs_sb_info *sbi,
+    struct curseg_info *curseg)
+{
+  unsigned int segno;
+
+  while (1) {
+    spin_lock(&curseg->zone_fifo_lock);
+    if (curseg->closed_aged &&
+        kfifo_get(&curseg->closed_zones, &segno)) {
+      curseg->closed_aged--;
+    } else if (!kfifo_get(&curseg->reclaimable_zones, &segno)) {
+      curseg->closed_aged = kfifo_len(&curseg->closed_zones);
+      spin_unlock(&curseg->zone_fifo_lock);
+      break;
+    }
+    spin_unlock(&curseg->zone_fifo_lock);
+
+    segno = GET_SEG_FROM_SEC(sbi, GET_SEC_FROM_SEG(sbi, segno));
+    //change zone status into full, section table is updated on completion
+    f2fs_issue_zone_mgmt(sbi, FDEV(0).bdev, REQ_OP_ZONE_FINISH,
+        SECTOR_FROM_BLOCK(START_BLOCK(sbi, segno)),
+        SECTOR_FROM_BLOCK(sbi->blocks_per_blkz * stripe_unit_zones(sbi)),
+        segno);
+  }
+}
+
+/*
+ * reclaim condition: inactive exist for one period. Zones that do not fit
+ * in a full reclaimable fifo stay inactive and age in a later period.
+ */
+static void f2fs_stripe_age(struct curseg_info *curseg)
+{
+  unsigned int segno;
+
+  spin_lock(&curseg->zone_fifo_lock);
+  while (!kfifo_is_full(&curseg->reclaimable_zones) &&
+      kfifo_get(&curseg->inactive_zones, &segno))
+    kfifo_put(&curseg->reclaimable_zones, segno);
+  spin_unlock(&curseg->zone_fifo_lock);
+}
+
+/*
+ * Feedback controller: return the change of stripe width that runs the
+ * last period's demand in the middle of the [dec, inc] band, in one step.
+ * While a log's writes queue deeper than its width at more than twice
+ * the uncongested latency, the device is saturated: hold the width under
+ * high demand and cut it by a quarter otherwise.
+ */
+static int f2fs_stripe_feedback(struct f2fs_sb_info *sbi, int log,
+    unsigned int width, block_t pages, block_t base_speed,
+    unsigned int inc, unsigned int dec)
+{
+  struct f2fs_stripe_stat *st = &sbi->stripe_stat[log];
+  u64 cap = (u64)width * base_speed;
+  unsigned int util, need, target;
+
+  util = cap ? div64_u64((u64)pages * 100, cap) : 100;
+
+  if (st->lat_base_us && st->lat_us > 2 * st->lat_base_us &&
+      st->qd > width) {
+    if (util > inc)
+      return 0;
+    return -(int)max(width / 4, 1U);
+  }
+
+  if (util >= dec && util <= inc)
+    return 0;
+
+  target = max((inc + dec) / 2, 1U);
+  need = max_t(u64, div64_u64((u64)pages * 100 + (u64)base_speed * target - 1,
+        (u64)base_speed * target), 1);
+  return (int)need - (int)width;
+}
+
+/* drop the slots beyond wanted_size, under active_lock */
+static void f2fs_stripe_trim(struct curseg_info *curseg)
+{
+  unsigned int i;
+
+  while (curseg->active_end > curseg->wanted_size) {
+    i = --curseg->active_end;
+    // the current section is dropped at its next allocation
+    if (i == curseg->cursor)
+      continue;
+    // inactive fifo is full, keep the rest active until the next period
+    if (!stripe_zone_deactivate(curseg, curseg->active_zones[i])) {
+      curseg->active_end++;
+      break;
+    }
+    curseg->active_zones[i] = NULL_SEGNO;
+  }
+}
+
+#if GC_LOG
+/*
+ * A lazily opened log (GC, lifetime) keeps the one section it writes, and
+ * is widened only in periods it is @busy, by the blocks it took, out of
+ * the open zones the logs sized before it left over, less the @reserved
+ * sections of the lazy logs sized after it. Returns the zones it holds.
+ */
+static unsigned int f2fs_lazy_log_stripe(struct f2fs_sb_info *sbi, int type,
+    bool busy, block_t pages, block_t base_speed, unsigned int opened,
+    unsigned int reserved)
+{
+  struct f2fs_stripe_policy *sp = &F2FS_OPTION(sbi).stripe;
+  struct curseg_info *curseg = CURSEG_I(sbi, type);
+  unsigned int max_open = READ_ONCE(sp->max_open);
+  unsigned int target, wanted = 1;
+
+  // stripe_min_open() budgets one section for every lazy log
+  max_open = max_open > reserved ? max_open - reserved : 0;
+
+  f2fs_stripe_reclaim(sbi, curseg);
+  f2fs_stripe_age(curseg);
+
+  target = max((READ_ONCE(sp->inc_thresh) + READ_ONCE(sp->dec_thresh)) / 2,
+      1U);
+  if (busy && base_speed)
+    wanted = div64_u64((u64)pages * 100 + (u64)base_speed * target - 1,
+        (u64)base_speed * target);
+  wanted = clamp(wanted, 1U, READ_ONCE(sp->max_cnt));
+  if (opened + wanted > max_open)
+    wanted = max(max_open > opened ? max_open - opened : 0, 1U);
+
+  spin_lock(&curseg->active_lock);
+  curseg->wanted_size = wanted;
+  f2fs_stripe_trim(curseg);
+  spin_unlock(&curseg->active_lock);
+
+  // an idle log gives its last section back as well, see f2fs_close_striped_log()
+  if (!busy && READ_ONCE(curseg->inited))
+    f2fs_close_striped_log(sbi, type);
+
+  // a log not opened yet holds no zone
+  if (!READ_ONCE(curseg->inited))
+    return stripe_zones_queued(curseg);
+  return wanted + stripe_zones_queued(curseg);
+}
+#endif
 
 int f2fs_monitor_func(void *data){
   
@@ -261,168 +470,122 @@ int f2fs_monitor_func(void *data){
   long time_ms = 1000;
   int i, j;
   int c = 0;
-  unsigned int segno, old_segno;
   struct curseg_info *curseg;
   unsigned int change = 0;
   unsigned int opened = 0;
   
-  unsigned int increase_threshold = 50; // %
-  unsigned int decrease_threshold = 10; // %
-  
-#if GRID_STRIPE
-  unsigned int max_total_wanted = 36; //20;
-  unsigned int max_wanted_size =  20;//16; // 128
-  int min_wanted_size = 1; // 1
-  block_t base_speed = 8 /* grid cnt */ * 
-    40 /* speed per zone (MB/s) */ * 1024 / 4 /* pages */; 
-#else 
-  unsigned int max_total_wanted = 288;
-  unsigned int max_wanted_size =  160;
-  int min_wanted_size = 8; 
-  block_t base_speed = 40 /* speed per zone (MB/s) */ * 1024 / 4 /* pages */; 
-#endif
+  struct f2fs_stripe_policy *sp = &F2FS_OPTION(sbi).stripe;
+  unsigned int increase_threshold, decrease_threshold; // %
+  unsigned int max_total_wanted, max_wanted_size;
+  unsigned int min_wanted_size;
+  unsigned int inc, dec, ctrl;
+  block_t base_speed;
+  struct blk_plug plug;
   int decisions[6] = {0, };
+  block_t monitor_pages[NR_PERSISTENT_LOG];
+  unsigned int gc_victims;
+#if GC_LOG
+  block_t gc_pages;
+#endif
   
   unsigned int data_pages, node_pages;
   printk("HD WD CD HN WN CN");
   while (!kthread_should_stop()) {
-      data_pages = f2fs_monitor_pages[0] + f2fs_monitor_pages[1] + f2fs_monitor_pages[2];
-      node_pages = f2fs_monitor_pages[3] + f2fs_monitor_pages[4] + f2fs_monitor_pages[5];
+      f2fs_monitor_collect(sbi, monitor_pages, &gc_victims);
+#if GC_LOG
+      gc_pages = f2fs_monitor_drain(&sbi->gc_log_pages);
+#endif
+      data_pages = monitor_pages[0] + monitor_pages[1] + monitor_pages[2];
+      node_pages = monitor_pages[3] + monitor_pages[4] + monitor_pages[5];
+
+      // policy may be changed through sysfs or remount
+      increase_threshold = READ_ONCE(sp->inc_thresh);
+      decrease_threshold = READ_ONCE(sp->dec_thresh);
+      max_total_wanted = READ_ONCE(sp->max_open);
+      // leave the GC and lifetime logs a section each
+      max_total_wanted = max_total_wanted > STRIPE_LAZY_LOGS ?
+        max_total_wanted - STRIPE_LAZY_LOGS : 0;
+      max_wanted_size = READ_ONCE(sp->max_cnt);
+      base_speed = stripe_unit_zones(sbi) * READ_ONCE(sp->zone_speed) *
+        1024 / 4 /* pages */;
+      ctrl = READ_ONCE(sp->ctrl);
 
 /*
     printk("%u %u %u %u %u %u", 
-      f2fs_monitor_pages[0],
-      f2fs_monitor_pages[1],
-      f2fs_monitor_pages[2],
-      f2fs_monitor_pages[3],
-      f2fs_monitor_pages[4],
-      f2fs_monitor_pages[5]
+      monitor_pages[0],
+      monitor_pages[1],
+      monitor_pages[2],
+      monitor_pages[3],
+      monitor_pages[4],
+      monitor_pages[5]
     );   
 */
     opened = 0;
 
+    // zone finishes of all logs go out as one batch
+    blk_start_plug(&plug);
     for (i = 0; i < 6; i++) {
 /*
-      if (f2fs_monitor_pages[i] > 80000)
+      if (monitor_pages[i] > 80000)
         printk("(%s:%d) %d up", __func__, __LINE__, i);
       
-    if (f2fs_monitor_pages[i] < 30000)
+    if (monitor_pages[i] < 30000)
         printk("(%s:%d) %d down", __func__, __LINE__, i);
 */
       curseg = CURSEG_I(sbi, i);
       //opened = sbi->f2fs_open_zones / 8 + 1;
 
       mutex_lock(&curseg->curseg_mutex);
-      opened += curseg->wanted_size;
-      if (curseg->inactive_end >= curseg->inactive_start) {
-        opened = opened + (curseg->inactive_end - curseg->inactive_start);
-      } else {
-        opened = opened + (128 + curseg->inactive_end - curseg->inactive_start);
-      }
-      if (curseg->reclaimable_end >= curseg->reclaimable_start) {
-        opened = opened + (curseg->reclaimable_end - curseg->reclaimable_start);
-      } else {
-        opened = opened + (128 + curseg->reclaimable_end - curseg->reclaimable_start);
-      }
+      opened += curseg->wanted_size + stripe_zones_queued(curseg);
       mutex_unlock(&curseg->curseg_mutex);
 
 /*
       if (i == CURSEG_COLD_DATA) {
-        if (f2fs_gc_monitor > 1) {
+        if (gc_victims > 1) {
           decisions[i] = 1;
         } else {
           decisions[i] = 0;
         }
-        f2fs_monitor_pages[i] = 0;
         continue;
       }
 */
 /*
-      if (f2fs_monitor_pages[i] == 0){
+      if (monitor_pages[i] == 0){
         decisions[i] = 0;
       } else 
 */
-      // free reclaimable zones 
-      if (curseg->reclaimable_start != curseg->reclaimable_end) {
-        while (curseg->reclaimable_start != curseg->reclaimable_end) {
-          spin_lock(&curseg->reclaimable_lock);
-          //printk("(%s:%d) reclaim zones", __func__, __LINE__);
-          segno = curseg->reclaimable_zones[curseg->reclaimable_start];
-          curseg->reclaimable_start++;
-          old_segno = segno;
-          segno = GET_SEG_FROM_SEC(sbi, GET_SEC_FROM_SEG(sbi, segno));
-          spin_unlock(&curseg->reclaimable_lock);
-
-          //change zone status into full
-#if GRID_STRIPE
-          blkdev_zone_mgmt(FDEV(0).bdev, REQ_OP_ZONE_FINISH, 
-              SECTOR_FROM_BLOCK(START_BLOCK(sbi, segno)), 
-              SECTOR_FROM_BLOCK(sbi->blocks_per_blkz * SM_I(sbi)->grid_cnt),
-              GFP_NOFS);
-#else 
-          blkdev_zone_mgmt(FDEV(0).bdev, REQ_OP_ZONE_FINISH, 
-              SECTOR_FROM_BLOCK(START_BLOCK(sbi, segno)), 
-              SECTOR_FROM_BLOCK(sbi->blocks_per_blkz),
-              GFP_NOFS);
-#endif
-          //update section table
-          get_sec_entry(sbi, segno)->inuse = 0;        
-          //printk("(%s:%d) reclaim zones end : %u(%u)", 
-          //  __func__, __LINE__, old_segno, 
-         //   GET_SEC_FROM_SEG(sbi, old_segno));
-        } 
-      }
+      // finish zones reclaimable for a period, then age inactive ones
+      f2fs_stripe_reclaim(sbi, curseg);
+      f2fs_stripe_age(curseg);
 
-      // move inactive to reclaimable
-      // reclaim condition: inactive exist for one period
-      if (curseg->inactive_start != curseg->inactive_end) {
-        spin_lock(&curseg->inactive_lock);
-        spin_lock(&curseg->reclaimable_lock);
-        while (curseg->inactive_start != curseg->inactive_end) {
-          //copy
-          if (curseg->reclaimable_end > 127)
-            curseg->reclaimable_end = 0;
-
-          curseg->reclaimable_zones[curseg->reclaimable_end] =
-            curseg->inactive_zones[curseg->inactive_start]; 
-          curseg->reclaimable_end++;
-          //remove
-          curseg->inactive_zones[curseg->inactive_start] = NULL_SEGNO;
-          curseg->inactive_start++; 
-          if (curseg->inactive_start > 127)
-            curseg->inactive_start = 0;
-
-          //printk("(%s:%d) inactive to reclaim", __func__, __LINE__);
-        }
-        spin_unlock(&curseg->reclaimable_lock);
-        spin_unlock(&curseg->inactive_lock);
-      }
       if (node_pages * 4 > data_pages){
 
         if (i==0)
           printk("md-intensive mode");
+        inc = 10;
+        dec = 2;
+      } else {
+        inc = increase_threshold;
+        dec = decrease_threshold;
+      }
 
-        // decision
-        if (f2fs_monitor_pages[i] > curseg->wanted_size * base_speed * 10 / 100) {
-          decisions[i] = 1;
-        } else if (f2fs_monitor_pages[i] < curseg->wanted_size * base_speed * 2 / 100) {
-          decisions[i] = -1; 
-        } else {
-          decisions[i] = 0;
-        }
+      // decision
+      if (ctrl == STRIPE_CTRL_FEEDBACK) {
+        decisions[i] = f2fs_stripe_feedback(sbi, i, curseg->wanted_size,
+            monitor_pages[i], base_speed, inc, dec);
+      } else if (monitor_pages[i] > curseg->wanted_size * base_speed * inc / 100) {
+        decisions[i] = 1;
+      } else if (monitor_pages[i] < curseg->wanted_size * base_speed * dec / 100) {
+        decisions[i] = -1; 
       } else {
-        if (f2fs_monitor_pages[i] > curseg->wanted_size * base_speed * increase_threshold / 100) {
-          decisions[i] = 1;
-        } else if (f2fs_monitor_pages[i] < curseg->wanted_size * base_speed * decrease_threshold / 100) {
-          decisions[i] = -1; 
-        } else {
-          decisions[i] = 0;
-        }
+        decisions[i] = 0;
       }
-      f2fs_monitor_pages[i] = 0;
+      // stripe_max lowered under a wide log
+      if (curseg->wanted_size > max_wanted_size && decisions[i] >= 0)
+        decisions[i] = -1;
     }
+    blk_finish_plug(&plug);
     c++;
-    f2fs_gc_monitor = 0;
     
 
 /*
@@ -435,61 +598,6 @@ int f2fs_monitor_func(void *data){
       decisions[5]
     );   
 */
-    //reclaim
-    if (curseg->reclaimable_start != curseg->reclaimable_end) {
-      while (curseg->reclaimable_start != curseg->reclaimable_end) {
-        spin_lock(&curseg->reclaimable_lock);
-	      //printk("(%s:%d) reclaim zones", __func__, __LINE__);
-        segno = curseg->reclaimable_zones[curseg->reclaimable_start];
-        curseg->reclaimable_start++;
-        old_segno = segno;
-        segno = GET_SEG_FROM_SEC(sbi, GET_SEC_FROM_SEG(sbi, segno));
-        spin_unlock(&curseg->reclaimable_lock);
-
-        //change zone status into full
-#if GRID_STRIPE 
-        blkdev_zone_mgmt(FDEV(0).bdev, REQ_OP_ZONE_FINISH, 
-            SECTOR_FROM_BLOCK(START_BLOCK(sbi, segno)), 
-            SECTOR_FROM_BLOCK(sbi->blocks_per_blkz * SM_I(sbi)->grid_cnt),
-            GFP_NOFS);
-#else
-        blkdev_zone_mgmt(FDEV(0).bdev, REQ_OP_ZONE_FINISH, 
-            SECTOR_FROM_BLOCK(START_BLOCK(sbi, segno)), 
-            SECTOR_FROM_BLOCK(sbi->blocks_per_blkz),
-            GFP_NOFS);
-#endif
-        //update section table
-        get_sec_entry(sbi, segno)->inuse = 0;        
-	      //printk("(%s:%d) reclaim zones end : %u(%u)", 
-        //  __func__, __LINE__, old_segno, 
-          //GET_SEC_FROM_SEG(sbi, old_segno));
-      } 
-    }
-
-    // reclaim condition: inactive exist for one period
-    if (curseg->inactive_start != curseg->inactive_end) {
-      spin_lock(&curseg->inactive_lock);
-      spin_lock(&curseg->reclaimable_lock);
-      while (curseg->inactive_start != curseg->inactive_end) {
-        //copy
-        if (curseg->reclaimable_end > 127)
-          curseg->reclaimable_end = 0;
-
-        curseg->reclaimable_zones[curseg->reclaimable_end] =
-          curseg->inactive_zones[curseg->inactive_start]; 
-        curseg->reclaimable_end++;
-        //remove
-        curseg->inactive_zones[curseg->inactive_start] = NULL_SEGNO;
-        curseg->inactive_start++; 
-        if (curseg->inactive_start > 127)
-          curseg->inactive_start = 0;
-
-//        printk("(%s:%d) inactive to reclaim", __func__, __LINE__);
-      }
-      spin_unlock(&curseg->reclaimable_lock);
-      spin_unlock(&curseg->inactive_lock);
-    }
-
     for (j = 0; j < 6; j++) {
 
     // for test  
@@ -499,17 +607,20 @@ int f2fs_monitor_func(void *data){
 
         change = decisions[j];
 #if !GRID_STRIPE
-        change = change * 8;
+        if (ctrl == STRIPE_CTRL_THRESH)
+          change = change * 8;
 #endif
         // check open zone limit for a log
         if (curseg->wanted_size + change > max_wanted_size) {
 //          printk("adjust wanted size: open zone limit for a log");
-          change = max_wanted_size - curseg->wanted_size;
+          change = curseg->wanted_size < max_wanted_size ?
+            max_wanted_size - curseg->wanted_size : 0;
         }
         // check global open zone limit
         if (opened + change > max_total_wanted) {
 //          printk("adjust wanted size: global open zone limit");
-          change = max_total_wanted - opened;
+          change = opened < max_total_wanted ?
+            max_total_wanted - opened : 0;
         }
         curseg->wanted_size += change;
         opened += change;
@@ -520,56 +631,41 @@ int f2fs_monitor_func(void *data){
   // decrease stripe size
       if (decisions[j] < 0) {
         spin_lock(&curseg->active_lock);
-        spin_lock(&curseg->inactive_lock);
 
-#if GRID_STRIPE
-        if (j < CURSEG_HOT_NODE)
-          min_wanted_size = 4;
-        else
-          min_wanted_size = 1;
-#else
-        if (j < CURSEG_HOT_NODE)
-          min_wanted_size = 32;
-        else
-          min_wanted_size = 8;
-#endif
+        min_wanted_size = stripe_min_wanted(sbi, j);
 
         change = decisions[j] * (-1);
 #if !GRID_STRIPE
-        change = change * 8;
+        if (ctrl == STRIPE_CTRL_THRESH)
+          change = change * 8;
 #endif
         if (change < 0)
           change = 0;
-        if (curseg->wanted_size - change < min_wanted_size) {
-          change = curseg->wanted_size - min_wanted_size;
+        if (curseg->wanted_size < min_wanted_size + change) {
+          change = curseg->wanted_size > min_wanted_size ?
+            curseg->wanted_size - min_wanted_size : 0;
         }
+        if (curseg->wanted_size > max_wanted_size + change)
+          change = curseg->wanted_size - max_wanted_size;
         curseg->wanted_size -= change;
         opened -= change;
-        
-        for (i = curseg->active_end - 1;
-          i >= curseg->active_start + curseg->wanted_size; i--){
-
-          if (curseg->active_zones[i] == NULL_SEGNO) {
-            continue;
-          }
-         // skip the current cursor
-          if (i == curseg->cursor) {
-            curseg->active_end--;
-            continue; 
-          }
-          if (curseg->inactive_end > 127)
-            curseg->inactive_end = 0;
-          curseg->inactive_zones[curseg->inactive_end] = curseg->active_zones[i];
-          curseg->inactive_end++;
-          curseg->active_zones[i] = NULL_SEGNO;
-          curseg->active_end--;
-        }
+        f2fs_stripe_trim(curseg);
 
-        spin_unlock(&curseg->inactive_lock);
         spin_unlock(&curseg->active_lock);
       }
 
     }
+#if LIFE_LOG
+    for (i = CURSEG_LIFE1_DATA; i <= CURSEG_LIFE5_DATA; i++)
+      opened += f2fs_lazy_log_stripe(sbi, i, true, f2fs_monitor_drain(
+            &sbi->life_log_pages[i - CURSEG_LIFE1_DATA]), base_speed, opened,
+          STRIPE_LAZY_LOGS - (i - CURSEG_LIFE1_DATA + 1));
+#endif
+#if GC_LOG
+    // user logs are sized first, GC takes what is left of the budget
+    opened += f2fs_lazy_log_stripe(sbi, CURSEG_GC_DATA, gc_victims,
+        gc_pages, base_speed, opened, 0);
+#endif
 //    curseg = CURSEG_I(sbi, CURSEG_WARM_DATA);
 
     printk("opened: %u wanted: %u %u %u %u %u %u",
@@ -1155,6 +1251,47 @@ static int f2fs_set_zstd_level(struct f2fs_sb_info *sbi, const char *str)
 #endif
 #endif
 
+#if STRIPE
+static void f2fs_set_stripe_option(struct f2fs_sb_info *sbi, int token,
+							unsigned int val)
+{
+	struct f2fs_stripe_policy *sp = &F2FS_OPTION(sbi).stripe;
+
+	switch (token) {
+	case Opt_stripe_cnt:
+		sp->stripe_cnt = val;
+		break;
+	case Opt_stripe_max:
+		sp->max_cnt = val;
+		break;
+	case Opt_stripe_min:
+		sp->min_cnt = val;
+		break;
+	case Opt_stripe_opt:
+		sp->opt = val;
+		break;
+	case Opt_stripe_zone_speed:
+		sp->zone_speed = val;
+		break;
+	case Opt_stripe_max_open:
+		sp->max_open = val;
+		break;
+	case Opt_stripe_inc_thresh:
+		sp->inc_thresh = val;
+		break;
+	case Opt_stripe_dec_thresh:
+		sp->dec_thresh = val;
+		break;
+	case Opt_stripe_probe:
+		sp->probe_mb = val;
+		break;
+	case Opt_stripe_ctrl:
+		sp->ctrl = val;
+		break;
+	}
+}
+#endif
+
 static int parse_options(struct super_block *sb, char *options, bool is_remount)
 {
 	struct f2fs_sb_info *sbi = F2FS_SB(sb);
@@ -1756,6 +1893,39 @@ static int parse_options(struct super_block *sb, char *options, bool is_remount)
 			}
 			kfree(name);
 			break;
+		case Opt_zone_append:
+#ifdef CONFIG_BLK_DEV_ZONED
+			set_opt(sbi, ZONE_APPEND);
+#else
+			f2fs_info(sbi, "zone_append option not supported");
+#endif
+			break;
+#if STRIPE
+		case Opt_stripe_cnt:
+		case Opt_stripe_max:
+		case Opt_stripe_min:
+		case Opt_stripe_opt:
+		case Opt_stripe_zone_speed:
+		case Opt_stripe_max_open:
+		case Opt_stripe_inc_thresh:
+		case Opt_stripe_dec_thresh:
+		case Opt_stripe_probe:
+		case Opt_stripe_ctrl:
+			if (args->from && match_int(args, &arg))
+				return -EINVAL;
+			if (arg < 0)
+				return -EINVAL;
+			f2fs_set_stripe_option(sbi, token, arg);
+			break;
+#endif
+#if DELAYED_MERGE
+		case Opt_fast_umount:
+			set_opt(sbi, FAST_UMOUNT);
+			break;
+		case Opt_nofast_umount:
+			clear_opt(sbi, FAST_UMOUNT);
+			break;
+#endif
 		default:
 			f2fs_err(sbi, "Unrecognized mount option \"%s\" or missing value",
 				 p);
@@ -1803,6 +1973,19 @@ default_check:
 		}
 	}
 
+	if (test_opt(sbi, ZONE_APPEND)) {
+		if (!f2fs_sb_has_blkzoned(sbi)) {
+			f2fs_err(sbi, "zone_append requires a zoned block device");
+			return -EINVAL;
+		}
+		/* appended pages are fixed up by their page cache index */
+		if (f2fs_sb_has_encrypt(sbi) || f2fs_sb_has_verity(sbi) ||
+				f2fs_sb_has_compression(sbi)) {
+			f2fs_err(sbi, "zone_append doesn't support encryption, verity or compression");
+			return -EINVAL;
+		}
+	}
+
 #ifdef CONFIG_F2FS_FS_COMPRESSION
 	if (f2fs_test_compress_extension(sbi)) {
 		f2fs_err(sbi, "invalid compress or nocompress extension");
@@ -2018,10 +2201,40 @@ static void f2fs_free_inode(struct inode *inode)
 
 static void destroy_percpu_info(struct f2fs_sb_info *sbi)
 {
+#if ZF2FS_MONITOR
+	int i;
+
+	for (i = 0; i < NR_PERSISTENT_LOG; i++)
+		percpu_counter_destroy(&sbi->monitor_pages[i]);
+	percpu_counter_destroy(&sbi->gc_monitor);
+#if GC_LOG
+	percpu_counter_destroy(&sbi->gc_log_pages);
+#endif
+#if LIFE_LOG
+	for (i = 0; i < NR_CURSEG_LIFE_TYPE; i++)
+		percpu_counter_destroy(&sbi->life_log_pages[i]);
+#endif
+#endif
 	percpu_counter_destroy(&sbi->alloc_valid_block_count);
 	percpu_counter_destroy(&sbi->total_valid_inode_count);
 }
 
+static void destroy_write_io(struct f2fs_sb_info *sbi)
+{
+	int i;
+
+	for (i = 0; i < NR_PAGE_TYPE; i++) {
+#if STRIPE
+		int n = (i == META) ? 1 : NR_TEMP_TYPE;
+		int j;
+
+		for (j = HOT; sbi->write_io[i] && j < n; j++)
+			kvfree(sbi->write_io[i][j].zbios);
+#endif
+		kvfree(sbi->write_io[i]);
+	}
+}
+
 static void destroy_device_list(struct f2fs_sb_info *sbi)
 {
 	int i;
@@ -2059,7 +2272,8 @@ static void f2fs_put_super(struct super_block *sb)
 #if DELAYED_MERGE
 #if !NAIVE_MFZ
 	/* 
-	 * For umount, merge is performed in foreground
+	 * For umount, merge is performed in foreground, or by the next
+	 * mount with fast_umount
 	 */
 	f2fs_stop_merge_thread(sbi);
 #endif
@@ -2067,6 +2281,9 @@ static void f2fs_put_super(struct super_block *sb)
 #if ZF2FS_MONITOR
   f2fs_stop_monitor_thread(sbi);
 #endif
+#ifdef CONFIG_BLK_DEV_ZONED
+	f2fs_wait_zone_mgmt(sbi);
+#endif
 
 	/*
 	 * We don't need to do checkpoint when superblock is clean.
@@ -2127,6 +2344,15 @@ static void f2fs_put_super(struct super_block *sb)
 	f2fs_destroy_segment_manager(sbi);
 
 	f2fs_destroy_post_read_wq(sbi);
+#ifdef CONFIG_BLK_DEV_ZONED
+	f2fs_destroy_zone_append(sbi);
+#endif
+#if META_FOR_ZNS
+	f2fs_destroy_meta_merge_wq(sbi);
+#endif
+#if PARALLEL_GC
+	f2fs_destroy_gc_wq(sbi);
+#endif
 
 	kvfree(sbi->ckpt);
 
@@ -2146,8 +2372,7 @@ static void f2fs_put_super(struct super_block *sb)
 	fscrypt_free_dummy_policy(&F2FS_OPTION(sbi).dummy_enc_policy);
 	destroy_percpu_info(sbi);
 	f2fs_destroy_iostat(sbi);
-	for (i = 0; i < NR_PAGE_TYPE; i++)
-		kvfree(sbi->write_io[i]);
+	destroy_write_io(sbi);
 #if IS_ENABLED(CONFIG_UNICODE)
 	utf8_unload(sb->s_encoding);
 #endif
@@ -2408,6 +2633,10 @@ static int f2fs_show_options(struct seq_file *seq, struct dentry *root)
 
 	if (test_opt(sbi, GC_MERGE))
 		seq_puts(seq, ",gc_merge");
+	if (test_opt(sbi, FAST_UMOUNT))
+		seq_puts(seq, ",fast_umount");
+	if (test_opt(sbi, ZONE_APPEND))
+		seq_puts(seq, ",zone_append");
 
 	if (test_opt(sbi, DISABLE_ROLL_FORWARD))
 		seq_puts(seq, ",disable_roll_forward");
@@ -2545,6 +2774,23 @@ static int f2fs_show_options(struct seq_file *seq, struct dentry *root)
 	else if (F2FS_OPTION(sbi).discard_unit == DISCARD_UNIT_SECTION)
 		seq_printf(seq, ",discard_unit=%s", "section");
 
+#if STRIPE
+	seq_printf(seq, ",stripe_cnt=%u,stripe_max=%u,stripe_min=%u,stripe_opt=%u",
+			F2FS_OPTION(sbi).stripe.stripe_cnt,
+			F2FS_OPTION(sbi).stripe.max_cnt,
+			F2FS_OPTION(sbi).stripe.min_cnt,
+			F2FS_OPTION(sbi).stripe.opt);
+	seq_printf(seq, ",stripe_zone_speed=%u,stripe_max_open=%u",
+			F2FS_OPTION(sbi).stripe.zone_speed,
+			F2FS_OPTION(sbi).stripe.max_open);
+	seq_printf(seq, ",stripe_inc_thresh=%u,stripe_dec_thresh=%u",
+			F2FS_OPTION(sbi).stripe.inc_thresh,
+			F2FS_OPTION(sbi).stripe.dec_thresh);
+	seq_printf(seq, ",stripe_ctrl=%u", F2FS_OPTION(sbi).stripe.ctrl);
+	if (F2FS_OPTION(sbi).stripe.probe_mb)
+		seq_printf(seq, ",stripe_probe=%u",
+				F2FS_OPTION(sbi).stripe.probe_mb);
+#endif
 	return 0;
 }
 
@@ -2567,6 +2813,9 @@ static void default_options(struct f2fs_sb_info *sbi)
 	F2FS_OPTION(sbi).compress_ext_cnt = 0;
 	F2FS_OPTION(sbi).compress_mode = COMPR_MODE_FS;
 	F2FS_OPTION(sbi).bggc_mode = BGGC_MODE_ON;
+#if STRIPE
+	f2fs_default_stripe_policy(&F2FS_OPTION(sbi).stripe);
+#endif
 
 	sbi->sb->s_flags &= ~SB_INLINECRYPT;
 
@@ -2699,6 +2948,7 @@ static int f2fs_remount(struct super_block *sb, int *flags, char *data)
 	bool enable_checkpoint = !test_opt(sbi, DISABLE_CHECKPOINT);
 	bool no_io_align = !F2FS_IO_ALIGNED(sbi);
 	bool no_atgc = !test_opt(sbi, ATGC);
+	bool no_zone_append = !test_opt(sbi, ZONE_APPEND);
 	bool no_discard = !test_opt(sbi, DISCARD);
 	bool no_compress_cache = !test_opt(sbi, COMPRESS_CACHE);
 	bool block_unit_discard = f2fs_block_unit_discard(sbi);
@@ -2748,6 +2998,12 @@ static int f2fs_remount(struct super_block *sb, int *flags, char *data)
 	if (err)
 		goto restore_opts;
 
+#if STRIPE
+	err = f2fs_check_stripe_policy(sbi, &F2FS_OPTION(sbi).stripe, false);
+	if (err)
+		goto restore_opts;
+#endif
+
 	/*
 	 * Previous and new state of filesystem is RO,
 	 * so skip checking GC and FLUSH_MERGE conditions.
@@ -2784,6 +3040,13 @@ static int f2fs_remount(struct super_block *sb, int *flags, char *data)
 		goto restore_opts;
 	}
 
+	/* disallow enable/disable zone_append dynamically */
+	if (no_zone_append == !!test_opt(sbi, ZONE_APPEND)) {
+		err = -EINVAL;
+		f2fs_warn(sbi, "switch zone_append option is not allowed");
+		goto restore_opts;
+	}
+
 	/* disallow enable/disable extent_cache dynamically */
 	if (no_extent_cache == !!test_opt(sbi, EXTENT_CACHE)) {
 		err = -EINVAL;
@@ -4188,6 +4451,12 @@ static void init_sb_info(struct f2fs_sb_info *sbi)
 static int init_percpu_info(struct f2fs_sb_info *sbi)
 {
 	int err;
+#if ZF2FS_MONITOR
+	int i;
+#endif
+#if LIFE_LOG
+	int j;
+#endif
 
 	err = percpu_counter_init(&sbi->alloc_valid_block_count, 0, GFP_KERNEL);
 	if (err)
@@ -4196,8 +4465,52 @@ static int init_percpu_info(struct f2fs_sb_info *sbi)
 	err = percpu_counter_init(&sbi->total_valid_inode_count, 0,
 								GFP_KERNEL);
 	if (err)
-		percpu_counter_destroy(&sbi->alloc_valid_block_count);
+		goto free_alloc_count;
+
+#if ZF2FS_MONITOR
+	for (i = 0; i < NR_PERSISTENT_LOG; i++) {
+		err = percpu_counter_init(&sbi->monitor_pages[i], 0,
+								GFP_KERNEL);
+		if (err)
+			goto free_monitor_pages;
+	}
+
+	err = percpu_counter_init(&sbi->gc_monitor, 0, GFP_KERNEL);
+	if (err)
+		goto free_monitor_pages;
+#if GC_LOG
+	err = percpu_counter_init(&sbi->gc_log_pages, 0, GFP_KERNEL);
+	if (err) {
+		percpu_counter_destroy(&sbi->gc_monitor);
+		goto free_monitor_pages;
+	}
+#endif
+#if LIFE_LOG
+	for (j = 0; j < NR_CURSEG_LIFE_TYPE; j++) {
+		err = percpu_counter_init(&sbi->life_log_pages[j], 0,
+								GFP_KERNEL);
+		if (err)
+			goto free_life_pages;
+	}
+#endif
+#endif
+	return 0;
 
+#if LIFE_LOG
+free_life_pages:
+	while (--j >= 0)
+		percpu_counter_destroy(&sbi->life_log_pages[j]);
+	percpu_counter_destroy(&sbi->gc_log_pages);
+	percpu_counter_destroy(&sbi->gc_monitor);
+#endif
+#if ZF2FS_MONITOR
+free_monitor_pages:
+	while (--i >= 0)
+		percpu_counter_destroy(&sbi->monitor_pages[i]);
+	percpu_counter_destroy(&sbi->total_valid_inode_count);
+#endif
+free_alloc_count:
+	percpu_counter_destroy(&sbi->alloc_valid_block_count);
 	return err;
 }
 
@@ -4275,6 +4588,22 @@ static int init_blkz_info(struct f2fs_sb_info *sbi, int devi)
 		FDEV(devi).zone_capacity_blocks = NULL;
 	}
 
+	if (test_opt(sbi, ZONE_APPEND)) {
+		struct request_queue *q = bdev_get_queue(bdev);
+		unsigned int blks = min_t(unsigned int, BIO_MAX_VECS,
+				queue_max_segments(q));
+
+		/* an append bio can't be split */
+		blks = min_t(unsigned int, blks, SECTOR_TO_BLOCK(
+				queue_max_zone_append_sectors(q)));
+		if (!blks) {
+			f2fs_err(sbi, "%pg doesn't support Zone Append", bdev);
+			return -EOPNOTSUPP;
+		}
+		if (!sbi->zone_append_blocks || blks < sbi->zone_append_blocks)
+			sbi->zone_append_blocks = blks;
+	}
+
 	return 0;
 }
 #endif
@@ -4708,7 +5037,7 @@ try_onemore:
 		int j;
 
 		sbi->write_io[i] =
-			f2fs_kmalloc(sbi,
+			f2fs_kzalloc(sbi,
 				     array_size(n,
 						sizeof(struct f2fs_bio_info)),
 				     GFP_KERNEL);
@@ -4725,12 +5054,27 @@ try_onemore:
 			INIT_LIST_HEAD(&sbi->write_io[i][j].io_list);
 			INIT_LIST_HEAD(&sbi->write_io[i][j].bio_list);
 			init_rwsem(&sbi->write_io[i][j].bio_list_lock);
+#if STRIPE
+			if (i == DATA || (NODE_STRIPE && i == NODE) ||
+					(META_LOG_STRIPE && i == META)) {
+				sbi->write_io[i][j].zbios = f2fs_kvzalloc(sbi,
+					array_size(STRIPE_ZONE_BIOS,
+					sizeof(struct f2fs_zone_bio)), GFP_KERNEL);
+				if (!sbi->write_io[i][j].zbios) {
+					err = -ENOMEM;
+					goto free_bio_info;
+				}
+			}
+#endif
 		}
 	}
 
 	init_rwsem(&sbi->cp_rwsem);
 	init_rwsem(&sbi->quota_sem);
 	init_waitqueue_head(&sbi->cp_wait);
+#ifdef CONFIG_BLK_DEV_ZONED
+	init_waitqueue_head(&sbi->zone_mgmt_wait);
+#endif
 	init_sb_info(sbi);
 
 	err = f2fs_init_iostat(sbi);
@@ -4800,6 +5144,39 @@ try_onemore:
 		f2fs_err(sbi, "Failed to initialize post read workqueue");
 		goto free_devices;
 	}
+#ifdef CONFIG_BLK_DEV_ZONED
+	err = f2fs_init_zone_append(sbi);
+	if (err) {
+		f2fs_err(sbi, "Failed to initialize zone append workqueue");
+		f2fs_destroy_post_read_wq(sbi);
+		goto free_devices;
+	}
+#endif
+#if META_FOR_ZNS
+	err = f2fs_init_meta_merge_wq(sbi);
+	if (err) {
+		f2fs_err(sbi, "Failed to initialize meta merge workqueue");
+#ifdef CONFIG_BLK_DEV_ZONED
+		f2fs_destroy_zone_append(sbi);
+#endif
+		f2fs_destroy_post_read_wq(sbi);
+		goto free_devices;
+	}
+#endif
+#if PARALLEL_GC
+	err = f2fs_init_gc_wq(sbi);
+	if (err) {
+		f2fs_err(sbi, "Failed to initialize gc workqueue");
+#if META_FOR_ZNS
+		f2fs_destroy_meta_merge_wq(sbi);
+#endif
+#ifdef CONFIG_BLK_DEV_ZONED
+		f2fs_destroy_zone_append(sbi);
+#endif
+		f2fs_destroy_post_read_wq(sbi);
+		goto free_devices;
+	}
+#endif
 
 	sbi->total_valid_node_count =
 				le32_to_cpu(sbi->ckpt->valid_node_count);
@@ -4826,6 +5203,10 @@ try_onemore:
 
 	f2fs_init_fsync_node_info(sbi);
 
+#if DELAYED_MERGE
+	/* merges in flight at the last checkpoint are redone by log replay */
+	clear_ckpt_flags(sbi, CP_MERGE_STATE_FLAGS);
+#endif
 	/* setup checkpoint request control and start checkpoint issue thread */
 	f2fs_init_ckpt_req_control(sbi);
 	if (!f2fs_readonly(sb) && !test_opt(sbi, DISABLE_CHECKPOINT) &&
@@ -4863,6 +5244,12 @@ try_onemore:
 			 err);
 		goto free_nm;
 	}
+#if DELAYED_MERGE
+	err = f2fs_build_meta_zone_stats(sbi);
+	if (err)
+		goto free_nm;
+	f2fs_start_replayed_merge(sbi);
+#endif
 
 	err = adjust_reserved_segment(sbi);
 	if (err)
@@ -4998,6 +5385,9 @@ reset_checkpoint:
 
 	/* f2fs_recover_fsync_data() cleared this already */
 	clear_sbi_flag(sbi, SBI_POR_DOING);
+#if STRIPE
+	f2fs_calibrate_stripe(sbi);
+#endif
 
 	if (test_opt(sbi, DISABLE_CHECKPOINT)) {
 		err = f2fs_disable_checkpoint(sbi);
@@ -5087,8 +5477,21 @@ free_nm:
 	f2fs_stop_discard_thread(sbi);
 	f2fs_destroy_node_manager(sbi);
 free_sm:
+#ifdef CONFIG_BLK_DEV_ZONED
+	/* zone finishes and resets complete into the curseg arrays */
+	f2fs_wait_zone_mgmt(sbi);
+#endif
 	f2fs_destroy_segment_manager(sbi);
 	f2fs_destroy_post_read_wq(sbi);
+#ifdef CONFIG_BLK_DEV_ZONED
+	f2fs_destroy_zone_append(sbi);
+#endif
+#if META_FOR_ZNS
+	f2fs_destroy_meta_merge_wq(sbi);
+#endif
+#if PARALLEL_GC
+	f2fs_destroy_gc_wq(sbi);
+#endif
 #if DELAYED_MERGE
 #if !NAIVE_MFZ
 stop_merge_thread:
@@ -5115,8 +5518,7 @@ free_percpu:
 free_iostat:
 	f2fs_destroy_iostat(sbi);
 free_bio_info:
-	for (i = 0; i < NR_PAGE_TYPE; i++)
-		kvfree(sbi->write_io[i]);
+	destroy_write_io(sbi);
 
 #if IS_ENABLED(CONFIG_UNICODE)
 	utf8_unload(sb->s_encoding);
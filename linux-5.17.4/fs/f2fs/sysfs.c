@@ -39,6 +39,9 @@ enum {
 	RESERVED_BLOCKS,	/* struct f2fs_sb_info */
 	CPRC_INFO,	/* struct ckpt_req_control */
 	ATGC_INFO,	/* struct atgc_management */
+#if STRIPE
+	STRIPE_INFO,	/* struct f2fs_stripe_policy */
+#endif
 };
 
 struct f2fs_attr {
@@ -79,6 +82,10 @@ static unsigned char *__struct_ptr(struct f2fs_sb_info *sbi, int struct_type)
 		return (unsigned char *)&sbi->cprc_info;
 	else if (struct_type == ATGC_INFO)
 		return (unsigned char *)&sbi->am;
+#if STRIPE
+	else if (struct_type == STRIPE_INFO)
+		return (unsigned char *)&F2FS_OPTION(sbi).stripe;
+#endif
 	return NULL;
 }
 
@@ -414,6 +421,26 @@ out:
 	ret = kstrtoul(skip_spaces(buf), 0, &t);
 	if (ret < 0)
 		return ret;
+#if STRIPE
+	if (a->struct_type == STRIPE_INFO) {
+		struct f2fs_stripe_policy sp;
+
+		if (t > UINT_MAX)
+			return -EINVAL;
+
+		/* validate the whole policy, the monitor reads it unlocked */
+		down_write(&sbi->sb_lock);
+		sp = F2FS_OPTION(sbi).stripe;
+		ui = (unsigned int *)((unsigned char *)&sp + a->offset);
+		*ui = t;
+		ret = f2fs_check_stripe_policy(sbi, &sp, false);
+		/* stripe_max_open=0 is resolved against the device */
+		if (!ret)
+			WRITE_ONCE(*(unsigned int *)(ptr + a->offset), *ui);
+		up_write(&sbi->sb_lock);
+		return ret ? ret : count;
+	}
+#endif
 #ifdef CONFIG_F2FS_FAULT_INJECTION
 	if (a->struct_type == FAULT_INFO_TYPE && t >= (1 << FAULT_MAX))
 		return -EINVAL;
@@ -821,6 +848,24 @@ F2FS_RW_ATTR(F2FS_SBI, f2fs_sb_info, gc_reclaimed_segments, gc_reclaimed_segs);
 F2FS_RW_ATTR(F2FS_SBI, f2fs_sb_info, max_fragment_chunk, max_fragment_chunk);
 F2FS_RW_ATTR(F2FS_SBI, f2fs_sb_info, max_fragment_hole, max_fragment_hole);
 
+#if STRIPE
+/* For dynamic striping */
+F2FS_RW_ATTR(STRIPE_INFO, f2fs_stripe_policy, stripe_cnt, stripe_cnt);
+F2FS_RW_ATTR(STRIPE_INFO, f2fs_stripe_policy, stripe_max, max_cnt);
+F2FS_RW_ATTR(STRIPE_INFO, f2fs_stripe_policy, stripe_min, min_cnt);
+F2FS_RW_ATTR(STRIPE_INFO, f2fs_stripe_policy, stripe_opt, opt);
+F2FS_RW_ATTR(STRIPE_INFO, f2fs_stripe_policy, stripe_zone_speed, zone_speed);
+F2FS_RW_ATTR(STRIPE_INFO, f2fs_stripe_policy, stripe_max_open, max_open);
+F2FS_RW_ATTR(STRIPE_INFO, f2fs_stripe_policy, stripe_inc_thresh, inc_thresh);
+F2FS_RW_ATTR(STRIPE_INFO, f2fs_stripe_policy, stripe_dec_thresh, dec_thresh);
+F2FS_RW_ATTR(STRIPE_INFO, f2fs_stripe_policy, stripe_ctrl, ctrl);
+#if GRID_STRIPE
+/* fixed by the on-disk section layout */
+F2FS_ATTR_OFFSET(SM_INFO, stripe_grid_cnt, 0444, f2fs_sbi_show, NULL,
+		offsetof(struct f2fs_sm_info, grid_cnt));
+#endif
+#endif
+
 #define ATTR_LIST(name) (&f2fs_attr_##name.attr)
 static struct attribute *f2fs_attrs[] = {
 	ATTR_LIST(gc_urgent_sleep_time),
@@ -902,6 +947,20 @@ static struct attribute *f2fs_attrs[] = {
 	ATTR_LIST(gc_reclaimed_segments),
 	ATTR_LIST(max_fragment_chunk),
 	ATTR_LIST(max_fragment_hole),
+#if STRIPE
+	ATTR_LIST(stripe_cnt),
+	ATTR_LIST(stripe_max),
+	ATTR_LIST(stripe_min),
+	ATTR_LIST(stripe_opt),
+	ATTR_LIST(stripe_zone_speed),
+	ATTR_LIST(stripe_max_open),
+	ATTR_LIST(stripe_inc_thresh),
+	ATTR_LIST(stripe_dec_thresh),
+	ATTR_LIST(stripe_ctrl),
+#if GRID_STRIPE
+	ATTR_LIST(stripe_grid_cnt),
+#endif
+#endif
 	NULL,
 };
 ATTRIBUTE_GROUPS(f2fs);
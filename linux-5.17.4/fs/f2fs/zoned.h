@@ -10,6 +10,12 @@
 #define DEBUG_GC 0
 
 #if META_FOR_ZNS
+  #define META_MERGE_MAX_ACTIVE 8 // meta zones merged in parallel
+  #define SUM_LOG_DELTA_MAX 128   // changed entries of a segment logged as deltas
+  #define MAX_META_LOG_GENS 8     // log zone generations per metadata log, mkfs -G
+  #define MAX_META_LOG_STRIPES 4  // zones per log zone generation, mkfs -M
+  #define META_ZONE_COPY_BLKS 128 // clean meta blocks carried over per bio
+
   //for evaluation - have to change META_LOG_STRIPE of mkfs
   #define NAIVE_MFZ 0
   #if !NAIVE_MFZ
@@ -17,7 +23,7 @@
     #define META_LOG_STRIPE 1
     
     #if META_LOG_STRIPE
-      #define META_STRIPE_CNT 2
+      #define META_STRIPE_CNT 2 // SSA log only, images made before mkfs -M
     #else //META_LOG_STRIPE
       #define META_STRIPE_CNT 1
     #endif //META_LOG_STRIPE
@@ -32,30 +38,73 @@
   #define META_LOG_STRIPE 0
 #endif//META_FOR_ZNS
 
+// default static stripe policy, "stripe_opt=" / sysfs stripe_opt
 #define OPT 2
 
 #define ZF2FS_MONITOR 1
 #define STRIPE 1
 
+// large sections: pick GC victims from dirty sections bucketed by valid blocks
+#define GC_VICTIM_INDEX 1
+
+// FG_GC: read live data blocks in on-disk runs and move them via META_MAPPING
+#define GC_BULK_READ 1
+
+// FG_GC from f2fs_balance_fs: migrate up to PARALLEL_GC_MAX victims at once
+#define PARALLEL_GC 1
+#define PARALLEL_GC_MAX 4
+
+/*
+ * The STRIPE_* counts below are only defaults: each mount can override
+ * them with "stripe_*=" options or /sys/fs/f2fs/<dev>/stripe_*.
+ */
 #if STRIPE
   #define GRID_STRIPE 1
   #define DYNAMIC_STRIPE 1
 
   #if GRID_STRIPE
+    // fixed by mkfs: a section is GRID_CNT zones, used if not zoned
     #define GRID_CNT 8
   #endif
 
   #define STRIPE_SMALL 0
-  #define STRIPE_MAX_CNT 16
+  #if DYNAMIC_STRIPE
+    #if GRID_STRIPE
+      #define STRIPE_MAX_CNT 20   // per log, in sections
+      #define STRIPE_MIN_CNT 4    // data logs, node logs use 1/4
+      #define STRIPE_MAX_OPEN 36  // all logs, in sections
+    #else
+      #define STRIPE_MAX_CNT 120  // below STRIPE_LIMIT
+      #define STRIPE_MIN_CNT 32
+      #define STRIPE_MAX_OPEN 288
+    #endif
+  #else
+    #define STRIPE_MAX_CNT 16
+    #define STRIPE_MIN_CNT 4
+    #define STRIPE_MAX_OPEN 288
+  #endif
   #define STRIPE_CNT 8
-  #define STRIPE_MIN_CNT 4
+  #define STRIPE_LIMIT 128        // zone slots per log w/o device limit
+  #define STRIPE_ZONE_BIOS 32     // write bios parked per striped log
+
+  #define STRIPE_ZONE_SPEED 40    // MB/s per zone, unless probed
+  #define STRIPE_META_ZONES 16    // open zones left to meta logs
+  #define STRIPE_INC_THRESHOLD 50 // %
+  #define STRIPE_DEC_THRESHOLD 10 // %
   #define NODE_STRIPE 1
+  // GC output goes to its own log, widened by the monitor only during GC
+  #define GC_LOG DYNAMIC_STRIPE
+  // overwritten data is placed by lifetime into 5 more logs, opened like GC's
+  #define LIFE_LOG GC_LOG
+  #define LIFE_LOG_BASE_SHIFT 3   // shortest class: blocks living < 8s
 #else // STRIPE 
   #define GRID_STRIPE 0
   #define STRIPE_MAX_CNT 1
   #define STRIPE_CNT 1
   #define STRIPE_MIN_CNT 1
   #define NODE_STRIPE 0
+  #define GC_LOG 0
+  #define LIFE_LOG 0
 #endif // STRIPE
 
 #endif //_LINUX_ZONED_H
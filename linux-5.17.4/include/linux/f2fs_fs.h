@@ -130,7 +130,8 @@ struct f2fs_super_block {
 	__le16  s_encoding;		/* Filename charset encoding */
 	__le16  s_encoding_flags;	/* Filename charset encoding flags */
 #if META_FOR_ZNS
-	__u8 reserved[282];
+	__le32 meta_log_stripes;	/* zones each log block rotates through */
+	__u8 reserved[278];
 #else
 	__u8 reserved[306];		/* valid reserved region */
 #endif
@@ -141,6 +142,12 @@ struct f2fs_super_block {
  * For checkpoint
  */
 #if DELAYED_MERGE
+/* Umount left entries newer than the main area in the log zones */
+#define CP_LOG_PENDING_FLAG		0x20000000
+
+/* Log zones hold nothing newer than the main area */
+#define CP_LOG_MERGED_FLAG		0x10000000
+
 /* Need to commit merge */
 #define CP_MERGE_DONE_FLAG 		0x08000000
 #define CP_SIT_MERGE_DONE_FLAG 	0x04000000
@@ -158,8 +165,12 @@ struct f2fs_super_block {
 #define CP_SIT_MERGE_FLAG 		0x00040000
 #define CP_NAT_MERGE_FLAG 		0x00020000
 #define CP_SSA_MERGE_FLAG 		0x00010000
+
+#define CP_MERGE_STATE_FLAGS		0x0fff0000
 #endif
 
+/* cur_data_segno[3..7] hold the lifetime data logs */
+#define CP_LIFE_LOG_FLAG		0x00008000
 #define CP_RESIZEFS_FLAG		0x00004000
 #define CP_DISABLED_QUICK_FLAG		0x00002000
 #define CP_DISABLED_FLAG		0x00001000
@@ -558,6 +569,33 @@ struct f2fs_sum_log_block {
 	struct f2fs_summary entries[ENTRIES_IN_SUM];
 	struct summary_footer footer;
 } __packed;
+
+/*
+ * A delta block packs the few summary entries changed in many segments.
+ * It starts like f2fs_sum_log_block, with SUM_LOG_DELTA_SEGNO as segno.
+ */
+#define SUM_LOG_DELTA_SEGNO	0xffffffff
+#define SUM_DELTA_FOOTER	0xffff	/* ofs_in_seg of a footer delta */
+
+struct f2fs_sum_delta {
+	__le32 segno;
+	__le16 ofs_in_seg;
+	union {
+		struct f2fs_summary sum;
+		struct summary_footer footer;
+	};
+} __packed;
+
+#define SUM_DELTA_ENTRIES	(((F2FS_BLKSIZE) - sizeof(__le32) - \
+				sizeof(__le64) - sizeof(__le16)) / \
+				sizeof(struct f2fs_sum_delta))
+
+struct f2fs_sum_delta_log_block {
+	__le32 segno;
+	__le64 cp_ver;
+	__le16 n_deltas;
+	struct f2fs_sum_delta deltas[SUM_DELTA_ENTRIES];
+} __packed;
 #endif
 /*
  * For directory operations